@@ -18,6 +18,7 @@
 #include <ostream>
 
 #include "third_party/zynamics/binexport/call_graph.h"
+#include "third_party/zynamics/binexport/util/format.h"
 
 BasicBlock::Cache BasicBlock::cache_;
 
@@ -90,47 +91,60 @@ void BasicBlock::Render(std::ostream* stream, const CallGraph& call_graph,
 void BasicBlock::RenderAdditional(std::ostream* stream,
 	const CallGraph& call_graph,
 	const FlowGraph& flow_graph,
-	Exporter& exporter) const {
+	Exporter&) const {
+	std::string output;
+	RenderAdditional(&output, call_graph, flow_graph);
+	*stream << output;
+}
+
+void BasicBlock::RenderAdditional(std::string* output,
+	const CallGraph& call_graph,
+	const FlowGraph& flow_graph) const {
 #ifdef _DEBUG
-	*stream << "		Start render basic block BasicBlock::RenderAdditional";
+	output->append("		Start render basic block BasicBlock::RenderAdditional");
 #endif
 	// начинаем рендерить базовые блоки функции ...
-	// получим количество инструкций в базовом блоке 
-	const auto ins_count = this->GetInstructionCount();
-	*stream << "    has " << ins_count << "  instructions \n";
+	// количество инструкций выводится в шестнадцатеричном виде: так его
+	// выводил поток после адреса функции
+	output->append("    has ");
+	security::binexport::AppendHex(GetInstructionCount(), 0, output);
+	output->append("  instructions \n");
 
 	for (const auto& instruction : *this) {
-
 #ifdef _DEBUG
-		*stream << "IA = ";
+		output->append("IA = ");
 #endif
 		// получаем адрес инструкции
-		*stream << std::hex << std::setfill('0') << std::uppercase << std::setw(8)
-			<< instruction.GetAddress() << " ";
+		security::binexport::AppendHex(instruction.GetAddress(), 8, output);
+		output->push_back(' ');
 
-		// рендерим инструкцию дальше 
-		instruction.RenderAdditional(stream, flow_graph, exporter);
+		// рендерим инструкцию дальше
+#ifdef _DEBUG
+		output->append("MNEM ");
+#endif
+		output->append(instruction.GetMnemonic());
+		output->push_back(' ');
+		RenderOperandsAdditional(instruction, flow_graph, output);
 
 		std::pair<Comments::const_iterator, Comments::const_iterator> comments =
 			call_graph.GetComments(instruction.GetAddress());
 
 		if (comments.first != comments.second) {
 			for (; comments.first != comments.second; ++comments.first) {
-				*stream << "  // " << *comments.first->comment_ << "\n";
+				output->append("  // ");
+				output->append(*comments.first->comment_);
+				output->push_back('\n');
 			}
 		}
 		else {
-			*stream << std::endl;
-
+			output->push_back('\n');
 		}
-
 	}
 
 #ifdef _DEBUG
 	// закончили рендерить базовый блок функции ...
-	*stream << "		Finish render basic block BasicBlock::RenderAdditional\n";
-#endif	
-
+	output->append("		Finish render basic block BasicBlock::RenderAdditional\n");
+#endif
 }
 
 int BasicBlock::GetInstructionCount() const {
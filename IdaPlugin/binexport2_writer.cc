@@ -25,13 +25,26 @@
 // So the new format is smaller than the original by about a factor ~2, despite
 // the fact that the original completely omitted operands! Both formats compress
 // equally well by another factor of ~5.
+//
+// Сообщение BinExport2 целиком в памяти не строится: поля верхнего уровня
+// пишутся в файл по одному элементу в порядке возрастания номеров полей, то есть
+// в том же порядке, что и у SerializeToOstream. Между секциями хранятся только
+// индексы (адрес -> номер инструкции, номера строк и комментариев).
 
 #include "third_party/zynamics/binexport/binexport2_writer.h"
 
 #include <algorithm>
 #include <cinttypes>
+#include <deque>
 #include <string>
 #include <fstream>
+#include <memory>
+
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "base/logging.h"
 #include "third_party/absl/container/flat_hash_map.h"
@@ -39,15 +52,132 @@
 #include "third_party/absl/strings/string_view.h"
 #include "third_party/absl/time/clock.h"
 #include "third_party/absl/time/time.h"
+#include "third_party/absl/types/span.h"
 #include "third_party/zynamics/binexport/binexport2.pb.h"
 #include "third_party/zynamics/binexport/call_graph.h"
 #include "third_party/zynamics/binexport/flow_graph.h"
 #include "third_party/zynamics/binexport/function.h"
+#include "third_party/zynamics/binexport/loop_nesting.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
 #include "third_party/zynamics/binexport/util/status_macros.h"
 
 namespace security::binexport {
 	namespace {
 
+		using google::protobuf::internal::WireFormatLite;
+
+/// \brief \n Запись полей верхнего уровня BinExport2 в wire-формате.\n
+/// Каждый элемент повторяющегося поля кодируется так же, как его закодировал бы\n
+/// SerializeToOstream для всего сообщения: тег, длина, тело.\n
+/// Поля должны добавляться в порядке возрастания номеров.
+		class BinExport2Stream {
+		public:
+			explicit BinExport2Stream(
+				google::protobuf::io::ZeroCopyOutputStream* output)
+				: stream_(output) {}
+
+			void AddMessage(int field_number,
+				const google::protobuf::MessageLite& message) {
+				CheckFieldOrder(field_number);
+				stream_.WriteTag(WireFormatLite::MakeTag(
+					field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+				stream_.WriteVarint32(static_cast<uint32_t>(message.ByteSizeLong()));
+				message.SerializeWithCachedSizes(&stream_);
+			}
+
+			void AddString(int field_number, absl::string_view value) {
+				CheckFieldOrder(field_number);
+				stream_.WriteTag(WireFormatLite::MakeTag(
+					field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+				stream_.WriteVarint32(static_cast<uint32_t>(value.size()));
+				stream_.WriteRaw(value.data(), static_cast<int>(value.size()));
+			}
+
+			/// \brief \n Дописывает уже закодированные записи поля field_number\n
+			/// (например, кусок, закодированный в рабочем потоке).
+			void AddRaw(int field_number, const std::string& encoded) {
+				CheckFieldOrder(field_number);
+				stream_.WriteRaw(encoded.data(), static_cast<int>(encoded.size()));
+			}
+
+			bool HadError() { return stream_.HadError(); }
+
+		private:
+			void CheckFieldOrder(int field_number) {
+				DCHECK_GE(field_number, last_field_number_);
+				last_field_number_ = field_number;
+			}
+
+			google::protobuf::io::CodedOutputStream stream_;
+			int last_field_number_ = 0;
+		};
+
+
+/// \brief \n Рабочие буферы одной записи, общие для всех секций.\n
+/// Сообщения-заготовки и граф вызовов размещаются на арене и освобождаются разом;\n
+/// буферы кусков переиспользуются секциями по очереди, поэтому память под них\n
+/// выделяется один раз на слот окна.
+		struct Scratch {
+			explicit Scratch(size_t slots) : chunk_buffers(slots), raw_bytes(slots) {}
+
+			template <typename Message>
+			Message* Create() {
+				return google::protobuf::Arena::CreateMessage<Message>(&arena);
+			}
+
+			/// \brief \n По одному сообщению-заготовке на каждый слот окна.
+			template <typename Message>
+			std::vector<Message*> CreatePerSlot() {
+				std::vector<Message*> messages(chunk_buffers.size());
+				for (auto& message : messages) {
+					message = Create<Message>();
+				}
+				return messages;
+			}
+
+			google::protobuf::Arena arena;
+			std::vector<std::string> chunk_buffers;  // Закодированные куски.
+			std::vector<std::string> raw_bytes;      // Байты инструкций куска.
+		};
+
+
+/// \brief \n Кодирует записи поля field_number кусками по chunk_size в нескольких\n
+/// потоках и выводит куски в stream по порядку.\n
+/// prepare(slot, begin, end) вызывается в главном потоке в порядке следования кусков,\n
+/// encode(slot, begin, end, stream) - в рабочем. slot - номер\n
+/// куска в текущем окне, по нему можно держать данные куска между вызовами.\n
+/// Одновременно в памяти находится не больше одного окна кусков.
+		template <typename Prepare, typename Encode>
+		void WriteInChunks(int field_number, size_t count, size_t chunk_size,
+			Prepare prepare, Encode encode, Scratch* scratch,
+			BinExport2Stream* stream) {
+			std::vector<std::string>& buffers = scratch->chunk_buffers;
+			const size_t window = buffers.size();
+			for (size_t window_begin = 0; window_begin < count;
+				window_begin += window * chunk_size) {
+				std::vector<std::function<void()>> tasks;
+				for (size_t slot = 0; slot < window; ++slot) {
+					const size_t begin = window_begin + slot * chunk_size;
+					if (begin >= count) {
+						break;
+					}
+					const size_t end = std::min(count, begin + chunk_size);
+					prepare(slot, begin, end);
+					buffers[slot].clear();
+					tasks.emplace_back([&buffers, &encode, slot, begin, end]() {
+						google::protobuf::io::StringOutputStream output(&buffers[slot]);
+						BinExport2Stream chunk_stream(&output);
+						encode(slot, begin, end, &chunk_stream);
+					});
+				}
+				const size_t used = tasks.size();
+				RunInParallel(std::move(tasks));
+				for (size_t slot = 0; slot < used; ++slot) {
+					stream->AddRaw(field_number, buffers[slot]);
+				}
+			}
+		}
+
 
 /// \brief \n Сортировка по убыванию количества вхождений, затем по мнемонической строке.\n
 /// Не путать с оператором > - эта функция вызывается как оператор меньше чем.\n
@@ -76,18 +206,16 @@ namespace security::binexport {
 		}
 
 
-/// \brief \n Хранит уникальные мнемоники в result proto.\n
+/// \brief \n Строит таблицу уникальных мнемоник.\n
 /// Возвращает вектор мнемоник, отсортированных по лексикографическому принципу для быстрого поиска.\n
 /// Каждой мнемонике соответствует свой индекс в массиве result proto.
 /// \n
 /// \param instructions
 /// \param mnemonics
-/// \param proto
-		void WriteMnemonics(const Instructions& instructions,
-			std::vector<std::pair<std::string, int32_t>>* mnemonics,
-			BinExport2* proto) {
+		void GetMnemonics(const Instructions& instructions,
+			std::vector<std::pair<std::string, int32_t>>* mnemonics) {
 			// Получить гистограмму мнемоник. Отсортировать гистограмму по убыванию количества вхождений.
-			// Сохранить мнемоники в буфере proto результата. Запомните индексы, присвоенные массиву proto. 
+			// Сохранить мнемоники в буфере proto результата. Запомните индексы, присвоенные массиву proto.
 			//Сортировать вектор индексов по строке мнемоники, чтобы обеспечить быстрый бинарный поиск по строке
 			//и отображения из строки в индекс.
 			absl::flat_hash_map<std::string, int32_t> mnemonic_histogram;
@@ -103,14 +231,27 @@ namespace security::binexport {
 			}
 			std::sort(mnemonics->begin(), mnemonics->end(),
 				&SortMnemonicsByOccurrenceCount);
-			proto->mutable_mnemonic()->Reserve(mnemonics->size());
+			int32_t index = 0;
 			for (auto& mnemonic : *mnemonics) {
-				mnemonic.second = proto->mnemonic_size();  // Remember current index.
-				proto->add_mnemonic()->set_name(mnemonic.first);
+				mnemonic.second = index++;  // Remember current index.
 			}
 			std::sort(mnemonics->begin(), mnemonics->end(), &SortMnemonicsAlphabetically);
 		}
 
+		void WriteMnemonics(
+			const std::vector<std::pair<std::string, int32_t>>& mnemonics,
+			BinExport2Stream* stream) {
+			std::vector<const std::string*> names(mnemonics.size());
+			for (const auto& mnemonic : mnemonics) {
+				names[mnemonic.second] = &mnemonic.first;
+			}
+			BinExport2::Mnemonic proto_mnemonic;
+			for (const std::string* name : names) {
+				proto_mnemonic.set_name(*name);
+				stream->AddMessage(BinExport2::kMnemonicFieldNumber, proto_mnemonic);
+			}
+		}
+
 
 /// \brief \n Перевод из внутреннего (internal) типа выражения в тип выражение,\n
 /// используемое форматом BinExport2 proto.\n
@@ -152,41 +293,48 @@ namespace security::binexport {
 		}
 
 
-/// \brief \n Сохраняет деревья выражений.
-/// \n
-/// \param proto BinExport2* proto
-		void WriteExpressions(BinExport2* proto) {
-			std::vector<const Expression*> expressions;
-			expressions.reserve(Expression::GetExpressions().size());
+		void GetSortedExpressions(std::vector<const Expression*>* expressions) {
+			expressions->reserve(Expression::GetExpressions().size());
 			for (const auto& expression_cache_entry : Expression::GetExpressions()) {
-				expressions.push_back(&expression_cache_entry.second);
+				expressions->push_back(&expression_cache_entry.second);
 			}
-			std::sort(expressions.begin(), expressions.end(), &SortExpressionsById);
+			ParallelSort(expressions->begin(), expressions->end(), &SortExpressionsById);
+		}
+
 
-			proto->mutable_expression()->Reserve(expressions.size());
+/// \brief \n Сохраняет деревья выражений.
+/// \n
+/// \param expressions const std::vector<const Expression*>& expressions, отсортированные по id
+/// \param stream BinExport2Stream* stream
+		void WriteExpressions(const std::vector<const Expression*>& expressions,
+			BinExport2Stream* stream) {
+			BinExport2::Expression proto_expression;
+			int index = 0;
 			for (const Expression* expression : expressions) {
 				// В выражениях Proto используется индекс, основанный на нулях, а в выражениях C++ - на единицах.
-				DCHECK_EQ(expression->GetId() - 1, proto->expression_size());
+				DCHECK_EQ(expression->GetId() - 1, index);
+				++index;
 				const auto& symbol = expression->GetSymbol();
 				DCHECK(!symbol.empty() || expression->IsImmediate());
-				BinExport2::Expression* proto_expression(proto->add_expression());
+				proto_expression.Clear();
 				if (!symbol.empty()) {
-					proto_expression->set_symbol(symbol);
+					proto_expression.set_symbol(symbol);
 				}
 				if (expression->GetParent() != nullptr) {
-					proto_expression->set_parent_index(expression->GetParent()->GetId() - 1);
+					proto_expression.set_parent_index(expression->GetParent()->GetId() - 1);
 				}
 				if (expression->IsImmediate()) {
-					proto_expression->set_immediate(expression->GetImmediate());
+					proto_expression.set_immediate(expression->GetImmediate());
 				}
 				if (expression->IsRelocation()) {
-					proto_expression->set_is_relocation(true);
+					proto_expression.set_is_relocation(true);
 				}
 				const auto type = ExpressionTypeToProtoType(expression->GetType());
 				if (type != BinExport2::Expression::IMMEDIATE_INT) {
 					// Сохраняется только в том случае, если отличается от значения по умолчанию.
-					proto_expression->set_type(type);
+					proto_expression.set_type(type);
 				}
+				stream->AddMessage(BinExport2::kExpressionFieldNumber, proto_expression);
 			}
 		}
 
@@ -195,31 +343,38 @@ namespace security::binexport {
 		}
 
 
-/// \brief \n Хранит деревья выражений (expression trees) для каждого операнда.
-/// \n
-/// \param proto BinExport2* proto
-		void WriteOperands(BinExport2* proto) {
-			std::vector<const Operand*> operands;
-			operands.reserve(Operand::GetOperands().size());
+		void GetSortedOperands(std::vector<const Operand*>* operands) {
+			operands->reserve(Operand::GetOperands().size());
 			for (const auto& operand_cache_entry : Operand::GetOperands()) {
-				operands.push_back(&operand_cache_entry.second);
+				operands->push_back(&operand_cache_entry.second);
 			}
-			std::sort(operands.begin(), operands.end(), &SortOperandsById);
+			ParallelSort(operands->begin(), operands->end(), &SortOperandsById);
+		}
+
 
-			proto->mutable_operand()->Reserve(operands.size());
+/// \brief \n Хранит деревья выражений (expression trees) для каждого операнда.
+/// \n
+/// \param operands const std::vector<const Operand*>& operands, отсортированные по id
+/// \param stream BinExport2Stream* stream
+		void WriteOperands(const std::vector<const Operand*>& operands,
+			BinExport2Stream* stream) {
+			BinExport2::Operand proto_operand;
+			int index = 0;
 			for (const Operand* operand : operands) {
 				// В выражениях Proto используется индекс, основанный на нулях, а в выражениях C++ - на единицах.
-				QCHECK_EQ(operand->GetId() - 1, proto->operand_size());
-				BinExport2::Operand* proto_operand(proto->add_operand());
-				proto_operand->mutable_expression_index()->Reserve(
+				QCHECK_EQ(operand->GetId() - 1, index);
+				++index;
+				proto_operand.Clear();
+				proto_operand.mutable_expression_index()->Reserve(
 					operand->GetExpressionCount());
 				const auto* previous_expression = *(operand->begin());
 				for (const auto* expression : *operand) {
 					QCHECK(expression->GetParent() != previous_expression->GetParent() ||
 						expression->GetPosition() >= previous_expression->GetPosition());
-					proto_operand->add_expression_index(expression->GetId() - 1);
+					proto_operand.add_expression_index(expression->GetId() - 1);
 					previous_expression = expression;
 				}
+				stream->AddMessage(BinExport2::kOperandFieldNumber, proto_operand);
 			}
 		}
 
@@ -264,75 +419,172 @@ namespace security::binexport {
 		}
 
 
-/// \brief \n Записать инструкцию
+/// \brief \n Отображение адрес -> индекс инструкции в proto, отсортированное по адресу.\n
+/// Индексы выдаются в том же порядке, в котором WriteInstructions пишет инструкции,\n
+/// поэтому отображение известно до записи самих инструкций.
+/// \n
+/// \param instructions const Instructions& instructions
+/// \param instruction_indices std::vector<std::pair<Address, int32_t>>* instruction_indices
+		void GetInstructionIndices(
+			const Instructions& instructions,
+			std::vector<std::pair<Address, int32_t>>* instruction_indices) {
+			instruction_indices->reserve(instructions.size());
+			int32_t index = 0;
+			for (const Instruction& instruction : instructions) {
+				if (!instruction.HasFlag(FLAG_INVALID)) {
+					instruction_indices->emplace_back(instruction.GetAddress(), index++);
+				}
+			}
+			ParallelSort(instruction_indices->begin(), instruction_indices->end());
+		}
+
+
+/// \brief \n Индекс инструкции для каждого комментария (в порядке call_graph.GetComments()).\n
+/// Комментарий относится к первой инструкции с адресом не меньше адреса комментария.
+/// \n
+/// \param call_graph const CallGraph& call_graph
+/// \param instruction_indices const std::vector<std::pair<Address, int32_t>>& instruction_indices
+/// \param comment_instruction_indices std::vector<int32_t>* comment_instruction_indices
+		void GetCommentInstructionIndices(
+			const CallGraph& call_graph,
+			const std::vector<std::pair<Address, int32_t>>& instruction_indices,
+			std::vector<int32_t>* comment_instruction_indices) {
+			const Comments& comments = call_graph.GetComments();
+			comment_instruction_indices->resize(comments.size());
+			ParallelFor(comments.size(), 4096, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					const auto instruction_it =
+						lower_bound(instruction_indices.begin(), instruction_indices.end(),
+							std::make_pair(comments[i].address_, 0));
+					QCHECK(instruction_it != instruction_indices.end());
+					(*comment_instruction_indices)[i] = instruction_it->second;
+				}
+			});
+		}
+
+
+/// \brief \n Записать инструкции.\n
+/// Обратные ссылки на комментарии (comment_index) берутся из instruction_comments -\n
+/// пар (индекс инструкции, индекс комментария), отсортированных по возрастанию.\n
+/// Инструкции кодируются кусками в рабочих потоках. Байты инструкций куска\n
+/// заранее копируются в главном потоке: страницы блоков памяти подгружаются через IDA.
 /// \n
 /// \param flow_graph const FlowGraph& flow_graph
 /// \param instructions const Instructions& instructions
 /// \param mnemonics const std::vector<std::pair<std::string, int32_t>>& mnemonics
 /// \param address_references const AddressReferences& address_references
-/// \param instruction_indices std::vector<std::pair<Address, int32_t>>* instruction_indices
-/// \param proto BinExport2* proto
+/// \param instruction_comments const std::vector<std::pair<int32_t, int32_t>>& instruction_comments
+/// \param scratch Scratch* scratch
+/// \param stream BinExport2Stream* stream
 		void WriteInstructions(
 			const FlowGraph& flow_graph, const Instructions& instructions,
 			const std::vector<std::pair<std::string, int32_t>>& mnemonics,
 			const AddressReferences& address_references,
-			std::vector<std::pair<Address, int32_t>>* instruction_indices,
-			BinExport2* proto) {
+			const std::vector<std::pair<int32_t, int32_t>>& instruction_comments,
+			Scratch* scratch, BinExport2Stream* stream) {
 			QCHECK(std::is_sorted(address_references.begin(), address_references.end()));
-			proto->mutable_instruction()->Reserve(instructions.size());
-			const Instruction* previous_instruction(nullptr);
-			for (const Instruction& instruction : instructions) {
-				if (instruction.HasFlag(FLAG_INVALID)) {
-					previous_instruction = nullptr;
-					continue;
+			constexpr size_t kChunkSize = 1 << 14;
+			// Индекс первой действительной инструкции куска.
+			std::vector<int32_t> first_indices(scratch->chunk_buffers.size());
+			const auto protos = scratch->CreatePerSlot<BinExport2::Instruction>();
+			int32_t next_index = 0;
+
+			const auto prepare = [&](size_t slot, size_t begin, size_t end) {
+				std::string& raw_bytes_buffer = scratch->raw_bytes[slot];
+				first_indices[slot] = next_index;
+				raw_bytes_buffer.clear();
+				for (size_t i = begin; i < end; ++i) {
+					const Instruction& instruction = instructions[i];
+					if (instruction.HasFlag(FLAG_INVALID)) {
+						continue;
+					}
+					// Байты вне address_space GetByteSpan() читает через IDA, поэтому
+					// они собираются здесь, в главном потоке, а не в encode.
+					const auto raw_bytes = instruction.GetByteSpan();
+					QCHECK_EQ(instruction.GetSize(), raw_bytes.size());
+					raw_bytes_buffer.append(reinterpret_cast<const char*>(raw_bytes.data()),
+						raw_bytes.size());
+					++next_index;
 				}
-				instruction_indices->push_back(
-					std::make_pair(instruction.GetAddress(), proto->instruction_size()));
-				BinExport2::Instruction* proto_instruction(proto->add_instruction());
-				QCHECK_EQ(instruction.GetSize(), instruction.GetBytes().size());
-				// Записать полный адрес инструкции, если:
-				// - нет предыдущей инструкции
-				// - предыдущая инструкция не имеет кодового потока в текущую инструкцию
-				// - предыдущая инструкция перекрывает текущую
-				// - текущая инструкция является точкой входа в функцию
-				if (previous_instruction == nullptr || !previous_instruction->IsFlow() ||
-					previous_instruction->GetAddress() + previous_instruction->GetSize() !=
-					instruction.GetAddress() ||
-					flow_graph.GetFunction(instruction.GetAddress())) {
-					proto_instruction->set_address(instruction.GetAddress());
-				}
-				proto_instruction->set_raw_bytes(instruction.GetBytes());
-				if (const auto index =
-					GetMnemonicIndex(mnemonics, instruction.GetMnemonic())) {
-					// Сохраняется только в том случае, если отличается от значения по умолчанию.
-					proto_instruction->set_mnemonic_index(index);
+			};
+
+			const auto encode = [&](size_t slot, size_t begin, size_t end,
+				BinExport2Stream* chunk_stream) {
+				const std::string& raw_bytes = scratch->raw_bytes[slot];
+				BinExport2::Instruction& proto_instruction = *protos[slot];
+				int32_t instruction_index = first_indices[slot];
+				size_t raw_bytes_offset = 0;
+				auto comment_it = std::lower_bound(instruction_comments.begin(),
+					instruction_comments.end(), std::make_pair(instruction_index, 0));
+				const Instruction* previous_instruction(nullptr);
+				if (begin > 0 && !instructions[begin - 1].HasFlag(FLAG_INVALID)) {
+					previous_instruction = &instructions[begin - 1];
 				}
-				proto_instruction->mutable_operand_index()->Reserve(
-					instruction.GetOperandCount());
-				for (const auto* operand : instruction) {
-					QCHECK_GT(operand->GetId(), 0);
-					proto_instruction->add_operand_index(operand->GetId() - 1);
+				for (size_t i = begin; i < end; ++i) {
+					const Instruction& instruction = instructions[i];
+					if (instruction.HasFlag(FLAG_INVALID)) {
+						previous_instruction = nullptr;
+						continue;
+					}
+					proto_instruction.Clear();
+					// Записать полный адрес инструкции, если:
+					// - нет предыдущей инструкции
+					// - предыдущая инструкция не имеет кодового потока в текущую инструкцию
+					// - предыдущая инструкция перекрывает текущую
+					// - текущая инструкция является точкой входа в функцию
+					if (previous_instruction == nullptr || !previous_instruction->IsFlow() ||
+						previous_instruction->GetAddress() + previous_instruction->GetSize() !=
+						instruction.GetAddress() ||
+						flow_graph.GetFunction(instruction.GetAddress())) {
+						proto_instruction.set_address(instruction.GetAddress());
+					}
+					proto_instruction.set_raw_bytes(
+						raw_bytes.data() + raw_bytes_offset, instruction.GetSize());
+					raw_bytes_offset += instruction.GetSize();
+					if (const auto index =
+						GetMnemonicIndex(mnemonics, instruction.GetMnemonic())) {
+						// Сохраняется только в том случае, если отличается от значения по умолчанию.
+						proto_instruction.set_mnemonic_index(index);
+					}
+					proto_instruction.mutable_operand_index()->Reserve(
+						instruction.GetOperandCount());
+					for (const auto* operand : instruction) {
+						QCHECK_GT(operand->GetId(), 0);
+						proto_instruction.add_operand_index(operand->GetId() - 1);
+					}
+					WriteCallTargets(instruction.GetAddress(), address_references,
+						&proto_instruction);
+					// Добавить обратные ссылки на комментарии к инструкции.
+					for (; comment_it != instruction_comments.end() &&
+						comment_it->first == instruction_index;
+						++comment_it) {
+						proto_instruction.add_comment_index(comment_it->second);
+					}
+					chunk_stream->AddMessage(BinExport2::kInstructionFieldNumber,
+						proto_instruction);
+					++instruction_index;
+					previous_instruction = &instruction;
 				}
-				WriteCallTargets(instruction.GetAddress(), address_references,
-					proto_instruction);
-				previous_instruction = &instruction;
-			}
-			std::sort(instruction_indices->begin(), instruction_indices->end());
+			};
+
+			WriteInChunks(BinExport2::kInstructionFieldNumber, instructions.size(),
+				kChunkSize, prepare, encode, scratch, stream);
+			QCHECK(instruction_comments.empty() ||
+				instruction_comments.back().first < next_index);
 		}
 
 		void WriteBasicBlocks(
-			const Instructions& instructions,
 			const std::vector<std::pair<Address, int32_t>>& instruction_indices,
-			BinExport2* proto) {
+			BinExport2Stream* stream) {
 			CHECK((instruction_indices.empty() && BasicBlock::blocks().empty()) ||
 				(!instruction_indices.empty() && !BasicBlock::blocks().empty()));
-			proto->mutable_basic_block()->Reserve(BasicBlock::blocks().size());
 			auto instruction_index_it = instruction_indices.begin();
+			BinExport2::BasicBlock proto_basic_block;
 			int id = 0;
 			for (auto& basic_block : BasicBlock::blocks()) {
 				// Обычно элементы кэша не должны модифицироваться, так как изменение объектов может привести к изменению их порядка.
 				// Однако здесь мы изменяем только id, что не влияет на порядок.
-				BinExport2::BasicBlock proto_basic_block;
+				proto_basic_block.Clear();
 				bool basic_block_is_invalid = false;
 				int begin_index = -1, end_index = -1;
 				for (const auto& instruction : *basic_block.second) {
@@ -382,12 +634,13 @@ namespace security::binexport {
 				}
 				if (!basic_block_is_invalid) {
 					basic_block.second->set_id(id++);
-					*proto->add_basic_block() = proto_basic_block;
+					stream->AddMessage(BinExport2::kBasicBlockFieldNumber,
+						proto_basic_block);
 				}
 			}
 		}
 
-		// 
+		//
 
 /// \brief \n Трансляция из внутреннего типа графа потока в тип графа, используемый буфером протокола.\n
 /// \n
@@ -410,62 +663,76 @@ namespace security::binexport {
 			}
 		}
 
-		void WriteFlowGraphs(const FlowGraph& flow_graph, BinExport2* proto) {
-			proto->mutable_flow_graph()->Reserve(flow_graph.GetFunctions().size());
+/// \brief \n Записывает графы потока функций. Графы кодируются кусками\n
+/// в рабочих потоках; идентификаторы базовых блоков к этому моменту уже назначены.
+		void WriteFlowGraphs(const FlowGraph& flow_graph, Scratch* scratch,
+			BinExport2Stream* stream) {
+			std::vector<const Function*> functions;
+			functions.reserve(flow_graph.GetFunctions().size());
 			for (const auto& address_to_function : flow_graph.GetFunctions()) {
 				const Function& function = *address_to_function.second;
 				if (function.GetBasicBlocks().empty() ||
 					function.GetType(true /* raw type */) == Function::TYPE_INVALID) {
 					continue;  // Пропустите пустые графы потоков, они существуют только как узлы графа вызовов.
 				}
+				functions.push_back(&function);
+			}
 
-				BinExport2::FlowGraph* proto_flow_graph = proto->add_flow_graph();
-				proto_flow_graph->mutable_basic_block_index()->Reserve(
-					function.GetBasicBlocks().size());
-				for (const BasicBlock* basic_block : function.GetBasicBlocks()) {
-					if (basic_block->GetEntryPoint() == function.GetEntryPoint()) {
-						proto_flow_graph->set_entry_basic_block_index(basic_block->id());
+			const auto protos = scratch->CreatePerSlot<BinExport2::FlowGraph>();
+			const auto encode = [&](size_t slot, size_t begin, size_t end,
+				BinExport2Stream* chunk_stream) {
+				BinExport2::FlowGraph& proto_flow_graph = *protos[slot];
+				for (size_t i = begin; i < end; ++i) {
+					const Function& function = *functions[i];
+					proto_flow_graph.Clear();
+					proto_flow_graph.mutable_basic_block_index()->Reserve(
+						function.GetBasicBlocks().size());
+					for (const BasicBlock* basic_block : function.GetBasicBlocks()) {
+						if (basic_block->GetEntryPoint() == function.GetEntryPoint()) {
+							proto_flow_graph.set_entry_basic_block_index(basic_block->id());
+						}
+						proto_flow_graph.add_basic_block_index(basic_block->id());
 					}
-					proto_flow_graph->add_basic_block_index(basic_block->id());
-				}
-				QCHECK_GE(proto_flow_graph->entry_basic_block_index(), 0);
-				QCHECK_EQ(proto_flow_graph->basic_block_index_size(),
-					function.GetBasicBlocks().size());
-
-				std::vector<Function::Edges::const_iterator> back_edges;
-				function.GetBackEdges(&back_edges);
-				auto back_edge = back_edges.begin();
-				proto_flow_graph->mutable_edge()->Reserve(function.GetEdges().size());
-				for (const FlowGraphEdge& edge : function.GetEdges()) {
-					BinExport2::FlowGraph::Edge* proto_edge = proto_flow_graph->add_edge();
-					const BasicBlock* source = function.GetBasicBlockForAddress(edge.source);
-					CHECK(source != nullptr);
-					const BasicBlock* target = function.GetBasicBlockForAddress(edge.target);
-					CHECK(target != nullptr);
-					proto_edge->set_source_basic_block_index(source->id());
-					proto_edge->set_target_basic_block_index(target->id());
-
-					const auto type = FlowGraphEdgeTypeToProtoType(edge.type);
-					if (type != BinExport2::FlowGraph::Edge::UNCONDITIONAL) {
-						// Сохраняется только в том случае, если отличается от значения по умолчанию.
-						proto_edge->set_type(type);
+					QCHECK_GE(proto_flow_graph.entry_basic_block_index(), 0);
+					QCHECK_EQ(proto_flow_graph.basic_block_index_size(),
+						function.GetBasicBlocks().size());
+
+					// Вложенность циклов считается после реконструкции функций;
+					// если её нет, считаем здесь.
+					std::unique_ptr<LoopNesting> local_loop_nesting;
+					const LoopNesting* loop_nesting = function.GetLoopNesting();
+					if (!loop_nesting) {
+						local_loop_nesting = std::make_unique<LoopNesting>(function);
+						loop_nesting = local_loop_nesting.get();
 					}
+					const auto& edges = function.GetEdges();
+					const auto& basic_blocks = function.GetBasicBlocks();
+					proto_flow_graph.mutable_edge()->Reserve(edges.size());
+					for (size_t j = 0; j < edges.size(); ++j) {
+						BinExport2::FlowGraph::Edge* proto_edge = proto_flow_graph.add_edge();
+						const uint32_t source = function.GetEdgeSourceIndex(j);
+						CHECK(source != Function::kInvalidIndex);
+						const uint32_t target = function.GetEdgeTargetIndex(j);
+						CHECK(target != Function::kInvalidIndex);
+						proto_edge->set_source_basic_block_index(basic_blocks[source]->id());
+						proto_edge->set_target_basic_block_index(basic_blocks[target]->id());
+
+						const auto type = FlowGraphEdgeTypeToProtoType(edges[j].type);
+						if (type != BinExport2::FlowGraph::Edge::UNCONDITIONAL) {
+							// Сохраняется только в том случае, если отличается от значения по умолчанию.
+							proto_edge->set_type(type);
+						}
 
-					// Продвигаем  back edge iterator. Обратите внимание, что back edges и regular edges сортируются одинаково,
-					// поэтому мы можем выполнять итерации по векторам с шагом блокировки.
-					for (; back_edge != back_edges.end() &&
-						(*back_edge)->source < edge.source &&
-						(*back_edge)->target < edge.target;
-						++back_edge) {
-					}
-					if (back_edge != back_edges.end() &&
-						(*back_edge)->source == edge.source &&
-						(*back_edge)->target == edge.target) {
-						proto_edge->set_is_back_edge(true);
-						++back_edge;
+						if (loop_nesting->IsBackEdge(j)) {
+							proto_edge->set_is_back_edge(true);
+						}
 					}
+					chunk_stream->AddMessage(BinExport2::kFlowGraphFieldNumber,
+						proto_flow_graph);
 				}
-			}
+			};
+			WriteInChunks(BinExport2::kFlowGraphFieldNumber, functions.size(), 256,
+				[](size_t, size_t, size_t) {}, encode, scratch, stream);
 		}
 
 
@@ -530,16 +797,28 @@ namespace security::binexport {
 			return it - call_graph.vertex().begin();
 		}
 
-		void WriteCallGraph(const CallGraph& call_graph, const FlowGraph& flow_graph,
-			BinExport2* proto) {
-			BinExport2::CallGraph* proto_call_graph(proto->mutable_call_graph());
+
+/// \brief \n Строит граф вызовов.\n
+/// Граф вызовов - одно сообщение, поэтому он строится в памяти целиком.\n
+/// Имена модулей и используемые библиотеки возвращаются для полей module и library,\n
+/// которые идут в файле позже.
+/// \n
+/// \param call_graph const CallGraph& call_graph
+/// \param flow_graph const FlowGraph& flow_graph
+/// \param proto_call_graph BinExport2::CallGraph* proto_call_graph
+/// \param used_libraries std::vector<const LibraryManager::LibraryRecord*>* used_libraries
+/// \param modules std::vector<std::string>* modules
+		void BuildCallGraph(
+			const CallGraph& call_graph, const FlowGraph& flow_graph,
+			BinExport2::CallGraph* proto_call_graph,
+			std::vector<const LibraryManager::LibraryRecord*>* used_libraries,
+			std::vector<std::string>* modules) {
 			proto_call_graph->mutable_vertex()->Reserve(flow_graph.GetFunctions().size());
 			// Создать список используемых библиотек.
-			std::vector<const LibraryManager::LibraryRecord*> used_libraries;
-			call_graph.GetLibraryManager().GetUsedLibraries(&used_libraries);
+			call_graph.GetLibraryManager().GetUsedLibraries(used_libraries);
 			absl::flat_hash_map<int, int> use_index;
-			for (int i = 0; i < used_libraries.size(); ++i) {
-				use_index[used_libraries[i]->library_index] = i;
+			for (int i = 0; i < used_libraries->size(); ++i) {
+				use_index[(*used_libraries)[i]->library_index] = i;
 			}
 
 			///\n Используется для проверки того, что функции отсортированы по адресу.\n
@@ -577,24 +856,13 @@ namespace security::binexport {
 				const std::string& module = function.GetModuleName();
 				if (!module.empty()) {
 					auto it = module_index.emplace(module, module_index.size());
+					if (it.second) {
+						modules->push_back(module);
+					}
 					proto_function->set_module_index(it.first->second);
 				}
 			}
 
-			if (!module_index.empty()) {
-				proto->mutable_module()->Reserve(module_index.size());
-				// Здесь мы имеем O(N^2) по количеству классов, что не должно быть большой проблемой.
-				for (int i = 0; i < module_index.size(); ++i) {
-					auto* module = proto->add_module();
-					module->set_name(
-						std::find_if(module_index.begin(), module_index.end(),
-							[i](const std::pair<std::string, int32_t>& kv) -> bool {
-								return kv.second == i;
-							})
-						->first);
-				}
-			}
-
 			proto_call_graph->mutable_edge()->Reserve(call_graph.GetEdges().size());
 			for (const EdgeInfo& edge : call_graph.GetEdges()) {
 				BinExport2::CallGraph::Edge* proto_edge(proto_call_graph->add_edge());
@@ -606,21 +874,90 @@ namespace security::binexport {
 				proto_edge->set_target_vertex_index(
 					GetVertexIndex(*proto_call_graph, target_address));
 			}
+		}
 
-			proto->mutable_library()->Reserve(used_libraries.size());
-			for (const auto* used : used_libraries) {
-				auto* library = proto->add_library();
-				library->set_name(used->name);
-				library->set_is_static(used->IsStatic());
+
+/// \brief \n Собирает тексты комментариев для таблицы строк (без повторов по указателю).\n
+/// Возвращает индекс строки для каждого комментария в порядке call_graph.GetComments().
+/// \n
+/// \param call_graph const CallGraph& call_graph
+/// \param comment_strings std::vector<const std::string*>* comment_strings
+/// \param comment_string_indices std::vector<int32_t>* comment_string_indices
+		void GetCommentStrings(const CallGraph& call_graph,
+			std::vector<const std::string*>* comment_strings,
+			std::vector<int32_t>* comment_string_indices) {
+			absl::flat_hash_map<const std::string*, int> comment_to_index;
+			comment_string_indices->reserve(call_graph.GetComments().size());
+			for (const Comment& comment : call_graph.GetComments()) {
+				auto val =
+					comment_to_index.emplace(comment.comment_, comment_strings->size());
+				if (val.second) {
+					comment_strings->push_back(comment.comment_);
+				}
+				comment_string_indices->push_back(val.first->second);
 			}
 		}
 
+
+/// \brief \n Ссылка инструкции на строку. Копится до записи поля string_reference,\n
+/// которое идёт в файле после таблицы строк.
+		struct StringReference {
+			int32_t instruction_index;
+			int32_t instruction_operand_index;
+			int32_t operand_expression_index;
+			int32_t string_table_index;
+		};
+
+/// \brief \n Переводит UTF-16LE в UTF-8: таблица строк BinExport2 хранит UTF-8.\n
+/// Непарные суррогаты заменяются на U+FFFD.
+		std::string Utf16ToUtf8(absl::Span<const Byte> bytes) {
+			std::string result;
+			result.reserve(bytes.size() / 2);
+			for (size_t i = 0; i + 1 < bytes.size(); i += 2) {
+				uint32_t code = bytes[i] | bytes[i + 1] << 8;
+				if (code >= 0xD800 && code < 0xDC00 && i + 3 < bytes.size()) {
+					const uint32_t low = bytes[i + 2] | bytes[i + 3] << 8;
+					if (low >= 0xDC00 && low < 0xE000) {
+						code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+						i += 2;
+					}
+				}
+				if (code >= 0xD800 && code < 0xE000) {
+					code = 0xFFFD;
+				}
+				if (code < 0x80) {
+					result += static_cast<char>(code);
+				}
+				else if (code < 0x800) {
+					result += static_cast<char>(0xC0 | code >> 6);
+					result += static_cast<char>(0x80 | (code & 0x3F));
+				}
+				else if (code < 0x10000) {
+					result += static_cast<char>(0xE0 | code >> 12);
+					result += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+					result += static_cast<char>(0x80 | (code & 0x3F));
+				}
+				else {
+					result += static_cast<char>(0xF0 | code >> 18);
+					result += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+					result += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+					result += static_cast<char>(0x80 | (code & 0x3F));
+				}
+			}
+			return result;
+		}
+
 		void WriteStrings(
 			const AddressReferences& address_references,
 			const AddressSpace& address_space,
 			const std::vector<std::pair<Address, int32_t>>& instruction_indices,
-			BinExport2* proto) {
-			absl::flat_hash_map<std::string, int> string_to_string_index;
+			int* string_table_size,
+			std::vector<StringReference>* string_references,
+			BinExport2Stream* stream) {
+			// Ключи ASCII-строк указывают прямо в байты блоков памяти, строки не
+			// копируются. UTF-16 переводится в UTF-8 и хранится в wide_contents.
+			absl::flat_hash_map<absl::string_view, int> string_to_string_index;
+			std::deque<std::string> wide_contents;
 			for (const auto& reference : address_references) {
 				if (reference.kind_ != TYPE_DATA_STRING &&
 					reference.kind_ != TYPE_DATA_WIDE_STRING) {
@@ -640,8 +977,6 @@ namespace security::binexport {
 					continue;
 				}
 
-				std::string content;
-
 
 /// \brief \n В случае block_size_left > reference.size_ мы, вероятно, должны проверить,\n
 /// может ли следующий блок памяти быть объединен с текущим,\n
@@ -652,26 +987,65 @@ namespace security::binexport {
 				}
 				const Address block_address = reference.target_ - block->first;
 				const int block_size_left = block->second.size() - block_address;
-				if (reference.kind_ != TYPE_DATA_STRING) {
-					continue;
+				const auto bytes = address_space.GetBytes(
+					reference.target_, std::min(reference.size_, block_size_left));
+				absl::string_view content(
+					reinterpret_cast<const char*>(bytes.data()), bytes.size());
+				if (reference.kind_ == TYPE_DATA_WIDE_STRING) {
+					content = wide_contents.emplace_back(Utf16ToUtf8(bytes));
 				}
-				content = std::string(
-					reinterpret_cast<const char*>(&address_space[reference.target_]),
-					std::min(reference.size_, block_size_left));
 
 				auto it =
-					string_to_string_index.try_emplace(content, proto->string_table_size());
+					string_to_string_index.try_emplace(content, *string_table_size);
 				// Дублирование строк.
 				if (it.second != false) {
-					proto->add_string_table(it.first->first);
+					stream->AddString(BinExport2::kStringTableFieldNumber, content);
+					++*string_table_size;
 				}
-				auto* proto_string_reference = proto->add_string_reference();
-				proto_string_reference->set_instruction_index(instruction->second);
-				proto_string_reference->set_instruction_operand_index(
-					reference.source_operand_);
-				proto_string_reference->set_operand_expression_index(
-					reference.source_expression_);
-				proto_string_reference->set_string_table_index(it.first->second);
+				string_references->push_back(
+					{ instruction->second, reference.source_operand_,
+					reference.source_expression_, it.first->second });
+			}
+		}
+
+		void WriteStringReferences(
+			const std::vector<StringReference>& string_references,
+			BinExport2Stream* stream) {
+			BinExport2::Reference proto_string_reference;
+			for (const auto& reference : string_references) {
+				proto_string_reference.set_instruction_index(reference.instruction_index);
+				proto_string_reference.set_instruction_operand_index(
+					reference.instruction_operand_index);
+				proto_string_reference.set_operand_expression_index(
+					reference.operand_expression_index);
+				proto_string_reference.set_string_table_index(
+					reference.string_table_index);
+				stream->AddMessage(BinExport2::kStringReferenceFieldNumber,
+					proto_string_reference);
+			}
+		}
+
+		void WriteSections(const AddressSpace& address_space,
+			BinExport2Stream* stream) {
+			BinExport2::Section section;
+			for (const auto& data : address_space.data()) {
+				section.set_address(data.first);
+				section.set_size(data.second.size());
+				section.set_flag_r(address_space.IsReadable(data.first));
+				section.set_flag_w(address_space.IsWritable(data.first));
+				section.set_flag_x(address_space.IsExecutable(data.first));
+				stream->AddMessage(BinExport2::kSectionFieldNumber, section);
+			}
+		}
+
+		void WriteLibraries(
+			const std::vector<const LibraryManager::LibraryRecord*>& used_libraries,
+			BinExport2Stream* stream) {
+			BinExport2::Library library;
+			for (const auto* used : used_libraries) {
+				library.set_name(used->name);
+				library.set_is_static(used->IsStatic());
+				stream->AddMessage(BinExport2::kLibraryFieldNumber, library);
 			}
 		}
 
@@ -679,12 +1053,8 @@ namespace security::binexport {
 			const AddressReferences& address_references,
 			const AddressSpace& address_space,
 			const std::vector<std::pair<Address, int32_t>>& instruction_indices,
-			BinExport2* proto) {
-			// Сопоставление адрес кэша -> отображение инструкции.
-			absl::flat_hash_map<Address, int32_t> address_to_index;
-			for (const auto& index : instruction_indices) {
-				address_to_index[index.first] = index.second;
-			}
+			BinExport2Stream* stream) {
+			BinExport2::DataReference proto_data_reference;
 			for (const auto& reference : address_references) {
 				if (reference.kind_ != TYPE_DATA) {
 					continue;
@@ -693,19 +1063,32 @@ namespace security::binexport {
 				if (reference.target_ == 0) {
 					continue;
 				}
-				const auto instruction = address_to_index.find(reference.source_);
+				const auto instruction =
+					lower_bound(instruction_indices.begin(), instruction_indices.end(),
+						std::make_pair(reference.source_, 0));
 				// Добавляйте ссылки на данные только при наличии ссылающейся инструкции.
-				if (instruction == address_to_index.end()) {
+				if (instruction == instruction_indices.end() ||
+					instruction->first != reference.source_) {
 					continue;
 				}
 				if (address_space.IsValidAddress(reference.target_)) {
-					auto* proto_data_reference = proto->add_data_reference();
-					proto_data_reference->set_instruction_index(instruction->second);
-					proto_data_reference->set_address(reference.target_);
+					proto_data_reference.set_instruction_index(instruction->second);
+					proto_data_reference.set_address(reference.target_);
+					stream->AddMessage(BinExport2::kDataReferenceFieldNumber,
+						proto_data_reference);
 				}
 			}
 		}
 
+		void WriteModules(const std::vector<std::string>& modules,
+			BinExport2Stream* stream) {
+			BinExport2::Module module;
+			for (const auto& name : modules) {
+				module.set_name(name);
+				stream->AddMessage(BinExport2::kModuleFieldNumber, module);
+			}
+		}
+
 
 /// \brief \n Переводит из внутреннего типа комментария в тип, используемый proto BinExport2.
 /// \n
@@ -740,37 +1123,22 @@ namespace security::binexport {
 
 		void WriteComments(
 			const CallGraph& call_graph,
-			const std::vector<std::pair<Address, int32_t>>& instruction_indices,
-			BinExport2* proto) {
-			absl::flat_hash_map<const std::string*, int> comment_to_index;
+			const std::vector<int32_t>& comment_instruction_indices,
+			const std::vector<int32_t>& comment_string_indices,
+			BinExport2Stream* stream) {
+			BinExport2::Comment proto_comment;
+			int comment_index = 0;
 			for (const Comment& comment : call_graph.GetComments()) {
-
-
-
-				auto val = comment_to_index.emplace(comment.comment_, proto->string_table_size());
-				const auto new_comment_it = val.first;
-				const auto inserted = val.second;
-
-				//const auto[new_comment_it, inserted] = comment_to_index.emplace(comment.comment_, proto->string_table_size());
-				if (inserted) {
-					proto->add_string_table(*comment.comment_);
-				}
-				const auto instruction_it =
-					lower_bound(instruction_indices.begin(), instruction_indices.end(),
-						std::make_pair(comment.address_, 0));
-				QCHECK(instruction_it != instruction_indices.end());
-
-				const Address instruction_index = instruction_it->second;
-				const int string_table_index = new_comment_it->second;
-
 				///\n
 				/// Напишите богатую структуру комментариев для BinDiff.
-				const int comment_index = proto->comment_size();
-				auto* proto_comment = proto->add_comment();
-				proto_comment->set_instruction_index(instruction_index);
-				proto_comment->set_string_table_index(string_table_index);
-				proto_comment->set_type(CommentTypeToProtoType(comment.type_));
-				proto_comment->set_repeatable(comment.repeatable_);
+				proto_comment.Clear();
+				proto_comment.set_instruction_index(
+					comment_instruction_indices[comment_index]);
+				proto_comment.set_string_table_index(
+					comment_string_indices[comment_index]);
+				proto_comment.set_type(CommentTypeToProtoType(comment.type_));
+				proto_comment.set_repeatable(comment.repeatable_);
+				++comment_index;
 
 				// Код, специфичный для IDA, кодирует тип комментария в номере операнда.
 				// Это связано с тем, что BinDiff внутренне добавляет все комментарии в глобальный кэш,
@@ -789,40 +1157,11 @@ namespace security::binexport {
 				}
 				// Номера операндов нужно писать только в том случае, если комментарий относится к реальному операнду.
 				if (operand_num >= 0 && operand_num < kMaxOp) {
-					proto_comment->set_instruction_operand_index(operand_num);
+					proto_comment.set_instruction_operand_index(operand_num);
 				}
-
-				// Добавить обратную ссылку на комментарий к инструкции
-				proto->mutable_instruction(instruction_index)
-					->add_comment_index(comment_index);
-			}
-		}
-
-		void WriteSections(const AddressSpace& address_space, BinExport2* proto) {
-			for (const auto& data : address_space.data()) {
-				auto* section = proto->add_section();
-				section->set_address(data.first);
-				section->set_size(data.second.size());
-				section->set_flag_r(address_space.IsReadable(data.first));
-				section->set_flag_w(address_space.IsWritable(data.first));
-				section->set_flag_x(address_space.IsExecutable(data.first));
+				stream->AddMessage(BinExport2::kCommentFieldNumber, proto_comment);
 			}
 		}
-
-
-/// \brief \n Записывает буфер двоичного протокола в указанный файл.
-/// \n
-/// \param filename const std::string& filename
-/// \param proto BinExport2* proto
-/// \return
-		absl::Status WriteProtoToFile(const std::string& filename, BinExport2* proto) {
-			std::ofstream stream(filename, std::ios::binary | std::ios::out);
-			if (!proto->SerializeToOstream(&stream)) {
-				return absl::UnknownError(
-					absl::StrCat("error serializing data to: '", filename, ""));
-			}
-			return absl::OkStatus();
-		}
 	}  // namespace
 
 	BinExport2Writer::BinExport2Writer(const std::string& result_filename,
@@ -834,36 +1173,127 @@ namespace security::binexport {
 		executable_hash_(executable_hash),
 		architecture_(architecture) {}
 
+	absl::Status BinExport2Writer::WriteToStream(
+		const CallGraph& call_graph, const FlowGraph& flow_graph,
+		const Instructions& instructions,
+		const AddressReferences& address_references,
+		const AddressSpace& address_space,
+		google::protobuf::io::ZeroCopyOutputStream* output) const {
+		// Независимые таблицы и индексы строятся одновременно. Цепочка
+		// instruction_indices -> comment_instruction_indices -> instruction_comments
+		// выполняется в одной задаче. После построения все они только читаются.
+		std::vector<const Expression*> expressions;
+		std::vector<const Operand*> operands;
+		std::vector<std::pair<std::string, int32_t>> mnemonics;
+		std::vector<std::pair<Address, int32_t>> instruction_indices;
+		std::vector<int32_t> comment_instruction_indices;
+		std::vector<std::pair<int32_t, int32_t>> instruction_comments;
+		Scratch scratch(GetParallelism());
+		auto* proto_call_graph = scratch.Create<BinExport2::CallGraph>();
+		std::vector<const LibraryManager::LibraryRecord*> used_libraries;
+		std::vector<std::string> modules;
+		std::vector<const std::string*> comment_strings;
+		std::vector<int32_t> comment_string_indices;
+		RunInParallel({
+			[&expressions]() { GetSortedExpressions(&expressions); },
+			[&operands]() { GetSortedOperands(&operands); },
+			[&instructions, &mnemonics]() { GetMnemonics(instructions, &mnemonics); },
+			[&]() {
+				BuildCallGraph(call_graph, flow_graph, proto_call_graph,
+					&used_libraries, &modules);
+			},
+			[&]() {
+				GetCommentStrings(call_graph, &comment_strings, &comment_string_indices);
+			},
+			[&]() {
+				GetInstructionIndices(instructions, &instruction_indices);
+				GetCommentInstructionIndices(call_graph, instruction_indices,
+					&comment_instruction_indices);
+				// Комментарии упорядочены по адресу, а не по индексу инструкции.
+				instruction_comments.reserve(comment_instruction_indices.size());
+				for (int32_t i = 0; i < comment_instruction_indices.size(); ++i) {
+					instruction_comments.emplace_back(comment_instruction_indices[i], i);
+				}
+				ParallelSort(instruction_comments.begin(), instruction_comments.end());
+			},
+		});
+
+		BinExport2Stream stream(output);
+		{
+			BinExport2::Meta meta_information;
+			meta_information.set_executable_name(executable_filename_);
+			meta_information.set_executable_id(executable_hash_);
+			meta_information.set_architecture_name(architecture_);
+			meta_information.set_timestamp(absl::ToUnixSeconds(absl::Now()));
+			stream.AddMessage(BinExport2::kMetaInformationFieldNumber,
+				meta_information);
+		}
+
+		WriteExpressions(expressions, &stream);
+		WriteOperands(operands, &stream);
+		WriteMnemonics(mnemonics, &stream);
+		WriteInstructions(flow_graph, instructions, mnemonics, address_references,
+			instruction_comments, &scratch, &stream);
+		WriteBasicBlocks(instruction_indices, &stream);
+		WriteFlowGraphs(flow_graph, &scratch, &stream);
+		stream.AddMessage(BinExport2::kCallGraphFieldNumber, *proto_call_graph);
+
+		// Таблица строк: сначала тексты комментариев, затем строковые литералы.
+		for (const std::string* comment : comment_strings) {
+			stream.AddString(BinExport2::kStringTableFieldNumber, *comment);
+		}
+		int string_table_size = comment_strings.size();
+		std::vector<StringReference> string_references;
+		WriteStrings(address_references, address_space, instruction_indices,
+			&string_table_size, &string_references, &stream);
+		WriteStringReferences(string_references, &stream);
+		// TODO(cblichmann): Write expression_substitution.
+		WriteSections(address_space, &stream);
+		WriteLibraries(used_libraries, &stream);
+		WriteDataReferences(address_references, address_space, instruction_indices,
+			&stream);
+		WriteModules(modules, &stream);
+		WriteComments(call_graph, comment_instruction_indices,
+			comment_string_indices, &stream);
+
+		if (stream.HadError()) {
+			return absl::UnknownError("error serializing BinExport2 data");
+		}
+		return absl::OkStatus();
+	}
+
 	absl::Status BinExport2Writer::WriteToProto(
 		const CallGraph& call_graph, const FlowGraph& flow_graph,
 		const Instructions& instructions,
 		const AddressReferences& address_references,
 		const AddressSpace& address_space, BinExport2* proto) const {
-		auto* meta_information = proto->mutable_meta_information();
-		meta_information->set_executable_name(executable_filename_);
-		meta_information->set_executable_id(executable_hash_);
-		meta_information->set_architecture_name(architecture_);
-		meta_information->set_timestamp(absl::ToUnixSeconds(absl::Now()));
-
-		WriteExpressions(proto);
-		WriteOperands(proto);
+		std::string buffer;
 		{
-			std::vector<std::pair<std::string, int32_t>> mnemonics;
-			WriteMnemonics(instructions, &mnemonics, proto);
-			std::vector<std::pair<Address, int32_t>> instruction_indices;
-			WriteInstructions(flow_graph, instructions, mnemonics, address_references,
-				&instruction_indices, proto);
-			WriteBasicBlocks(instructions, instruction_indices, proto);
-			WriteComments(call_graph, instruction_indices, proto);
-			WriteStrings(address_references, address_space, instruction_indices, proto);
-			// TODO(cblichmann): Write expression_substitution.
-			WriteDataReferences(address_references, address_space, instruction_indices,
-				proto);
-		}
-		WriteFlowGraphs(flow_graph, proto);
-		WriteCallGraph(call_graph, flow_graph, proto);
-		WriteSections(address_space, proto);
-
+			google::protobuf::io::StringOutputStream output(&buffer);
+			NA_RETURN_IF_ERROR(WriteToStream(call_graph, flow_graph, instructions,
+				address_references, address_space, &output));
+		}
+		// Ёмкость крупных повторяющихся полей известна заранее. Если proto создан
+		// на арене, сами элементы при разборе тоже размещаются на ней.
+		proto->mutable_expression()->Reserve(
+			proto->expression_size() + Expression::GetExpressions().size());
+		proto->mutable_operand()->Reserve(
+			proto->operand_size() + Operand::GetOperands().size());
+		proto->mutable_instruction()->Reserve(
+			proto->instruction_size() + instructions.size());
+		proto->mutable_basic_block()->Reserve(
+			proto->basic_block_size() + BasicBlock::blocks().size());
+		proto->mutable_flow_graph()->Reserve(
+			proto->flow_graph_size() + flow_graph.GetFunctions().size());
+		proto->mutable_comment()->Reserve(
+			proto->comment_size() + call_graph.GetComments().size());
+		proto->mutable_call_graph()->mutable_vertex()->Reserve(
+			proto->call_graph().vertex_size() + flow_graph.GetFunctions().size());
+		proto->mutable_call_graph()->mutable_edge()->Reserve(
+			proto->call_graph().edge_size() + call_graph.GetEdges().size());
+		if (!proto->MergeFromString(buffer)) {
+			return absl::UnknownError("error parsing serialized BinExport2 data");
+		}
 		return absl::OkStatus();
 	}
 
@@ -874,10 +1304,18 @@ namespace security::binexport {
 		const AddressSpace& address_space) {
 		LOG(INFO) << "Writing to: \"" << filename_ << "\".";
 
-		BinExport2 proto;
-		NA_RETURN_IF_ERROR(WriteToProto(call_graph, flow_graph, instructions,
-			address_references, address_space, &proto));
-		return WriteProtoToFile(filename_, &proto);
+		std::ofstream file(filename_, std::ios::binary | std::ios::out);
+		absl::Status status;
+		{
+			google::protobuf::io::OstreamOutputStream output(&file);
+			status = WriteToStream(call_graph, flow_graph, instructions,
+				address_references, address_space, &output);
+		}
+		if (!status.ok() || !file.flush()) {
+			return absl::UnknownError(
+				absl::StrCat("error serializing data to: '", filename_, ""));
+		}
+		return absl::OkStatus();
 	}
 
 }  // namespace security::binexport
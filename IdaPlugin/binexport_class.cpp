@@ -6,12 +6,15 @@
 #include "flow_analysis.h"
 #include "names.h"
 #include "third_party/zynamics/binexport/binexport2_writer.h"
+#include "third_party/zynamics/binexport/chain_writer.h"
 #include "third_party/zynamics/binexport/dump_writer.h"
+#include "third_party/zynamics/binexport/similarity_index.h"
 #include "third_party/zynamics/binexport/statistics_writer.h"
 #include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/format.h"
 #include "third_party/zynamics/binexport/util/timer.h"
 #include "third_party/zynamics/binexport/writer.h"
+#include "settings.h"
 #include "ui.h"
 // Определения для использования функций binexport конец
 
@@ -56,6 +59,11 @@ void ExportIdb(SB::Writer* writer) {
 	Instructions instructions;
 	_RPT1(0, "\tFlowGraph\n", "");
 	FlowGraph flow_graph;
+	{
+		// Мягкий бюджет функции из настроек, рёбер и инструкций с запасом на блок.
+		const size_t budget = Settings::getExportFunctionBudget();
+		flow_graph.SetFunctionBudget({ budget, 2 * budget, 8 * budget });
+	}
 	_RPT1(0, "\tCallGraph\n", "");
 	CallGraph call_graph;
 	// контеинеры и классы для хранения данных конец **********************
@@ -88,9 +96,15 @@ int ExportBinary(const std::string& filename) {
 	try {
 		const std::string hash =
 			SB::GetInputFileSha256().value_or(SB::GetInputFileMd5().value_or(""));
-		SB::BinExport2Writer writer(filename, SB::GetModuleName(), hash,
-			SB::GetArchitectureName().value());
+		// Вместе с .BinExport дописывается индекс похожих функций в том же каталоге.
+		SB::ChainWriter writer;
+		writer.Add(std::make_shared<SB::BinExport2Writer>(
+			filename, SB::GetModuleName(), hash, SB::GetArchitectureName().value()));
+		writer.Add(std::make_shared<SB::SimilarityIndexWriter>(
+			JoinPath(Dirname(filename), SB::kSimilarityIndexFilename),
+			SB::GetModuleName(), hash));
 		ExportIdb(&writer);
+		Settings::setExportLastDir(QString::fromStdString(Dirname(filename)));
 	}
 	catch (const std::exception& error) {
 		LOG(INFO) << "Error exporting: " << error.what();
@@ -128,8 +142,12 @@ int ExportText(const std::string& filename) {
 int ExportStatistics(const std::string& filename) {
 	_RPT1(0, "FuncName ExportStatistics \n", "");
 	try {
+		// Рядом с текстовым отчётом пишется тот же отчёт в JSON для сводной
+		// обработки по многим бинарникам: <file>.statistics.json.
 		std::ofstream file(filename);
-		SB::StatisticsWriter writer{ file };
+		std::ofstream json_file(ReplaceFileExtension(filename, ".statistics.json"));
+		SB::StatisticsWriter writer{ file, json_file, SB::GetModuleName(),
+			SB::GetInputFileSha256().value_or(SB::GetInputFileMd5().value_or("")) };
 		ExportIdb(&writer);
 	}
 	catch (const std::exception& error) {
@@ -0,0 +1,177 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/byte_profile.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "third_party/zynamics/binexport/virtual_memory.h"
+
+namespace security::binexport {
+	namespace {
+
+		// Окон в куске для параллельного счёта (1 МБ).
+		constexpr size_t kWindowsPerChunk = 256;
+
+		// Как в StringLiteralTable: видимые ASCII и \t, \n, \r.
+		inline bool IsPrintable(int byte) {
+			return (byte >= 0x20 && byte < 0x7F) || byte == '\t' || byte == '\n' ||
+				byte == '\r';
+		}
+
+/// \brief \n c * log2(c) для c от 0 до kWindowSize.
+		const std::vector<double>& GetCountLogTable() {
+			static const std::vector<double>* table = [] {
+				auto* values = new std::vector<double>(ByteProfile::kWindowSize + 1, 0.0);
+				for (size_t c = 2; c < values->size(); ++c) {
+					(*values)[c] = c * std::log2(static_cast<double>(c));
+				}
+				return values;
+			}();
+			return *table;
+		}
+
+/// \brief \n Гистограмма size байтов. Соседние байты попадают в разные таблицы,\n
+/// поэтому инкременты одного значения подряд не упираются в одну ячейку памяти.
+		void CountBytes(const Byte* bytes, size_t size,
+			std::array<uint64_t, 256>* histogram) {
+			uint32_t counts[4][256] = {};
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8) {
+				uint64_t word;
+				std::memcpy(&word, bytes + i, sizeof(word));
+				++counts[0][word & 0xFF];
+				++counts[1][word >> 8 & 0xFF];
+				++counts[2][word >> 16 & 0xFF];
+				++counts[3][word >> 24 & 0xFF];
+				++counts[0][word >> 32 & 0xFF];
+				++counts[1][word >> 40 & 0xFF];
+				++counts[2][word >> 48 & 0xFF];
+				++counts[3][word >> 56];
+			}
+			for (; i < size; ++i) {
+				++counts[0][bytes[i]];
+			}
+			for (int value = 0; value < 256; ++value) {
+				(*histogram)[value] = uint64_t{ counts[0][value] } + counts[1][value] +
+					counts[2][value] + counts[3][value];
+			}
+		}
+
+	}  // namespace
+
+	double ByteProfile::GetEntropy(absl::Span<const uint64_t> histogram) {
+		uint64_t total = 0;
+		for (const uint64_t count : histogram) {
+			total += count;
+		}
+		if (total == 0) {
+			return 0.0;
+		}
+		// H = log2(n) - sum(c * log2(c)) / n
+		const std::vector<double>& table = GetCountLogTable();
+		double sum = 0.0;
+		for (const uint64_t count : histogram) {
+			sum += count < table.size() ? table[count]
+				: count * std::log2(static_cast<double>(count));
+		}
+		return std::max(0.0, std::log2(static_cast<double>(total)) - sum / total);
+	}
+
+	double ByteProfile::GetPrintableRatio(absl::Span<const uint64_t> histogram) {
+		uint64_t total = 0;
+		uint64_t printable = 0;
+		for (size_t value = 0; value < histogram.size(); ++value) {
+			total += histogram[value];
+			printable += IsPrintable(static_cast<int>(value)) ? histogram[value] : 0;
+		}
+		return total != 0 ? static_cast<double>(printable) / total : 0.0;
+	}
+
+	std::vector<std::pair<size_t, size_t>> ByteProfile::GetHighEntropyRuns(
+		absl::Span<const float> window_entropy, double threshold) {
+		std::vector<std::pair<size_t, size_t>> runs;
+		for (size_t i = 0; i < window_entropy.size();) {
+			if (window_entropy[i] < threshold) {
+				++i;
+				continue;
+			}
+			size_t end = i;
+			while (end < window_entropy.size() && window_entropy[end] >= threshold) {
+				++end;
+			}
+			runs.emplace_back(i, end - i);
+			i = end;
+		}
+		return runs;
+	}
+
+	ByteProfile::ByteProfile(const AddressSpace& address_space) {
+		// Куски выровнены по окнам. Куски блока идут подряд, первый - с нуля.
+		const std::vector<AddressSpaceChunk> chunks = GetAddressSpaceChunks(
+			address_space, kWindowsPerChunk * kWindowSize);
+		std::vector<size_t> chunk_blocks(chunks.size());
+		for (size_t i = 0; i < chunks.size(); ++i) {
+			if (chunks[i].begin == 0) {
+				Block block;
+				block.address = chunks[i].address;
+				block.size = chunks[i].size;
+				block.histogram.fill(0);
+				block.entropy = 0.0;
+				block.printable_ratio = 0.0;
+				const size_t window_count = (block.size + kWindowSize - 1) / kWindowSize;
+				block.window_entropy.resize(window_count);
+				block.window_printable_ratio.resize(window_count);
+				blocks_.push_back(std::move(block));
+			}
+			chunk_blocks[i] = blocks_.size() - 1;
+		}
+
+		// Кусок пишет только свои окна и свою гистограмму.
+		std::vector<std::array<uint64_t, 256>> chunk_histograms(chunks.size());
+		ScanAddressSpaceChunks(chunks, [this, &chunk_blocks, &chunk_histograms](
+			size_t index, const AddressSpaceChunk& chunk) {
+			Block& block = blocks_[chunk_blocks[index]];
+			std::array<uint64_t, 256>& chunk_histogram = chunk_histograms[index];
+			std::array<uint64_t, 256> histogram;
+			chunk_histogram.fill(0);
+			for (size_t begin = chunk.begin; begin < chunk.end; begin += kWindowSize) {
+				const size_t window = begin / kWindowSize;
+				const size_t size = std::min<size_t>(kWindowSize, chunk.end - begin);
+				CountBytes(chunk.bytes + begin, size, &histogram);
+				block.window_entropy[window] =
+					static_cast<float>(GetEntropy(histogram));
+				block.window_printable_ratio[window] =
+					static_cast<float>(GetPrintableRatio(histogram));
+				for (int value = 0; value < 256; ++value) {
+					chunk_histogram[value] += histogram[value];
+				}
+			}
+		});
+
+		for (size_t i = 0; i < chunks.size(); ++i) {
+			Block& block = blocks_[chunk_blocks[i]];
+			for (int value = 0; value < 256; ++value) {
+				block.histogram[value] += chunk_histograms[i][value];
+			}
+		}
+		for (Block& block : blocks_) {
+			block.entropy = GetEntropy(block.histogram);
+			block.printable_ratio = GetPrintableRatio(block.histogram);
+		}
+	}
+
+}  // namespace security::binexport
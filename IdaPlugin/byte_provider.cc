@@ -0,0 +1,165 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/byte_provider.h"
+
+#ifdef _WIN32
+// clang-format off
+#include <windows.h>
+// clang-format on
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+std::shared_ptr<MappedFile> MappedFile::Open(const std::string& filename,
+	Mode mode) {
+	std::shared_ptr<MappedFile> result(new MappedFile());
+	result->mode_ = mode;
+	const bool copy_on_write = mode == Mode::kCopyOnWrite;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	result->file_ = file;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		return nullptr;
+	}
+	// PAGE_WRITECOPY: запись в отображение остаётся приватной для процесса, но
+	// система резервирует под него commit размером с файл.
+	HANDLE mapping = CreateFileMappingA(file, nullptr,
+		copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		return nullptr;
+	}
+	result->mapping_ = mapping;
+	void* view = MapViewOfFile(mapping,
+		copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		return nullptr;
+	}
+	result->data_ = static_cast<Byte*>(view);
+	result->size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	void* view = mmap(nullptr, file_stat.st_size,
+		copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED) {
+		return nullptr;
+	}
+	result->data_ = static_cast<Byte*>(view);
+	result->size_ = static_cast<size_t>(file_stat.st_size);
+#endif
+	return result;
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (data_) {
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_) {
+		CloseHandle(mapping_);
+	}
+	if (file_) {
+		CloseHandle(file_);
+	}
+#else
+	if (data_) {
+		munmap(data_, size_);
+	}
+#endif
+}
+
+FileRegionByteProvider::FileRegionByteProvider(std::shared_ptr<MappedFile> file,
+	size_t offset, size_t size)
+	: file_(std::move(file)), data_(file_->mutable_data() + offset), size_(size) {}
+
+const Byte* FileRegionByteProvider::Data(size_t offset, size_t length) const {
+	if (offset > size_ || length > size_ - offset) {
+		return nullptr;
+	}
+	return data_ + offset;
+}
+
+Byte* FileRegionByteProvider::MutableData(size_t offset, size_t length) {
+	if (offset > size_ || length > size_ - offset) {
+		return nullptr;
+	}
+	return data_ + offset;
+}
+
+PagedByteProvider::PagedByteProvider(size_t size, FetchCallback fetch)
+	: size_(size),
+	fetch_(std::move(fetch)),
+	// Без инициализации: ОС выделяет физические страницы только при первой записи.
+	buffer_(new Byte[size]),
+	loaded_(new std::atomic<bool>[(size + kPageSize - 1) / kPageSize]) {
+	for (size_t i = 0; i < (size_ + kPageSize - 1) / kPageSize; ++i) {
+		loaded_[i].store(false, std::memory_order_relaxed);
+	}
+}
+
+void PagedByteProvider::PageIn(size_t offset, size_t length) const {
+	if (length == 0) {
+		return;
+	}
+	const size_t first_page = offset / kPageSize;
+	const size_t last_page = (offset + length - 1) / kPageSize;
+	for (size_t page = first_page; page <= last_page; ++page) {
+		if (loaded_[page].load(std::memory_order_acquire)) {
+			continue;
+		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (loaded_[page].load(std::memory_order_relaxed)) {
+			continue;  // Загрузил другой поток.
+		}
+		const size_t page_offset = page * kPageSize;
+		fetch_(page_offset, buffer_.get() + page_offset,
+			std::min(kPageSize, size_ - page_offset));
+		loaded_[page].store(true, std::memory_order_release);
+	}
+}
+
+const Byte* PagedByteProvider::Data(size_t offset, size_t length) const {
+	if (offset > size_ || length > size_ - offset) {
+		return nullptr;
+	}
+	PageIn(offset, length);
+	return buffer_.get() + offset;
+}
+
+Byte* PagedByteProvider::MutableData(size_t offset, size_t length) {
+	if (offset > size_ || length > size_ - offset) {
+		return nullptr;
+	}
+	PageIn(offset, length);
+	return buffer_.get() + offset;
+}
@@ -0,0 +1,287 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/byte_search.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BYTE_SEARCH_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define BYTE_SEARCH_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/virtual_memory.h"
+
+namespace security::binexport {
+	namespace {
+
+		// Куски для параллельного просмотра и участки внутри куска, по которым
+		// проходят все фильтры, пока участок в кэше.
+		constexpr size_t kChunkSize = size_t{ 1 } << 20;
+		constexpr size_t kStripeSize = size_t{ 16 } << 10;
+
+/// \brief \n Грубая частота байта в коде и данных x86: чем больше, тем хуже\n
+/// байт подходит для фильтра.
+		int GetByteWeight(Byte byte) {
+			switch (byte) {
+			case 0x00:
+				return 8;
+			case 0xFF:
+				return 6;
+			case 0xCC:
+			case 0x90:
+				return 5;
+			case 0x48: case 0x8B: case 0x89: case 0x24: case 0x4C: case 0x44:
+			case 0x0F: case 0x85: case 0xC0: case 0xE8: case 0x83: case 0x01:
+			case 0x20: case 0x45: case 0x8D: case 0x74: case 0x08: case 0x10:
+			case 0x40: case 0xC3: case 0x33: case 0xEB: case 0x75: case 0x41:
+			case 0x49: case 0x4D: case 0x02: case 0x04: case 0xC7: case 0x28:
+				return 3;
+			default:
+				return 1;
+			}
+		}
+
+		int GetHexDigit(char c) {
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		}
+
+		bool Matches(const BytePatternSearch::Pattern& pattern, const Byte* bytes) {
+			const size_t size = pattern.bytes.size();
+			const Byte* expected = reinterpret_cast<const Byte*>(pattern.bytes.data());
+			const Byte* mask = reinterpret_cast<const Byte*>(pattern.mask.data());
+			size_t i = 0;
+#ifdef BYTE_SEARCH_SSE2
+			for (; i + 16 <= size; i += 16) {
+				const __m128i difference = _mm_and_si128(
+					_mm_xor_si128(
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i)),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(expected + i))),
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i)));
+				if (_mm_movemask_epi8(
+					_mm_cmpeq_epi8(difference, _mm_setzero_si128())) != 0xFFFF) {
+					return false;
+				}
+			}
+#endif
+			for (; i < size; ++i) {
+				if ((bytes[i] ^ expected[i]) & mask[i]) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+	}  // namespace
+
+	absl::StatusOr<BytePatternSearch::Pattern> BytePatternSearch::ParsePattern(
+		absl::string_view text) {
+		Pattern pattern;
+		for (size_t i = 0; i < text.size();) {
+			const char c = text[i];
+			if (c == ' ' || c == '\t') {
+				++i;
+				continue;
+			}
+			if (c == '?') {
+				i += i + 1 < text.size() && text[i + 1] == '?' ? 2 : 1;
+				pattern.bytes.push_back('\0');
+				pattern.mask.push_back('\0');
+				continue;
+			}
+			if ((c == 'x' || c == 'X') && i + 1 < text.size() &&
+				(text[i + 1] == 'x' || text[i + 1] == 'X')) {
+				i += 2;
+				pattern.bytes.push_back('\0');
+				pattern.mask.push_back('\0');
+				continue;
+			}
+			const int high = GetHexDigit(c);
+			const int low = i + 1 < text.size() ? GetHexDigit(text[i + 1]) : -1;
+			if (high < 0 || low < 0) {
+				return absl::InvalidArgumentError(
+					absl::StrCat("bad byte at position ", i, " in \"", text, "\""));
+			}
+			i += 2;
+			pattern.bytes.push_back(static_cast<char>(high << 4 | low));
+			pattern.mask.push_back('\xFF');
+		}
+		if (pattern.bytes.empty() || pattern.bytes.size() > kMaxPatternSize) {
+			return absl::InvalidArgumentError(absl::StrCat(
+				"pattern must have 1 to ", kMaxPatternSize, " bytes: \"", text, "\""));
+		}
+		return pattern;
+	}
+
+	absl::Status BytePatternSearch::AddPattern(Pattern pattern) {
+		if (pattern.bytes.empty() || pattern.bytes.size() > kMaxPatternSize ||
+			pattern.mask.size() != pattern.bytes.size()) {
+			return absl::InvalidArgumentError("bad pattern size");
+		}
+		// Два самых редких байта без маски, при равенстве - первые.
+		constexpr size_t kNone = ~size_t{ 0 };
+		size_t first = kNone;
+		size_t second = kNone;
+		const auto weight = [&pattern](size_t i) {
+			return GetByteWeight(static_cast<Byte>(pattern.bytes[i]));
+		};
+		for (size_t i = 0; i < pattern.bytes.size(); ++i) {
+			if (pattern.mask[i] == '\0') {
+				continue;
+			}
+			if (first == kNone || weight(i) < weight(first)) {
+				second = first;
+				first = i;
+			}
+			else if (second == kNone || weight(i) < weight(second)) {
+				second = i;
+			}
+		}
+		if (first == kNone) {
+			return absl::InvalidArgumentError("pattern has only wildcards");
+		}
+		if (second == kNone) {
+			second = first;
+		}
+		if (second < first) {
+			std::swap(first, second);
+		}
+
+		const uint32_t index = static_cast<uint32_t>(patterns_.size());
+		const Byte first_byte = static_cast<Byte>(pattern.bytes[first]);
+		const Byte second_byte = static_cast<Byte>(pattern.bytes[second]);
+		const uint32_t distance = static_cast<uint32_t>(second - first);
+		patterns_.push_back(std::move(pattern));
+		for (Filter& filter : filters_) {
+			if (filter.first == first_byte && filter.second == second_byte &&
+				filter.distance == distance) {
+				filter.patterns.emplace_back(index, static_cast<uint32_t>(first));
+				return absl::OkStatus();
+			}
+		}
+		filters_.push_back({ first_byte, second_byte, distance,
+			{ { index, static_cast<uint32_t>(first) } } });
+		return absl::OkStatus();
+	}
+
+	void BytePatternSearch::Scan(const Filter& filter, const Byte* bytes,
+		size_t size, size_t begin, size_t end, Address address,
+		std::vector<Hit>* hits) const {
+		if (size <= filter.distance) {
+			return;
+		}
+		// Позиции первого байта фильтра, второй байт должен быть в блоке.
+		end = std::min(end, size - filter.distance);
+		const auto check = [&](size_t position) {
+			for (const auto& entry : filter.patterns) {
+				const Pattern& pattern = patterns_[entry.first];
+				if (position < entry.second) {
+					continue;
+				}
+				const size_t start = position - entry.second;
+				if (start + pattern.bytes.size() <= size &&
+					Matches(pattern, bytes + start)) {
+					hits->push_back({ address + start, entry.first });
+				}
+			}
+		};
+
+		size_t position = begin;
+#if defined(BYTE_SEARCH_AVX2)
+		const __m256i first_wide = _mm256_set1_epi8(static_cast<char>(filter.first));
+		const __m256i second_wide =
+			_mm256_set1_epi8(static_cast<char>(filter.second));
+		for (; position + 32 <= end; position += 32) {
+			const __m256i lhs = _mm256_cmpeq_epi8(first_wide, _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(bytes + position)));
+			const __m256i rhs = _mm256_cmpeq_epi8(second_wide, _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(bytes + position + filter.distance)));
+			uint32_t candidates =
+				static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(lhs, rhs)));
+			for (size_t bit = 0; candidates != 0; ++bit, candidates >>= 1) {
+				if (candidates & 1) {
+					check(position + bit);
+				}
+			}
+		}
+#endif
+#if defined(BYTE_SEARCH_SSE2)
+		const __m128i first_narrow = _mm_set1_epi8(static_cast<char>(filter.first));
+		const __m128i second_narrow = _mm_set1_epi8(static_cast<char>(filter.second));
+		for (; position + 16 <= end; position += 16) {
+			const __m128i lhs = _mm_cmpeq_epi8(first_narrow, _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(bytes + position)));
+			const __m128i rhs = _mm_cmpeq_epi8(second_narrow, _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(bytes + position + filter.distance)));
+			uint32_t candidates =
+				static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(lhs, rhs)));
+			for (size_t bit = 0; candidates != 0; ++bit, candidates >>= 1) {
+				if (candidates & 1) {
+					check(position + bit);
+				}
+			}
+		}
+#endif
+		for (; position < end; ++position) {
+			if (bytes[position] == filter.first &&
+				bytes[position + filter.distance] == filter.second) {
+				check(position);
+			}
+		}
+	}
+
+	std::vector<BytePatternSearch::Hit> BytePatternSearch::Find(
+		const AddressSpace& address_space) const {
+		if (filters_.empty()) {
+			return {};
+		}
+		const std::vector<AddressSpaceChunk> chunks =
+			GetAddressSpaceChunks(address_space, kChunkSize);
+
+		// Кусок отвечает за позиции первого байта фильтра в [begin, end), поэтому
+		// каждое вхождение находится ровно одним куском.
+		std::vector<std::vector<Hit>> chunk_hits(chunks.size());
+		ScanAddressSpaceChunks(chunks,
+			[this, &chunk_hits](size_t index, const AddressSpaceChunk& chunk) {
+			for (size_t stripe = chunk.begin; stripe < chunk.end;
+				stripe += kStripeSize) {
+				const size_t stripe_end = std::min(chunk.end, stripe + kStripeSize);
+				for (const Filter& filter : filters_) {
+					Scan(filter, chunk.bytes, chunk.size, stripe, stripe_end,
+						chunk.address, &chunk_hits[index]);
+				}
+			}
+		});
+
+		std::vector<Hit> hits;
+		for (const auto& part : chunk_hits) {
+			hits.insert(hits.end(), part.begin(), part.end());
+		}
+		std::sort(hits.begin(), hits.end(), [](const Hit& lhs, const Hit& rhs) {
+			return lhs.address != rhs.address ? lhs.address < rhs.address
+				: lhs.pattern < rhs.pattern;
+		});
+		return hits;
+	}
+
+}  // namespace security::binexport
@@ -21,7 +21,6 @@
 
 
 #include "debug_log.h"
-#include "third_party/zynamics/binexport/hash.h"
 #include "third_party/zynamics/binexport/flow_graph.h"
 
 
@@ -36,7 +35,7 @@ namespace {
 
 }  // namespace
 
-CallGraph::StringCache CallGraph::string_cache_;
+CommentStringPool CallGraph::string_cache_;
 int CallGraph::instance_count_ = 0;
 
 // Attention: do _not_ use source_basic_block_id for sorting!
@@ -194,6 +193,11 @@ void CallGraph::RenderAdditional(std::ostream* stream,
 				<< (library.IsStatic() ? "static" : "dynamic")
 				<< " library " << ln << library.name;
 		}
+		// теги криптографических констант, см. ReportCryptoConstants()
+		const auto crypto = exporter.crypto_tags.find(function_address);
+		if (crypto != exporter.crypto_tags.end()) {
+			*stream << "  crypto: " << crypto->second;
+		}
 		// Предпочтите "\n" вместо endl при вызове в цикле, так как std::endl каждый раз сбрасывает поток.
 		*stream << "\n";
 		// далее добавляем полученные данные в наши мапы ... №№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№№
@@ -241,12 +245,12 @@ CallGraph::CallGraph() { ++instance_count_; }
 CallGraph::~CallGraph() {
 	--instance_count_;
 	if (instance_count_ == 0) {
-		StringCache{}.swap(string_cache_);
+		string_cache_.Clear();
 	}
 }
 
-const std::string* CallGraph::CacheString(const std::string& text) {
-	return &*string_cache_.insert(text).first;
+const std::string* CallGraph::CacheString(absl::string_view text) {
+	return string_cache_.Insert(text);
 }
 
 void CallGraph::AddFunction(Address address) { functions_.insert(address); }
@@ -353,23 +357,6 @@ void CallGraph::AddComment(Address address, size_t operand,
 		Comment(address, operand, CacheString(comment), type, repeatable));
 }
 
-size_t CallGraph::GetStringReference(Address address) const {
-	auto it = string_references_.find(address);
-	if (it != string_references_.end()) {
-		return it->second;
-	}
-	return 0;
-}
-
-void CallGraph::AddStringReference(Address address, const std::string& ref) {
-	if (ref.empty()) {
-		return;
-	}
-
-	// TODO(jduart): Concat multiple hashes.
-	string_references_[address] = GetSdbmHash(ref);
-}
-
 // Fold the strings of all comments that are of type regular and share the same
 // address, since the database schema doesn't allow more than one comment per
 // address.
@@ -377,7 +364,30 @@ void CallGraph::AddStringReference(Address address, const std::string& ref) {
 /// \brief \n Сложите строки всех комментариев типа regular, имеющих один и тот же адрес,\n
 /// поскольку схема базы данных не допускает более одного комментария на один адрес.
 void CallGraph::PostProcessComments() {
-	std::stable_sort(comments_.begin(), comments_.end(), &SortComments);
+	// Границы возрастающих отрезков. Попарное слияние соседних отрезков
+	// устойчиво, поэтому порядок равных комментариев тот же, что у stable_sort.
+	std::vector<size_t> runs;
+	runs.push_back(0);
+	for (size_t i = 1; i < comments_.size(); ++i) {
+		if (SortComments(comments_[i], comments_[i - 1])) {
+			runs.push_back(i);
+		}
+	}
+	runs.push_back(comments_.size());
+	while (runs.size() > 2) {
+		size_t merged = 1;
+		for (size_t i = 0; i + 2 < runs.size(); i += 2) {
+			std::inplace_merge(comments_.begin() + runs[i],
+				comments_.begin() + runs[i + 1], comments_.begin() + runs[i + 2],
+				&SortComments);
+			runs[merged++] = runs[i + 2];
+		}
+		if (runs.size() % 2 == 0) {
+			// Нечётное число отрезков: последний переходит на следующий проход.
+			runs[merged++] = runs.back();
+		}
+		runs.resize(merged);
+	}
 	FoldComments();
 }
 
@@ -398,19 +408,21 @@ void CallGraph::FoldComments() {
 	Comments::iterator first = comments_.begin();
 	const Comments::iterator last = comments_.end();
 	Comments::iterator result = first;
+	std::vector<const std::string*> parts;
 	while (++first != last) {
 		if (!AreDuplicateRegularComments(*result, *first)) {
 			*(++result) = *first;
 		}
 		else {
-			std::string accumulated_comment(*result->comment_);
+			// Текст склеивается сразу в пуле строк.
+			parts.clear();
+			parts.push_back(result->comment_);
 			while (first != last && AreDuplicateRegularComments(*result, *first)) {
-				accumulated_comment.append("\n");
-				accumulated_comment.append(*first->comment_);
+				parts.push_back(first->comment_);
 				++first;
 			}
 			--first;
-			result->comment_ = CacheString(accumulated_comment);
+			result->comment_ = string_cache_.InsertJoined(parts, '\n');
 		}
 	}
 	comments_.erase(++result, comments_.end());
@@ -0,0 +1,381 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/call_graph_index.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "third_party/absl/container/flat_hash_set.h"
+#include "third_party/zynamics/binexport/call_graph.h"
+#include "third_party/zynamics/binexport/function.h"
+
+namespace security::binexport {
+	namespace {
+
+/// \brief \n Списки соседей в формате CSR из отсортированных пар без повторов.
+		void BuildAdjacency(const std::vector<std::pair<uint32_t, uint32_t>>& pairs,
+			size_t count, std::vector<uint32_t>* offsets,
+			std::vector<uint32_t>* neighbours) {
+			offsets->assign(count + 1, 0);
+			for (const auto& pair : pairs) {
+				++(*offsets)[pair.first + 1];
+			}
+			std::partial_sum(offsets->begin(), offsets->end(), offsets->begin());
+			neighbours->resize(pairs.size());
+			for (size_t i = 0; i < pairs.size(); ++i) {
+				(*neighbours)[i] = pairs[i].second;
+			}
+		}
+
+		absl::Span<const uint32_t> GetNeighbours(const std::vector<uint32_t>& offsets,
+			const std::vector<uint32_t>& neighbours, uint32_t node) {
+			return absl::MakeConstSpan(neighbours.data() + offsets[node],
+				offsets[node + 1] - offsets[node]);
+		}
+
+		void SortUnique(std::vector<std::pair<uint32_t, uint32_t>>* pairs) {
+			std::sort(pairs->begin(), pairs->end());
+			pairs->erase(std::unique(pairs->begin(), pairs->end()), pairs->end());
+		}
+
+	}  // namespace
+
+	CallGraphIndex::CallGraphIndex(const CallGraph& call_graph) {
+		std::vector<Address> functions(call_graph.GetFunctions().begin(),
+			call_graph.GetFunctions().end());
+		std::vector<std::pair<Address, Address>> calls;
+		calls.reserve(call_graph.GetEdges().size());
+		for (const EdgeInfo& edge : call_graph.GetEdges()) {
+			if (edge.function_ != nullptr) {
+				calls.emplace_back(edge.function_->GetEntryPoint(), edge.target_);
+			}
+		}
+		Build(std::move(functions), std::move(calls));
+	}
+
+	CallGraphIndex::CallGraphIndex(std::vector<Address> functions,
+		std::vector<std::pair<Address, Address>> calls) {
+		Build(std::move(functions), std::move(calls));
+	}
+
+	void CallGraphIndex::Build(std::vector<Address> functions,
+		std::vector<std::pair<Address, Address>> calls) {
+		addresses_ = std::move(functions);
+		addresses_.reserve(addresses_.size() + 2 * calls.size());
+		for (const auto& call : calls) {
+			addresses_.push_back(call.first);
+			addresses_.push_back(call.second);
+		}
+		std::sort(addresses_.begin(), addresses_.end());
+		addresses_.erase(std::unique(addresses_.begin(), addresses_.end()),
+			addresses_.end());
+		addresses_.shrink_to_fit();
+
+		std::vector<std::pair<uint32_t, uint32_t>> index_calls;
+		index_calls.reserve(calls.size());
+		for (const auto& call : calls) {
+			index_calls.emplace_back(GetFunction(call.first), GetFunction(call.second));
+		}
+		std::vector<std::pair<Address, Address>>().swap(calls);
+		SortUnique(&index_calls);
+		BuildAdjacency(index_calls, addresses_.size(), &callee_offsets_, &callees_);
+
+		BuildComponents();
+		BuildComponentGraph();
+		BuildLabels();
+	}
+
+	uint32_t CallGraphIndex::GetFunction(Address address) const {
+		const auto it =
+			std::lower_bound(addresses_.begin(), addresses_.end(), address);
+		return it != addresses_.end() && *it == address
+			? static_cast<uint32_t>(it - addresses_.begin())
+			: kNone;
+	}
+
+	absl::Span<const uint32_t> CallGraphIndex::GetCallees(uint32_t function) const {
+		return GetNeighbours(callee_offsets_, callees_, function);
+	}
+
+	absl::Span<const uint32_t> CallGraphIndex::GetComponentFunctions(
+		uint32_t component) const {
+		return GetNeighbours(component_function_offsets_, component_functions_,
+			component);
+	}
+
+	absl::Span<const uint32_t> CallGraphIndex::GetComponentCallees(
+		uint32_t component) const {
+		return GetNeighbours(component_callee_offsets_, component_callees_,
+			component);
+	}
+
+	absl::Span<const uint32_t> CallGraphIndex::GetComponentCallers(
+		uint32_t component) const {
+		return GetNeighbours(component_caller_offsets_, component_callers_,
+			component);
+	}
+
+/// \brief \n Компоненты сильной связности по Тарьяну. Рекурсия заменена явным\n
+/// стеком вызовов, компонента получает номер при завершении обхода её корня,\n
+/// поэтому номера идут в обратном топологическом порядке.
+	void CallGraphIndex::BuildComponents() {
+		const uint32_t count = static_cast<uint32_t>(addresses_.size());
+		components_.assign(count, kNone);
+		std::vector<uint32_t> order(count, kNone);
+		std::vector<uint32_t> low(count, 0);
+		std::vector<uint32_t> stack;  // Стек Тарьяна.
+		std::vector<std::pair<uint32_t, uint32_t>> frames;  // Функция, следующий вызов.
+		uint32_t counter = 0;
+		uint32_t component_count = 0;
+		for (uint32_t root = 0; root < count; ++root) {
+			if (order[root] != kNone) {
+				continue;
+			}
+			order[root] = low[root] = counter++;
+			stack.push_back(root);
+			frames.emplace_back(root, callee_offsets_[root]);
+			while (!frames.empty()) {
+				const uint32_t function = frames.back().first;
+				if (frames.back().second < callee_offsets_[function + 1]) {
+					const uint32_t callee = callees_[frames.back().second++];
+					if (order[callee] == kNone) {
+						order[callee] = low[callee] = counter++;
+						stack.push_back(callee);
+						frames.emplace_back(callee, callee_offsets_[callee]);
+					}
+					else if (components_[callee] == kNone) {
+						// Ещё на стеке Тарьяна.
+						low[function] = std::min(low[function], order[callee]);
+					}
+					continue;
+				}
+				frames.pop_back();
+				if (low[function] == order[function]) {
+					uint32_t member;
+					do {
+						member = stack.back();
+						stack.pop_back();
+						components_[member] = component_count;
+					} while (member != function);
+					++component_count;
+				}
+				if (!frames.empty()) {
+					const uint32_t caller = frames.back().first;
+					low[caller] = std::min(low[caller], low[function]);
+				}
+			}
+		}
+
+		std::vector<std::pair<uint32_t, uint32_t>> members;
+		members.reserve(count);
+		for (uint32_t function = 0; function < count; ++function) {
+			members.emplace_back(components_[function], function);
+		}
+		std::sort(members.begin(), members.end());
+		BuildAdjacency(members, component_count, &component_function_offsets_,
+			&component_functions_);
+	}
+
+	void CallGraphIndex::BuildComponentGraph() {
+		const uint32_t component_count =
+			static_cast<uint32_t>(component_function_offsets_.size() - 1);
+		recursive_.assign(component_count, false);
+		std::vector<std::pair<uint32_t, uint32_t>> component_calls;
+		for (uint32_t function = 0; function < addresses_.size(); ++function) {
+			const uint32_t component = components_[function];
+			for (const uint32_t callee : GetCallees(function)) {
+				if (components_[callee] != component) {
+					component_calls.emplace_back(component, components_[callee]);
+				}
+				else if (callee == function) {
+					recursive_[component] = true;
+				}
+			}
+			if (component_function_offsets_[component + 1] -
+				component_function_offsets_[component] > 1) {
+				recursive_[component] = true;
+			}
+		}
+		SortUnique(&component_calls);
+		BuildAdjacency(component_calls, component_count,
+			&component_callee_offsets_, &component_callees_);
+		for (auto& call : component_calls) {
+			std::swap(call.first, call.second);
+		}
+		std::sort(component_calls.begin(), component_calls.end());
+		BuildAdjacency(component_calls, component_count,
+			&component_caller_offsets_, &component_callers_);
+	}
+
+/// \brief \n Метки GRAIL: обход в глубину от компонент без вызывающих, rank -\n
+/// номер в постпорядке, low - наименьший rank среди достижимых. Если a\n
+/// достигает b, то [low, rank] b вложен в [low, rank] a. Второй обход идёт\n
+/// в обратном порядке корней и потомков. Первый обход также задаёт остовный лес.
+	void CallGraphIndex::BuildLabels() {
+		const uint32_t component_count =
+			static_cast<uint32_t>(recursive_.size());
+		tree_enter_.assign(component_count, 0);
+		tree_leave_.assign(component_count, 0);
+		std::vector<uint32_t> roots;
+		for (uint32_t component = 0; component < component_count; ++component) {
+			if (GetComponentCallers(component).empty()) {
+				roots.push_back(component);
+			}
+		}
+
+		std::vector<bool> visited;
+		std::vector<std::pair<uint32_t, uint32_t>> stack;  // Компонента, следующий потомок.
+		for (int traversal = 0; traversal < 2; ++traversal) {
+			auto& labels = labels_[traversal];
+			labels.assign(component_count, Label{ 0, 0 });
+			visited.assign(component_count, false);
+			const bool reverse = traversal == 1;
+			uint32_t rank = 0;
+			uint32_t clock = 0;
+			for (size_t i = 0; i < roots.size(); ++i) {
+				const uint32_t root = roots[reverse ? roots.size() - 1 - i : i];
+				visited[root] = true;
+				labels[root].low = kNone;
+				if (!reverse) {
+					tree_enter_[root] = clock++;
+				}
+				stack.emplace_back(root, 0);
+				while (!stack.empty()) {
+					const uint32_t component = stack.back().first;
+					const auto callees = GetComponentCallees(component);
+					if (stack.back().second < callees.size()) {
+						const size_t position = stack.back().second++;
+						const uint32_t callee =
+							callees[reverse ? callees.size() - 1 - position : position];
+						if (!visited[callee]) {
+							visited[callee] = true;
+							labels[callee].low = kNone;
+							if (!reverse) {
+								tree_enter_[callee] = clock++;
+							}
+							stack.emplace_back(callee, 0);
+						}
+						else {
+							// Граф ациклический, посещённая компонента уже завершена.
+							labels[component].low =
+								std::min(labels[component].low, labels[callee].low);
+						}
+						continue;
+					}
+					labels[component].rank = rank++;
+					labels[component].low =
+						std::min(labels[component].low, labels[component].rank);
+					if (!reverse) {
+						tree_leave_[component] = clock++;
+					}
+					stack.pop_back();
+					if (!stack.empty()) {
+						const uint32_t caller = stack.back().first;
+						labels[caller].low =
+							std::min(labels[caller].low, labels[component].low);
+					}
+				}
+			}
+		}
+	}
+
+	bool CallGraphIndex::ComponentCanReach(uint32_t from, uint32_t to) const {
+		const auto in_tree = [this](uint32_t ancestor, uint32_t node) {
+			return tree_enter_[ancestor] <= tree_enter_[node] &&
+				tree_leave_[node] <= tree_leave_[ancestor];
+		};
+		const auto may_reach = [this](uint32_t source, uint32_t target) {
+			for (const auto& labels : labels_) {
+				if (labels[source].low > labels[target].low ||
+					labels[target].rank > labels[source].rank) {
+					return false;
+				}
+			}
+			return true;
+		};
+		// Вызываемые компоненты имеют меньшие номера.
+		if (from < to || !may_reach(from, to)) {
+			return false;
+		}
+		if (in_tree(from, to)) {
+			return true;
+		}
+		absl::flat_hash_set<uint32_t> visited;
+		std::vector<uint32_t> stack = { from };
+		while (!stack.empty()) {
+			const uint32_t component = stack.back();
+			stack.pop_back();
+			for (const uint32_t callee : GetComponentCallees(component)) {
+				if (callee == to || in_tree(callee, to)) {
+					return true;
+				}
+				if (callee > to && may_reach(callee, to) &&
+					visited.insert(callee).second) {
+					stack.push_back(callee);
+				}
+			}
+		}
+		return false;
+	}
+
+	bool CallGraphIndex::CanReach(uint32_t from, uint32_t to) const {
+		const uint32_t from_component = components_[from];
+		const uint32_t to_component = components_[to];
+		if (from_component == to_component) {
+			return from != to || recursive_[from_component];
+		}
+		return ComponentCanReach(from_component, to_component);
+	}
+
+	std::vector<uint32_t> CallGraphIndex::CollectReachable(
+		uint32_t function, const std::vector<uint32_t>& offsets,
+		const std::vector<uint32_t>& neighbours) const {
+		const uint32_t start = components_[function];
+		std::vector<uint32_t> result;
+		if (recursive_[start]) {
+			const auto members = GetComponentFunctions(start);
+			result.assign(members.begin(), members.end());
+		}
+		absl::flat_hash_set<uint32_t> visited = { start };
+		std::vector<uint32_t> stack = { start };
+		while (!stack.empty()) {
+			const uint32_t component = stack.back();
+			stack.pop_back();
+			for (const uint32_t next : GetNeighbours(offsets, neighbours, component)) {
+				if (visited.insert(next).second) {
+					const auto members = GetComponentFunctions(next);
+					result.insert(result.end(), members.begin(), members.end());
+					stack.push_back(next);
+				}
+			}
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	std::vector<uint32_t> CallGraphIndex::GetTransitiveCallees(
+		uint32_t function) const {
+		return CollectReachable(function, component_callee_offsets_,
+			component_callees_);
+	}
+
+	std::vector<uint32_t> CallGraphIndex::GetTransitiveCallers(
+		uint32_t function) const {
+		return CollectReachable(function, component_caller_offsets_,
+			component_callers_);
+	}
+
+}  // namespace security::binexport
@@ -0,0 +1,50 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/chain_writer.h"
+
+#include "base/logging.h"
+
+namespace security::binexport {
+
+	absl::Status ChainWriter::Write(const CallGraph& call_graph,
+		const FlowGraph& flow_graph,
+		const Instructions& instructions,
+		const AddressReferences& address_references,
+		const TypeSystem* type_system,
+		const AddressSpace& address_space) {
+		// Ошибка одного writer-а не отменяет остальные.
+		bool success = true;
+		for (auto& writer : writers_) {
+			const absl::Status status =
+				writer->Write(call_graph, flow_graph, instructions, address_references,
+					type_system, address_space);
+			if (!status.ok()) {
+				LOG(INFO) << "Writer failed: " << status.message();
+				success = false;
+			}
+		}
+		if (!success) {
+			return absl::UnknownError("at least one of the writers in the chain failed");
+		}
+		return absl::OkStatus();
+	}
+
+	void ChainWriter::Add(std::shared_ptr<Writer> writer) {
+		writers_.push_back(std::move(writer));
+	}
+
+	bool ChainWriter::IsEmpty() const { return writers_.empty(); }
+
+}  // namespace security::binexport
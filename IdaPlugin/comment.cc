@@ -42,3 +42,42 @@ Comment::Comment(Address address, size_t operand_num,
 			"...");
 	}
 }
+
+const std::string* CommentStringPool::Insert(absl::string_view text) {
+	const auto it = index_.find(text);
+	if (it != index_.end()) {
+		return it->second;
+	}
+	strings_.emplace_back(text.data(), text.size());
+	const std::string* result = &strings_.back();
+	index_.emplace(absl::string_view(*result), result);
+	return result;
+}
+
+const std::string* CommentStringPool::InsertJoined(
+	absl::Span<const std::string* const> parts, char separator) {
+	size_t size = parts.empty() ? 0 : parts.size() - 1;
+	for (const std::string* part : parts) {
+		size += part->size();
+	}
+	strings_.emplace_back();
+	std::string& joined = strings_.back();
+	joined.reserve(size);
+	for (size_t i = 0; i < parts.size(); ++i) {
+		if (i > 0) {
+			joined.push_back(separator);
+		}
+		joined.append(*parts[i]);
+	}
+	const auto inserted = index_.emplace(absl::string_view(joined), &joined);
+	if (!inserted.second) {
+		// Такой текст уже есть: новая строка последняя в пуле и снимается.
+		strings_.pop_back();
+	}
+	return inserted.first->second;
+}
+
+void CommentStringPool::Clear() {
+	index_.clear();
+	std::deque<std::string>().swap(strings_);
+}
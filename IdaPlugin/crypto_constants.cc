@@ -0,0 +1,255 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/crypto_constants.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "third_party/zynamics/binexport/basic_block.h"
+#include "third_party/zynamics/binexport/flow_graph.h"
+#include "third_party/zynamics/binexport/function.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
+
+namespace security::binexport {
+	namespace {
+
+		// Таблицы хранятся в памяти в порядке little endian; берутся начала
+		// таблиц, их достаточно, чтобы не путать таблицы с другими данными.
+		constexpr uint8_t kAesSbox[] = {
+			0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5,
+			0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+			0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0,
+			0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0 };
+		constexpr uint8_t kAesInverseSbox[] = {
+			0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38,
+			0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
+			0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87,
+			0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB };
+		constexpr uint32_t kAesTe0[] = {
+			0xC66363A5, 0xF87C7C84, 0xEE777799, 0xF67B7B8D };
+		constexpr uint32_t kAesTd0[] = {
+			0x51F4A750, 0x7E416553, 0x1A17A4C3, 0x3A275E96 };
+		constexpr uint32_t kAesRcon[] = {
+			0x01000000, 0x02000000, 0x04000000, 0x08000000,
+			0x10000000, 0x20000000, 0x40000000, 0x80000000 };
+		// DES S1 по одному значению на байт.
+		constexpr uint8_t kDesSbox1[] = {
+			14, 4, 13, 1, 2, 15, 11, 8, 3, 10, 6, 12, 5, 9, 0, 7,
+			0, 15, 7, 4, 14, 2, 13, 1, 10, 6, 12, 11, 9, 5, 3, 8 };
+		constexpr uint32_t kMd5Init[] = {
+			0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+		constexpr uint32_t kMd5Sine[] = {
+			0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE };
+		constexpr uint32_t kSha1Init[] = {
+			0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+		constexpr uint32_t kSha256Init[] = {
+			0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A };
+		constexpr uint32_t kSha224Init[] = {
+			0xC1059ED8, 0x367CD507, 0x3070DD17, 0xF70E5939 };
+		constexpr uint32_t kSha256Rounds[] = {
+			0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5 };
+		constexpr uint64_t kSha512Init[] = {
+			0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL };
+		constexpr uint64_t kSha512Rounds[] = {
+			0x428A2F98D728AE22ULL, 0x7137449123EF65CDULL };
+		constexpr uint32_t kCrc32Table[] = {
+			0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA };
+		constexpr uint32_t kCrc32cTable[] = {
+			0x00000000, 0xF26B8303, 0xE13B70F7, 0x1350F3F4 };
+		constexpr uint32_t kBlowfishP[] = {
+			0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344 };
+		constexpr char kChaChaSigma[] = "expand 32-byte k";
+
+		// Значения непосредственных операндов.
+		struct Immediate {
+			uint32_t value;
+			const char* tag;
+		};
+		constexpr Immediate kImmediates[] = {
+			{ 0x67452301, "md5-sha1-init" },
+			{ 0xEFCDAB89, "md5-sha1-init" },
+			{ 0x98BADCFE, "md5-sha1-init" },
+			{ 0x10325476, "md5-sha1-init" },
+			{ 0xC3D2E1F0, "sha1-init" },
+			{ 0x5A827999, "sha1-rounds" },
+			{ 0x6ED9EBA1, "sha1-rounds" },
+			{ 0x8F1BBCDC, "sha1-rounds" },
+			{ 0xCA62C1D6, "sha1-rounds" },
+			{ 0xD76AA478, "md5-sine" },
+			{ 0xE8C7B756, "md5-sine" },
+			{ 0x6A09E667, "sha2-init" },
+			{ 0xBB67AE85, "sha2-init" },
+			{ 0xC1059ED8, "sha224-init" },
+			{ 0x428A2F98, "sha2-rounds" },
+			{ 0x71374491, "sha2-rounds" },
+			{ 0xEDB88320, "crc32-poly" },
+			{ 0x04C11DB7, "crc32-poly" },
+			{ 0x82F63B78, "crc32c-poly" },
+			{ 0x9E3779B9, "tea-delta" },
+			{ 0x61C88647, "tea-delta" },
+			{ 0x61707865, "chacha-sigma" },
+			{ 0x3320646E, "chacha-sigma" },
+			{ 0x243F6A88, "blowfish-p" },
+		};
+
+		template <typename T, size_t N>
+		std::string GetBytes(const T (&values)[N]) {
+			std::string bytes;
+			bytes.reserve(sizeof(values));
+			for (const T value : values) {
+				for (size_t i = 0; i < sizeof(T); ++i) {
+					bytes.push_back(static_cast<char>(
+						static_cast<uint64_t>(value) >> (i * 8) & 0xFF));
+				}
+			}
+			return bytes;
+		}
+
+	}  // namespace
+
+	const CryptoConstants& CryptoConstants::Get() {
+		static const CryptoConstants* constants = new CryptoConstants();
+		return *constants;
+	}
+
+	CryptoConstants::CryptoConstants() {
+		const auto add_tag = [this](const char* tag) {
+			for (uint32_t i = 0; i < tags_.size(); ++i) {
+				if (std::strcmp(tags_[i], tag) == 0) {
+					return i;
+				}
+			}
+			tags_.push_back(tag);
+			return static_cast<uint32_t>(tags_.size() - 1);
+		};
+		const auto add_table = [this, &add_tag](const char* tag,
+			const std::string& bytes) {
+			auto status = tables_.AddPattern({ bytes, std::string(bytes.size(), '\xFF') });
+			if (status.ok()) {
+				table_tags_.push_back(add_tag(tag));
+				table_sizes_.push_back(bytes.size());
+			}
+		};
+		add_table("aes-sbox", GetBytes(kAesSbox));
+		add_table("aes-inv-sbox", GetBytes(kAesInverseSbox));
+		add_table("aes-te", GetBytes(kAesTe0));
+		add_table("aes-td", GetBytes(kAesTd0));
+		add_table("aes-rcon", GetBytes(kAesRcon));
+		add_table("des-sbox", GetBytes(kDesSbox1));
+		// Начальные значения MD5 - первые 4 слова SHA-1, см. FindInMemory().
+		add_table("md5-init", GetBytes(kMd5Init));
+		add_table("md5-sine", GetBytes(kMd5Sine));
+		add_table("sha1-init", GetBytes(kSha1Init));
+		add_table("sha256-init", GetBytes(kSha256Init));
+		add_table("sha224-init", GetBytes(kSha224Init));
+		add_table("sha2-rounds", GetBytes(kSha256Rounds));
+		add_table("sha512-init", GetBytes(kSha512Init));
+		add_table("sha512-rounds", GetBytes(kSha512Rounds));
+		add_table("crc32-table", GetBytes(kCrc32Table));
+		add_table("crc32c-table", GetBytes(kCrc32cTable));
+		add_table("blowfish-p", GetBytes(kBlowfishP));
+		add_table("chacha-sigma",
+			std::string(kChaChaSigma, sizeof(kChaChaSigma) - 1));
+
+		for (const Immediate& immediate : kImmediates) {
+			immediates_.emplace_back(immediate.value, add_tag(immediate.tag));
+		}
+		std::sort(immediates_.begin(), immediates_.end());
+	}
+
+	std::vector<CryptoConstants::Hit> CryptoConstants::FindInMemory(
+		const AddressSpace& address_space) const {
+		// Образцы без масок, поэтому таблица, совпавшая по тому же адресу с более
+		// длинной, - её начало и отдельно не отмечается (MD5 внутри SHA-1).
+		const auto found = tables_.Find(address_space);
+		std::vector<Hit> hits;
+		for (size_t i = 0, end = 0; i < found.size(); i = end) {
+			size_t longest = 0;
+			for (end = i; end < found.size() && found[end].address == found[i].address;
+				++end) {
+				longest = std::max(longest, table_sizes_[found[end].pattern]);
+			}
+			for (size_t j = i; j < end; ++j) {
+				if (table_sizes_[found[j].pattern] == longest) {
+					hits.push_back({ found[j].address, table_tags_[found[j].pattern], 0 });
+				}
+			}
+		}
+		return hits;
+	}
+
+	uint32_t CryptoConstants::FindImmediate(uint64_t value) const {
+		// Только 32-битные значения и их знаковое расширение (imm32 в 64-битной
+		// инструкции): у произвольной 64-битной константы младшие биты не
+		// сравниваются.
+		if ((value >> 32) != 0 &&
+			static_cast<int64_t>(value) != static_cast<int32_t>(value)) {
+			return kNone;
+		}
+		const uint32_t low = static_cast<uint32_t>(value);
+		const auto it = std::lower_bound(immediates_.begin(), immediates_.end(),
+			std::make_pair(low, uint32_t{ 0 }));
+		return it != immediates_.end() && it->first == low ? it->second : kNone;
+	}
+
+	std::vector<CryptoConstants::Hit> CryptoConstants::FindInImmediates(
+		const FlowGraph& flow_graph) const {
+		std::vector<const Function*> functions;
+		functions.reserve(flow_graph.GetFunctions().size());
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			functions.push_back(entry.second);
+		}
+		std::vector<std::vector<Hit>> results(functions.size());
+		ParallelFor(functions.size(), 64, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				for (const auto* basic_block : functions[i]->GetBasicBlocks()) {
+					for (const auto& instruction : *basic_block) {
+						for (const Operand* operand : instruction) {
+							for (const Expression* expression : *operand) {
+								if (expression->GetType() != Expression::TYPE_IMMEDIATE_INT) {
+									continue;
+								}
+								const uint32_t tag = FindImmediate(
+									static_cast<uint64_t>(expression->GetImmediate()));
+								if (tag != kNone) {
+									results[i].push_back({ instruction.GetAddress(), tag,
+										functions[i]->GetEntryPoint() });
+								}
+							}
+						}
+					}
+				}
+			}
+		});
+
+		std::vector<Hit> hits;
+		for (const auto& result : results) {
+			hits.insert(hits.end(), result.begin(), result.end());
+		}
+		std::sort(hits.begin(), hits.end(), [](const Hit& lhs, const Hit& rhs) {
+			return lhs.address != rhs.address ? lhs.address < rhs.address
+				: lhs.function != rhs.function ? lhs.function < rhs.function
+				: lhs.tag < rhs.tag;
+		});
+		hits.erase(std::unique(hits.begin(), hits.end(),
+			[](const Hit& lhs, const Hit& rhs) {
+			return lhs.address == rhs.address && lhs.function == rhs.function &&
+				lhs.tag == rhs.tag;
+		}), hits.end());
+		return hits;
+	}
+
+}  // namespace security::binexport
@@ -0,0 +1,516 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/reader/differ.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <tuple>
+
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/synchronization/mutex.h"
+#include "third_party/zynamics/binexport/hash.h"
+#include "third_party/zynamics/binexport/reader/graph_utility.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::binexport {
+	namespace {
+
+		// Функции сигнатур считаются кусками: один граф строится слишком быстро,
+		// чтобы отдавать его отдельному потоку.
+		constexpr size_t kMinSignatureChunk = 64;
+
+		// Ниже этого сходства соседи не сопоставляются.
+		constexpr double kMinNeighborSimilarity = 0.5;
+
+		// Сходство размеров графов одно даёт ровно 0.5, поэтому соседи без общих
+		// мнемоник (например, любые две функции из одного блока) отсекаются
+		// отдельно по гистограмме.
+		constexpr double kMinNeighborMnemonicSimilarity = 0.3;
+
+		// Начиная с этого сходства гистограмм надёжность сопоставления соседей
+		// не снижается.
+		constexpr double kConfidentNeighborMnemonicSimilarity = 0.6;
+
+		// Сколько соседей второго файла, ближайших по числу блоков, проверяется
+		// для соседа первого файла. Без ограничения пара функций-«хабов» с
+		// тысячами вызывающих даёт квадратичное число кандидатов.
+		constexpr size_t kMaxNeighborCandidates = 8;
+
+		// Функции из одного блока почти всегда совпадают по структуре, поэтому на
+		// этапе kStructure они не сопоставляются.
+		constexpr uint32_t kMinStructureBasicBlocks = 2;
+
+		uint64_t CombineHash(uint64_t hash, uint64_t value) {
+			// FNV-1a по 64-битным словам.
+			return (hash ^ value) * 0x100000001b3ULL;
+		}
+
+		double GetRatio(uint32_t first, uint32_t second) {
+			const uint32_t max = std::max(first, second);
+			return max == 0 ? 1.0 : static_cast<double>(std::min(first, second)) / max;
+		}
+
+		double GetMatchStageConfidence(MatchStage stage) {
+			switch (stage) {
+			case MatchStage::kExactHash:
+				return 1.0;
+			case MatchStage::kName:
+				return 0.95;
+			case MatchStage::kStructure:
+				return 0.85;
+			case MatchStage::kCallGraphNeighbor:
+				return 0.7;
+			}
+			return 0.0;
+		}
+
+/// \brief \n Уровни вершин в обходе в ширину от входного блока.\n
+/// Недостижимые вершины получают уровень 0.
+		std::vector<uint32_t> GetBreadthFirstLevels(const FlowGraph& flow_graph) {
+			const auto& graph = flow_graph.graph();
+			constexpr uint32_t kUnvisited = std::numeric_limits<uint32_t>::max();
+			std::vector<uint32_t> levels(boost::num_vertices(graph), kUnvisited);
+			const FlowGraph::Vertex entry =
+				flow_graph.GetVertex(flow_graph.entry_point_address());
+			if (IsValidVertex(entry)) {
+				std::vector<FlowGraph::Vertex> queue{ entry };
+				levels[entry] = 0;
+				for (size_t i = 0; i < queue.size(); ++i) {
+					const FlowGraph::Vertex vertex = queue[i];
+					FlowGraph::OutEdgeIterator it, end;
+					for (std::tie(it, end) = boost::out_edges(vertex, graph); it != end;
+						++it) {
+						const FlowGraph::Vertex target = boost::target(*it, graph);
+						if (levels[target] == kUnvisited) {
+							levels[target] = levels[vertex] + 1;
+							queue.push_back(target);
+						}
+					}
+				}
+			}
+			std::replace(levels.begin(), levels.end(), kUnvisited, 0u);
+			return levels;
+		}
+
+/// \brief \n MD-индекс графа потока.\n
+/// Слагаемые сортируются перед суммированием, чтобы одинаковые графы давали
+/// побитово равный результат независимо от порядка рёбер.
+		double GetMdIndex(const FlowGraph& flow_graph) {
+			const auto& graph = flow_graph.graph();
+			const std::vector<uint32_t> levels = GetBreadthFirstLevels(flow_graph);
+			std::vector<double> terms;
+			terms.reserve(boost::num_edges(graph));
+			FlowGraph::EdgeIterator it, end;
+			for (std::tie(it, end) = boost::edges(graph); it != end; ++it) {
+				const EdgeDegrees degrees = GetEdgeDegrees<FlowGraph>(graph, *it);
+				terms.push_back(1.0 / std::sqrt(
+					levels[boost::source(*it, graph)] +
+					degrees.source_in_degree * std::sqrt(2.0) +
+					degrees.source_out_degree * std::sqrt(3.0) +
+					degrees.target_in_degree * std::sqrt(5.0) +
+					degrees.target_out_degree * std::sqrt(7.0) +
+					levels[boost::target(*it, graph)] * std::sqrt(11.0)));
+			}
+			std::sort(terms.begin(), terms.end());
+			double md_index = 0.0;
+			for (double term : terms) {
+				md_index += term;
+			}
+			return md_index;
+		}
+
+		std::vector<Address> GetNeighbors(const CallGraph& call_graph,
+			CallGraph::Vertex vertex, bool callees,
+			const LazyBinExport2Reader& reader) {
+			const auto& graph = call_graph.graph();
+			std::vector<Address> neighbors;
+			if (callees) {
+				CallGraph::OutEdgeIterator it, end;
+				for (std::tie(it, end) = boost::out_edges(vertex, graph); it != end; ++it) {
+					neighbors.push_back(call_graph.GetAddress(boost::target(*it, graph)));
+				}
+			}
+			else {
+				CallGraph::InEdgeIterator it, end;
+				for (std::tie(it, end) = boost::in_edges(vertex, graph); it != end; ++it) {
+					neighbors.push_back(call_graph.GetAddress(boost::source(*it, graph)));
+				}
+			}
+			neighbors.erase(std::remove_if(neighbors.begin(), neighbors.end(),
+				[&reader](Address address) { return !reader.HasFlowGraph(address); }),
+				neighbors.end());
+			std::sort(neighbors.begin(), neighbors.end());
+			neighbors.erase(std::unique(neighbors.begin(), neighbors.end()),
+				neighbors.end());
+			return neighbors;
+		}
+
+		void ComputeSignature(const FlowGraph& flow_graph, const CallGraph& call_graph,
+			const LazyBinExport2Reader& reader, FunctionSignature* signature) {
+			signature->basic_block_count = static_cast<uint32_t>(flow_graph.GetVertexCount());
+			signature->edge_count = static_cast<uint32_t>(flow_graph.GetEdgeCount());
+			signature->instruction_count =
+				static_cast<uint32_t>(flow_graph.GetInstructionCount());
+			signature->md_index = GetMdIndex(flow_graph);
+
+			uint64_t hash = 0xcbf29ce484222325ULL;
+			hash = CombineHash(hash, signature->basic_block_count);
+			hash = CombineHash(hash, signature->edge_count);
+			absl::flat_hash_map<uint32_t, uint32_t> histogram;
+			for (const auto& instruction : flow_graph.instructions()) {
+				const uint32_t mnemonic = GetSdbmHash(instruction.mnemonic());
+				hash = CombineHash(hash, mnemonic);
+				++histogram[mnemonic];
+			}
+			signature->exact_hash = hash;
+			signature->mnemonic_histogram.assign(histogram.begin(), histogram.end());
+			std::sort(signature->mnemonic_histogram.begin(),
+				signature->mnemonic_histogram.end());
+
+			const CallGraph::Vertex vertex = GetVertex(call_graph, signature->address);
+			if (!IsValidVertex(vertex)) {
+				return;
+			}
+			const auto& properties = call_graph.graph()[vertex];
+			if (properties.flags & CallGraph::kVertexName) {
+				signature->name = properties.name;
+			}
+			signature->callers = GetNeighbors(call_graph, vertex, false, reader);
+			signature->callees = GetNeighbors(call_graph, vertex, true, reader);
+		}
+
+/// \brief \n Состояние сопоставления двух наборов сигнатур.
+		class Matcher {
+		public:
+			Matcher(const std::vector<FunctionSignature>& primary,
+				const std::vector<FunctionSignature>& secondary)
+				: primary_(primary),
+				secondary_(secondary),
+				primary_match_(primary.size(), -1),
+				secondary_match_(secondary.size(), -1) {}
+
+/// \brief \n Сопоставляет несопоставленные функции, ключ которых встречается
+/// ровно один раз в каждом файле. key(signature, &key) возвращает false,
+/// если функция не участвует в этапе.
+			template <typename Key, typename KeyFunction>
+			void MatchUniqueKeys(MatchStage stage, KeyFunction key_function) {
+				// Ключ -> (число функций, номер последней) для каждого файла.
+				absl::flat_hash_map<Key, std::pair<int, int>> primary_keys, secondary_keys;
+				const auto collect = [&key_function](
+					const std::vector<FunctionSignature>& signatures,
+					const std::vector<int>& matches,
+					absl::flat_hash_map<Key, std::pair<int, int>>* keys) {
+					for (int i = 0; i < signatures.size(); ++i) {
+						Key key;
+						if (matches[i] == -1 && key_function(signatures[i], &key)) {
+							auto& entry = (*keys)[key];
+							++entry.first;
+							entry.second = i;
+						}
+					}
+				};
+				collect(primary_, primary_match_, &primary_keys);
+				collect(secondary_, secondary_match_, &secondary_keys);
+				for (int i = 0; i < primary_.size(); ++i) {
+					Key key;
+					if (primary_match_[i] != -1 || !key_function(primary_[i], &key)) {
+						continue;
+					}
+					const auto primary_entry = primary_keys.find(key);
+					const auto secondary_entry = secondary_keys.find(key);
+					if (primary_entry->second.first == 1 &&
+						secondary_entry != secondary_keys.end() &&
+						secondary_entry->second.first == 1) {
+						AddMatch(i, secondary_entry->second.second, stage);
+					}
+				}
+			}
+
+/// \brief \n Распространяет сопоставление по графу вызовов волнами: кандидаты
+/// от всех пар предыдущей волны оцениваются параллельно, затем жадно
+/// принимаются по убыванию сходства.
+			void PropagateToNeighbors() {
+				std::vector<std::pair<int, int>> wave = matches_;
+				while (!wave.empty()) {
+					std::vector<std::pair<int, int>> candidates;
+					for (const auto& pair : wave) {
+						AddCandidates(primary_[pair.first].callers,
+							secondary_[pair.second].callers, &candidates);
+						AddCandidates(primary_[pair.first].callees,
+							secondary_[pair.second].callees, &candidates);
+					}
+					std::sort(candidates.begin(), candidates.end());
+					candidates.erase(std::unique(candidates.begin(), candidates.end()),
+						candidates.end());
+
+					std::vector<double> similarities(candidates.size());
+					ParallelFor(candidates.size(), 1024,
+						[this, &candidates, &similarities](size_t begin, size_t end) {
+						for (size_t i = begin; i < end; ++i) {
+							const auto& primary = primary_[candidates[i].first];
+							const auto& secondary = secondary_[candidates[i].second];
+							similarities[i] = GetMnemonicSimilarity(primary, secondary) <
+								kMinNeighborMnemonicSimilarity
+								? 0.0 : GetSimilarity(primary, secondary);
+						}
+					});
+					std::vector<size_t> order(candidates.size());
+					for (size_t i = 0; i < order.size(); ++i) {
+						order[i] = i;
+					}
+					// stable_sort: при равном сходстве порядок задают адреса.
+					std::stable_sort(order.begin(), order.end(),
+						[&similarities](size_t left, size_t right) {
+						return similarities[left] > similarities[right];
+					});
+
+					const size_t first_new = matches_.size();
+					for (size_t i : order) {
+						if (similarities[i] < kMinNeighborSimilarity) {
+							break;
+						}
+						if (primary_match_[candidates[i].first] == -1 &&
+							secondary_match_[candidates[i].second] == -1) {
+							AddMatch(candidates[i].first, candidates[i].second,
+								MatchStage::kCallGraphNeighbor);
+						}
+					}
+					wave.assign(matches_.begin() + first_new, matches_.end());
+				}
+			}
+
+			std::vector<FunctionMatch> GetMatches() const {
+				std::vector<FunctionMatch> result(matches_.size());
+				ParallelFor(matches_.size(), 1024, [this, &result](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i) {
+						const auto& primary = primary_[matches_[i].first];
+						const auto& secondary = secondary_[matches_[i].second];
+						auto& match = result[i];
+						match.primary = primary.address;
+						match.secondary = secondary.address;
+						match.stage = stages_[i];
+						match.similarity = GetSimilarity(primary, secondary);
+						match.confidence = match.stage == MatchStage::kExactHash
+							? 1.0 : GetMatchStageConfidence(match.stage) * match.similarity;
+						if (match.stage == MatchStage::kCallGraphNeighbor) {
+							match.confidence *= std::min(1.0,
+								GetMnemonicSimilarity(primary, secondary) /
+								kConfidentNeighborMnemonicSimilarity);
+						}
+					}
+				});
+				std::sort(result.begin(), result.end(),
+					[](const FunctionMatch& left, const FunctionMatch& right) {
+					return left.primary < right.primary;
+				});
+				return result;
+			}
+
+		private:
+			void AddMatch(int primary, int secondary, MatchStage stage) {
+				primary_match_[primary] = secondary;
+				secondary_match_[secondary] = primary;
+				matches_.emplace_back(primary, secondary);
+				stages_.push_back(stage);
+			}
+
+			static int FindSignature(const std::vector<FunctionSignature>& signatures,
+				Address address) {
+				const auto it = std::lower_bound(signatures.begin(), signatures.end(),
+					address, [](const FunctionSignature& signature, Address address) {
+					return signature.address < address;
+				});
+				return it != signatures.end() && it->address == address
+					? static_cast<int>(it - signatures.begin()) : -1;
+			}
+
+			void AddCandidates(const std::vector<Address>& primary_neighbors,
+				const std::vector<Address>& secondary_neighbors,
+				std::vector<std::pair<int, int>>* candidates) const {
+				// Несопоставленные соседи второго файла: (число блоков, номер).
+				std::vector<std::pair<uint32_t, int>> secondary;
+				for (Address secondary_address : secondary_neighbors) {
+					const int index = FindSignature(secondary_, secondary_address);
+					if (index != -1 && secondary_match_[index] == -1) {
+						secondary.emplace_back(secondary_[index].basic_block_count, index);
+					}
+				}
+				if (secondary.empty()) {
+					return;
+				}
+				std::sort(secondary.begin(), secondary.end());
+
+				for (Address primary_address : primary_neighbors) {
+					const int primary = FindSignature(primary_, primary_address);
+					if (primary == -1 || primary_match_[primary] != -1) {
+						continue;
+					}
+					// Ближайшие по числу блоков - в обе стороны от точки вставки.
+					const uint32_t count = primary_[primary].basic_block_count;
+					size_t right = std::lower_bound(secondary.begin(), secondary.end(),
+						std::make_pair(count, std::numeric_limits<int>::min())) -
+						secondary.begin();
+					size_t left = right;
+					for (size_t taken = 0; taken < kMaxNeighborCandidates &&
+						(left != 0 || right != secondary.size()); ++taken) {
+						if (left == 0 || (right != secondary.size() &&
+							secondary[right].first - count <= count - secondary[left - 1].first)) {
+							candidates->emplace_back(primary, secondary[right++].second);
+						}
+						else {
+							candidates->emplace_back(primary, secondary[--left].second);
+						}
+					}
+				}
+			}
+
+			const std::vector<FunctionSignature>& primary_;
+			const std::vector<FunctionSignature>& secondary_;
+			std::vector<int> primary_match_;
+			std::vector<int> secondary_match_;
+			std::vector<std::pair<int, int>> matches_;
+			std::vector<MatchStage> stages_;
+		};
+
+	}  // namespace
+
+	const char* GetMatchStageName(MatchStage stage) {
+		switch (stage) {
+		case MatchStage::kExactHash:
+			return "exact hash";
+		case MatchStage::kName:
+			return "name";
+		case MatchStage::kStructure:
+			return "structure";
+		case MatchStage::kCallGraphNeighbor:
+			return "call graph neighbor";
+		}
+		return "unknown";
+	}
+
+	absl::StatusOr<std::vector<FunctionSignature>> ComputeFunctionSignatures(
+		LazyBinExport2Reader* reader) {
+		const std::vector<Address> entry_points = reader->GetFlowGraphEntryPoints();
+		std::vector<FunctionSignature> signatures(entry_points.size());
+		absl::Mutex status_mutex;
+		absl::Status status;
+		ParallelFor(entry_points.size(), kMinSignatureChunk,
+			[&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				auto& signature = signatures[i];
+				signature.address = entry_points[i];
+				auto flow_graph = reader->GetFlowGraph(entry_points[i]);
+				if (!flow_graph.ok()) {
+					absl::MutexLock lock(&status_mutex);
+					status.Update(flow_graph.status());
+					return;
+				}
+				ComputeSignature(**flow_graph, reader->call_graph(), *reader,
+					&signature);
+			}
+		});
+		if (!status.ok()) {
+			return status;
+		}
+		return signatures;
+	}
+
+	double GetMnemonicSimilarity(const FunctionSignature& primary,
+		const FunctionSignature& secondary) {
+		uint64_t common = 0, total = 0;
+		auto first = primary.mnemonic_histogram.begin();
+		auto second = secondary.mnemonic_histogram.begin();
+		const auto first_end = primary.mnemonic_histogram.end();
+		const auto second_end = secondary.mnemonic_histogram.end();
+		while (first != first_end || second != second_end) {
+			if (second == second_end || (first != first_end && first->first < second->first)) {
+				total += first++->second;
+			}
+			else if (first == first_end || second->first < first->first) {
+				total += second++->second;
+			}
+			else {
+				common += std::min(first->second, second->second);
+				total += std::max(first->second, second->second);
+				++first;
+				++second;
+			}
+		}
+		return total == 0 ? 1.0 : static_cast<double>(common) / total;
+	}
+
+	double GetSimilarity(const FunctionSignature& primary,
+		const FunctionSignature& secondary) {
+		return 0.5 * GetMnemonicSimilarity(primary, secondary) +
+			0.2 * GetRatio(primary.basic_block_count, secondary.basic_block_count) +
+			0.2 * GetRatio(primary.edge_count, secondary.edge_count) +
+			0.1 * GetRatio(
+				static_cast<uint32_t>(primary.callers.size() + primary.callees.size()),
+				static_cast<uint32_t>(secondary.callers.size() + secondary.callees.size()));
+	}
+
+	absl::StatusOr<std::vector<FunctionMatch>> DiffBinExport(
+		LazyBinExport2Reader* primary, LazyBinExport2Reader* secondary) {
+		NA_ASSIGN_OR_RETURN(const std::vector<FunctionSignature> primary_signatures,
+			ComputeFunctionSignatures(primary));
+		NA_ASSIGN_OR_RETURN(const std::vector<FunctionSignature> secondary_signatures,
+			ComputeFunctionSignatures(secondary));
+
+		Matcher matcher(primary_signatures, secondary_signatures);
+		matcher.MatchUniqueKeys<uint64_t>(MatchStage::kExactHash,
+			[](const FunctionSignature& signature, uint64_t* key) {
+			*key = signature.exact_hash;
+			return true;
+		});
+		matcher.MatchUniqueKeys<std::string>(MatchStage::kName,
+			[](const FunctionSignature& signature, std::string* key) {
+			*key = signature.name;
+			return !key->empty();
+		});
+		using StructureKey = std::tuple<double, uint32_t, uint32_t, size_t, size_t>;
+		matcher.MatchUniqueKeys<StructureKey>(MatchStage::kStructure,
+			[](const FunctionSignature& signature, StructureKey* key) {
+			*key = StructureKey(signature.md_index, signature.basic_block_count,
+				signature.edge_count, signature.callers.size(),
+				signature.callees.size());
+			return signature.basic_block_count >= kMinStructureBasicBlocks;
+		});
+		matcher.PropagateToNeighbors();
+		return matcher.GetMatches();
+	}
+
+	absl::Status WriteMatchTable(const std::vector<FunctionMatch>& matches,
+		const std::string& filename) {
+		std::ofstream file(filename);
+		file << "primary\tsecondary\tsimilarity\tconfidence\tstage\n";
+		for (const auto& match : matches) {
+			file << absl::StrCat(absl::Hex(match.primary, absl::kZeroPad8), "\t",
+				absl::Hex(match.secondary, absl::kZeroPad8), "\t",
+				absl::SixDigits(match.similarity), "\t",
+				absl::SixDigits(match.confidence), "\t",
+				GetMatchStageName(match.stage), "\n");
+		}
+		if (!file) {
+			return absl::UnknownError(
+				absl::StrCat("failed to write match table: '", filename, "'"));
+		}
+		return absl::OkStatus();
+	}
+
+}  // namespace security::binexport
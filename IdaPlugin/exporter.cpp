@@ -1,8 +1,10 @@
 ﻿#include "exporter.h"
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include<boost/tokenizer.hpp>
 #include <frame.hpp>
 #include <iostream>
+#include <memory>
 #include <name.hpp>
 #include <search.hpp>
 #include <sstream>
@@ -12,6 +14,17 @@
 #include "help_functions.h"
 #include "pe_heders.h"
 #include "util.h"
+#include "digest.h"
+#include "names.h"
+#include "third_party/zynamics/binexport/byte_profile.h"
+#include "third_party/zynamics/binexport/byte_search.h"
+#include "third_party/zynamics/binexport/call_graph_index.h"
+#include "third_party/zynamics/binexport/reader/differ.h"
+#include "third_party/zynamics/binexport/similarity_index.h"
+#include "third_party/zynamics/binexport/transitive_effects.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
+#include "third_party/zynamics/binexport/util/format.h"
+#include "third_party/zynamics/binexport/util/timer.h"
 
 #include "debug_log.h"
 
@@ -315,6 +328,54 @@ void Exporter::ParseCMD(const std::string &cmd_command) const
 	}
 
 
+	if (command[1] == "diff")
+	{
+		CommandDiff();
+		return;
+	}
+
+	if (command[1] == "similar" && exporter.cmd_arg > 2)
+	{
+		CommandSimilar(command);
+		return;
+	}
+
+	if ((command[1] == "callers" || command[1] == "callees") && exporter.cmd_arg > 2)
+	{
+		CommandCallGraph(command);
+		return;
+	}
+
+	if (command[1] == "reach" && exporter.cmd_arg > 3)
+	{
+		CommandCallGraph(command);
+		return;
+	}
+
+	if (command[1] == "libsig" && exporter.cmd_arg > 2)
+	{
+		CommandLibrarySignatures(command);
+		return;
+	}
+
+	if (command[1] == "search" && exporter.cmd_arg > 2)
+	{
+		CommandByteSearch(command);
+		return;
+	}
+
+	if (command[1] == "budget")
+	{
+		CommandFunctionBudget(command);
+		return;
+	}
+
+	if (command[1] == "entropy")
+	{
+		PrintEntropyReport();
+		return;
+	}
+
 	msg("    Unknown Argument    %s \n\n", command[1].c_str());
 
 }
@@ -1055,6 +1116,20 @@ void Exporter::CommandPrintHelp() const
 		"        - 'segment' \n"
 		"        - 'module' \n"
 		"        - 'capstone' \n"
+		"        - 'diff'            compare two .BinExport files, the files are selected in dialogs \n"
+		"        - 'similar'         'bb similar xxxxxxxx' top similar functions from the BinExport similarity index \n"
+		"        - 'callees'         'bb callees xxxxxxxx' all functions reachable by calls from the function \n"
+		"        - 'callers'         'bb callers xxxxxxxx' all functions the function is reachable from \n"
+		"        - 'reach'           'bb reach xxxxxxxx yyyyyyyy' is there a call path between two functions \n"
+		"        - 'libsig'          'bb libsig load' directory of library signature sets (*.bxsig) \n"
+		"                            applied on every export, 'bb libsig save' file to write \n"
+		"                            signatures of the named functions on the next export \n"
+		"        - 'search'          'bb search 48 8b xx xx e8 or 55 8b ec' byte patterns in all segments, \n"
+		"                            'xx' is any byte, hits are grouped by function \n"
+		"        - 'budget'          'bb budget 20000' soft limit of basic blocks per exported function, \n"
+		"                            larger functions are cut, without a number prints the limit \n"
+		"        - 'entropy'         entropy, printable ratio and packed/encrypted regions of the segments \n"
+		"                            from the last export \n"
 		"\n\n"
 		"        next expressions can serve as the third argument : \n"
 		"            with 'function' \n"
@@ -1070,6 +1145,533 @@ void Exporter::CommandPrintHelp() const
 	);
 }
 
+void Exporter::CommandDiff() const
+{
+	TRACE_FN();
+
+	const char* primary_file = ask_file(
+		/*for_saving=*/false, "*.BinExport", "%s",
+		"FILTER BinExport v2 files|*.BinExport\nPrimary BinExport file");
+	if (!primary_file) {
+		return;
+	}
+	const std::string primary_filename = primary_file;  // ask_file возвращает общий буфер
+
+	const char* secondary_file = ask_file(
+		/*for_saving=*/false, "*.BinExport", "%s",
+		"FILTER BinExport v2 files|*.BinExport\nSecondary BinExport file");
+	if (!secondary_file) {
+		return;
+	}
+	const std::string secondary_filename = secondary_file;
+
+	const char* output_file = ask_file(
+		/*for_saving=*/true, "*.matches", "%s",
+		"FILTER Match tables|*.matches\nSave match table");
+	if (!output_file) {
+		return;
+	}
+	const std::string output_filename = output_file;
+
+	Timer<> timer;
+	auto primary = SB::LazyBinExport2Reader::Open(primary_filename);
+	auto secondary = SB::LazyBinExport2Reader::Open(secondary_filename);
+	if (!primary.ok() || !secondary.ok())
+	{
+		const auto& status = primary.ok() ? secondary.status() : primary.status();
+		msg("    bb diff - ERROR: %s \n\n", std::string(status.message()).c_str());
+		return;
+	}
+	const auto matches = SB::DiffBinExport(primary->get(), secondary->get());
+	if (!matches.ok())
+	{
+		msg("    bb diff - ERROR: %s \n\n", std::string(matches.status().message()).c_str());
+		return;
+	}
+	const auto status = SB::WriteMatchTable(*matches, output_filename);
+	if (!status.ok())
+	{
+		msg("    bb diff - ERROR: %s \n\n", std::string(status.message()).c_str());
+		return;
+	}
+	msg("    bb diff: matched %d of %d / %d functions in %s \n\n",
+		static_cast<int>(matches->size()),
+		static_cast<int>((*primary)->GetFlowGraphEntryPoints().size()),
+		static_cast<int>((*secondary)->GetFlowGraphEntryPoints().size()),
+		SB::HumanReadableDuration(timer.elapsed()).c_str());
+}
+
+void Exporter::CommandLibrarySignatures(const std::vector<std::string>& command) const
+{
+	TRACE_FN();
+
+	if (command[2] == "load")
+	{
+		const char* file = ask_file(
+			/*for_saving=*/false, "*.bxsig", "%s",
+			"FILTER Library signatures|*.bxsig\nAny signature set in the directory");
+		if (!file) {
+			return;
+		}
+		const std::string directory = Dirname(file);
+		Settings::setExportLibrarySignaturesDir(QString::fromStdString(directory));
+		msg("    bb libsig: signature sets from %s are applied on export \n\n",
+			directory.c_str());
+		return;
+	}
+
+	if (command[2] == "save")
+	{
+		const char* file = ask_file(
+			/*for_saving=*/true, "*.bxsig", "%s",
+			"FILTER Library signatures|*.bxsig\nSave library signatures");
+		if (!file) {
+			return;
+		}
+		library_signature_output = file;
+		msg("    bb libsig: signatures are written to %s on the next export \n\n",
+			library_signature_output.c_str());
+		return;
+	}
+
+	msg("    bb libsig - ERROR: expected 'load' or 'save', got '%s' \n\n",
+		command[2].c_str());
+}
+
+void Exporter::CommandFunctionBudget(const std::vector<std::string>& command) const
+{
+	TRACE_FN();
+
+	if (exporter.cmd_arg > 2)
+	{
+		const std::string& value = command[2];
+		if (value.empty() || value.size() > 9 ||
+			!std::all_of(value.begin(), value.end(), [](char c) { return c >= '0' && c <= '9'; }))
+		{
+			msg("    bb budget - ERROR: '%s' is not a number of basic blocks \n\n", value.c_str());
+			return;
+		}
+		Settings::setExportFunctionBudget(std::stoi(value));
+	}
+	msg("    bb budget: functions are cut at %d basic blocks on export \n\n",
+		Settings::getExportFunctionBudget());
+}
+
+void Exporter::CommandByteSearch(const std::vector<std::string>& command) const
+{
+	TRACE_FN();
+
+	// сколько вхождений выводить
+	constexpr size_t kPrintLimit = 1000;
+
+	SB::BytePatternSearch search;
+	std::string text;
+	for (size_t i = 2; i <= command.size(); ++i)
+	{
+		if (i < command.size() && command[i] != "or")
+		{
+			text.append(command[i]);
+			continue;
+		}
+		auto pattern = SB::BytePatternSearch::ParsePattern(text);
+		if (!pattern.ok())
+		{
+			msg("    bb search - ERROR: %s \n\n", std::string(pattern.status().message()).c_str());
+			return;
+		}
+		const auto status = search.AddPattern(*std::move(pattern));
+		if (!status.ok())
+		{
+			msg("    bb search - ERROR: %s in '%s' \n\n", std::string(status.message()).c_str(),
+				text.c_str());
+			return;
+		}
+		text.clear();
+	}
+
+	// байты сегментов читаются в этом (главном) потоке
+	AddressSpace address_space;
+	size_t scanned = 0;
+	for (int i = 0; i < get_segm_qty(); ++i)
+	{
+		const segment_t* segment = getnseg(i);
+		address_space.AddMemoryBlock(segment->start_ea,
+			SB::GetSectionMemoryBlock(segment->start_ea), SB::GetPermissions(segment));
+		scanned += segment->end_ea - segment->start_ea;
+	}
+
+	Timer<> timer;
+	const auto hits = search.Find(address_space);
+	const double scan_time = timer.elapsed();
+
+	// функция вхождения по индексу экспортёра: кусок из local_func_address,
+	// хвост относится к владельцу; IDA - только пока индекс не построен
+	const auto find_function = [this](ea_t address) -> ea_t
+	{
+		if (function_index.empty())
+		{
+			const func_t* func = get_func(address);
+			return func != nullptr ? func->start_ea : BADADDR;
+		}
+		auto chunk = local_func_address.upper_bound(address);
+		if (chunk == local_func_address.begin() || address >= (--chunk)->second)
+		{
+			return BADADDR;
+		}
+		const auto index = function_index.find(chunk->first);
+		if (index != function_index.end())
+		{
+			const PeFunc& data = function_data[index->second];
+			if ((data.func_flag & FUNC_TAIL) != 0 && data.function_owner != 0)
+			{
+				return data.function_owner;
+			}
+		}
+		return chunk->first;
+	};
+
+	// вхождения по функциям, BADADDR - вне функций
+	std::map<ea_t, std::vector<SB::BytePatternSearch::Hit>> groups;
+	for (const auto& hit : hits)
+	{
+		groups[find_function(hit.address)].push_back(hit);
+	}
+
+	size_t printed = 0;
+	for (const auto& group : groups)
+	{
+		if (printed >= kPrintLimit)
+		{
+			break;
+		}
+		if (group.first == BADADDR)
+		{
+			msg("    outside functions : %d hits \n", static_cast<int>(group.second.size()));
+		}
+		else
+		{
+			const auto index = function_index.find(group.first);
+			const std::string& name = index != function_index.end()
+				? function_data[index->second].name : std::string();
+			msg("    %llx %-40s : %d hits \n", group.first, name.c_str(),
+				static_cast<int>(group.second.size()));
+		}
+		for (const auto& hit : group.second)
+		{
+			if (printed++ >= kPrintLimit)
+			{
+				break;
+			}
+			msg("        %llx  pattern %d \n", hit.address, static_cast<int>(hit.pattern) + 1);
+		}
+	}
+	msg("    bb search: %d patterns, %d hits in %d functions, %.1f MB scanned in %s \n\n",
+		static_cast<int>(search.GetPatternCount()), static_cast<int>(hits.size()),
+		static_cast<int>(groups.size() - groups.count(BADADDR)),
+		scanned / 1048576.0, SB::HumanReadableDuration(scan_time).c_str());
+}
+
+void Exporter::PrintEntropyReport() const
+{
+	TRACE_FN();
+
+	// участков окон на сегмент
+	constexpr size_t kRunLimit = 8;
+
+	if (segments_data.empty())
+	{
+		msg("    bb entropy - ERROR: no segments, export the database first \n\n");
+		return;
+	}
+
+	msg("\n---- Segment entropy -------------------------------------\n");
+	msg("        %-12s %-8s %-16s %10s %8s %9s \n",
+		"name", "class", "start", "size", "entropy", "printable");
+	int packed = 0;
+	uint64_t high_entropy_bytes = 0;
+	for (const auto& segment : segments_data)
+	{
+		const uint64_t size = segment.end_address - segment.start_address;
+		if (segment.histogram.empty())
+		{
+			msg("        %-12s %-8s %-16llx %10llu %8s %9s   no bytes \n",
+				segment.name.c_str(), segment.s_class.c_str(),
+				static_cast<unsigned long long>(segment.start_address),
+				static_cast<unsigned long long>(size), "-", "-");
+			continue;
+		}
+		const auto runs = SB::ByteProfile::GetHighEntropyRuns(segment.window_entropy);
+		const char* verdict = "";
+		if (segment.entropy >= SB::ByteProfile::kHighEntropy)
+		{
+			verdict = segment.s_class == "CODE" ? "packed/encrypted code" : "packed/encrypted";
+			++packed;
+		}
+		else if (!runs.empty())
+		{
+			verdict = "high-entropy regions";
+		}
+		msg("        %-12s %-8s %-16llx %10llu %8.3f %9.3f   %s \n",
+			segment.name.c_str(), segment.s_class.c_str(),
+			static_cast<unsigned long long>(segment.start_address),
+			static_cast<unsigned long long>(size), segment.entropy,
+			segment.printable_ratio, verdict);
+
+		for (size_t i = 0; i < runs.size(); ++i)
+		{
+			const ea_t start = segment.start_address +
+				static_cast<ea_t>(runs[i].first) * SB::ByteProfile::kWindowSize;
+			const ea_t end = std::min<ea_t>(segment.end_address,
+				start + static_cast<ea_t>(runs[i].second) * SB::ByteProfile::kWindowSize);
+			high_entropy_bytes += end - start;
+			if (i >= kRunLimit)
+			{
+				continue;
+			}
+			float max_entropy = 0;
+			for (size_t window = runs[i].first; window < runs[i].first + runs[i].second; ++window)
+			{
+				max_entropy = std::max(max_entropy, segment.window_entropy[window]);
+			}
+			msg("            %llx - %llx  %.1f KB, max entropy %.3f \n",
+				static_cast<unsigned long long>(start), static_cast<unsigned long long>(end),
+				(end - start) / 1024.0, max_entropy);
+		}
+		if (runs.size() > kRunLimit)
+		{
+			msg("            ... %d more regions \n", static_cast<int>(runs.size() - kRunLimit));
+		}
+	}
+	msg("    bb entropy: %d segments, %d packed/encrypted, %.1f MB in high-entropy %u-byte windows \n\n",
+		static_cast<int>(segments_data.size()), packed, high_entropy_bytes / 1048576.0,
+		SB::ByteProfile::kWindowSize);
+}
+
+void Exporter::CommandSimilar(const std::vector<std::string>& command) const
+{
+	TRACE_FN();
+
+	// сколько кандидатов выводить
+	constexpr size_t kCandidateCount = 10;
+
+	if (!IsHexadecimal(command[2]))
+	{
+		msg("    bb similar - ERROR: '%s' is not a hexadecimal address \n\n", command[2].c_str());
+		return;
+	}
+	const func_t* func = get_func(std::stoull(command[2], nullptr, 16));
+	if (func == nullptr)
+	{
+		msg("    bb similar - ERROR: IDA HAS NO function at %s \n\n", command[2].c_str());
+		return;
+	}
+
+	const std::string directory = Settings::getExportLastDir().toStdString();
+	if (directory.empty())
+	{
+		msg("    bb similar - ERROR: no BinExport export yet, the index is written on export \n\n");
+		return;
+	}
+	const auto index = SB::SimilarityIndex::Get(
+		JoinPath(directory, SB::kSimilarityIndexFilename));
+	if (!index.ok())
+	{
+		msg("    bb similar - ERROR: %s \n\n", std::string(index.status().message()).c_str());
+		return;
+	}
+
+	const std::string hash =
+		SB::GetInputFileSha256().value_or(SB::GetInputFileMd5().value_or(""));
+	SB::FunctionFingerprint fingerprint;
+	if (!(*index)->FindFunction(hash, func->start_ea, &fingerprint))
+	{
+		msg("    bb similar - ERROR: function %llx is not in the index, export the database first \n\n",
+			func->start_ea);
+		return;
+	}
+
+	const auto candidates =
+		(*index)->Query(fingerprint, kCandidateCount, hash, func->start_ea);
+	msg("\n        functions similar to %llx (%d functions indexed) \n\n",
+		func->start_ea, static_cast<int>((*index)->size()));
+	for (const auto& candidate : candidates)
+	{
+		msg("                %5.3f  %2d  %-24s %llx  %s \n",
+			candidate.similarity, candidate.sim_hash_distance,
+			candidate.executable_filename->c_str(), candidate.address,
+			candidate.name.c_str());
+	}
+	msg("\n");
+}
+
+namespace {
+
+/// \brief \n Индекс графа вызовов текущей базы, построенный по ссылкам IDA ...
+/// \details Граф вызовов экспорта после записи файла не сохраняется, поэтому для\n
+/// \details запросов из CMD вызовы собираются заново (fl_CN / fl_CF из кода функций,\n
+/// \details включая хвостовые куски).
+	std::unique_ptr<SB::CallGraphIndex> BuildCallGraphIndex()
+	{
+		const size_t function_count = get_func_qty();
+		std::vector<Address> functions;
+		std::vector<std::pair<Address, Address>> calls;
+		functions.reserve(function_count);
+		xrefblk_t xref;
+		func_item_iterator_t item;
+		for (size_t i = 0; i < function_count; ++i)
+		{
+			func_t* func = getn_func(i);
+			if (func == nullptr)
+			{
+				continue;
+			}
+			functions.push_back(func->start_ea);
+			for (bool item_ok = item.set(func); item_ok; item_ok = item.next_code())
+			{
+				for (bool ok = xref.first_from(item.current(), XREF_FAR); ok; ok = xref.next_from())
+				{
+					if (!xref.iscode || (xref.type != fl_CN && xref.type != fl_CF))
+					{
+						continue;
+					}
+					// вызов внутрь функции относим к её началу
+					const func_t* callee = get_func(xref.to);
+					calls.emplace_back(func->start_ea,
+						callee != nullptr ? callee->start_ea : xref.to);
+				}
+			}
+		}
+		return std::make_unique<SB::CallGraphIndex>(std::move(functions),
+			std::move(calls));
+	}
+
+	// Индекс перестраивается только после изменений в базе, см. CallGraphIndexCallback().
+	std::unique_ptr<SB::CallGraphIndex> call_graph_index_cache;
+	bool call_graph_index_dirty = true;
+	bool call_graph_index_hooked = false;
+
+/// \brief \n Обработчик HT_IDB: помечает индекс графа вызовов устаревшим ...
+/// \details Срабатывает на изменение границ и хвостов функций и ссылок кода.
+	ssize_t idaapi CallGraphIndexCallback(void*, int notification_code, va_list)
+	{
+		switch (notification_code)
+		{
+		case idb_event::closebase:
+		case idb_event::func_added:
+		case idb_event::deleting_func:
+		case idb_event::func_updated:
+		case idb_event::set_func_start:
+		case idb_event::set_func_end:
+		case idb_event::func_tail_appended:
+		case idb_event::func_tail_deleted:
+		case idb_event::tail_owner_changed:
+		case idb_event::added_cref:
+		case idb_event::deleted_cref:
+			call_graph_index_dirty = true;
+			break;
+		default:
+			break;
+		}
+		return 0;
+	}
+
+/// \brief \n Индекс графа вызовов из кэша, при изменениях в базе - построенный заново.
+	const SB::CallGraphIndex& GetCallGraphIndex()
+	{
+		if (!call_graph_index_hooked)
+		{
+			hook_to_notification_point(HT_IDB, CallGraphIndexCallback);
+			call_graph_index_hooked = true;
+		}
+		if (call_graph_index_dirty || call_graph_index_cache == nullptr)
+		{
+			call_graph_index_cache = BuildCallGraphIndex();
+			call_graph_index_dirty = false;
+		}
+		return *call_graph_index_cache;
+	}
+
+/// \brief \n Номер функции в индексе по шестнадцатеричному адресу из CMD или kNone.
+	uint32_t FindCallGraphFunction(const SB::CallGraphIndex& index,
+		const std::string& command, const std::string& argument)
+	{
+		if (!IsHexadecimal(argument))
+		{
+			msg("    bb %s - ERROR: '%s' is not a hexadecimal address \n\n",
+				command.c_str(), argument.c_str());
+			return SB::CallGraphIndex::kNone;
+		}
+		const ea_t address = std::stoull(argument, nullptr, 16);
+		const func_t* func = get_func(address);
+		const uint32_t function =
+			index.GetFunction(func != nullptr ? func->start_ea : address);
+		if (function == SB::CallGraphIndex::kNone)
+		{
+			msg("    bb %s - ERROR: IDA HAS NO function at %s \n\n",
+				command.c_str(), argument.c_str());
+		}
+		return function;
+	}
+
+}  // namespace
+
+void Exporter::CommandCallGraph(const std::vector<std::string>& command) const
+{
+	TRACE_FN();
+
+	Timer<> timer;
+	const SB::CallGraphIndex& index = GetCallGraphIndex();
+	const uint32_t function = FindCallGraphFunction(index, command[1], command[2]);
+	if (function == SB::CallGraphIndex::kNone)
+	{
+		return;
+	}
+
+	if (command[1] == "reach")
+	{
+		const uint32_t target = FindCallGraphFunction(index, command[1], command[3]);
+		if (target == SB::CallGraphIndex::kNone)
+		{
+			return;
+		}
+		msg("\n        %llx %s reach %llx by calls \n\n",
+			index.GetFunctionAddress(function),
+			index.CanReach(function, target) ? "DOES" : "does NOT",
+			index.GetFunctionAddress(target));
+		return;
+	}
+
+	const bool callees = command[1] == "callees";
+	const auto functions = callees ? index.GetTransitiveCallees(function)
+		: index.GetTransitiveCallers(function);
+	msg("\n        %s of %llx: %d functions, %s \n\n", callees ? "callees" : "callers",
+		index.GetFunctionAddress(function), static_cast<int>(functions.size()),
+		index.IsRecursive(index.GetComponent(function)) ? "recursive" : "not recursive");
+	qstring name;
+	for (const uint32_t other : functions)
+	{
+		const ea_t address = index.GetFunctionAddress(other);
+		name.clear();
+		get_func_name(&name, address);
+		msg("                %llx  %s \n", address, name.c_str());
+	}
+	msg("\n        call graph: %d functions, %d components, %s \n\n",
+		static_cast<int>(index.GetFunctionCount()),
+		static_cast<int>(index.GetComponentCount()),
+		SB::HumanReadableDuration(timer.elapsed()).c_str());
+}
+
+void Exporter::ReleaseCallGraphIndex()
+{
+	if (call_graph_index_hooked)
+	{
+		unhook_from_notification_point(HT_IDB, CallGraphIndexCallback);
+		call_graph_index_hooked = false;
+	}
+	call_graph_index_cache.reset();
+	call_graph_index_dirty = true;
+}
+
 void Exporter::CommandFunctionParse(std::vector<std::string>& command) const
 {
 	TRACE_FN();
@@ -1635,6 +2237,48 @@ void Exporter::PrintStats() const
 		}
 	}
 
+	// Топ по транзитивным эффектам (ReportTransitiveEffects()): сначала больше
+	// видов эффектов вместе с вызываемыми, затем больше полученных от них
+	const auto count_effects = [](uint8_t mask) {
+		int count = 0;
+		for (; mask != 0; mask &= mask - 1) ++count;
+		return count;
+	};
+	std::sort(rows.begin(), rows.end(), [&count_effects](const Row& a, const Row& b) {
+		const int ta = count_effects(a.fx->transitive_effects);
+		const int tb = count_effects(b.fx->transitive_effects);
+		if (ta != tb)
+			return ta > tb;
+		const int ia = count_effects(a.fx->transitive_effects & ~a.fx->local_effects);
+		const int ib = count_effects(b.fx->transitive_effects & ~b.fx->local_effects);
+		if (ia != ib)
+			return ia > ib;
+		return a.fx->instr_total > b.fx->instr_total;
+	});
+
+	msg("\n  Top-10 by transitive effects (* - only through callees)\n");
+	{
+		const size_t N = rows.size() < 10 ? rows.size() : 10;
+		for (size_t i = 0; i < N && rows[i].fx->transitive_effects != 0; ++i) {
+			const auto &r = rows[i];
+			qstring name = get_fn_name(r.fva);
+			qstring effects;
+			for (int bit = 0; bit < SB::TransitiveEffects::kEffectCount; ++bit) {
+				if ((r.fx->transitive_effects >> bit & 1) == 0) continue;
+				if (!effects.empty()) effects.append(' ');
+				effects.append(SB::TransitiveEffects::GetEffectName(
+					static_cast<SB::TransitiveEffects::Effect>(1 << bit)));
+				if ((r.fx->local_effects >> bit & 1) == 0) effects.append('*');
+			}
+			msg("   %2zu) %s  @%llX  [%s]  ins=%llu\n",
+				i + 1,
+				name.c_str(),
+				static_cast<unsigned long long>(r.fva),
+				effects.c_str(),
+				static_cast<unsigned long long>(r.fx->instr_total));
+		}
+	}
+
 	msg("----------------------------------------------------------\n\n");
 	// [EFFECTS-SUMMARY] --- end ---
 
@@ -86,6 +86,11 @@ struct FunctionEffects {
 /// \brief \n Пишет heap-указатель в out-параметр (store через адрес параметра).  \n
 	bool writes_heap_to_outparam = false;
 
+/// \brief \n Собственные побочные эффекты, биты TransitiveEffects::Effect.  \n
+	uint8_t local_effects = 0;
+/// \brief \n Эффекты функции вместе со всеми вызываемыми ею (транзитивно).  \n
+	uint8_t transitive_effects = 0;
+
 	
 };
 // [EFFECTS] --- end ---
@@ -127,6 +132,10 @@ public:
 	int arg_counter = 0;
 	// количество параметров в векторе для анализа 
 	int cmd_arg = 0;
+	// файл для сигнатур библиотек при следующем экспорте ('bb libsig save'),
+	// после записи очищается; static - общий для копий exporter в единицах
+	// трансляции, экспорт BinExport2 идёт не через копию CMD
+	static inline std::string library_signature_output;
 
 
 /// \brief \n Структура с данными об инструкции функций в pe файле...
@@ -289,6 +298,12 @@ public:
 		std::string s_class{};			///< класс сегмента
 		ea_t start_address{};			///< адрес начала включая
 		ea_t end_address{};				///< адрес окончания исключая
+		// Профиль байтов сегмента, см. SB::ByteProfile; пусто - байтов нет
+		double entropy{};				///< энтропия Шеннона, бит на байт (0..8)
+		double printable_ratio{};		///< доля печатаемых ASCII-байтов (0..1)
+		std::vector<uint64_t> histogram{};	///< число байтов каждого значения, 256 элементов
+		std::vector<float> window_entropy{};	///< энтропия окон по SB::ByteProfile::kWindowSize байт
+		std::vector<float> window_printable_ratio{};	///< доля печатаемых байтов окон
 	} pe_segment;
 
 
@@ -440,6 +455,48 @@ public:
 	void ParseCMD(const std::string &cmd_command) const;
 	void CommandPrintHelp() const;
 	void CommandFunctionParse(std::vector<std::string> &command) const;
+
+/// \brief \n Сравнить два файла .BinExport и сохранить таблицу сопоставления функций ...
+/// \details Файлы запрашиваются диалогами: в строке CMD допустимы только буквы, цифры и пробелы.
+	void CommandDiff() const;
+
+/// \brief \n Найти в индексе похожих функций кандидатов для функции по адресу ...
+/// \details Индекс берётся из каталога последнего экспорта BinExport, текущая база
+/// \details должна быть в нём проиндексирована (индекс дописывается при каждом экспорте).
+	void CommandSimilar(const std::vector<std::string>& command) const;
+
+/// \brief \n Запросы к графу вызовов: 'callees', 'callers' (транзитивно) и 'reach' ...
+/// \details Граф сжимается в компоненты сильной связности, достижимость отвечает\n
+/// \details индекс SB::CallGraphIndex, который строится по ссылкам IDA и кэшируется\n
+/// \details до изменения функций или ссылок кода в базе (события HT_IDB).
+	void CommandCallGraph(const std::vector<std::string>& command) const;
+
+/// \brief \n Снять обработчик событий базы и освободить кэш индекса графа вызовов ...
+/// \details Вызывается при выгрузке плагина.
+	static void ReleaseCallGraphIndex();
+
+/// \brief \n Сигнатуры библиотек: 'load' - выбрать каталог наборов, 'save' - файл ...
+/// \details Наборы из каталога применяются при каждом экспорте. Файл для 'save'\n
+/// \details заполняется сигнатурами именованных функций при следующем экспорте.
+	void CommandLibrarySignatures(const std::vector<std::string>& command) const;
+
+/// \brief \n Поиск байтовых образцов с масками по всем сегментам ...
+/// \details 'bb search 48 8b xx xx e8 or 55 8b ec' - байты парами шестнадцатеричных\n
+/// \details цифр, 'xx' - любой байт, образцы разделяются 'or'. Вхождения\n
+/// \details группируются по функциям из function_index и local_func_address, до\n
+/// \details первого заполнения индекса - по функциям IDA.
+	void CommandByteSearch(const std::vector<std::string>& command) const;
+
+/// \brief \n Мягкий бюджет функции при экспорте, в базовых блоках ...
+/// \details 'bb budget' - текущее значение, 'bb budget 20000' - новое\n
+/// \details (не меньше 1000, см. Settings::setExportFunctionBudget).
+	void CommandFunctionBudget(const std::vector<std::string>& command) const;
+
+/// \brief \n Отчёт об энтропии сегментов: сжатые и шифрованные участки ...
+/// \details По segments_data: размер, энтропия, доля печатаемых байтов и участки\n
+/// \details окон с энтропией от SB::ByteProfile::kHighEntropy. Выводится при экспорте\n
+/// \details и командой 'bb entropy'.
+	void PrintEntropyReport() const;
 	void ParseCMDFunctionAbout(ea_t address) const;
 	int FunctionInstructionCount(const ea_t start_address, const ea_t end_address) const;
 
@@ -557,6 +614,15 @@ public:
 /// \brief \n
 	std::vector<PeSegment> segments_data;
 
+
+/// \brief \n Теги криптографических констант, которые использует функция \n
+/// - key -  адрес начала функции
+/// - item - теги через ", " (например "aes-sbox, sha1-init") \n
+/// заполняется при экспорте, см. SB::CryptoConstants
+/// \n\n
+/// \ingroup FUNCTION_W
+	std::map<ea_t, std::string> crypto_tags;
+
 	// [STACK] --- begin ---
 
 /// \brief \n Статическая PE-информация о стеке процесса/потоков по умолчанию. \n
@@ -35,6 +35,8 @@
 // clang-format on
 
 #include "base/logging.h"
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/match.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/zynamics/binexport/flow_analysis.h"
 #include "arm.h"
@@ -46,6 +48,14 @@
 #include "ppc.h"
 #include "types_container.h"
 #include "util.h"
+#include "third_party/zynamics/binexport/byte_profile.h"
+#include "third_party/zynamics/binexport/call_graph_index.h"
+#include "third_party/zynamics/binexport/crypto_constants.h"
+#include "third_party/zynamics/binexport/heap_tracking.h"
+#include "third_party/zynamics/binexport/library_signatures.h"
+#include "third_party/zynamics/binexport/stack_depth.h"
+#include "third_party/zynamics/binexport/transitive_effects.h"
+#include "third_party/zynamics/binexport/util/filesystem.h"
 #include "third_party/zynamics/binexport/util/format.h"
 #include "third_party/zynamics/binexport/util/timer.h"
 #include "third_party/zynamics/binexport/x86_nop.h"
@@ -105,6 +115,66 @@ namespace security::binexport {
 		return modules;
 	}
 
+/// \brief \n Известна ли по имени функция как невозвратная ...
+/// \details Сравнение без префикса __imp_, ведущих подчёркиваний и суффикса @N (stdcall).
+	bool IsNoReturnName(absl::string_view name) {
+		static constexpr absl::string_view kNoReturnNames[] = {
+			"abort", "amsg_exit", "assert_fail", "crtExitProcess",
+			"CxxThrowException", "cxa_rethrow", "cxa_throw", "exit", "Exit",
+			"ExitProcess", "ExitThread", "FatalAppExitA", "FatalAppExitW",
+			"FatalExit", "FreeLibraryAndExitThread", "invalid_parameter_noinfo_noreturn",
+			"longjmp", "quick_exit", "RaiseFailFastException", "report_gsfailure",
+			"report_rangecheckfailure", "RtlExitUserProcess", "RtlExitUserThread",
+			"RtlRaiseStatus", "stack_chk_fail", "std_terminate", "terminate",
+			"Unwind_Resume", "?terminate@@YAXXZ",
+		};
+		if (absl::StartsWith(name, "__imp_")) {
+			name.remove_prefix(6);
+		}
+		while (!name.empty() && name.front() == '_') {
+			name.remove_prefix(1);
+		}
+		const size_t at = name.rfind('@');
+		if (at != absl::string_view::npos && at != 0 && name.front() != '?') {
+			name = name.substr(0, at);
+		}
+		return std::find(std::begin(kNoReturnNames), std::end(kNoReturnNames),
+			name) != std::end(kNoReturnNames);
+	}
+
+/// \brief \n Начальное множество невозвратных функций для FlowGraph::SetNoReturnFunctions() ...
+/// \details Импорт с известными именами (адрес ячейки импорта - цель вызова) и функции,\n
+/// \details которые IDA пометила FUNC_NORET или которые называются так же.
+	std::vector<Address> GetNoReturnSeeds() {
+		std::vector<Address> seeds;
+		for (uint i = 0; i < get_import_module_qty(); ++i) {
+			enum_import_names(
+				i,
+				static_cast<import_enum_cb_t*>([](ea_t ea, const char* name,
+					uval_t /* ord */,
+					void* param) -> int {
+				if (name != nullptr && IsNoReturnName(name)) {
+					static_cast<std::vector<Address>*>(param)->push_back(ea);
+				}
+				return 1;  // Continue enumeration
+			}),
+				static_cast<void*>(&seeds));
+		}
+		qstring name;
+		for (size_t i = 0; i < get_func_qty(); ++i) {
+			const func_t* func = getn_func(i);
+			if (func == nullptr) {
+				continue;
+			}
+			if ((func->flags & FUNC_NORET) ||
+				(get_func_name(&name, func->start_ea) > 0 &&
+					IsNoReturnName(name.c_str()))) {
+				seeds.push_back(func->start_ea);
+			}
+		}
+		return seeds;
+	}
+
 	std::string GetModuleName(Address address, const ModuleMap& modules) {
 
 		TRACE_FN();
@@ -174,7 +244,9 @@ namespace security::binexport {
 		FlowGraph* flow_graph, CallGraph* call_graph,
 		AddressReferences* address_references,
 		EntryPointManager* entry_point_adder,
-		const ModuleMap& modules) {
+		const ModuleMap& modules,
+		const StringLiteralTable& string_literals,
+		std::vector<Address>* unresolved_call_sites) {
 
 		TRACE_FN();
 		
@@ -299,6 +371,7 @@ namespace security::binexport {
 			if (is_call_insn(ida_instruction)) {
 				// Call to imported function or call [offset+eax*4]
 				// Вызов импортируемой функции или вызов [offset+eax*4]
+				bool has_reference = false;
 				for (bool ok = xref.first_from(ida_instruction.ea, XREF_DATA); ok;
 					ok = xref.next_from()) {
 					if (IsPossibleFunction(xref.to, modules)) {
@@ -307,19 +380,38 @@ namespace security::binexport {
 						entry_point_adder->Add(xref.to, EntryPoint::Source::CALL_TARGET);
 					}
 					instruction->SetFlag(FLAG_CALL, true);
+					has_reference = true;
 					address_references->emplace_back(
 						ida_instruction.ea, GetSourceExpressionId(*instruction, xref.to),
 						xref.to, TYPE_CALL_INDIRECT);
 				}
+				// call eax, call [eax+8]: без ссылок FLAG_CALL не ставится (иначе
+				// FindBasicBlockBreaks() применит к нему эвристику noreturn), адрес
+				// запоминается для оценки глубины стека и эффектов.
+				if (!has_reference) {
+					unresolved_call_sites->push_back(ida_instruction.ea);
+				}
 			}
 			else {  // Assume data reference as in "push aValue"
 				// Предполагать ссылку на данные, как в "push aValue"
 				for (bool ok = xref.first_from(ida_instruction.ea, XREF_DATA); ok;
 					ok = xref.next_from()) {
-					if (!GetStringReference(ida_instruction.ea).empty()) {
+					// Каждая ссылка на строку получает свой тип и размер, текст
+					// пишет в таблицу строк BinExport2 WriteStrings().
+					// Строка - только смещение (dr_O) на литерал, отмеченный в IDA,
+					// как в GetStringReference(): чтение и запись данных, похожих
+					// на строку, остаются TYPE_DATA.
+					const StringLiteralTable::Literal* literal =
+						xref.type == dr_O && is_strlit(get_flags(xref.to))
+						? string_literals.Find(xref.to) : nullptr;
+					if (literal != nullptr) {
 						address_references->emplace_back(
 							ida_instruction.ea, GetSourceExpressionId(*instruction, xref.to),
-							xref.to, TYPE_DATA_STRING);
+							xref.to,
+							literal->encoding == StringLiteralTable::kUtf16
+							? TYPE_DATA_WIDE_STRING
+							: TYPE_DATA_STRING,
+							literal->size);
 					}
 					else {
 						address_references->emplace_back(
@@ -335,7 +427,9 @@ namespace security::binexport {
 		FlowGraph* flow_graph, CallGraph* call_graph,
 		AddressReferences* address_references,
 		EntryPointManager* entry_point_adder,
-		const ModuleMap& modules) {
+		const ModuleMap& modules,
+		const StringLiteralTable& string_literals,
+		std::vector<Address>* unresolved_call_sites) {
 
 		TRACE_FN();
 		
@@ -460,6 +554,7 @@ namespace security::binexport {
 			if (is_call_insn(ida_instruction)) {
 				// Call to imported function or call [offset+eax*4]
 				// Вызов импортируемой функции или вызов [offset+eax*4]
+				bool has_reference = false;
 				for (bool ok = xref.first_from(ida_instruction.ea, XREF_DATA); ok;
 					ok = xref.next_from()) {
 					if (IsPossibleFunction(xref.to, modules)) {
@@ -468,19 +563,38 @@ namespace security::binexport {
 						entry_point_adder->Add(xref.to, EntryPoint::Source::CALL_TARGET);
 					}
 					instruction->SetFlag(FLAG_CALL, true);
+					has_reference = true;
 					address_references->emplace_back(
 						ida_instruction.ea, GetSourceExpressionId(*instruction, xref.to),
 						xref.to, TYPE_CALL_INDIRECT);
 				}
+				// call eax, call [eax+8]: без ссылок FLAG_CALL не ставится (иначе
+				// FindBasicBlockBreaks() применит к нему эвристику noreturn), адрес
+				// запоминается для оценки глубины стека и эффектов.
+				if (!has_reference) {
+					unresolved_call_sites->push_back(ida_instruction.ea);
+				}
 			}
 			else {  // Assume data reference as in "push aValue"
 					// Предполагать ссылку на данные, как в "push aValue"
 				for (bool ok = xref.first_from(ida_instruction.ea, XREF_DATA); ok;
 					ok = xref.next_from()) {
-					if (!GetStringReference(ida_instruction.ea).empty()) {
+					// Каждая ссылка на строку получает свой тип и размер, текст
+					// пишет в таблицу строк BinExport2 WriteStrings().
+					// Строка - только смещение (dr_O) на литерал, отмеченный в IDA,
+					// как в GetStringReference(): чтение и запись данных, похожих
+					// на строку, остаются TYPE_DATA.
+					const StringLiteralTable::Literal* literal =
+						xref.type == dr_O && is_strlit(get_flags(xref.to))
+						? string_literals.Find(xref.to) : nullptr;
+					if (literal != nullptr) {
 						address_references->emplace_back(
 							ida_instruction.ea, GetSourceExpressionId(*instruction, xref.to),
-							xref.to, TYPE_DATA_STRING);
+							xref.to,
+							literal->encoding == StringLiteralTable::kUtf16
+							? TYPE_DATA_WIDE_STRING
+							: TYPE_DATA_STRING,
+							literal->size);
 					}
 					else {
 						address_references->emplace_back(
@@ -494,6 +608,597 @@ namespace security::binexport {
 
 
 
+/// \brief \n Наибольшая глубина стека по графу вызовов и сравнение с резервом стека PE ...
+/// \details Кадр функции - локальные переменные, сохраняемые регистры, адрес возврата\n
+/// \details и аргументы, снимаемые при возврате (по func_t IDA). Вызовы без ребра в графе\n
+/// \details вызовов, вызовы без ссылок (unresolved_call_sites, по возрастанию адреса)\n
+/// \details и функции без кадра (импорт) оцениваются величиной из настроек.
+	void ReportStackDepth(const CallGraphIndex& index, const CallGraph& call_graph,
+		const FlowGraph& flow_graph, const std::vector<Address>& unresolved_call_sites,
+		uint64_t stack_reserve) {
+		std::vector<uint64_t> frame_sizes(index.GetFunctionCount(),
+			StackDepth::kUnknownFrame);
+		std::vector<bool> unresolved_calls(index.GetFunctionCount(), false);
+
+		// Сколько инструкций вызова функции имеют рёбра. Рёбра отсортированы по
+		// (источник, функция, цель), повторы одного вызова идут подряд.
+		absl::flat_hash_map<const Function*, size_t> resolved_calls;
+		const EdgeInfo* previous = nullptr;
+		for (const EdgeInfo& edge : call_graph.GetEdges()) {
+			if (edge.function_ != nullptr &&
+				(previous == nullptr || previous->source_ != edge.source_ ||
+					previous->function_ != edge.function_)) {
+				++resolved_calls[edge.function_];
+			}
+			previous = &edge;
+		}
+
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			const Function& function = *entry.second;
+			const uint32_t id = index.GetFunction(function.GetEntryPoint());
+			if (id == CallGraphIndex::kNone) {
+				continue;
+			}
+			const func_t* ida_func = get_func(function.GetEntryPoint());
+			if (ida_func != nullptr && ida_func->start_ea == function.GetEntryPoint()) {
+				frame_sizes[id] = ida_func->frsize + ida_func->frregs +
+					get_frame_retsize(ida_func) + ida_func->argsize;
+			}
+			size_t calls = 0;
+			bool has_unresolved_site = false;
+			for (const auto* basic_block : function.GetBasicBlocks()) {
+				for (const auto& instruction : *basic_block) {
+					calls += instruction.HasFlag(FLAG_CALL);
+					has_unresolved_site = has_unresolved_site ||
+						std::binary_search(unresolved_call_sites.begin(),
+							unresolved_call_sites.end(), instruction.GetAddress());
+				}
+			}
+			const auto resolved = resolved_calls.find(&function);
+			unresolved_calls[id] = has_unresolved_site ||
+				calls > (resolved != resolved_calls.end() ? resolved->second : 0);
+		}
+
+		const uint64_t call_estimate = Settings::getExportStackCallEstimate();
+		const StackDepth stack_depth(index, frame_sizes, unresolved_calls,
+			call_estimate);
+
+		size_t estimated = 0;
+		size_t over_reserve = 0;
+		for (uint32_t i = 0; i < index.GetFunctionCount(); ++i) {
+			estimated += !stack_depth.IsUnbounded(i) && stack_depth.IsEstimated(i);
+			over_reserve += stack_reserve != 0 && !stack_depth.IsUnbounded(i) &&
+				stack_depth.GetDepth(i) > stack_reserve;
+		}
+		msg("    Stack depth: %d of %d functions unbounded (recursion), %d estimated "
+			"(indirect/external calls as %llu bytes) \n",
+			static_cast<int>(stack_depth.GetUnboundedCount()),
+			static_cast<int>(index.GetFunctionCount()), static_cast<int>(estimated),
+			static_cast<unsigned long long>(call_estimate));
+
+		const uint32_t deepest = stack_depth.GetDeepestFunction();
+		if (deepest == StackDepth::kNone) {
+			return;
+		}
+		const uint64_t depth = stack_depth.GetDepth(deepest);
+		msg("        deepest %llx: %llu bytes%s, stack reserve %llu bytes%s \n",
+			index.GetFunctionAddress(deepest), static_cast<unsigned long long>(depth),
+			stack_depth.IsEstimated(deepest) ? " (estimated)" : "",
+			static_cast<unsigned long long>(stack_reserve),
+			stack_reserve == 0 ? " (unknown)"
+			: depth > stack_reserve ? " - EXCEEDED" : "");
+		for (const uint32_t function : stack_depth.GetDeepestPath(deepest)) {
+			msg("            %llx  %llu \n", index.GetFunctionAddress(function),
+				static_cast<unsigned long long>(stack_depth.GetDepth(function)));
+		}
+		if (over_reserve != 0) {
+			msg("        %d functions may exceed the stack reserve \n",
+				static_cast<int>(over_reserve));
+		}
+	}
+
+/// \brief \n Вид вызываемой функции для отслеживания кучи: 1 - аллокатор, 2 - освобождение ...
+/// \details По подстроке (деманглированного) имени, как в [ALLOC DETECT].
+	int GetHeapCalleeKind(absl::string_view name) {
+		static constexpr absl::string_view kAllocNames[] = {
+			"malloc", "realloc", "calloc", "operator new", "HeapAlloc", "LocalAlloc",
+			"GlobalAlloc",
+		};
+		static constexpr absl::string_view kFreeNames[] = {
+			"free", "operator delete", "HeapFree", "LocalFree", "GlobalFree",
+		};
+		for (const absl::string_view part : kAllocNames) {
+			if (absl::StrContains(name, part)) {
+				return 1;
+			}
+		}
+		for (const absl::string_view part : kFreeNames) {
+			if (absl::StrContains(name, part)) {
+				return 2;
+			}
+		}
+		return 0;
+	}
+
+/// \brief \n Места вызова аллокаторов и функций освобождения по возрастанию адреса ...
+/// \details Цель вызова - по code-xref или операнду (в том числе ячейка импорта),\n
+/// \details thunk разворачивается до цели. Имя каждой цели проверяется один раз.
+	void GetHeapCalls(const detego::Instructions& instructions,
+		std::vector<Address>* alloc_calls, std::vector<Address>* free_calls) {
+		absl::flat_hash_map<Address, int> callee_kinds;
+		qstring name;
+		qstring demangled;
+		for (const auto& instruction : instructions) {
+			if (!instruction.HasFlag(FLAG_CALL)) {
+				continue;
+			}
+			const Address address = instruction.GetAddress();
+			ea_t callee = get_first_fcref_from(address);
+			insn_t insn;
+			if (callee == BADADDR && decode_insn(&insn, address) > 0) {
+				const op_t& operand = insn.ops[0];
+				if (operand.type == o_near || operand.type == o_far ||
+					operand.type == o_mem) {
+					callee = operand.addr;
+				}
+			}
+			if (callee == BADADDR) {
+				continue;
+			}
+			auto it = callee_kinds.find(callee);
+			if (it == callee_kinds.end()) {
+				ea_t target = callee;
+				if (func_t* func = get_func(callee)) {
+					const ea_t thunk_target = ResolveThunkTarget(func);
+					if (thunk_target != BADADDR) {
+						target = thunk_target;
+					}
+				}
+				int kind = 0;
+				if (get_name(&name, target) > 0) {
+					if (demangle_name(&demangled, name.c_str(), MNG_SHORT_FORM) > 0) {
+						name = demangled;
+					}
+					kind = GetHeapCalleeKind(name.c_str());
+				}
+				it = callee_kinds.emplace(callee, kind).first;
+			}
+			if (it->second == 1) {
+				alloc_calls->push_back(address);
+			}
+			else if (it->second == 2) {
+				free_calls->push_back(address);
+			}
+		}
+	}
+
+/// \brief \n Отслеживание указателей из аллокаторов и запись результатов в FunctionEffects ...
+/// \details Места вызова определяются в главном потоке (API IDA), сам анализ\n
+/// \details (HeapTracking) идёт по функциям параллельно. Только для x86.
+	void ReportHeapTracking(const FlowGraph& flow_graph,
+		const detego::Instructions& instructions, Exporter* exporter) {
+		if (GetArchitecture() != kX86) {
+			return;
+		}
+		std::vector<Address> alloc_calls;
+		std::vector<Address> free_calls;
+		GetHeapCalls(instructions, &alloc_calls, &free_calls);
+		const HeapTracking heap_tracking(flow_graph, alloc_calls, free_calls);
+
+		size_t returns_heap = 0;
+		size_t writes_outparam = 0;
+		for (const HeapTracking::Summary& summary : heap_tracking.summaries()) {
+			FunctionEffects& fx = exporter->GetOrCreateFuncEffects(summary.function);
+			fx.alloc_calls = summary.alloc_calls;
+			fx.free_calls = summary.free_calls;
+			fx.heap_touches = summary.heap_touches;
+			fx.heap_first_touch_events = summary.first_touch_events;
+			fx.returns_heap_ptr = summary.returns_heap_ptr;
+			fx.writes_heap_to_outparam = summary.writes_heap_to_outparam;
+			returns_heap += summary.returns_heap_ptr;
+			writes_outparam += summary.writes_heap_to_outparam;
+		}
+		for (auto& pe_instruction : exporter->vector_pe_instructions) {
+			pe_instruction.is_alloc_call = std::binary_search(
+				alloc_calls.begin(), alloc_calls.end(), pe_instruction.address);
+			pe_instruction.touches_heap =
+				heap_tracking.TouchesHeap(pe_instruction.address);
+		}
+		msg("    Heap tracking: %d alloc / %d free call sites in %d functions, "
+			"%d heap accesses, %d functions return heap pointers, %d store them "
+			"to out-parameters \n",
+			static_cast<int>(alloc_calls.size()), static_cast<int>(free_calls.size()),
+			static_cast<int>(heap_tracking.summaries().size()),
+			static_cast<int>(heap_tracking.GetTouchingInstructions().size()),
+			static_cast<int>(returns_heap), static_cast<int>(writes_outparam));
+	}
+
+/// \brief \n Инструкции с записью в глобальные данные (data-xref dr_W) и косвенные\n
+/// вызовы (цель в регистре или памяти по регистру, без code-xref) по возрастанию адреса.\n
+/// Вызовы без ссылок (call eax) не имеют FLAG_CALL и берутся из unresolved_call_sites.
+	void GetEffectInstructions(const detego::Instructions& instructions,
+		const std::vector<Address>& unresolved_call_sites,
+		std::vector<Address>* global_writes, std::vector<Address>* indirect_calls) {
+		xrefblk_t xref;
+		insn_t insn;
+		for (const auto& instruction : instructions) {
+			const Address address = instruction.GetAddress();
+			for (bool ok = xref.first_from(address, XREF_DATA); ok;
+				ok = xref.next_from()) {
+				if (xref.type == dr_W) {
+					global_writes->push_back(address);
+					break;
+				}
+			}
+			const bool is_call = instruction.HasFlag(FLAG_CALL) ||
+				std::binary_search(unresolved_call_sites.begin(),
+					unresolved_call_sites.end(), address);
+			if (is_call && get_first_fcref_from(address) == BADADDR &&
+				decode_insn(&insn, address) > 0) {
+				const optype_t type = insn.ops[0].type;
+				if (type == o_reg || type == o_phrase || type == o_displ) {
+					indirect_calls->push_back(address);
+				}
+			}
+		}
+	}
+
+/// \brief \n Транзитивные побочные эффекты функций по графу вызовов ...
+/// \details Собственные эффекты берутся из FunctionEffects (ReportHeapTracking() уже\n
+/// \details отработал), из инструкций функции и, для импорта, по имени. Имя\n
+/// \details проверяется только у импортированных функций (без тела) и у thunk,\n
+/// \details разворачиваемых до цели: локальная функция с "free" в имени аллокатором\n
+/// \details не считается. Маски записываются в FunctionEffects::local_effects и\n
+/// \details transitive_effects.
+	void ReportTransitiveEffects(const CallGraphIndex& index,
+		const FlowGraph& flow_graph, const detego::Instructions& instructions,
+		const std::vector<Address>& unresolved_call_sites, Exporter* exporter) {
+		using Effect = TransitiveEffects::Effect;
+		std::vector<Address> global_writes;
+		std::vector<Address> indirect_calls;
+		GetEffectInstructions(instructions, unresolved_call_sites, &global_writes,
+			&indirect_calls);
+
+		std::vector<uint8_t> local_effects(index.GetFunctionCount(), 0);
+		qstring name;
+		qstring demangled;
+		for (uint32_t i = 0; i < index.GetFunctionCount(); ++i) {
+			ea_t target = index.GetFunctionAddress(i);
+			func_t* func = get_func(target);
+			if (func != nullptr && (func->flags & FUNC_THUNK) != 0) {
+				target = ResolveThunkTarget(func);
+				if (target == BADADDR) {
+					continue;
+				}
+			}
+			else {
+				const Function* function = flow_graph.GetFunction(target);
+				if (function != nullptr && !function->IsImported()) {
+					continue;
+				}
+			}
+			if (get_name(&name, target) <= 0) {
+				continue;
+			}
+			if (demangle_name(&demangled, name.c_str(), MNG_SHORT_FORM) > 0) {
+				name = demangled;
+			}
+			const int kind = GetHeapCalleeKind(name.c_str());
+			local_effects[i] = kind == 1 ? TransitiveEffects::kAllocates
+				: kind == 2 ? TransitiveEffects::kFrees : 0;
+		}
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			const Function& function = *entry.second;
+			const uint32_t id = index.GetFunction(function.GetEntryPoint());
+			if (id == CallGraphIndex::kNone) {
+				continue;
+			}
+			uint8_t& effects = local_effects[id];
+			for (const auto* basic_block : function.GetBasicBlocks()) {
+				for (const auto& instruction : *basic_block) {
+					const Address address = instruction.GetAddress();
+					if (std::binary_search(global_writes.begin(), global_writes.end(),
+						address)) {
+						effects |= TransitiveEffects::kWritesGlobals;
+					}
+					if (std::binary_search(indirect_calls.begin(), indirect_calls.end(),
+						address)) {
+						effects |= TransitiveEffects::kDispatchesViaFunctionPointer;
+					}
+				}
+			}
+			if (const FunctionEffects* fx =
+				exporter->FindFuncEffects(function.GetEntryPoint())) {
+				effects |= (fx->alloc_calls ? TransitiveEffects::kAllocates : 0) |
+					(fx->free_calls ? TransitiveEffects::kFrees : 0) |
+					(fx->global_writes ? TransitiveEffects::kWritesGlobals : 0) |
+					(fx->heap_touches ? TransitiveEffects::kTouchesHeap : 0) |
+					(fx->dispatches_via_funptr
+						? TransitiveEffects::kDispatchesViaFunctionPointer : 0);
+			}
+		}
+
+		const TransitiveEffects effects(index, std::move(local_effects));
+		int local_counts[TransitiveEffects::kEffectCount] = {};
+		int transitive_counts[TransitiveEffects::kEffectCount] = {};
+		for (uint32_t i = 0; i < index.GetFunctionCount(); ++i) {
+			const uint8_t local = effects.GetLocalEffects(i);
+			const uint8_t transitive = effects.GetEffects(i);
+			if (transitive == 0) {
+				continue;
+			}
+			FunctionEffects& fx =
+				exporter->GetOrCreateFuncEffects(index.GetFunctionAddress(i));
+			fx.local_effects = local;
+			fx.transitive_effects = transitive;
+			for (int bit = 0; bit < TransitiveEffects::kEffectCount; ++bit) {
+				local_counts[bit] += local >> bit & 1;
+				transitive_counts[bit] += transitive >> bit & 1;
+			}
+		}
+		msg("    Transitive effects: %d functions, %d waves (own / with callees) \n",
+			static_cast<int>(index.GetFunctionCount()),
+			static_cast<int>(effects.GetWaveCount()));
+		for (int bit = 0; bit < TransitiveEffects::kEffectCount; ++bit) {
+			msg("        %-12s %d / %d \n",
+				TransitiveEffects::GetEffectName(static_cast<Effect>(1 << bit)),
+				local_counts[bit], transitive_counts[bit]);
+		}
+	}
+
+/// \brief \n Теги криптографических констант функций ...
+/// \details Таблицы ищутся одним проходом по address_space, функции для них - по\n
+/// \details ссылкам на данные (на начало таблицы или элемента IDA, в котором она\n
+/// \details лежит) или как содержащие таблицу. Непосредственные операнды\n
+/// \details проверяются по инструкциям функций. Теги записываются в\n
+/// \details Exporter::crypto_tags и комментарием функции в модель BinExport.
+	void ReportCryptoConstants(CallGraph* call_graph, const FlowGraph& flow_graph,
+		const AddressSpace& address_space, Exporter* exporter) {
+		const CryptoConstants& constants = CryptoConstants::Get();
+		Timer<> timer;
+		const auto table_hits = constants.FindInMemory(address_space);
+		const auto immediate_hits = constants.FindInImmediates(flow_graph);
+		const double scan_time = timer.elapsed();
+
+		// пары (функция, тег)
+		std::vector<std::pair<Address, uint32_t>> tags;
+		for (const auto& hit : immediate_hits) {
+			tags.emplace_back(hit.function, hit.tag);
+		}
+		const auto add_function = [&flow_graph, &tags](ea_t address, uint32_t tag) {
+			const func_t* func = get_func(address);
+			if (func != nullptr && flow_graph.GetFunction(func->start_ea) != nullptr) {
+				tags.emplace_back(func->start_ea, tag);
+			}
+		};
+		const auto add_referrers = [&add_function](ea_t address, uint32_t tag) {
+			xrefblk_t xref;
+			for (bool ok = xref.first_to(address, XREF_DATA); ok; ok = xref.next_to()) {
+				add_function(xref.from, tag);
+			}
+		};
+		for (const auto& hit : table_hits) {
+			add_function(hit.address, hit.tag);
+			add_referrers(hit.address, hit.tag);
+			const ea_t head = get_item_head(hit.address);
+			if (head != hit.address) {
+				add_referrers(head, hit.tag);
+			}
+		}
+		std::sort(tags.begin(), tags.end());
+		tags.erase(std::unique(tags.begin(), tags.end()), tags.end());
+
+		exporter->crypto_tags.clear();
+		for (const auto& entry : tags) {
+			std::string& text = exporter->crypto_tags[entry.first];
+			text.append(text.empty() ? "" : ", ").append(constants.GetTag(entry.second));
+		}
+		for (const auto& entry : exporter->crypto_tags) {
+			// UA_MAXOP + 1..7 заняты комментариями IDA (UA_MAXOP + 7 - имя функции,
+			// см. GetLocationNames()), ключ комментария - (адрес, операнд).
+			call_graph->AddComment(entry.first, UA_MAXOP + 8,
+				"crypto: " + entry.second, Comment::FUNCTION, /*repeatable=*/false);
+		}
+
+		msg("    Crypto constants: %d tables, %d immediates, %d functions tagged in %s \n",
+			static_cast<int>(table_hits.size()), static_cast<int>(immediate_hits.size()),
+			static_cast<int>(exporter->crypto_tags.size()),
+			HumanReadableDuration(scan_time).c_str());
+		for (const auto& hit : table_hits) {
+			msg("        %llx %s \n", static_cast<unsigned long long>(hit.address),
+				constants.GetTag(hit.tag));
+		}
+		for (const auto& entry : exporter->crypto_tags) {
+			msg("        %llx %-40s %s \n", static_cast<unsigned long long>(entry.first),
+				flow_graph.GetFunction(entry.first)->GetName(Function::DEMANGLED).c_str(),
+				entry.second.c_str());
+		}
+	}
+
+/// \brief \n Профиль байтов сегментов: энтропия, гистограмма, доля печатаемых ...
+/// \details Блоки address_space совпадают с сегментами IDA, профиль блока\n
+/// \details записывается в элемент Exporter::segments_data с тем же адресом\n
+/// \details начала. Отчёт - Exporter::PrintEntropyReport().
+	void ProfileSegments(const AddressSpace& address_space, Exporter* exporter) {
+		Timer<> timer;
+		const ByteProfile profile(address_space);
+		const double profile_time = timer.elapsed();
+
+		uint64_t profiled = 0;
+		for (const auto& block : profile.blocks()) {
+			profiled += block.size;
+			for (auto& segment : exporter->segments_data) {
+				if (segment.start_address != block.address) {
+					continue;
+				}
+				segment.entropy = block.entropy;
+				segment.printable_ratio = block.printable_ratio;
+				segment.histogram.assign(block.histogram.begin(), block.histogram.end());
+				segment.window_entropy = block.window_entropy;
+				segment.window_printable_ratio = block.window_printable_ratio;
+				break;
+			}
+		}
+
+		msg("    Segment profile: %d blocks, %.1f MB in %s \n",
+			static_cast<int>(profile.blocks().size()), profiled / 1048576.0,
+			HumanReadableDuration(profile_time).c_str());
+		exporter->PrintEntropyReport();
+	}
+
+/// \brief \n Образец сигнатуры библиотеки по началу функции в IDA ...
+/// \details Берутся до LibrarySignatures::kMaxPatternSize байт тела функции. Байты\n
+/// \details адресов (переходы, вызовы, обращения к памяти и смещения) маскируются:\n
+/// \details от начала операнда до начала следующего или до конца инструкции.
+	bool GetSignaturePattern(Address address, std::string* bytes,
+		std::string* mask) {
+		const func_t* func = get_func(address);
+		if (func == nullptr || func->start_ea != address) {
+			return false;
+		}
+		const size_t size = static_cast<size_t>(std::min<ea_t>(
+			func->end_ea - address, LibrarySignatures::kMaxPatternSize));
+		bytes->assign(size, '\0');
+		if (size == 0 ||
+			get_bytes(&(*bytes)[0], size, address) != static_cast<ssize_t>(size)) {
+			return false;
+		}
+		mask->assign(size, '\xFF');
+
+		insn_t insn;
+		for (ea_t ea = address; ea < address + size;) {
+			if (decode_insn(&insn, ea) <= 0) {
+				// Неразобранный хвост не сравнивается.
+				std::fill(mask->begin() + (ea - address), mask->end(), '\0');
+				break;
+			}
+			const flags_t flags = get_flags(ea);
+			for (int n = 0; n < UA_MAXOP && insn.ops[n].type != o_void; ++n) {
+				const op_t& op = insn.ops[n];
+				if (op.offb == 0 || !(op.type == o_near || op.type == o_far ||
+					op.type == o_mem || is_off(flags, n))) {
+					continue;
+				}
+				size_t end = insn.size;
+				for (int k = 0; k < UA_MAXOP && insn.ops[k].type != o_void; ++k) {
+					if (insn.ops[k].offb > op.offb && insn.ops[k].offb < end) {
+						end = insn.ops[k].offb;
+					}
+				}
+				for (size_t i = ea - address + op.offb;
+					i < std::min<size_t>(ea - address + end, size); ++i) {
+					(*mask)[i] = '\0';
+				}
+			}
+			ea += insn.size;
+		}
+		// Слишком общий образец совпадал бы с чужими функциями.
+		return std::count(mask->begin(), mask->end(), '\xFF') >= 8;
+	}
+
+/// \brief \n Записать сигнатуры именованных функций базы в файл ...
+/// \details Набор называется по имени входного файла. Используется на эталонной\n
+/// \details базе библиотеки (например, .lib, загруженной в IDA).
+	void WriteLibrarySignatures(const FlowGraph& flow_graph,
+		const std::string& path) {
+		LibrarySignatures signatures;
+		const uint32_t library = signatures.AddLibrary(GetModuleName());
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			const Function& function = *entry.second;
+			const Function::FunctionType type = function.GetType(false);
+			if (!function.HasRealName() || function.GetBasicBlocks().empty() ||
+				(type != Function::TYPE_STANDARD && type != Function::TYPE_LIBRARY)) {
+				continue;
+			}
+			LibrarySignatures::Signature signature;
+			if (!GetSignaturePattern(function.GetEntryPoint(), &signature.bytes,
+				&signature.mask)) {
+				continue;
+			}
+			signature.library = library;
+			signature.name = function.GetName(Function::MANGLED);
+			signature.shape_hash = LibrarySignatures::GetShapeHash(function);
+			signatures.AddSignature(std::move(signature));
+		}
+		const absl::Status status = signatures.WriteFile(path);
+		if (!status.ok()) {
+			msg("    Library signatures - ERROR: %s \n",
+				std::string(status.message()).c_str());
+			return;
+		}
+		msg("    Library signatures: %d written to %s \n",
+			static_cast<int>(signatures.signatures().size()), path.c_str());
+	}
+
+/// \brief \n Распознать функции статических библиотек по наборам сигнатур ...
+/// \details Наборы (*.bxsig) берутся из каталога Settings::getExportLibrarySignaturesDir().\n
+/// \details Распознанные функции без имени получают имя, тип TYPE_LIBRARY и библиотеку\n
+/// \details в LibraryManager. Меняется только модель BinExport, база IDA - нет.
+	void RecognizeLibraryFunctions(FlowGraph* flow_graph, CallGraph* call_graph,
+		const AddressSpace& address_space) {
+		const std::string directory =
+			Settings::getExportLibrarySignaturesDir().toStdString();
+		if (directory.empty()) {
+			return;
+		}
+		Timer<> timer;
+		std::vector<std::string> entries;
+		absl::Status status = GetDirectoryEntries(directory, &entries);
+		LibrarySignatures signatures;
+		for (const auto& entry : entries) {
+			if (!status.ok()) {
+				break;
+			}
+			if (absl::EqualsIgnoreCase(GetFileExtension(entry), ".bxsig")) {
+				status = signatures.ReadFile(JoinPath(directory, entry));
+			}
+		}
+		if (!status.ok()) {
+			msg("    Library signatures - ERROR: %s \n",
+				std::string(status.message()).c_str());
+			return;
+		}
+		signatures.Build();
+		const auto load_time = absl::Seconds(timer.elapsed());
+		timer.restart();
+
+		const auto matches = signatures.Find(address_space, *flow_graph);
+		LibraryManager* library_manager = call_graph->GetLibraryManager();
+		std::vector<int> library_indices(signatures.libraries().size(), -1);
+		int recognized = 0;
+		qstring demangled;
+		for (const auto& match : matches) {
+			Function* function = flow_graph->GetFunction(match.function);
+			if (function->HasRealName() ||
+				function->GetType(true) != Function::TYPE_STANDARD) {
+				continue;
+			}
+			const auto& signature = signatures.signatures()[match.signature];
+			int& library_index = library_indices[signature.library];
+			if (library_index < 0) {
+				library_index = library_manager->AddKnownLibrary(
+					signatures.libraries()[signature.library],
+					LibraryManager::Linkage::kStatic);
+			}
+			library_manager->UseFunction(match.function, library_index);
+			library_manager->AddKnownFunction(
+				signatures.libraries()[signature.library], signature.name,
+				library_index, match.function);
+			function->SetType(Function::TYPE_LIBRARY);
+			function->SetLibraryIndex(library_index);
+			function->SetName(signature.name,
+				demangle_name(&demangled, signature.name.c_str(), MNG_SHORT_FORM) > 0
+				? std::string(demangled.c_str()) : std::string());
+			++recognized;
+		}
+		msg("    Library signatures: %d signatures (%d usable) loaded in %s, "
+			"%d functions recognized in %s \n",
+			static_cast<int>(signatures.signatures().size()),
+			static_cast<int>(signatures.GetAnchorCount()),
+			HumanReadableDuration(load_time).c_str(), recognized,
+			HumanReadableDuration(absl::Seconds(timer.elapsed())).c_str());
+	}
+
 	// начинаем анализ 
 
 	void AnalyzeFlowIda(EntryPoints* entry_points, const ModuleMap& modules,
@@ -505,6 +1210,7 @@ namespace security::binexport {
 
 		Timer<> timer;
 		AddressReferences address_references;
+		std::vector<Address> unresolved_call_sites;
 
 		// Add initial entry points as functions.
 		// Добавить начальные точки входа как функции.
@@ -521,7 +1227,7 @@ namespace security::binexport {
 		for (int i = 0; i < get_segm_qty(); ++i) {
 			const segment_t* segment = getnseg(i);
 			address_space.AddMemoryBlock(segment->start_ea,
-				GetSectionBytes(segment->start_ea),
+				GetSectionMemoryBlock(segment->start_ea),
 				GetPermissions(segment));
 			flags.AddMemoryBlock(
 				segment->start_ea,
@@ -533,7 +1239,8 @@ namespace security::binexport {
 		TypeSystem type_system(types, address_space);
 
 		Instruction::SetBitness(GetArchitectureBitness());
-		Instruction::SetGetBytesCallback(&GetBytes);
+		Instruction::SetVirtualMemory(&address_space);
+		Instruction::SetGetBytesCallback(&GetBytes);  // Только для адресов вне address_space.
 		Instruction::SetMemoryFlags(&flags);
 		std::function<Instruction(const insn_t&, CallGraph*, FlowGraph*, TypeSystem*)>
 			parse_instruction = nullptr;
@@ -562,6 +1269,12 @@ namespace security::binexport {
 			break;
 		}
 
+		msg("harvesting comments and strings\n");
+		StringLiteralTable string_literals;
+		string_literals.Scan(address_space);
+		const CommentIndex comment_index = CommentIndex::Build(&string_literals);
+		string_literals.Finish();
+
 		msg("flow analysis\n");
 		for (EntryPointManager entry_point_adder(entry_points, "flow analysis");
 			!entry_points->empty();) {
@@ -583,14 +1296,16 @@ namespace security::binexport {
 				continue;
 			}
 			AnalyzeFlow(ida_instruction, &new_instruction, flow_graph, call_graph,
-				&address_references, &entry_point_adder, modules);
-			call_graph->AddStringReference(address, GetStringReference(address));
-			GetComments(ida_instruction, &call_graph->GetComments());
+				&address_references, &entry_point_adder, modules, string_literals,
+				&unresolved_call_sites);
+			// Комментарии запрашиваются у IDA только для адресов из comment_index.
+			GetComments(ida_instruction, comment_index.Find(address),
+				&call_graph->GetComments());
 
 			if (mark_x86_nops) {
 				// FLAG_NOP is only important when reconstructing functions, thus we can set if after AnalyzeFlow().
 				//  FLAG_NOP важен только при реконструкции функций, поэтому мы можем установить его после AnalyzeFlow().
-				new_instruction.SetFlag(FLAG_NOP, IsNopX86(new_instruction.GetBytes()));
+				new_instruction.SetFlag(FLAG_NOP, IsNopX86(new_instruction.GetByteSpan()));
 			}
 			// информацию о инструкции кидаем в вектор !!!
 			instructions->push_back(new_instruction);
@@ -598,6 +1313,7 @@ namespace security::binexport {
 
 		msg("sorting instructions\n");
 		SortInstructions(instructions);
+		std::sort(unresolved_call_sites.begin(), unresolved_call_sites.end());
 
 		msg("reconstructing flow graphs\n");
 		std::sort(address_references.begin(), address_references.end());
@@ -605,12 +1321,20 @@ namespace security::binexport {
 		ReconstructFlowGraph(instructions, *flow_graph, call_graph);
 
 		msg("reconstructing functions\n");
+		flow_graph->SetNoReturnFunctions(GetNoReturnSeeds());
 		flow_graph->ReconstructFunctions(instructions, call_graph,
 			noreturn_heuristic);
 
 		// Должна вызываться после ReconstructFunctions(), так как при этом иногда удаляются исходные базовые блоки для ребра.
 		// Происходит только в том случае, если дизассемблирование в IDA основательно нарушено.
 		flow_graph->PruneFlowGraphEdges();
+		flow_graph->ComputeLoopNesting();
+		// Резерв стека из OptionalHeader, разобранного при старте плагина.
+		exporter.RefreshPeImageInfo();
+		const CallGraphIndex call_graph_index(*call_graph);
+		ReportStackDepth(call_graph_index, *call_graph, *flow_graph, unresolved_call_sites,
+			exporter.GetPeImageInfo().stack_reserve);
+		ReportCryptoConstants(call_graph, *flow_graph, address_space, &exporter);
 
 		// Примечание: PruneFlowGraphEdges может добавлять комментарии к call_graph,
 		// поэтому после этого должна выполняться пост_обработка.
@@ -684,7 +1408,13 @@ namespace security::binexport {
 
 		} // ограничим зону видимости наших новых переменных ********************************
 
-
+		// Типы и имена уже установлены: сигнатуры применяются к безымянным
+		// TYPE_STANDARD, как в AnalyzeFlowIdaAdditional().
+		RecognizeLibraryFunctions(flow_graph, call_graph, address_space);
+		if (!Exporter::library_signature_output.empty()) {
+			WriteLibrarySignatures(*flow_graph, Exporter::library_signature_output);
+			Exporter::library_signature_output.clear();
+		}
 
 		const auto processing_time = absl::Seconds(timer.elapsed());
 		timer.restart();
@@ -694,6 +1424,7 @@ namespace security::binexport {
 		auto ignore_error(writer->Write(*call_graph, *flow_graph, *instructions,
 			address_references, &type_system, address_space));
 
+		Instruction::SetVirtualMemory(nullptr);  // address_space локальный.
 		Operand::EmptyCache();
 		Expression::EmptyCache();
 
@@ -717,6 +1448,7 @@ namespace security::binexport {
 		
 		Timer<> timer;
 		AddressReferences address_references;
+		std::vector<Address> unresolved_call_sites;
 
 		// Add initial entry points as functions.
 		// Добавить начальные точки входа как функции.
@@ -749,7 +1481,7 @@ namespace security::binexport {
 		for (int i = 0; i < get_segm_qty(); ++i) {
 			const segment_t* segment = getnseg(i);
 			address_space.AddMemoryBlock(segment->start_ea,
-				GetSectionBytes(segment->start_ea),
+				GetSectionMemoryBlock(segment->start_ea),
 				GetPermissions(segment));
 			flags.AddMemoryBlock(
 				segment->start_ea,
@@ -772,6 +1504,7 @@ namespace security::binexport {
 		}
 		// закончили вывод информации о сегментах 
 		if (mdbg) msg("\n\n\t\tSegments output finish \n");
+		ProfileSegments(address_space, exporter);
 
 		
 
@@ -779,7 +1512,8 @@ namespace security::binexport {
 		TypeSystem type_system(types, address_space);
 
 		Instruction::SetBitness(GetArchitectureBitness());
-		Instruction::SetGetBytesCallback(&GetBytes);
+		Instruction::SetVirtualMemory(&address_space);
+		Instruction::SetGetBytesCallback(&GetBytes);  // Только для адресов вне address_space.
 		Instruction::SetMemoryFlags(&flags);
 		std::function<Instruction(const insn_t&, CallGraph*, FlowGraph*, TypeSystem*)>
 			parse_instruction = nullptr;
@@ -818,6 +1552,12 @@ namespace security::binexport {
 			break;
 		}
 
+		msg("    Harvesting comments and strings\n");
+		StringLiteralTable string_literals;
+		string_literals.Scan(address_space);
+		const CommentIndex comment_index = CommentIndex::Build(&string_literals);
+		string_literals.Finish();
+
 		msg("    Flow analysis\n");
 		for (EntryPointManager entry_point_adder(entry_points, "flow analysis"); !entry_points->empty();)
 		{
@@ -839,14 +1579,16 @@ namespace security::binexport {
 				continue;
 			}
 			AnalyzeFlowAdditional(ida_instruction, &new_instruction, flow_graph, call_graph,
-				&address_references, &entry_point_adder, modules);
-			call_graph->AddStringReference(address, GetStringReference(address));
-			GetComments(ida_instruction, &call_graph->GetComments());
+				&address_references, &entry_point_adder, modules, string_literals,
+				&unresolved_call_sites);
+			// Комментарии запрашиваются у IDA только для адресов из comment_index.
+			GetComments(ida_instruction, comment_index.Find(address),
+				&call_graph->GetComments());
 
 			if (mark_x86_nops) {
 				// FLAG_NOP is only important when reconstructing functions, thus we can set if after AnalyzeFlow().
 				//  FLAG_NOP важен только при реконструкции функций, поэтому мы можем установить его после AnalyzeFlow().
-				new_instruction.SetFlag(FLAG_NOP, IsNopX86(new_instruction.GetBytes()));
+				new_instruction.SetFlag(FLAG_NOP, IsNopX86(new_instruction.GetByteSpan()));
 			}
 			// информацию о инструкции кидаем в вектор !!!
 			instructions->push_back(new_instruction);
@@ -854,6 +1596,7 @@ namespace security::binexport {
 
 		msg("    Sorting instructions\n");
 		SortInstructions(instructions);
+		std::sort(unresolved_call_sites.begin(), unresolved_call_sites.end());
 
 
 		// в векторе instructions у нас содержаться все инструкции PE файла ,
@@ -865,23 +1608,6 @@ namespace security::binexport {
 
 		}
 
-		// СОЗДАНО GPT
-/* НАЧАЛО СОЗДАНО GPT можно пока закомментить 
-		// [HEAP] --- begin additions ---
-		// Требуется: #include <unordered_map>
-		static const int HEAP_TOUCH_WINDOW = 16;     ///< ждём разыменование RAX/EAX
-		static const int HEAP_ALIAS_WINDOW = 16;     ///< ждём разыменование через регистр-алиас (mov/lea reg, rax/[rax+..])
-
-													 // Окно «прямого» разыменования через RAX/EAX (ключ: fva)
-		std::unordered_map<ea_t, int> heap_window;
-
-		// Окна для регистров-алиасов: для каждой функции храним TTL по номеру регистра
-		std::unordered_map<ea_t, std::unordered_map<int, int>> heap_alias_window;
-		std::unordered_map<ea_t, bool> heap_event_armed;  ///< true -> ждём первое касание после аллокации.
-
-		// [HEAP] --- end additions ---
-
-*/ // КОНЕЦ СОЗДАНО GPT
 		
 		for (const auto& item : *instructions)
 		{
@@ -1520,188 +2246,8 @@ namespace security::binexport {
 
 
 				
-				// --- [HEAP] begin ---
-				auto is_reg_name = [&](int reg, const char* want) -> bool {
-					const char *rn = ph.reg_names[reg];
-					return rn && strcmp(rn, want) == 0;
-				};
-
-				// Хелпер: есть ли разыменование через указанный регистр (как базу адреса)
-				auto mem_deref_by_reg = [&](const insn_t &ins, int base_reg) -> bool {
-					for (int i = 0; i < UA_MAXOP && ins.ops[i].type != o_void; ++i) {
-						const op_t &op = ins.ops[i];
-						if (op.type == o_displ || op.type == o_phrase) {
-							if (op.reg == base_reg) return true;
-						}
-					}
-					return false;
-				};
-
-				// Найдём номера RAX/EAX (на x86/x64 один из них будет валиден)
-				int REG_RAX = -1, REG_EAX = -1;
-				for (int r = 0; r < ph.regs_num; ++r) {
-					if (REG_RAX == -1 && is_reg_name(r, "rax")) REG_RAX = r;
-					if (REG_EAX == -1 && is_reg_name(r, "eax")) REG_EAX = r;
-				}
-				auto is_retreg = [&](int r)->bool { return r == REG_RAX || r == REG_EAX; };
-
-				ea_t fva = exporter->pe_instruction.func_address;
-
-				// 1) Если alloc-call — «вооружаем» окно прямого разыменования через RAX/EAX
-				if (is_alloc_call) {
-					heap_window[fva] = HEAP_TOUCH_WINDOW;
-					// и обнулим возможные старые алиасы — начинаем новую «цепочку» от свежего указателя
-					heap_alias_window[fva].clear();
-					heap_event_armed[fva] = true;   // ждём первое касание после этой аллокации
-
-				}
-
-				// 2) Если окно активно — ловим разыменование через RAX/EAX
-				auto itw = heap_window.find(fva);
-				if (itw != heap_window.end() && itw->second > 0) {
-					// если в этой инструкции адрес строится от rax/eax — touch
-					if ((REG_RAX >= 0 && mem_deref_by_reg(insn, REG_RAX)) ||
-						(REG_EAX >= 0 && mem_deref_by_reg(insn, REG_EAX))) {
-						exporter->pe_instruction.touches_heap = true;
-						auto &fx = exporter->GetOrCreateFuncEffects(fva);
-						++fx.heap_touches;
-						// событие первого касания
-						if (heap_event_armed[fva]) {
-							++fx.heap_first_touch_events;
-							heap_event_armed[fva] = false;
-						}
-						itw->second = 0; // окно отработало
-					}
-					else {
-						--(itw->second);
-						if (itw->second <= 0) heap_window.erase(itw);
-					}
-				}
-
-				// 3) Заводим алиасы: mov reg, rax  |  lea reg, [rax+…]
-				auto &aliases = heap_alias_window[fva];
-				for (int i = 0; i < UA_MAXOP && insn.ops[i].type != o_void; ++i) {
-					const op_t &dst = insn.ops[0];
-					const op_t &src = insn.ops[1];
-
-					// mov reg, rax/eax
-					// быстрый гард 
-					if (insn.itype != 0  &&
-						dst.type == o_reg && is_retreg(src.type == o_reg ? src.reg : -1))
-					{
-						aliases[dst.reg] = HEAP_ALIAS_WINDOW;
-						break;
-					}
-
-					// lea reg, [rax+...]
-					if (insn.itype != 0 &&
-						dst.type == o_reg && (src.type == o_displ || src.type == o_phrase) &&
-						is_retreg(src.reg))
-					{
-						aliases[dst.reg] = HEAP_ALIAS_WINDOW;
-						break;
-					}
-				}
-
-				// 4) Если есть активные алиасы — ловим разыменование через любой из них
-				if (!aliases.empty()) {
-					bool touched = false;
-					for (auto it = aliases.begin(); it != aliases.end(); ) {
-						const int areg = it->first;
-						int &ttl = it->second;
-
-						if (ttl > 0 && mem_deref_by_reg(insn, areg)) {
-							exporter->pe_instruction.touches_heap = true;
-							auto &fx = exporter->GetOrCreateFuncEffects(fva);
-							++fx.heap_touches;
-							// событие первого касания
-							if (heap_event_armed[fva]) {
-								++fx.heap_first_touch_events;
-								heap_event_armed[fva] = false;
-							}
-							
-							touched = true;
-							it = aliases.erase(it); // этот алиас отработал
-						}
-						else {
-							if (ttl > 0) --ttl;
-							if (ttl <= 0) { it = aliases.erase(it); }
-							else { ++it; }
-						}
-					}
-
-					// если потрогали — гасим прямое окно тоже (необязательно, но шум снижает)
-					if (touched) {
-						auto it2 = heap_window.find(fva);
-						if (it2 != heap_window.end()) heap_window.erase(it2);
-					}
-				}
-				// --- [HEAP] end ---
-
-				// --- [RETURNS HEAP PTR] begin ---
-				// Если текущая инструкция — возврат, и до него была аллокация,
-				// но «первого касания» так и не случилось — считаем, что функция
-				// возвращает heap-указатель наружу (transfer ownership).
-				if (exporter->pe_instruction.addr_return) {
-					ea_t fva = exporter->pe_instruction.func_address;
-					if (heap_event_armed[fva]) {              // была свежая alloc-цепочка, касаний не зафиксировали
-						auto &fx = exporter->GetOrCreateFuncEffects(fva);
-						fx.returns_heap_ptr = true;           // помечаем поведение
-
-															  // снимаем «вооружение», чтобы не сработало повторно
-						heap_event_armed[fva] = false;
-						heap_window.erase(fva);
-						heap_alias_window[fva].clear();
-					}
-				}
-				// --- [RETURNS HEAP PTR] end ---
-
-				// --- [OUT-PARAM STORE] begin ---
-
-
-				// \brief \n true, если инструкция сохраняет heap-указатель из RAX/EAX в ячейку, адрес которой строится от регистров-параметров. \n
-				auto store_heap_to_param_slot = [&](const insn_t &ins)->bool {
-					// ожидаем минимум два операнда: dst, src
-					const op_t &dst = ins.ops[0];
-					const op_t &src = ins.ops[1];
-					// dst: [param_reg + ...]
-					const bool dst_is_param_ptr = (dst.type == o_displ || dst.type == o_phrase) && IsParamReg(dst.reg);
-					// src: rax/eax
-					const bool src_is_retreg = (src.type == o_reg) && (
-						(ph.reg_names[src.reg] && (strcmp(ph.reg_names[src.reg], "rax") == 0 || strcmp(ph.reg_names[src.reg], "eax") == 0))
-						);
-					// тип операции — перенос/загрузка эффективного адреса
-					const bool is_mov_or_lea =
-						(ins.itype != 0) && ( // быстрый гард
-											  // большинство процессорных модулей кодируют MOV/LEA в itype; конкретные значения нам не нужны
-							true
-							);
-
-					return is_mov_or_lea && dst_is_param_ptr && src_is_retreg;
-				};
-
-				{
-					ea_t fva = exporter->pe_instruction.func_address;
-
-					if (store_heap_to_param_slot(insn)) {
-						auto &fx = exporter->GetOrCreateFuncEffects(fva);
-						fx.writes_heap_to_outparam = true;
-
-						// логично считать это «первым касанием» аллокации
-						if (heap_event_armed[fva]) {
-							++fx.heap_first_touch_events;
-							heap_event_armed[fva] = false;
-						}
-
-						// отметим и на уровне инструкции
-						exporter->pe_instruction.touches_heap = true;
-
-						// погасим окна, чтобы не дублировать события
-						heap_window.erase(fva);
-						heap_alias_window[fva].clear();
-					}
-				}
-				// --- [OUT-PARAM STORE] end ---
+				// [HEAP] указатели из аллокаторов отслеживает ReportHeapTracking() -
+				// анализ потока данных по базовым блокам после восстановления функций.
 
 
 			}
@@ -1713,7 +2259,7 @@ namespace security::binexport {
 			exporter->pe_instruction.writes_global = writes_global;
 			exporter->pe_instruction.sp_delta = sp_delta;
 			exporter->pe_instruction.is_alloc_call = is_alloc_call;
-			// touches_heap уже проставляем внутри [HEAP] при срабатывании окна
+			// touches_heap и счётчики кучи заполняет ReportHeapTracking() после восстановления функций
 
 			// --- [INSTR FLAGS] end ---
 
@@ -1758,12 +2304,21 @@ namespace security::binexport {
 		ReconstructFlowGraph(instructions, *flow_graph, call_graph);
 
 		msg("    Reconstructing functions\n");
+		flow_graph->SetNoReturnFunctions(GetNoReturnSeeds());
 		flow_graph->ReconstructFunctions(instructions, call_graph,
 			noreturn_heuristic);
 
 		// Должна вызываться после ReconstructFunctions(), так как при этом иногда удаляются исходные базовые блоки для ребра.
 		// Происходит только в том случае, если дизассемблирование в IDA основательно нарушено.
 		flow_graph->PruneFlowGraphEdges();
+		flow_graph->ComputeLoopNesting();
+		const CallGraphIndex call_graph_index(*call_graph);
+		ReportStackDepth(call_graph_index, *call_graph, *flow_graph, unresolved_call_sites,
+			exporter->GetPeImageInfo().stack_reserve);
+		ReportHeapTracking(*flow_graph, *instructions, exporter);
+		ReportTransitiveEffects(call_graph_index, *flow_graph, *instructions,
+			unresolved_call_sites, exporter);
+		ReportCryptoConstants(call_graph, *flow_graph, address_space, exporter);
 
 		// Примечание: PruneFlowGraphEdges может добавлять комментарии к call_graph,
 		// поэтому после этого должна выполняться пост_обработка.
@@ -1939,6 +2494,12 @@ namespace security::binexport {
 
 		msg("        Install Function Type Finish ... \n");
 
+		RecognizeLibraryFunctions(flow_graph, call_graph, address_space);
+		if (!Exporter::library_signature_output.empty()) {
+			WriteLibrarySignatures(*flow_graph, Exporter::library_signature_output);
+			Exporter::library_signature_output.clear();
+		}
+
 
 		const auto processing_time = absl::Seconds(timer.elapsed());
 		timer.restart();
@@ -1951,6 +2512,7 @@ namespace security::binexport {
 		// было реализовано ранее ...
 		//auto ignore_error(writer->Write(*call_graph, *flow_graph, *instructions,address_references, &type_system, address_space));
 
+		Instruction::SetVirtualMemory(nullptr);  // address_space локальный.
 		Operand::EmptyCache();
 		Expression::EmptyCache();
 
@@ -15,6 +15,7 @@
 #include "third_party/zynamics/binexport/flow_graph.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cinttypes>
 #include <iterator>
 #include <list>
@@ -26,6 +27,8 @@
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/zynamics/binexport/call_graph.h"
 #include "third_party/zynamics/binexport/comment.h"
+#include "third_party/zynamics/binexport/noreturn_analysis.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
 #include "third_party/zynamics/binexport/virtual_memory.h"
 
 #include "debug_log.h"
@@ -51,10 +54,53 @@ void FlowGraph::RenderAdditional(std::ostream* stream,
 #ifdef _DEBUG
 	*stream << "		Start Rendering FUNCTIONS from FlowGraph::RenderAdditional \n" ;
 #endif
-	for (const auto& function : functions_) {
-		function.second->RenderAdditional(stream, call_graph, *this, exporter);
+	if (mdbg) {
+		// Function::RenderAdditional() пишет отладочный вывод через msg(),
+		// которое вызывается только из главного потока.
+		for (const auto& function : functions_) {
+			function.second->RenderAdditional(stream, call_graph, *this, exporter);
 
-		*stream << "\n";
+			*stream << "\n";
+		}
+		return;
+	}
+
+	// Функции рендерятся параллельно окнами по kFunctionsPerSlot * slots функций:
+	// каждый поток пишет в свой буфер, буферы выводятся в порядке адресов,
+	// поэтому текст совпадает с последовательным выводом.
+	constexpr size_t kFunctionsPerSlot = 64;
+	std::vector<const Function*> functions;
+	functions.reserve(functions_.size());
+	for (const auto& function : functions_) {
+		functions.push_back(function.second);
+	}
+	std::vector<std::string> buffers(GetParallelism());
+	const size_t window = buffers.size() * kFunctionsPerSlot;
+	for (size_t window_begin = 0; window_begin < functions.size();
+		window_begin += window) {
+		const size_t window_end = std::min(functions.size(), window_begin + window);
+		std::vector<std::function<void()>> tasks;
+		for (size_t slot = 0; slot < buffers.size(); ++slot) {
+			const size_t begin = window_begin + slot * kFunctionsPerSlot;
+			if (begin >= window_end) {
+				break;
+			}
+			const size_t end = std::min(window_end, begin + kFunctionsPerSlot);
+			tasks.emplace_back([this, &functions, &buffers, &call_graph, slot, begin,
+				end]() {
+				std::string& buffer = buffers[slot];
+				buffer.clear();
+				for (size_t i = begin; i < end; ++i) {
+					functions[i]->RenderAdditional(&buffer, call_graph, *this);
+					buffer.push_back('\n');
+				}
+			});
+		}
+		const size_t used = tasks.size();
+		RunInParallel(std::move(tasks));
+		for (size_t slot = 0; slot < used; ++slot) {
+			stream->write(buffers[slot].data(), buffers[slot].size());
+		}
 	}
 }
 
@@ -110,10 +156,8 @@ std::vector<Address> FlowGraph::FindBasicBlockBreaks(
 	// Поиск невозвратных вызовов. Мы просто считаем, что любой вызов, за которым следует недопустимая инструкция
 	// или инструкцией многобайтовой подстановки (nop), является невозвратным.
 	// Обоснование инструкции nop приведено в b/24084521.
-	// TODO(soerenme) Пометить целевую функцию как невозвращающуюся и использовать эту информацию для всех последующих вызовов функции,
-	// даже если за этими вызовами не следует инструкция invalid или nop. 
-	// Это несколько опасно, так как вводит зависимость порядка от дизассемблирования
-	// - к моменту обнаружения вызова функции мы уже знаем, является ли она невозвратной или нет?
+	// Эти локальные признаки затем распространяются по графу вызовов
+	// (NoReturnAnalysis), уже не завися от порядка дизассемблирования.
 	for (auto call_instruction = instructions->begin();
 		call_instruction != instructions->end(); ++call_instruction) {
 		if (!call_instruction->HasFlag(FLAG_CALL)) {
@@ -151,6 +195,21 @@ std::vector<Address> FlowGraph::FindBasicBlockBreaks(
 	}
 
 
+	// Функция, любой путь которой заканчивается невозвратным вызовом, сама
+	// невозвратная. Поток после вызовов таких функций снимается до разбиения
+	// на базовые блоки, поэтому ложные рёбра проваливания не появляются.
+	{
+		const security::binexport::NoReturnAnalysis noreturn(
+			*instructions, edges_, *call_graph, noreturn_seeds_);
+		for (const Address address : noreturn.GetNoReturnCalls()) {
+			GetInstruction(instructions, address)->SetFlag(FLAG_FLOW, false);
+		}
+		noreturn_functions_ = noreturn.GetNoReturnFunctions();
+		LOG(INFO) << absl::StrCat(noreturn_functions_.size(),
+			" non-returning functions (", noreturn_seeds_.size(), " known), ",
+			noreturn.GetNoReturnCalls().size(), " calls without fall-through");
+	}
+
 /// \brief \n Адреса, где должен произойти break базового блока.
 	std::vector<Address> basic_block_breaks;
 
@@ -238,7 +297,6 @@ void FlowGraph::CreateBasicBlocks(Instructions* instructions,
 		instruction.SetFlag(FLAG_VISITED, false);
 	}
 
-	absl::flat_hash_set<Address> invalid_functions;
 	// Начните с каждого известного адреса точки входа функции и следуйте по нему. 
 	// Создайте новые функции и добавьте к ним базовые блоки и ребра.
 	for (Address entry_point : call_graph->GetFunctions()) {
@@ -248,9 +306,8 @@ void FlowGraph::CreateBasicBlocks(Instructions* instructions,
 		std::stack<Address> address_stack;
 		address_stack.push(entry_point);
 
-		const int initial_edge_number = new_edges.size();
-		int current_bb_number = 0;
-		int number_of_instructions = 0;
+		size_t current_bb_number = 0;
+		size_t number_of_instructions = 0;
 		// Вести учет базовых блоков, уже добавленных в данную функцию.
 		absl::flat_hash_set<Address> function_basic_blocks;
 		while (!address_stack.empty()) {
@@ -272,10 +329,10 @@ void FlowGraph::CreateBasicBlocks(Instructions* instructions,
 				///\n
 				/// Нам необходимо создать новый базовый блок.
 				BasicBlockInstructions basic_block_instructions;
-				int bb_instr_cnt = 0;
+				size_t bb_instr_cnt = 0;
 				bool bb_skip = false;
 				do {
-					if (++bb_instr_cnt > kMaxFunctionInstructions) {
+					if (++bb_instr_cnt > budget_.instructions) {
 						bb_skip = true;
 						break;
 					}
@@ -300,18 +357,15 @@ void FlowGraph::CreateBasicBlocks(Instructions* instructions,
 			}
 			CHECK(basic_block != nullptr);
 			++current_bb_number;
-			// Стирает все new_edges для текущей точки входа (для экономии памяти)
-			// и добавляет точку входа в список недопустимых функций,
-			// которая обрабатывается позже (после всех точек входа). Этот шаг экономит память и процессор,
-			// поскольку он пропускает генерацию результатов,
-			// которые в противном случае были бы отброшены функцией FlowGraph::FinalizeFunctions
-			if ((current_bb_number > kMaxFunctionEarlyBasicBlocks) ||
-				(number_of_instructions > kMaxFunctionInstructions)) {
-				if (initial_edge_number < new_edges.size()) {
-					new_edges.erase(new_edges.begin() + initial_edge_number,
-						new_edges.end());
-				}
-				invalid_functions.insert(entry_point);
+			// Функция больше бюджета: дальше не идём. Уже созданные блоки и
+			// рёбра остаются, FlowGraph::FinalizeFunctions соберёт из них
+			// усечённую функцию.
+			if ((current_bb_number > budget_.basic_blocks) ||
+				(number_of_instructions > budget_.instructions)) {
+				LOG(WARNING) << absl::StrCat(
+					"Function ", absl::Hex(entry_point, absl::kZeroPad8),
+					" exceeds the budget of ", budget_.basic_blocks, " basic blocks / ",
+					budget_.instructions, " instructions, truncating.");
 				break;
 			}
 
@@ -347,31 +401,6 @@ void FlowGraph::CreateBasicBlocks(Instructions* instructions,
 		}
 	}
 
-	if (!invalid_functions.empty()) {
-		LOG(INFO) << "Early erase of " << invalid_functions.size()
-			<< " invalid functions.";
-
-		// Удаляем все входные базовые блоки для "недействительных" функций,
-		// мы сохраняем точки входа в call_graph->functions_, чтобы позже FlowGraph::FinalizeFunctions
-		// мог добавить записи "фиктивных" функций для целей вызова, которые могут быть неправильными,
-		// но мы не можем определить это в данный момент.
-		// Такие недействительные цели вызова будут помечены как импортированные функции в выходном binexport.
-		for (const Address& addr : invalid_functions) {
-			BasicBlock::blocks().erase(addr);
-		}
-		// Удаление всех ребер, идущих от/к недействительным_функциям. Этот шаг может быть не обязательным,
-		// но он уменьшает объем данных, которые будут обрабатываться в дальнейшем.
-		edges_.erase(
-			std::remove_if(edges_.begin(), edges_.end(),
-				[&invalid_functions](const FlowGraphEdge& edge) {
-			return (invalid_functions.find(edge.source) !=
-				invalid_functions.end()) ||
-				(invalid_functions.find(edge.target) !=
-					invalid_functions.end());
-		}),
-			edges_.end());
-	}
-
 	// Добавляем новые синтетические ребра.
 	edges_.insert(edges_.end(), new_edges.begin(), new_edges.end());
 	std::sort(edges_.begin(), edges_.end());
@@ -447,107 +476,162 @@ void FlowGraph::MergeBasicBlocks(const CallGraph& call_graph) {
 }
 
 
+bool FlowGraph::BuildFunction(
+	const CallGraph& call_graph, Function* function,
+	std::vector<std::pair<Address, Address>>* call_edges) const {
+	const Address entry_point = function->GetEntryPoint();
+	std::stack<Address> address_stack;
+	address_stack.push(entry_point);
+	size_t num_instructions = 0;
+	// Следите за базовыми блоками и ребрами, уже добавленными в эту функцию.
+	absl::flat_hash_set<Address> function_basic_blocks;
+	// TODO(cblichmann): Встреча одного и того же базового блока несколько раз в процессе обхода ожидаема и нормальна.
+	// А вот встреча с одним и тем же ребром - нет. Это просто неэффективно - зачем мы вообще добавили это дважды?
+	// В настоящее время только дизассемблер ARM выводит лишние ребра.
+	absl::flat_hash_set<FlowGraphEdge, FlowGraphEdgeHash> done_edges;
+	// Рёбра добавляются в функцию после обхода: при обрезке по бюджету часть
+	// целей так и не попадает в функцию.
+	std::vector<FlowGraphEdge> function_edges;
+	bool truncated = false;
+	while (!address_stack.empty()) {
+		Address address = address_stack.top();
+		address_stack.pop();
+		if (function_basic_blocks.contains(address)) {
+			continue;  // Уже добавлено в функцию.
+		}
+		if (function_basic_blocks.size() >= budget_.basic_blocks ||
+			function_edges.size() >= budget_.edges ||
+			num_instructions >= budget_.instructions) {
+			truncated = true;
+			break;
+		}
+		function_basic_blocks.insert(address);
+		BasicBlock* basic_block = BasicBlock::Find(address);
+		if (!basic_block) {
+			// Функция без тела (импортированная/недействительная)(imported/invalid).
+			continue;
+		}
+		function->AddBasicBlock(basic_block);
+		num_instructions += basic_block->GetInstructionCount();
+
+		const auto source_address = basic_block->GetLastAddress();
+		auto edge =
+			std::lower_bound(edges_.begin(), edges_.end(), source_address,
+				[](const FlowGraphEdge& edge, Address address) {
+			return edge.source < address;
+		});
+		uint64_t dropped_edges = 0;
+		for (; edge != edges_.end() && edge->source == source_address; ++edge) {
+			if (!BasicBlock::Find(edge->target)) {
+				DLOG(INFO) << absl::StrCat(
+					"Dropping edge ", absl::Hex(edge->source, absl::kZeroPad8),
+					" -> ", absl::Hex(edge->target, absl::kZeroPad8),
+					" because the target address is invalid.");
+				++dropped_edges;
+				continue;
+			}
+			if (done_edges.insert(*edge).second) {
+				function_edges.push_back(*edge);
+				address_stack.push(edge->target);
+			}
+		}
+		LOG_IF(INFO, dropped_edges > 0) << absl::StrCat(
+			"Dropped ", dropped_edges,
+			" edges because the target address is invalid (current basic block ",
+			absl::Hex(address, absl::kZeroPad8), ").");
+	}
+	for (const auto& edge : function_edges) {
+		// Рёбра в блоки, до которых обход не дошёл, отбрасываются здесь, иначе
+		// BuildGraphIndex() искал бы их цели линейно (см. FixEdges()).
+		if (!truncated || function_basic_blocks.contains(edge.target)) {
+			function->AddEdge(edge);
+		}
+	}
+	if (truncated) {
+		LOG(WARNING) << absl::StrCat(
+			"Truncating function ", absl::Hex(entry_point, absl::kZeroPad8),
+			" at ", function_basic_blocks.size(), " basic blocks, ",
+			function->GetEdges().size(), " edges, ", num_instructions,
+			" instructions (budget is ", budget_.basic_blocks, ", ",
+			budget_.edges, ", ", budget_.instructions, ")");
+	}
+	// Итерация базового блока и сбор рёбер графа вызовов для каждой инструкции вызова.
+	// Граф вызовов уже знает об адресах источника и цели, но еще не связан с функциями.
+	const auto& all_call_edges = call_graph.GetEdges();
+	for (const auto* basic_block : function->GetBasicBlocks()) {
+		for (const auto& instruction : *basic_block) {
+			if (instruction.HasFlag(FLAG_CALL)) {
+				auto edge = std::lower_bound(
+					all_call_edges.begin(), all_call_edges.end(),
+					instruction.GetAddress(),
+					[](const EdgeInfo& edge, Address address) {
+					return edge.source_ < address;
+				});
+				for (; edge != all_call_edges.end() &&
+					edge->source_ == instruction.GetAddress();
+					++edge) {
+					call_edges->emplace_back(edge->source_, edge->target_);
+				}
+			}
+		}
+	}
+	function->SortGraph();
+	return truncated;
+}
+
+
 /// \brief \n Теперь у нас есть глобальный "суп" из базовых блоков и ребер.\n
 /// Далее нам необходимо проследить поток от каждой точки входа в функцию\n
 /// и собрать список базовых блоков и ребер для каждой функции.\n
 ///  При этом мы также связываем новую функцию с графом вызовов.\n
+/// Функции собираются параллельно, результат совпадает с последовательной сборкой:\n
+/// каждая функция пишет только в свои структуры, а в граф вызовов и functions_\n
+/// они добавляются затем в порядке точек входа.
 /// \n
 /// \param call_graph CallGraph* call_graph
 void FlowGraph::FinalizeFunctions(CallGraph* call_graph) {
-	// Теперь у нас есть глобальный "суп" из базовых блоков и ребер.
-	// Далее нам необходимо проследить поток от каждой точки входа в функцию
-	// и собрать список базовых блоков и ребер для каждой функции.
-	// При этом мы также связываем новую функцию с графом вызовов.
-	for (Address entry_point : call_graph->GetFunctions()) {
-		std::stack<Address> address_stack;
-		address_stack.push(entry_point);
-		std::unique_ptr<Function> function(new Function(entry_point));
-		size_t num_instructions = 0;
-		// Следите за базовыми блоками и ребрами, уже добавленными в эту функцию.
-		absl::flat_hash_set<Address> function_basic_blocks;
-		// TODO(cblichmann): Встреча одного и того же базового блока несколько раз в процессе обхода ожидаема и нормальна.
-		// А вот встреча с одним и тем же ребром - нет. Это просто неэффективно - зачем мы вообще добавили это дважды?
-		// В настоящее время только дизассемблер ARM выводит лишние ребра.
-		absl::flat_hash_set<FlowGraphEdge, FlowGraphEdgeHash> done_edges;
-		while (!address_stack.empty()) {
-			Address address = address_stack.top();
-			address_stack.pop();
-			if (!function_basic_blocks.insert(address).second) {
-				continue;  // Уже добавлено в функцию.
-			}
-			if (function_basic_blocks.size() >= kMaxFunctionBasicBlocks ||
-				function->GetEdges().size() >= kMaxFunctionEdges ||
-				num_instructions >= kMaxFunctionInstructions) {
-				break;
-			}
-			BasicBlock* basic_block = BasicBlock::Find(address);
-			if (!basic_block) {
-				// Функция без тела (импортированная/недействительная)(imported/invalid).
-				continue;
-			}
-			function->AddBasicBlock(basic_block);
-			num_instructions += basic_block->GetInstructionCount();
-
-			const auto source_address = basic_block->GetLastAddress();
-			auto edge =
-				std::lower_bound(edges_.begin(), edges_.end(), source_address,
-					[](const FlowGraphEdge& edge, Address address) {
-				return edge.source < address;
-			});
-			uint64_t dropped_edges = 0;
-			for (; edge != edges_.end() && edge->source == source_address; ++edge) {
-				if (!BasicBlock::Find(edge->target)) {
-					DLOG(INFO) << absl::StrCat(
-						"Dropping edge ", absl::Hex(edge->source, absl::kZeroPad8),
-						" -> ", absl::Hex(edge->target, absl::kZeroPad8),
-						" because the target address is invalid.");
-					++dropped_edges;
-					continue;
-				}
-				if (done_edges.insert(*edge).second) {
-					function->AddEdge(*edge);
-					address_stack.push(edge->target);
-				}
-			}
-			LOG_IF(INFO, dropped_edges > 0) << absl::StrCat(
-				"Dropped ", dropped_edges,
-				" edges because the target address is invalid (current basic block ",
-				absl::Hex(address, absl::kZeroPad8), ").");
-		}
-		if (function_basic_blocks.size() >= kMaxFunctionBasicBlocks ||
-			function->GetEdges().size() >= kMaxFunctionEdges ||
-			num_instructions >= kMaxFunctionInstructions) {
-			DLOG(INFO) << absl::StrCat(
-				"Discarding excessively large function ",
-				absl::Hex(entry_point, absl::kZeroPad8), ": ",
-				function_basic_blocks.size(), " basic blocks, ",
-				function->GetEdges().size(), " edges, ", num_instructions,
-				" instructions (Limit is ", kMaxFunctionBasicBlocks, ", ",
-				kMaxFunctionEdges, ", ", kMaxFunctionInstructions, ")");
-			function->Clear();
-		}
-		for (const auto* basic_block : function->GetBasicBlocks()) {
-			// Итерация базового блока и добавление ребер в граф вызовов для каждой инструкции вызова.
-			// Граф вызовов уже знает об адресах источника и цели, но еще не связан с функциями.
-			const auto& call_edges = call_graph->GetEdges();
-			for (const auto& instruction : *basic_block) {
-				if (instruction.HasFlag(FLAG_CALL)) {
-					auto edge = std::lower_bound(
-						call_edges.begin(), call_edges.end(), instruction.GetAddress(),
-						[](const EdgeInfo& edge, Address address) {
-						return edge.source_ < address;
-					});
-					for (; edge != call_edges.end() &&
-						edge->source_ == instruction.GetAddress();
-						++edge) {
-						call_graph->ScheduleEdgeAdd(function.get(), edge->source_,
-							edge->target_);
-					}
+	const std::vector<Address> entry_points(call_graph->GetFunctions().begin(),
+		call_graph->GetFunctions().end());
+	// Объекты создаются в главном потоке: счётчик экземпляров Function не атомарный.
+	std::vector<std::unique_ptr<Function>> functions(entry_points.size());
+	for (size_t i = 0; i < entry_points.size(); ++i) {
+		functions[i].reset(new Function(entry_points[i]));
+	}
+	std::vector<std::vector<std::pair<Address, Address>>> call_edges(
+		entry_points.size());
+	std::vector<uint8_t> truncated(entry_points.size(), 0);
+
+	// Размер функций сильно различается, поэтому потоки берут точки входа
+	// небольшими порциями из общего счётчика, а не делят их поровну заранее.
+	constexpr size_t kBatchSize = 64;
+	std::atomic<size_t> next_entry_point{ 0 };
+	std::vector<std::function<void()>> tasks;
+	const size_t thread_count = std::max<size_t>(1, std::min<size_t>(
+		GetParallelism(), (entry_points.size() + kBatchSize - 1) / kBatchSize));
+	for (size_t i = 0; i < thread_count; ++i) {
+		tasks.emplace_back([&]() {
+			for (size_t begin = next_entry_point.fetch_add(kBatchSize);
+				begin < entry_points.size();
+				begin = next_entry_point.fetch_add(kBatchSize)) {
+				const size_t end = std::min(entry_points.size(), begin + kBatchSize);
+				for (size_t j = begin; j < end; ++j) {
+					truncated[j] =
+						BuildFunction(*call_graph, functions[j].get(), &call_edges[j]);
 				}
 			}
+		});
+	}
+	RunInParallel(std::move(tasks));
+	const size_t truncated_count =
+		std::count(truncated.begin(), truncated.end(), 1);
+	LOG_IF(INFO, truncated_count > 0) << absl::StrCat(
+		"Truncated ", truncated_count, " functions exceeding the budget.");
+
+	for (size_t i = 0; i < entry_points.size(); ++i) {
+		for (const auto& edge : call_edges[i]) {
+			call_graph->ScheduleEdgeAdd(functions[i].get(), edge.first, edge.second);
 		}
-		function->SortGraph();
-		functions_.insert(std::make_pair(entry_point, function.release()));
+		functions_.insert(std::make_pair(entry_points[i], functions[i].release()));
 	}
 
 	// Они нам больше не нужны (функции хранят свою собственную копию).
@@ -570,3 +654,17 @@ void FlowGraph::PruneFlowGraphEdges() {
 		kv.second->FixEdges();
 	}
 }
+
+void FlowGraph::ComputeLoopNesting() {
+	std::vector<Function*> functions;
+	functions.reserve(functions_.size());
+	for (const auto& kv : functions_) {
+		functions.push_back(kv.second);
+	}
+	// Функции не зависят друг от друга и читают только свой граф.
+	ParallelFor(functions.size(), 256, [&functions](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			functions[i]->ComputeLoopNesting();
+		}
+	});
+}
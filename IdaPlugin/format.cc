@@ -55,4 +55,38 @@ namespace security::binexport {
 		return HumanReadableDuration(absl::ToDoubleSeconds(duration));
 	}
 
+	void AppendHex(uint64_t value, int min_width, std::string* output) {
+		static constexpr char kDigits[] = "0123456789ABCDEF";
+		char buffer[16];
+		int size = 0;
+		do {
+			buffer[size++] = kDigits[value & 0xF];
+			value >>= 4;
+		} while (value != 0);
+		if (size < min_width) {
+			output->append(min_width - size, '0');
+		}
+		while (size > 0) {
+			output->push_back(buffer[--size]);
+		}
+	}
+
+	void AppendDecimal(int64_t value, std::string* output) {
+		char buffer[20];
+		int size = 0;
+		// Модуль через uint64_t, чтобы не переполниться на INT64_MIN.
+		uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value)
+			: static_cast<uint64_t>(value);
+		do {
+			buffer[size++] = static_cast<char>('0' + magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude != 0);
+		if (value < 0) {
+			output->push_back('-');
+		}
+		while (size > 0) {
+			output->push_back(buffer[--size]);
+		}
+	}
+
 }  // namespace security::binexport
@@ -14,19 +14,42 @@
 
 #include "third_party/zynamics/binexport/function.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <iomanip>
 #include <iostream>
-
-#include <boost/graph/compressed_sparse_row_graph.hpp>  // NOLINT
-#include <boost/graph/dominator_tree.hpp>               // NOLINT
-#include <boost/graph/filtered_graph.hpp>               // NOLINT
-#include <boost/graph/iteration_macros.hpp>             // NOLINT
+#include <numeric>
 
 #include "base/logging.h"
 #include "third_party/absl/strings/ascii.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/zynamics/binexport/call_graph.h"
+#include "third_party/zynamics/binexport/loop_nesting.h"
+#include "third_party/zynamics/binexport/util/format.h"
+
+namespace {
+
+/// \brief \n Списки рёбер блоков в формате CSR сортировкой подсчётом.\n
+/// endpoints - индекс блока для каждого ребра, kInvalidIndex пропускается.
+void BuildAdjacency(const std::vector<uint32_t>& endpoints, size_t block_count,
+	std::vector<uint32_t>* offsets, std::vector<uint32_t>* edges) {
+	offsets->assign(block_count + 1, 0);
+	for (const uint32_t block : endpoints) {
+		if (block != Function::kInvalidIndex) {
+			++(*offsets)[block + 1];
+		}
+	}
+	std::partial_sum(offsets->begin(), offsets->end(), offsets->begin());
+	edges->resize(offsets->back());
+	std::vector<uint32_t> next(offsets->begin(), offsets->end() - 1);
+	for (uint32_t edge = 0; edge < endpoints.size(); ++edge) {
+		if (endpoints[edge] != Function::kInvalidIndex) {
+			(*edges)[next[endpoints[edge]]++] = edge;
+		}
+	}
+}
+
+}  // namespace
 
 int Function::instance_count_ = 0;
 Function::StringCache Function::string_cache_;
@@ -96,65 +119,77 @@ void Function::Render(std::ostream* stream, const CallGraph& call_graph,
 void Function::RenderAdditional(std::ostream* stream,
 	const CallGraph& call_graph,
 	const FlowGraph& flow_graph,
-	Exporter& exporter) const {
+	Exporter&) const {
+	if (mdbg)
+	{
+		// получим количество базовых блоков в функции ...
+		for (const auto& basic_block_ptr : basic_blocks_) {
+			msg("        Func %llx have %d basic blocks \n", GetEntryPoint(), basic_blocks_.size());
+			msg("        start bas bl %llx : %llx bas bl end \n",
+				basic_block_ptr->GetEntryPoint(), basic_block_ptr->GetLastAddress());
+		}
+	}
+	std::string output;
+	RenderAdditional(&output, call_graph, flow_graph);
+	*stream << output;
+}
 
+void Function::RenderAdditional(std::string* output,
+	const CallGraph& call_graph,
+	const FlowGraph& flow_graph) const {
 #ifdef _DEBUG
-	*stream << "\n			Start Rendering function Function::RenderAdditional \n\n";
+	output->append("\n			Start Rendering function Function::RenderAdditional \n\n");
 #endif
 	// получить данные о функции - точка вхожа (адрес) и имя функции (простое или размангленное) ???
-	*stream << std::hex << std::setfill('0') << std::uppercase << std::setw(8)
-		<< GetEntryPoint() << "    " << GetModuleName()
-		<< (GetModuleName().empty() ? "" : ".") << GetName(DEMANGLED) << "\n";
-
-	// получим количество базовых блоков в функции ...
-	for (const auto& basic_block_ptr : basic_blocks_) {
-		{ /* Моя вставка */
-			// получим количество базовых блоков в функции ...
-			const auto count = basic_blocks_.size();
-			const auto basic_blocks_address = basic_block_ptr->GetEntryPoint();
-			const auto basic_blocks_last_address = basic_block_ptr->GetLastAddress();
-			if (mdbg)
-			{
-				msg("        Func %llx have %d basic blocks \n", GetEntryPoint(), count);
-				msg("        start bas bl %llx : %llx bas bl end \n", basic_blocks_address, basic_blocks_last_address);
-			}
-
+	security::binexport::AppendHex(GetEntryPoint(), 8, output);
+	output->append("    ");
+	output->append(GetModuleName());
+	output->append(GetModuleName().empty() ? "" : ".");
+	output->append(GetName(DEMANGLED));
+	output->push_back('\n');
+
+	for (size_t i = 0; i < basic_blocks_.size(); ++i) {
+		// блоки внутри циклов помечаем глубиной вложенности
+		const uint32_t loop_depth =
+			loop_nesting_ ? loop_nesting_->GetLoopDepth(i) : 0;
+		if (loop_depth > 0) {
+			output->append("    loop depth ");
+			security::binexport::AppendDecimal(loop_depth, output);
+			output->push_back('\n');
 		}
 		// идем парсить базовый блок далее ...
-		basic_block_ptr->RenderAdditional(stream, call_graph, flow_graph, exporter);
-		*stream << "\n";
+		basic_blocks_[i]->RenderAdditional(output, call_graph, flow_graph);
+		output->push_back('\n');
 	}
 
 	// получаем данные для ребер
 #ifdef _DEBUG
-	*stream << "\n			Start get edges  Function::RenderAdditional \n\n";
+	output->append("\n			Start get edges  Function::RenderAdditional \n\n");
 #endif
 	for (const auto& edge : edges_) {
-
-		*stream << std::hex << std::setfill('0') << std::uppercase << std::setw(8)
-			<< edge.source << " -> " << std::hex << std::setfill('0')
-			<< std::uppercase << std::setw(8) << edge.target << " "
-			<< edge.GetTypeName() << "\n";
-
+		security::binexport::AppendHex(edge.source, 8, output);
+		output->append(" -> ");
+		security::binexport::AppendHex(edge.target, 8, output);
+		output->push_back(' ');
+		output->append(edge.GetTypeName());
+		output->push_back('\n');
 	}
 
 #ifdef _DEBUG
-	*stream << "\n			Finish get edges  Function::RenderAdditional \n";
+	output->append("\n			Finish get edges  Function::RenderAdditional \n");
 #endif
 
-
-
 	if (!edges_.empty()) {
-		*stream << "\n";
+		output->push_back('\n');
 	}
 
 #ifdef _DEBUG
-	// закончили рендерить функцию 
-	*stream << "		Finish Rendering function FlowGraph::RenderAdditional \n";
+	// закончили рендерить функцию
+	output->append("		Finish Rendering function FlowGraph::RenderAdditional \n");
 #endif
 
-	*stream << "---------------------------\n";
-	}
+	output->append("---------------------------\n");
+}
 
 
 
@@ -175,11 +210,59 @@ void Function::SortGraph() {
 		basic_blocks_.end());
 
 	std::sort(edges_.begin(), edges_.end());
+	BuildGraphIndex();
 }
 
 void Function::Clear() {
 	basic_blocks_.clear();
 	edges_.clear();
+	BuildGraphIndex();
+}
+
+/// \brief \n Сопоставляет концы рёбер индексам блоков и строит списки\n
+/// исходящих и входящих рёбер. Время O(E log N), память O(N + E).
+void Function::BuildGraphIndex() {
+	loop_nesting_.reset();
+	const size_t block_count = basic_blocks_.size();
+	const auto to_index = [block_count](int index) {
+		return index >= 0 && static_cast<size_t>(index) < block_count
+			? static_cast<uint32_t>(index) : kInvalidIndex;
+	};
+	edge_sources_.resize(edges_.size());
+	edge_targets_.resize(edges_.size());
+	for (size_t i = 0; i < edges_.size(); ++i) {
+		edge_sources_[i] = to_index(GetBasicBlockIndexForAddress(edges_[i].source));
+		edge_targets_[i] = to_index(GetBasicBlockIndexForAddress(edges_[i].target));
+	}
+	BuildAdjacency(edge_sources_, block_count, &successor_offsets_,
+		&successor_edges_);
+	BuildAdjacency(edge_targets_, block_count, &predecessor_offsets_,
+		&predecessor_edges_);
+
+	entry_index_ = kInvalidIndex;
+	const auto entry = std::lower_bound(basic_blocks_.begin(),
+		basic_blocks_.end(), entry_point_,
+		[](const BasicBlock* basic_block, Address address) {
+		return basic_block->GetEntryPoint() < address;
+	});
+	if (entry != basic_blocks_.end() && (*entry)->GetEntryPoint() == entry_point_) {
+		entry_index_ = static_cast<uint32_t>(entry - basic_blocks_.begin());
+	}
+}
+
+absl::Span<const uint32_t> Function::GetSuccessorEdges(
+	uint32_t basic_block) const {
+	return absl::MakeConstSpan(successor_edges_.data() +
+		successor_offsets_[basic_block],
+		successor_offsets_[basic_block + 1] - successor_offsets_[basic_block]);
+}
+
+absl::Span<const uint32_t> Function::GetPredecessorEdges(
+	uint32_t basic_block) const {
+	return absl::MakeConstSpan(predecessor_edges_.data() +
+		predecessor_offsets_[basic_block],
+		predecessor_offsets_[basic_block + 1] -
+		predecessor_offsets_[basic_block]);
 }
 
 
@@ -280,6 +363,16 @@ int Function::GetBasicBlockIndexForAddress(Address address) const {
 	if (pivot != basic_blocks_.end() && (*pivot)->GetEntryPoint() == address) {
 		return std::distance(basic_blocks_.begin(), pivot);
 	}
+	// Обычно адрес лежит в ближайшем блоке слева (например, источник ребра -
+	// последняя инструкция блока). Поиск в обе стороны нужен только для
+	// перекрывающихся блоков.
+	if (pivot != basic_blocks_.begin()) {
+		const auto* basic_block = *(pivot - 1);
+		if (basic_block->GetLastAddress() == address ||
+			basic_block->GetInstruction(address) != basic_block->end()) {
+			return std::distance(basic_blocks_.begin(), pivot) - 1;
+		}
+	}
 
 	BasicBlocks::const_reverse_iterator left(pivot);
 	BasicBlocks::const_iterator right(pivot);
@@ -337,90 +430,26 @@ void Function::FixEdges() {
 		return source_missing || target_missing;
 	}),
 		edges_.end());
+	BuildGraphIndex();
 }
 
 void Function::GetBackEdges(
 	std::vector<Edges::const_iterator>* back_edges) const {
-	using LocalGraph = boost::compressed_sparse_row_graph<
-		boost::bidirectionalS, boost::property<boost::vertex_index_t, int>,
-		boost::property<boost::edge_index_t, int>>;
-	using LocalVertex = boost::graph_traits<LocalGraph>::vertex_descriptor;
-	using LocalEdge = std::pair<LocalVertex, LocalVertex>;
-
 	back_edges->clear();
-	std::vector<LocalEdge> local_edges;
-	local_edges.reserve(edges_.size());
-	for (const auto& edge : edges_) {
-		auto source_index = GetBasicBlockIndexForAddress(edge.source);
-		CHECK(source_index < basic_blocks_.size() &&
-			basic_blocks_[source_index]->GetLastAddress() == edge.source);
-		auto target_index = GetBasicBlockIndexForAddress(edge.target);
-		CHECK(target_index < basic_blocks_.size() &&
-			basic_blocks_[target_index]->GetEntryPoint() == edge.target);
-		local_edges.emplace_back(source_index, target_index);
+	std::unique_ptr<security::binexport::LoopNesting> local;
+	const security::binexport::LoopNesting* loop_nesting = loop_nesting_.get();
+	if (!loop_nesting) {
+		local.reset(new security::binexport::LoopNesting(*this));
+		loop_nesting = local.get();
 	}
-	// TODO(cblichmann): Use edges_are_sorted (they are, after all, already sorted
-	//                   by source index).
-	const LocalGraph graph(boost::edges_are_unsorted_multi_pass,
-		local_edges.begin(), local_edges.end(),
-		basic_blocks_.size());
-	std::vector<LocalVertex> dominator_nodes(
-		num_vertices(graph), boost::graph_traits<LocalGraph>::null_vertex());
-	boost::lengauer_tarjan_dominator_tree(
-		// Need boost::filtered_graph<> to satisfy Boost.Graph concept.
-		boost::make_filtered_graph(graph, boost::keep_all()),
-		boost::vertex(GetBasicBlockIndexForAddress(GetEntryPoint()), graph),
-		make_iterator_property_map(dominator_nodes.begin(),
-			get(boost::vertex_index, graph)));
-	BGL_FORALL_EDGES(edge, graph, LocalGraph) {
-		const auto source = boost::source(edge, graph);
-		const auto target = boost::target(edge, graph);
-		bool is_loop = source == target;  // Самостоятельные ребра всегда являются петлями. (Self edges are always loops.)
-		if (!is_loop) {
-			// Traverse the Dominator Tree until we either reach a non-dominated node
-			// or arrive back at the node we started from.
-			// Обходить доминантное дерево до тех пор, пока мы не достигнем узла без доминирования
-			// или не вернемся в узел, с которого начали.
-			for (auto node = dominator_nodes[source];
-				node != boost::graph_traits<LocalGraph>::null_vertex();
-				node = dominator_nodes[node]) {
-				if (node == target) {
-					is_loop = true;
-					break;
-				}
-			}
-		}
-
-		if (is_loop) {
-			const auto edge_index = get(boost::edge_index, graph, edge);
-			auto detego_edge = edges_.begin() + edge_index;
-			const auto source_address = basic_blocks_[source]->GetLastAddress();
-			const auto target_address = basic_blocks_[target]->GetEntryPoint();
-			if (detego_edge->source != source_address ||
-				detego_edge->target != target_address) {
-				// TODO(soerenme) Figure out what's going on here. Most of the time
-				//     edge.idx will point to the correct original edge. However,
-				//     sometimes it does not, in which case I perform this expensive
-				//     search instead.
-				// TODO(soerenme) Разберитесь, что здесь происходит. В большинстве случаев edge.idx будет указывать на правильное исходное ребро.
-				// Однако иногда это не так, и тогда я выполняю этот дорогостоящий поиск.
-				detego_edge = std::lower_bound(
-					edges_.begin(), edges_.end(),
-					FlowGraphEdge(source_address, target_address,
-						FlowGraphEdge::TYPE_TRUE),
-					[](const FlowGraphEdge& one, const FlowGraphEdge& two) {
-					return one.source == two.source ? one.target < two.target
-						: one.source < two.source;
-				});
-			}
-			CHECK(detego_edge->source == source_address);
-			CHECK(detego_edge->target == target_address);
-			back_edges->emplace_back(detego_edge);
+	// Рёбра перебираются в порядке хранения, поэтому результат уже отсортирован.
+	for (size_t i = 0; i < edges_.size(); ++i) {
+		if (loop_nesting->IsBackEdge(i)) {
+			back_edges->push_back(edges_.begin() + i);
 		}
 	}
-	// Back edges are not sorted, sort them now, otherwise the loop-finding logic
-	// won't spot them and mark them as back_edges.
-	// Обратные грани не отсортированы, отсортируйте их сейчас,
-	// иначе логика поиска циклов не заметит их и не пометит как back_edges.
-	std::sort(back_edges->begin(), back_edges->end());
+}
+
+void Function::ComputeLoopNesting() {
+	loop_nesting_.reset(new security::binexport::LoopNesting(*this));
 }
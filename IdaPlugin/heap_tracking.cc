@@ -0,0 +1,622 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/heap_tracking.h"
+
+#include <algorithm>
+#include <bitset>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/match.h"
+#include "third_party/zynamics/binexport/basic_block.h"
+#include "third_party/zynamics/binexport/flow_graph.h"
+#include "third_party/zynamics/binexport/function.h"
+#include "third_party/zynamics/binexport/loop_nesting.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
+
+namespace security::binexport {
+	namespace {
+
+		// Места хранения: 16 регистров общего назначения, затем ячейки стека.
+		constexpr int kRegisterCount = 16;
+		constexpr int kLocationCount = 64;
+		constexpr int kMaxStackSlots = kLocationCount - kRegisterCount;
+		constexpr uint8_t kNoLocation = 0xFF;
+		// Места вызова аллокатора сверх 64 в функции делят последний бит.
+		constexpr uint32_t kMaxSites = 64;
+
+		enum Register : uint8_t {
+			kRax, kRcx, kRdx, kRbx, kRsp, kRbp, kRsi, kRdi,
+			kR8, kR9, kR10, kR11, kR12, kR13, kR14, kR15,
+		};
+
+		constexpr uint64_t Bit(int location) { return uint64_t{ 1 } << location; }
+
+		// Регистры, не сохраняемые вызываемой функцией (Win64 и cdecl/stdcall).
+		constexpr uint64_t kCallerSaved = Bit(kRax) | Bit(kRcx) | Bit(kRdx) |
+			Bit(kR8) | Bit(kR9) | Bit(kR10) | Bit(kR11);
+		// Регистровые параметры Win64, для x86 - ecx/edx (fastcall, thiscall).
+		constexpr uint64_t kParamRegisters =
+			Bit(kRcx) | Bit(kRdx) | Bit(kR8) | Bit(kR9);
+
+/// \brief \n Номер регистра общего назначения по имени любой его части или kNoLocation.
+		uint8_t GetRegister(absl::string_view name) {
+			static const auto* registers = [] {
+				auto* registers = new absl::flat_hash_map<absl::string_view, uint8_t>();
+				static constexpr absl::string_view kLegacy[][5] = {
+					{ "rax", "eax", "ax", "al", "ah" },
+					{ "rcx", "ecx", "cx", "cl", "ch" },
+					{ "rdx", "edx", "dx", "dl", "dh" },
+					{ "rbx", "ebx", "bx", "bl", "bh" },
+					{ "rsp", "esp", "sp", "spl", "" },
+					{ "rbp", "ebp", "bp", "bpl", "" },
+					{ "rsi", "esi", "si", "sil", "" },
+					{ "rdi", "edi", "di", "dil", "" },
+				};
+				for (uint8_t i = 0; i < 8; ++i) {
+					for (const absl::string_view part : kLegacy[i]) {
+						if (!part.empty()) {
+							registers->emplace(part, i);
+						}
+					}
+				}
+				static constexpr absl::string_view kExtended[][4] = {
+					{ "r8", "r8d", "r8w", "r8b" },{ "r9", "r9d", "r9w", "r9b" },
+					{ "r10", "r10d", "r10w", "r10b" },{ "r11", "r11d", "r11w", "r11b" },
+					{ "r12", "r12d", "r12w", "r12b" },{ "r13", "r13d", "r13w", "r13b" },
+					{ "r14", "r14d", "r14w", "r14b" },{ "r15", "r15d", "r15w", "r15b" },
+				};
+				for (uint8_t i = 0; i < 8; ++i) {
+					for (const absl::string_view part : kExtended[i]) {
+						registers->emplace(part, kR8 + i);
+					}
+				}
+				return registers;
+			}();
+			const auto it = registers->find(name);
+			return it != registers->end() ? it->second : kNoLocation;
+		}
+
+		enum class Kind : uint8_t {
+			kWrite,        // Первый операнд перезаписывается.
+			kMove,         // mov: значение копируется.
+			kConditional,  // cmovcc: значение добавляется.
+			kAdd,          // add: указатель плюс смещение.
+			kKeep,         // sub, inc, dec, and: указатель остаётся указателем.
+			kAddress,      // lea: адрес без обращения к памяти.
+			kExchange,
+			kNoWrite,      // cmp, test, push, переходы.
+			kCall,
+			kReturn,
+			kIgnore,       // nop: операнды не читаются.
+		};
+
+		Kind GetKind(const std::string& mnemonic) {
+			if (mnemonic == "mov") {
+				return Kind::kMove;
+			}
+			if (absl::StartsWith(mnemonic, "cmov")) {
+				return Kind::kConditional;
+			}
+			if (mnemonic == "add") {
+				return Kind::kAdd;
+			}
+			if (mnemonic == "sub" || mnemonic == "inc" || mnemonic == "dec" ||
+				mnemonic == "and") {
+				return Kind::kKeep;
+			}
+			if (mnemonic == "lea") {
+				return Kind::kAddress;
+			}
+			if (mnemonic == "xchg") {
+				return Kind::kExchange;
+			}
+			if (mnemonic == "call") {
+				return Kind::kCall;
+			}
+			if (absl::StartsWith(mnemonic, "ret")) {
+				return Kind::kReturn;
+			}
+			if (mnemonic == "nop") {
+				return Kind::kIgnore;
+			}
+			if (mnemonic == "cmp" || mnemonic == "test" || mnemonic == "push" ||
+				mnemonic == "bt" || mnemonic[0] == 'j') {
+				return Kind::kNoWrite;
+			}
+			return Kind::kWrite;
+		}
+
+		// Операнд, сведённый к месту хранения.
+		struct OperandInfo {
+			bool memory = false;
+			// Регистр, ячейка стека или kNoLocation.
+			uint8_t location = kNoLocation;
+			// Регистры адреса для обращения к памяти.
+			uint64_t address_registers = 0;
+		};
+
+		// Действие инструкции над состоянием.
+		enum class Operation : uint8_t {
+			kNone,
+			kKill,         // destination = пусто
+			kCopy,         // destination = source
+			kMerge,        // destination |= source
+			kAddress,      // destination = регистры адреса
+			kExchange,     // обмен destination и source
+			kCall,         // caller-saved = пусто
+			kAlloc,        // то же, rax = место вызова site
+			kReturn,
+		};
+
+		struct Step {
+			Address address;
+			Operation operation = Operation::kNone;
+			uint8_t destination = kNoLocation;
+			uint8_t source = kNoLocation;
+			uint8_t site = 0;
+			// Регистры адресов обращений к памяти (кроме lea).
+			uint64_t touch_registers = 0;
+			// Регистры адреса для kAddress или адреса записи значения source в
+			// память вне стека (проверка out-параметра).
+			uint64_t address_registers = 0;
+			bool stores_source = false;
+		};
+
+		struct State {
+			uint64_t heap[kLocationCount];
+			uint64_t params;
+
+			bool MergeFrom(const State& other) {
+				uint64_t changed = (params | other.params) ^ params;
+				params |= other.params;
+				for (int i = 0; i < kLocationCount; ++i) {
+					changed |= (heap[i] | other.heap[i]) ^ heap[i];
+					heap[i] |= other.heap[i];
+				}
+				return changed != 0;
+			}
+		};
+
+		struct Result {
+			bool analyzed = false;
+			HeapTracking::Summary summary = {};
+			std::vector<Address> touching_instructions;
+		};
+
+		class FunctionTracker {
+		public:
+			FunctionTracker(const Function& function,
+				absl::Span<const Address> alloc_calls,
+				absl::Span<const Address> free_calls)
+				: function_(function),
+				alloc_calls_(alloc_calls),
+				free_calls_(free_calls) {}
+
+			bool Run(Result* result);
+
+		private:
+			OperandInfo ParseOperand(const Operand& operand);
+			uint8_t GetStackSlot(uint8_t base, int64_t displacement);
+			Step Decode(const Instruction& instruction);
+			void Apply(const Step& step, State* state, Result* result);
+
+			const Function& function_;
+			absl::Span<const Address> alloc_calls_;
+			absl::Span<const Address> free_calls_;
+
+			absl::flat_hash_map<std::pair<uint8_t, int64_t>, uint8_t> stack_slots_;
+			uint64_t stack_params_ = 0;
+			uint32_t site_count_ = 0;
+			uint32_t free_count_ = 0;
+
+			uint64_t touched_sites_ = 0;
+		};
+
+		uint8_t FunctionTracker::GetStackSlot(uint8_t base, int64_t displacement) {
+			const auto it = stack_slots_.find({ base, displacement });
+			if (it != stack_slots_.end()) {
+				return it->second;
+			}
+			if (stack_slots_.size() >= static_cast<size_t>(kMaxStackSlots)) {
+				return kNoLocation;
+			}
+			const uint8_t slot =
+				static_cast<uint8_t>(kRegisterCount + stack_slots_.size());
+			stack_slots_.emplace(std::make_pair(base, displacement), slot);
+			// Выше сохранённого ebp и адреса возврата лежат аргументы.
+			if (base == kRbp && displacement >= 8) {
+				stack_params_ |= Bit(slot);
+			}
+			return slot;
+		}
+
+		OperandInfo FunctionTracker::ParseOperand(const Operand& operand) {
+			OperandInfo info;
+			uint8_t base = kNoLocation;
+			int register_count = 0;
+			int64_t displacement = 0;
+			for (const Expression* expression : operand) {
+				switch (expression->GetType()) {
+				case Expression::TYPE_DEREFERENCE:
+					info.memory = true;
+					break;
+				case Expression::TYPE_REGISTER: {
+					const uint8_t reg = GetRegister(expression->GetSymbol());
+					if (!info.memory) {
+						info.location = reg;
+						break;
+					}
+					++register_count;
+					if (reg != kNoLocation) {
+						base = reg;
+						info.address_registers |= Bit(reg);
+					}
+					break;
+				}
+				case Expression::TYPE_IMMEDIATE_INT:
+				case Expression::TYPE_STACKVARIABLE:
+				case Expression::TYPE_GLOBALVARIABLE: {
+					// Множитель индекса не входит в смещение.
+					const Expression* parent = expression->GetParent();
+					if (info.memory &&
+						(parent == nullptr || parent->GetSymbol() != "*")) {
+						displacement += expression->GetImmediate();
+					}
+					break;
+				}
+				default:
+					break;
+				}
+			}
+			if (info.memory) {
+				info.location = register_count == 1 && (base == kRsp || base == kRbp)
+					? GetStackSlot(base, displacement)
+					: kNoLocation;
+			}
+			return info;
+		}
+
+		Step FunctionTracker::Decode(const Instruction& instruction) {
+			Step step;
+			step.address = instruction.GetAddress();
+			const Kind kind = GetKind(instruction.GetMnemonic());
+			if (kind == Kind::kIgnore) {
+				return step;
+			}
+
+			OperandInfo operands[2];
+			int operand_count = 0;
+			for (const Operand* operand : instruction) {
+				const OperandInfo info = ParseOperand(*operand);
+				if (info.memory && kind != Kind::kAddress) {
+					step.touch_registers |= info.address_registers;
+				}
+				if (operand_count < 2) {
+					operands[operand_count] = info;
+				}
+				++operand_count;
+			}
+			const OperandInfo& destination = operands[0];
+			const OperandInfo& source = operands[1];
+
+			switch (kind) {
+			case Kind::kCall: {
+				step.operation = Operation::kCall;
+				const Address address = instruction.GetAddress();
+				if (std::binary_search(alloc_calls_.begin(), alloc_calls_.end(),
+					address)) {
+					step.operation = Operation::kAlloc;
+					step.site = static_cast<uint8_t>(
+						std::min(site_count_, kMaxSites - 1));
+					++site_count_;
+				}
+				if (std::binary_search(free_calls_.begin(), free_calls_.end(),
+					address)) {
+					++free_count_;
+				}
+				return step;
+			}
+			case Kind::kReturn:
+				step.operation = Operation::kReturn;
+				return step;
+			case Kind::kNoWrite:
+				return step;
+			default:
+				break;
+			}
+			if (operand_count == 0) {
+				return step;
+			}
+
+			step.destination = destination.location;
+			step.source = operand_count > 1 ? source.location : kNoLocation;
+			switch (kind) {
+			case Kind::kMove:
+				step.operation = Operation::kCopy;
+				// Запись в память вне стека: возможно, по адресу out-параметра.
+				if (destination.memory && destination.location == kNoLocation &&
+					step.source != kNoLocation) {
+					step.address_registers = destination.address_registers;
+					step.stores_source = true;
+				}
+				break;
+			case Kind::kConditional:
+				step.operation = Operation::kMerge;
+				break;
+			case Kind::kAdd:
+				step.operation =
+					step.source != kNoLocation ? Operation::kMerge : Operation::kNone;
+				break;
+			case Kind::kKeep:
+				step.operation = Operation::kNone;
+				break;
+			case Kind::kAddress:
+				step.operation = Operation::kAddress;
+				step.address_registers =
+					operand_count > 1 ? source.address_registers : 0;
+				break;
+			case Kind::kExchange:
+				step.operation = Operation::kExchange;
+				break;
+			default:
+				step.operation = Operation::kKill;
+				break;
+			}
+			if (step.destination == kNoLocation &&
+				step.operation != Operation::kExchange) {
+				step.operation = Operation::kNone;
+			}
+			return step;
+		}
+
+		uint64_t HeapOf(const State& state, uint64_t locations) {
+			uint64_t heap = 0;
+			for (int i = 0; locations >> i != 0; ++i) {
+				if (locations >> i & 1) {
+					heap |= state.heap[i];
+				}
+			}
+			return heap;
+		}
+
+/// \brief \n Передаточная функция инструкции. Если result задан, записываются обращения\n
+/// к куче (последний проход по уже сошедшимся состояниям).
+		void FunctionTracker::Apply(const Step& step, State* state, Result* result) {
+			if (result != nullptr) {
+				const uint64_t touched = HeapOf(*state, step.touch_registers);
+				if (touched != 0) {
+					++result->summary.heap_touches;
+					result->touching_instructions.push_back(step.address);
+					touched_sites_ |= touched;
+				}
+				if (step.stores_source && (state->params & step.address_registers)) {
+					const uint64_t stored = state->heap[step.source];
+					if (stored != 0) {
+						result->summary.writes_heap_to_outparam = true;
+						touched_sites_ |= stored;
+					}
+				}
+				if (step.operation == Operation::kReturn && state->heap[kRax] != 0) {
+					result->summary.returns_heap_ptr = true;
+				}
+			}
+
+			const auto set = [state](uint8_t location, uint64_t heap, bool param) {
+				state->heap[location] = heap;
+				state->params = param ? state->params | Bit(location)
+					: state->params & ~Bit(location);
+			};
+			const uint8_t destination = step.destination;
+			const uint8_t source = step.source;
+			const bool source_param =
+				source != kNoLocation && (state->params & Bit(source));
+			const uint64_t source_heap =
+				source != kNoLocation ? state->heap[source] : 0;
+			switch (step.operation) {
+			case Operation::kNone:
+			case Operation::kReturn:
+				break;
+			case Operation::kKill:
+				set(destination, 0, false);
+				break;
+			case Operation::kCopy:
+				set(destination, source_heap, source_param);
+				break;
+			case Operation::kMerge:
+				set(destination, state->heap[destination] | source_heap,
+					source_param || (state->params & Bit(destination)));
+				break;
+			case Operation::kAddress:
+				set(destination, HeapOf(*state, step.address_registers),
+					(state->params & step.address_registers) != 0);
+				break;
+			case Operation::kExchange:
+				if (destination == kNoLocation || source == kNoLocation) {
+					if (destination != kNoLocation) {
+						set(destination, 0, false);
+					}
+					if (source != kNoLocation) {
+						set(source, 0, false);
+					}
+					break;
+				}
+				{
+					const uint64_t destination_heap = state->heap[destination];
+					const bool destination_param = state->params & Bit(destination);
+					set(destination, source_heap, source_param);
+					set(source, destination_heap, destination_param);
+				}
+				break;
+			case Operation::kCall:
+			case Operation::kAlloc:
+				for (int i = 0; i < kRegisterCount; ++i) {
+					if (kCallerSaved & Bit(i)) {
+						state->heap[i] = 0;
+					}
+				}
+				state->params &= ~kCallerSaved;
+				if (step.operation == Operation::kAlloc) {
+					state->heap[kRax] = Bit(step.site);
+				}
+				break;
+			}
+		}
+
+		bool FunctionTracker::Run(Result* result) {
+			const LoopNesting* loop_nesting = function_.GetLoopNesting();
+			const auto& basic_blocks = function_.GetBasicBlocks();
+			if (loop_nesting == nullptr || basic_blocks.empty()) {
+				return false;
+			}
+			// Без вызовов аллокатора и освобождения функцию не разбираем.
+			bool has_heap_calls = false;
+			for (const auto* basic_block : basic_blocks) {
+				for (const auto& instruction : *basic_block) {
+					if (instruction.HasFlag(FLAG_CALL)) {
+						const Address address = instruction.GetAddress();
+						has_heap_calls |=
+							std::binary_search(alloc_calls_.begin(), alloc_calls_.end(),
+								address) ||
+							std::binary_search(free_calls_.begin(), free_calls_.end(),
+								address);
+					}
+				}
+				if (has_heap_calls) {
+					break;
+				}
+			}
+			if (!has_heap_calls) {
+				return false;
+			}
+
+			// Инструкции разбираются один раз, шаги блоков лежат подряд.
+			const uint32_t block_count = static_cast<uint32_t>(basic_blocks.size());
+			std::vector<uint32_t> step_offsets(block_count + 1, 0);
+			std::vector<Step> steps;
+			for (uint32_t i = 0; i < block_count; ++i) {
+				for (const auto& instruction : *basic_blocks[i]) {
+					steps.push_back(Decode(instruction));
+				}
+				step_offsets[i + 1] = static_cast<uint32_t>(steps.size());
+			}
+
+			HeapTracking::Summary& summary = result->summary;
+			summary.function = function_.GetEntryPoint();
+			summary.alloc_calls = site_count_;
+			summary.free_calls = free_count_;
+			if (site_count_ == 0) {
+				return true;
+			}
+
+			const std::vector<uint32_t>& order = loop_nesting->GetReversePostorder();
+			if (order.empty()) {
+				return true;
+			}
+			std::vector<uint32_t> order_index(block_count, LoopNesting::kNone);
+			for (uint32_t i = 0; i < order.size(); ++i) {
+				order_index[order[i]] = i;
+			}
+			std::vector<State> in_states(block_count, State{});
+			in_states[order[0]].params = kParamRegisters | stack_params_;
+
+			const auto transfer = [&](uint32_t block, State* state, Result* record) {
+				for (uint32_t i = step_offsets[block]; i < step_offsets[block + 1]; ++i) {
+					Apply(steps[i], state, record);
+				}
+			};
+			// Рабочий список номеров в обратном постпорядке: блок обрабатывается
+			// заново, только если выросло его входное состояние. Состояние - 65
+			// масок по 64 бита, слияние - OR, поэтому вход блока растёт не больше
+			// 65 * 64 раз и блок обрабатывается не больше 65 * 64 + 1 раз.
+			std::priority_queue<uint32_t, std::vector<uint32_t>,
+				std::greater<uint32_t>> worklist;
+			std::vector<bool> queued(order.size(), true);
+			for (uint32_t i = 0; i < order.size(); ++i) {
+				worklist.push(i);
+			}
+			State state;
+			while (!worklist.empty()) {
+				const uint32_t i = worklist.top();
+				worklist.pop();
+				queued[i] = false;
+				const uint32_t block = order[i];
+				state = in_states[block];
+				transfer(block, &state, nullptr);
+				for (const uint32_t edge : function_.GetSuccessorEdges(block)) {
+					const uint32_t target = function_.GetEdgeTargetIndex(edge);
+					if (target == Function::kInvalidIndex ||
+						order_index[target] == LoopNesting::kNone) {
+						continue;
+					}
+					const uint32_t target_index = order_index[target];
+					if (in_states[target].MergeFrom(state) && !queued[target_index]) {
+						queued[target_index] = true;
+						worklist.push(target_index);
+					}
+				}
+			}
+
+			for (const uint32_t block : order) {
+				state = in_states[block];
+				transfer(block, &state, result);
+			}
+			summary.first_touch_events =
+				static_cast<uint32_t>(std::bitset<64>(touched_sites_).count());
+			return true;
+		}
+
+	}  // namespace
+
+	HeapTracking::HeapTracking(const FlowGraph& flow_graph,
+		absl::Span<const Address> alloc_calls,
+		absl::Span<const Address> free_calls) {
+		std::vector<const Function*> functions;
+		functions.reserve(flow_graph.GetFunctions().size());
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			functions.push_back(entry.second);
+		}
+		std::vector<Result> results(functions.size());
+		ParallelFor(functions.size(), 64, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				FunctionTracker tracker(*functions[i], alloc_calls, free_calls);
+				results[i].analyzed = tracker.Run(&results[i]);
+			}
+		});
+
+		for (size_t i = 0; i < functions.size(); ++i) {
+			if (!results[i].analyzed) {
+				continue;
+			}
+			summaries_.push_back(results[i].summary);
+			touching_instructions_.insert(touching_instructions_.end(),
+				results[i].touching_instructions.begin(),
+				results[i].touching_instructions.end());
+		}
+		// Функции перечислены по адресу, но базовые блоки могут быть общими.
+		std::sort(touching_instructions_.begin(), touching_instructions_.end());
+		touching_instructions_.erase(
+			std::unique(touching_instructions_.begin(), touching_instructions_.end()),
+			touching_instructions_.end());
+	}
+
+	bool HeapTracking::TouchesHeap(Address instruction) const {
+		return std::binary_search(touching_instructions_.begin(),
+			touching_instructions_.end(), instruction);
+	}
+
+}  // namespace security::binexport
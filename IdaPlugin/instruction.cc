@@ -26,6 +26,7 @@
 
 #include "base/logging.h"
 #include "third_party/zynamics/binexport/flow_graph.h"
+#include "third_party/zynamics/binexport/util/format.h"
 #include "third_party/zynamics/binexport/virtual_memory.h"
 
 namespace {
@@ -182,15 +183,17 @@ namespace {
 
 	// TODO(cblichmann): Immediate floats are rendered as hex and aren't properly
 	//                   checked for their sign.
-	void RenderExpressionAdditional(std::ostream* stream, const TreeNode& node,
-		int substitution_id, const std::string& substitution, Exporter& exporter) {
+	// Вывод совпадает с прежней версией на std::ostream, но пишется прямо в
+	// буфер, без временных строк на каждый операнд.
+	void RenderExpressionAdditional(std::string* output, const TreeNode& node,
+		int substitution_id, const std::string& substitution) {
 		CHECK(node.expression != nullptr);
 		const auto& expression = *node.expression;
 		if (expression.GetId() == substitution_id) {
 #ifdef _DEBUG
-			*stream << " AA ";
+			output->append(" AA ");
 #endif
-			*stream << substitution;
+			output->append(substitution);
 			return;
 		}
 		int8_t expression_type = expression.GetType();
@@ -200,36 +203,36 @@ namespace {
 			if ((expression_symbol != "b4" && Instruction::GetBitness() == 32) ||
 				(expression_symbol != "b8" && Instruction::GetBitness() == 64)) {
 #ifdef _DEBUG
-				*stream << " BB ";
+				output->append(" BB ");
 #endif
-				*stream << expression_symbol << " ";
+				output->append(expression_symbol);
+				output->push_back(' ');
 			}
 			for (auto* child : node.children) {
-
-				RenderExpressionAdditional(stream, (TreeNode&)*child, substitution_id, substitution, exporter);
+				RenderExpressionAdditional(output, *child, substitution_id, substitution);
 			}
 			break;
 		}
 		case Expression::TYPE_REGISTER:
 		case Expression::TYPE_SYMBOL: {
 #ifdef _DEBUG
-			*stream << " REG ";
+			output->append(" REG ");
 #endif
-			*stream << expression_symbol;
+			output->append(expression_symbol);
 			break;
 		}
 		case Expression::TYPE_OPERATOR: {
 			if (node.children.size() > 1 && expression_symbol != "{") {
 				for (auto it = node.children.begin(), end = node.children.end();
 					it != end; ++it) {
-					RenderExpressionAdditional(stream, (TreeNode&)**it, substitution_id, substitution, exporter);
+					RenderExpressionAdditional(output, **it, substitution_id, substitution);
 					TreeNode::Children::const_iterator j = it;
 					if (++j != node.children.end()) {
 						if (expression_symbol == "+" && (*j)->expression->IsImmediate()) {
 							if (Instruction::IsNegativeValue(
 								(*j)->expression->GetImmediate()) &&
 								(*j)->expression->GetSymbol().empty()) {
-								// Ќичего не выводить, иначе получим: eax+-12
+								// Ничего не выводить, иначе получим: eax+-12
 							}
 							else if ((*j)->expression->GetImmediate() == 0) {
 								// Skip "+0".
@@ -238,55 +241,55 @@ namespace {
 							}
 							else {
 #ifdef _DEBUG
-								*stream << " MO ";   // математический оператор
+								output->append(" MO ");   // математический оператор
 #endif
-								*stream << expression_symbol;
+								output->append(expression_symbol);
 							}
 						}
 						else {
 #ifdef _DEBUG
-							*stream << " EE ";
+							output->append(" EE ");
 #endif
-							*stream << expression_symbol;
+							output->append(expression_symbol);
 						}
 					}
 				}
 			}
 			else if (expression_symbol == "{") {
 #ifdef _DEBUG
-				*stream << "B{ ";
+				output->append("B{ ");
 #endif
-				*stream << "{";
+				output->push_back('{');
 				for (auto it = node.children.begin(), end = node.children.end();
 					it != end; ++it) {
-					RenderExpressionAdditional(stream, (TreeNode&)**it, substitution_id, substitution, exporter);
+					RenderExpressionAdditional(output, **it, substitution_id, substitution);
 					TreeNode::Children::const_iterator j = it;
 					if (++j != node.children.end()) {
-						*stream << ",";
+						output->push_back(',');
 					}
 				}
-				*stream << "}";
+				output->push_back('}');
 			}
 			else {
 #ifdef _DEBUG
-				*stream << " SEG ";
+				output->append(" SEG ");
 #endif
-				*stream << expression_symbol;
+				output->append(expression_symbol);
 				for (auto child : node.children) {
-					RenderExpressionAdditional(stream, (TreeNode&)*child, substitution_id, substitution, exporter);
+					RenderExpressionAdditional(output, *child, substitution_id, substitution);
 				}
 			}
 			break;
 		}
 		case Expression::TYPE_DEREFERENCE: {
 #ifdef _DEBUG
-			*stream << " B[ ";
+			output->append(" B[ ");
 #endif
-			*stream << "[";
+			output->push_back('[');
 			for (auto child : node.children) {
-				RenderExpressionAdditional(stream, (TreeNode&)*child, substitution_id, substitution, exporter);
+				RenderExpressionAdditional(output, *child, substitution_id, substitution);
 			}
-			*stream << "]";
+			output->push_back(']');
 			break;
 		}
 		case Expression::TYPE_IMMEDIATE_INT:
@@ -298,26 +301,30 @@ namespace {
 					expression.GetParent()->GetSymbol() == "+") ||
 					expression.GetImmediate() <= 9) {
 #ifdef _DEBUG
-					*stream << " NUM ";
+					output->append(" NUM ");
 #endif
-					*stream << std::dec << std::setw(0)
-						<< (Instruction::GetBitness() == 32
-							? static_cast<int32_t>(expression_immediate)
-							: expression_immediate);
+					security::binexport::AppendDecimal(
+						Instruction::GetBitness() == 32
+						? static_cast<int32_t>(expression_immediate)
+						: expression_immediate,
+						output);
 				}
 				else {
 #ifdef _DEBUG
-					*stream << " HEX ";
+					output->append(" HEX ");
 #endif
-					*stream << " 0x" << std::hex << std::uppercase << expression_immediate;
+					// Как и std::hex, отрицательное значение выводится в дополнительном коде.
+					output->append(" 0x");
+					security::binexport::AppendHex(
+						static_cast<uint64_t>(expression_immediate), 0, output);
 				}
 			}
 			else {
-				// ¬ывод подстановочного выражени¤ вместо фактического значени¤.
+				// Вывод подстановочного выражения вместо фактического значения.
 #ifdef _DEBUG
-				*stream << " VAR ";
+				output->append(" VAR ");
 #endif
-				*stream << expression_symbol;
+				output->append(expression_symbol);
 			}
 			break;
 		}
@@ -326,20 +333,19 @@ namespace {
 		case Expression::TYPE_STACKVARIABLE:
 		case Expression::TYPE_FUNCTION: {
 #ifdef _DEBUG
-			*stream << " ADDR ";
+			output->append(" ADDR ");
 #endif
-			*stream << expression_symbol;
+			output->append(expression_symbol);
 			break;
 		}
 		default: {
 			const std::string error("Unknown expression type in RenderExpression.");
-			*stream << error;
+			output->append(error);
 			LOG(INFO) << error;
 			break;
 		}
 		}
 	}
-
 	FlowGraph::Substitutions::const_iterator GetSubstitution(
 		Address address, int operand_num,
 		FlowGraph::Substitutions::const_iterator subst_begin,
@@ -413,16 +419,22 @@ std::string RenderOperands(const Instruction& instruction,
 }
 
 std::string RenderOperandsAdditional(const Instruction& instruction,
-	const FlowGraph& flow_graph, Exporter& exporter) {
+	const FlowGraph& flow_graph, Exporter&) {
+	std::string output;
+	RenderOperandsAdditional(instruction, flow_graph, &output);
+	return output;
+}
 
+void RenderOperandsAdditional(const Instruction& instruction,
+	const FlowGraph& flow_graph, std::string* output) {
 	if (!instruction.GetOperandCount()) {
-		return "";
+		return;
 	}
 
-	std::stringstream stream;
-
 #ifdef _DEBUG
-	stream << "OPCNT " << static_cast<int>(instruction.GetOperandCount()) << " ";
+	output->append("OPCNT ");
+	security::binexport::AppendDecimal(instruction.GetOperandCount(), output);
+	output->push_back(' ');
 #endif
 
 	auto subst_it = flow_graph.GetSubstitutions().lower_bound(
@@ -433,19 +445,24 @@ std::string RenderOperandsAdditional(const Instruction& instruction,
 		++subst_it;
 	}
 
-	Tree tree;
-	// std::stringstream stream; // ранее stream был определен здесь 
+	// Узлы дерева операнда переиспользуются между вызовами в одном потоке.
+	// Ёмкость резервируется заранее, поэтому указатели на узлы не меняются.
+	thread_local std::vector<TreeNode> tree;
 	int operand_index = 0;
 	for (const auto* operand : instruction) {
 #ifdef _DEBUG
-		stream << "Op" << operand_index + 1 << " ";
+		output->append("Op");
+		security::binexport::AppendDecimal(operand_index + 1, output);
+		output->push_back(' ');
 #endif
+		tree.clear();
+		tree.reserve(operand->GetExpressionCount());
 		for (const auto* expression : *operand) {
-			tree.emplace_back(std::make_shared<TreeNode>(expression));
+			tree.emplace_back(expression);
 			for (auto it = tree.rbegin(), tree_end = tree.rend(); it != tree_end;
 				++it) {
-				if ((*it)->expression == expression->GetParent()) {
-					(*it)->children.emplace_back(&**tree.rbegin()); // replace push to emplace
+				if (it->expression == expression->GetParent()) {
+					it->children.emplace_back(&tree.back());
 					break;
 				}
 			}
@@ -457,18 +474,15 @@ std::string RenderOperandsAdditional(const Instruction& instruction,
 			subst_it =
 				GetSubstitution(instruction.GetAddress(), operand_index, subst_it,
 					subst_end, &substitution, &expression_id);
-			// здесь рендерим операнд 'operand_index' инструкции 
-			RenderExpressionAdditional(&stream, **tree.begin(), expression_id, substitution, exporter);
+			// здесь рендерим операнд 'operand_index' инструкции
+			RenderExpressionAdditional(output, tree.front(), expression_id, substitution);
 		}
-		tree.clear();
 
 		if (operand_index != instruction.GetOperandCount() - 1) {
-			stream << ", ";
+			output->append(", ");
 		}
 		++operand_index;
 	}
-
-	return stream.str();
 }
 
 
@@ -624,19 +638,30 @@ const std::string& Instruction::GetMnemonic() const {
 	return *mnemonic_;
 }
 
-std::string Instruction::GetBytes() const {
-	if (!get_bytes_callback_ && virtual_memory_) {
-		// TODO(soerenme) Optimize this so we don't need a call to GetMemoryBlock
-		//     for each instruction.
-		const auto memory_block = virtual_memory_->GetMemoryBlock(address_);
-		return std::string(
-			reinterpret_cast<const char*>(&*memory_block->second.begin() +
-				address_ - memory_block->first),
-			size_);
+absl::Span<const Byte> Instruction::GetByteSpan() const {
+	if (virtual_memory_) {
+		const auto bytes = virtual_memory_->GetBytes(address_, size_);
+		if (bytes.size() == size_) {
+			return bytes;
+		}
 	}
 
+	// Резервный путь: байты вне загруженных блоков (например, после первого
+	// неопределённого байта сегмента). Callback читает байты через IDA, поэтому
+	// сюда можно попадать только из главного потока. Буфер потока
+	// переиспользуется между вызовами: callback пишет в него на месте.
 	assert(get_bytes_callback_);
-	return get_bytes_callback_(*this);
+	thread_local std::string fallback_bytes;
+	get_bytes_callback_(*this, &fallback_bytes);
+	return absl::Span<const Byte>(
+		reinterpret_cast<const Byte*>(fallback_bytes.data()),
+		fallback_bytes.size());
+}
+
+std::string Instruction::GetBytes() const {
+	const auto bytes = GetByteSpan();
+	return std::string(reinterpret_cast<const char*>(bytes.data()),
+		bytes.size());
 }
 
 void Instruction::SetNextInstruction(Address) {
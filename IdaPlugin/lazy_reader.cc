@@ -0,0 +1,447 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/reader/lazy_reader.h"
+
+#include <algorithm>
+
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/util/status_macros.h"
+
+namespace security::binexport {
+	namespace {
+
+		enum WireType {
+			kWireTypeVarint = 0,
+			kWireTypeFixed64 = 1,
+			kWireTypeLengthDelimited = 2,
+			kWireTypeFixed32 = 5,
+		};
+
+		bool ReadVarint(const Byte** pos, const Byte* end, uint64_t* value) {
+			uint64_t result = 0;
+			for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+				const Byte byte = *(*pos)++;
+				result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+				if (!(byte & 0x80)) {
+					*value = result;
+					return true;
+				}
+			}
+			return false;
+		}
+
+
+/// \brief \n Обходит поля сообщения в wire-формате, не разбирая вложенные сообщения.\n
+/// visitor(field_number, wire_type, value, payload, field_start):\n
+/// value - значение varint или длина тела length-delimited поля,\n
+/// payload - начало тела, field_start - позиция сразу за тегом.\n
+/// Возвращает false, если данные повреждены.
+		template <typename Visitor>
+		bool ForEachField(const Byte* pos, const Byte* end, Visitor visitor) {
+			while (pos < end) {
+				uint64_t tag;
+				if (!ReadVarint(&pos, end, &tag)) {
+					return false;
+				}
+				const Byte* field_start = pos;
+				uint64_t value = 0;
+				switch (tag & 7) {
+				case kWireTypeVarint:
+					if (!ReadVarint(&pos, end, &value)) {
+						return false;
+					}
+					break;
+				case kWireTypeFixed64:
+					if (end - pos < 8) {
+						return false;
+					}
+					pos += 8;
+					break;
+				case kWireTypeLengthDelimited:
+					if (!ReadVarint(&pos, end, &value) ||
+						value > static_cast<uint64_t>(end - pos)) {
+						return false;
+					}
+					pos += value;
+					break;
+				case kWireTypeFixed32:
+					if (end - pos < 4) {
+						return false;
+					}
+					pos += 4;
+					break;
+				default:
+					return false;  // Группы в BinExport2 не используются.
+				}
+				const Byte* payload =
+					(tag & 7) == kWireTypeLengthDelimited ? pos - value : field_start;
+				visitor(static_cast<int>(tag >> 3), static_cast<int>(tag & 7), value,
+					payload, field_start);
+			}
+			return true;
+		}
+
+		absl::Status CorruptedError(absl::string_view what) {
+			return absl::DataLossError(absl::StrCat("corrupted BinExport2 data: ", what));
+		}
+
+	}  // namespace
+
+	absl::StatusOr<std::unique_ptr<LazyBinExport2Reader>> LazyBinExport2Reader::Open(
+		const std::string& filename, size_t cache_size) {
+		std::shared_ptr<MappedFile> file =
+			MappedFile::Open(filename, MappedFile::Mode::kReadOnly);
+		if (!file) {
+			return absl::NotFoundError(absl::StrCat("cannot map file: '", filename, "'"));
+		}
+		std::unique_ptr<LazyBinExport2Reader> reader(
+			new LazyBinExport2Reader(std::move(file), cache_size));
+		NA_RETURN_IF_ERROR(reader->BuildIndex());
+		NA_RETURN_IF_ERROR(reader->ComputeInstructionAddresses());
+		NA_RETURN_IF_ERROR(reader->IndexFlowGraphs());
+		return reader;
+	}
+
+	LazyBinExport2Reader::LazyBinExport2Reader(std::shared_ptr<MappedFile> file,
+		size_t cache_size)
+		: file_(std::move(file)), cache_size_(std::max<size_t>(cache_size, 1)) {}
+
+	absl::Status LazyBinExport2Reader::BuildIndex() {
+		// Поля, которые нужны графу вызовов, разбираются сразу. Для таблиц,
+		// из которых строятся графы потока, запоминаются только смещения.
+		BinExport2 header;
+		bool parsed = true;
+		const Byte* data = file_->data();
+		const bool valid = ForEachField(data, data + file_->size(),
+			[&](int field_number, int wire_type, uint64_t size, const Byte* payload,
+				const Byte* field_start) {
+			if (wire_type != kWireTypeLengthDelimited) {
+				return;
+			}
+			const uint64_t offset = field_start - data;
+			switch (field_number) {
+			case BinExport2::kMetaInformationFieldNumber:
+				parsed &= header.mutable_meta_information()->MergeFromString(
+					std::string(reinterpret_cast<const char*>(payload), size));
+				break;
+			case BinExport2::kMnemonicFieldNumber:
+				mnemonics_.push_back(offset);
+				break;
+			case BinExport2::kInstructionFieldNumber:
+				instructions_.push_back(offset);
+				break;
+			case BinExport2::kBasicBlockFieldNumber:
+				basic_blocks_.push_back(offset);
+				break;
+			case BinExport2::kFlowGraphFieldNumber:
+				flow_graphs_.push_back(offset);
+				break;
+			case BinExport2::kCallGraphFieldNumber:
+				parsed &= header.mutable_call_graph()->MergeFromString(
+					std::string(reinterpret_cast<const char*>(payload), size));
+				break;
+			case BinExport2::kLibraryFieldNumber:
+				parsed &= header.add_library()->ParseFromArray(payload, size);
+				break;
+			case BinExport2::kModuleFieldNumber:
+				parsed &= header.add_module()->ParseFromArray(payload, size);
+				break;
+			default:
+				break;
+			}
+		});
+		if (!valid || !parsed) {
+			return CorruptedError("top-level fields");
+		}
+		meta_information_ = header.meta_information();
+		call_graph_ = CallGraph::FromBinExport2Proto(header);
+		return absl::OkStatus();
+	}
+
+	absl::Status LazyBinExport2Reader::ComputeInstructionAddresses() {
+		// Адрес хранится только у инструкций, в которые нет потока из предыдущей;
+		// для остальных он равен адресу предыдущей плюс её размер.
+		instruction_addresses_.reserve(instructions_.size());
+		Address next_address = 0;
+		for (uint64_t offset : instructions_) {
+			NA_ASSIGN_OR_RETURN(const auto element, GetElement(offset));
+			bool has_address = false;
+			Address address = 0;
+			uint64_t size = 0;
+			if (!ForEachField(element.first, element.first + element.second,
+				[&](int field_number, int wire_type, uint64_t value, const Byte*,
+					const Byte*) {
+				if (field_number == BinExport2::Instruction::kAddressFieldNumber &&
+					wire_type == kWireTypeVarint) {
+					has_address = true;
+					address = value;
+				}
+				else if (field_number == BinExport2::Instruction::kRawBytesFieldNumber &&
+					wire_type == kWireTypeLengthDelimited) {
+					size = value;
+				}
+			})) {
+				return CorruptedError("instruction");
+			}
+			if (!has_address) {
+				address = next_address;
+			}
+			instruction_addresses_.push_back(address);
+			next_address = address + size;
+		}
+		return absl::OkStatus();
+	}
+
+	absl::Status LazyBinExport2Reader::IndexFlowGraphs() {
+		flow_graph_entry_points_.reserve(flow_graphs_.size());
+		BinExport2::BasicBlock basic_block;
+		for (uint32_t i = 0; i < flow_graphs_.size(); ++i) {
+			NA_ASSIGN_OR_RETURN(const auto element, GetElement(flow_graphs_[i]));
+			uint64_t entry_basic_block_index = 0;
+			// Рёбра и список блоков не разбираются: нужен только входной блок.
+			if (!ForEachField(element.first, element.first + element.second,
+				[&](int field_number, int wire_type, uint64_t value, const Byte*,
+					const Byte*) {
+				if (field_number ==
+					BinExport2::FlowGraph::kEntryBasicBlockIndexFieldNumber &&
+					wire_type == kWireTypeVarint) {
+					entry_basic_block_index = value;
+				}
+			})) {
+				return CorruptedError("flow graph");
+			}
+			NA_RETURN_IF_ERROR(
+				ParseElement(basic_blocks_, entry_basic_block_index, &basic_block));
+			if (basic_block.instruction_index_size() == 0 ||
+				basic_block.instruction_index(0).begin_index() < 0 ||
+				static_cast<size_t>(basic_block.instruction_index(0).begin_index()) >=
+				instruction_addresses_.size()) {
+				return CorruptedError("entry basic block");
+			}
+			flow_graph_entry_points_.emplace_back(
+				instruction_addresses_[basic_block.instruction_index(0).begin_index()], i);
+		}
+		std::sort(flow_graph_entry_points_.begin(), flow_graph_entry_points_.end());
+		return absl::OkStatus();
+	}
+
+	absl::StatusOr<std::pair<const Byte*, size_t>> LazyBinExport2Reader::GetElement(
+		uint64_t offset) const {
+		const Byte* pos = file_->data() + offset;
+		const Byte* end = file_->data() + file_->size();
+		uint64_t size;
+		if (!ReadVarint(&pos, end, &size) || size > static_cast<uint64_t>(end - pos)) {
+			return CorruptedError("element length");
+		}
+		return std::make_pair(pos, static_cast<size_t>(size));
+	}
+
+	template <typename Message>
+	absl::Status LazyBinExport2Reader::ParseElement(const Offsets& offsets,
+		size_t index, Message* message) const {
+		if (index >= offsets.size()) {
+			return CorruptedError(absl::StrCat("index out of range: ", index));
+		}
+		NA_ASSIGN_OR_RETURN(const auto element, GetElement(offsets[index]));
+		if (!message->ParseFromArray(element.first, static_cast<int>(element.second))) {
+			return CorruptedError(message->GetTypeName());
+		}
+		return absl::OkStatus();
+	}
+
+	std::vector<Address> LazyBinExport2Reader::GetFlowGraphEntryPoints() const {
+		std::vector<Address> entry_points;
+		entry_points.reserve(flow_graph_entry_points_.size());
+		for (const auto& entry_point : flow_graph_entry_points_) {
+			entry_points.push_back(entry_point.first);
+		}
+		return entry_points;
+	}
+
+	bool LazyBinExport2Reader::HasFlowGraph(Address entry_point) const {
+		const auto it = std::lower_bound(flow_graph_entry_points_.begin(),
+			flow_graph_entry_points_.end(), std::make_pair(entry_point, uint32_t{0}));
+		return it != flow_graph_entry_points_.end() && it->first == entry_point;
+	}
+
+	absl::StatusOr<size_t> LazyBinExport2Reader::FindFlowGraph(
+		Address entry_point) const {
+		const auto it = std::lower_bound(flow_graph_entry_points_.begin(),
+			flow_graph_entry_points_.end(), std::make_pair(entry_point, uint32_t{0}));
+		if (it == flow_graph_entry_points_.end() || it->first != entry_point) {
+			return absl::NotFoundError(absl::StrCat(
+				"no flow graph at ", absl::Hex(entry_point, absl::kZeroPad8)));
+		}
+		return it->second;
+	}
+
+	absl::Status LazyBinExport2Reader::LoadBasicBlocks(
+		size_t flow_graph_index, BinExport2::FlowGraph* flow_graph,
+		std::vector<BinExport2::BasicBlock>* basic_blocks,
+		std::vector<int>* instruction_indices) const {
+		NA_RETURN_IF_ERROR(ParseElement(flow_graphs_, flow_graph_index, flow_graph));
+		basic_blocks->resize(flow_graph->basic_block_index_size());
+		for (int i = 0; i < flow_graph->basic_block_index_size(); ++i) {
+			auto& basic_block = (*basic_blocks)[i];
+			NA_RETURN_IF_ERROR(ParseElement(basic_blocks_,
+				flow_graph->basic_block_index(i), &basic_block));
+			for (const auto& range : basic_block.instruction_index()) {
+				const int end = range.has_end_index() ? range.end_index()
+					: range.begin_index() + 1;
+				if (range.begin_index() < 0 ||
+					static_cast<size_t>(end) > instruction_addresses_.size()) {
+					return CorruptedError("basic block instruction range");
+				}
+				for (int index = range.begin_index(); index < end; ++index) {
+					instruction_indices->push_back(index);
+				}
+			}
+		}
+		std::sort(instruction_indices->begin(), instruction_indices->end());
+		instruction_indices->erase(
+			std::unique(instruction_indices->begin(), instruction_indices->end()),
+			instruction_indices->end());
+		return absl::OkStatus();
+	}
+
+	absl::StatusOr<std::unique_ptr<FlowGraph>> LazyBinExport2Reader::LoadFlowGraph(
+		size_t flow_graph_index) const {
+		BinExport2::FlowGraph flow_graph;
+		std::vector<BinExport2::BasicBlock> basic_blocks;
+		std::vector<int> instruction_indices;
+		NA_RETURN_IF_ERROR(LoadBasicBlocks(flow_graph_index, &flow_graph,
+			&basic_blocks, &instruction_indices));
+
+		// Поднабор BinExport2 только с данными этой функции. Индексы базовых
+		// блоков, инструкций и мнемоник пересчитаны в номера внутри поднабора,
+		// порядок инструкций совпадает с порядком в файле.
+		BinExport2 proto;
+		*proto.mutable_meta_information() = meta_information_;
+		std::vector<Address> addresses;
+		addresses.reserve(instruction_indices.size());
+		proto.mutable_instruction()->Reserve(instruction_indices.size());
+		absl::flat_hash_map<int, int> mnemonic_map;
+		for (int index : instruction_indices) {
+			auto* instruction = proto.add_instruction();
+			NA_RETURN_IF_ERROR(ParseElement(instructions_, index, instruction));
+			auto mnemonic = mnemonic_map.emplace(instruction->mnemonic_index(),
+				proto.mnemonic_size());
+			if (mnemonic.second) {
+				NA_RETURN_IF_ERROR(ParseElement(mnemonics_,
+					instruction->mnemonic_index(), proto.add_mnemonic()));
+			}
+			instruction->set_mnemonic_index(mnemonic.first->second);
+			addresses.push_back(instruction_addresses_[index]);
+		}
+		const auto local_instruction = [&instruction_indices](int index) {
+			return static_cast<int>(std::lower_bound(instruction_indices.begin(),
+				instruction_indices.end(), index) - instruction_indices.begin());
+		};
+
+		absl::flat_hash_map<int, int> basic_block_map;
+		auto* local_flow_graph = proto.add_flow_graph();
+		proto.mutable_basic_block()->Reserve(basic_blocks.size());
+		for (int i = 0; i < basic_blocks.size(); ++i) {
+			basic_block_map.emplace(flow_graph.basic_block_index(i), i);
+			local_flow_graph->add_basic_block_index(i);
+			auto* local_basic_block = proto.add_basic_block();
+			int begin_index = -1, end_index = -1;
+			const auto flush = [&]() {
+				if (begin_index < 0) {
+					return;
+				}
+				auto* range = local_basic_block->add_instruction_index();
+				range->set_begin_index(begin_index);
+				if (end_index != begin_index + 1) {
+					range->set_end_index(end_index);
+				}
+			};
+			for (const auto& range : basic_blocks[i].instruction_index()) {
+				const int end = range.has_end_index() ? range.end_index()
+					: range.begin_index() + 1;
+				for (int index = range.begin_index(); index < end; ++index) {
+					const int local = local_instruction(index);
+					if (local != end_index) {
+						flush();
+						begin_index = local;
+					}
+					end_index = local + 1;
+				}
+			}
+			flush();
+		}
+
+		const auto entry = basic_block_map.find(flow_graph.entry_basic_block_index());
+		if (entry == basic_block_map.end()) {
+			return CorruptedError("flow graph entry basic block");
+		}
+		local_flow_graph->set_entry_basic_block_index(entry->second);
+		local_flow_graph->mutable_edge()->Reserve(flow_graph.edge_size());
+		for (const auto& edge : flow_graph.edge()) {
+			const auto source = basic_block_map.find(edge.source_basic_block_index());
+			const auto target = basic_block_map.find(edge.target_basic_block_index());
+			if (source == basic_block_map.end() || target == basic_block_map.end()) {
+				return CorruptedError("flow graph edge");
+			}
+			auto* local_edge = local_flow_graph->add_edge();
+			*local_edge = edge;
+			local_edge->set_source_basic_block_index(source->second);
+			local_edge->set_target_basic_block_index(target->second);
+		}
+		return FlowGraph::FromBinExport2Proto(proto, *local_flow_graph, addresses);
+	}
+
+	absl::StatusOr<std::shared_ptr<const FlowGraph>> LazyBinExport2Reader::GetFlowGraph(
+		Address entry_point) {
+		{
+			absl::MutexLock lock(&cache_mutex_);
+			const auto it = cache_index_.find(entry_point);
+			if (it != cache_index_.end()) {
+				cache_.splice(cache_.begin(), cache_, it->second);
+				return it->second->second;
+			}
+		}
+		// Граф строится без блокировки, чтобы разные функции загружались параллельно.
+		NA_ASSIGN_OR_RETURN(const size_t flow_graph_index, FindFlowGraph(entry_point));
+		NA_ASSIGN_OR_RETURN(std::unique_ptr<FlowGraph> loaded,
+			LoadFlowGraph(flow_graph_index));
+		std::shared_ptr<const FlowGraph> flow_graph(std::move(loaded));
+
+		absl::MutexLock lock(&cache_mutex_);
+		const auto it = cache_index_.find(entry_point);
+		if (it != cache_index_.end()) {
+			return it->second->second;  // Другой поток успел раньше.
+		}
+		cache_.emplace_front(entry_point, flow_graph);
+		cache_index_[entry_point] = cache_.begin();
+		if (cache_.size() > cache_size_) {
+			cache_index_.erase(cache_.back().first);
+			cache_.pop_back();
+		}
+		return flow_graph;
+	}
+
+	absl::StatusOr<std::vector<int>> LazyBinExport2Reader::GetInstructionIndices(
+		Address entry_point) const {
+		NA_ASSIGN_OR_RETURN(const size_t flow_graph_index, FindFlowGraph(entry_point));
+		BinExport2::FlowGraph flow_graph;
+		std::vector<BinExport2::BasicBlock> basic_blocks;
+		std::vector<int> instruction_indices;
+		NA_RETURN_IF_ERROR(LoadBasicBlocks(flow_graph_index, &flow_graph,
+			&basic_blocks, &instruction_indices));
+		return instruction_indices;
+	}
+
+}  // namespace security::binexport
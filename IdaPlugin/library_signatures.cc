@@ -0,0 +1,425 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/library_signatures.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/zynamics/binexport/basic_block.h"
+#include "third_party/zynamics/binexport/flow_graph.h"
+#include "third_party/zynamics/binexport/function.h"
+#include "third_party/zynamics/binexport/virtual_memory.h"
+
+namespace security::binexport {
+	namespace {
+
+		constexpr uint32_t kNone = ~uint32_t{ 0 };
+		constexpr char kMagic[4] = { 'B', 'X', 'L', 'S' };
+		constexpr uint32_t kVersion = 1;
+		// Исполняемые блоки просматриваются кусками такого размера.
+		constexpr size_t kChunkSize = size_t{ 1 } << 20;
+
+		// Числа в файле - little endian, как в памяти x86.
+		template <typename T>
+		void Put(std::string* output, T value) {
+			output->append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		template <typename T>
+		bool Get(absl::string_view* input, T* value) {
+			if (input->size() < sizeof(T)) {
+				return false;
+			}
+			std::memcpy(value, input->data(), sizeof(T));
+			input->remove_prefix(sizeof(T));
+			return true;
+		}
+
+		bool GetString(absl::string_view* input, size_t size, std::string* value) {
+			if (input->size() < size) {
+				return false;
+			}
+			value->assign(input->data(), size);
+			input->remove_prefix(size);
+			return true;
+		}
+
+	}  // namespace
+
+	uint32_t LibrarySignatures::AddLibrary(absl::string_view name) {
+		const auto it = std::find(libraries_.begin(), libraries_.end(), name);
+		if (it != libraries_.end()) {
+			return static_cast<uint32_t>(it - libraries_.begin());
+		}
+		libraries_.emplace_back(name);
+		return static_cast<uint32_t>(libraries_.size() - 1);
+	}
+
+	void LibrarySignatures::AddSignature(Signature signature) {
+		signature.bytes.resize(std::min(signature.bytes.size(), kMaxPatternSize));
+		signature.mask.resize(signature.bytes.size(), '\0');
+		signatures_.push_back(std::move(signature));
+	}
+
+	absl::Status LibrarySignatures::ReadFile(absl::string_view path) {
+		std::ifstream stream(std::string(path), std::ios::in | std::ios::binary);
+		if (!stream) {
+			return absl::NotFoundError(
+				absl::StrCat("cannot open signature file \"", path, "\""));
+		}
+		const std::string contents((std::istreambuf_iterator<char>(stream)),
+			std::istreambuf_iterator<char>());
+		absl::string_view input(contents);
+		const auto corrupted = [path]() {
+			return absl::InvalidArgumentError(
+				absl::StrCat("corrupted signature file \"", path, "\""));
+		};
+
+		uint32_t version;
+		uint32_t library_count;
+		uint32_t signature_count;
+		if (input.substr(0, sizeof(kMagic)) !=
+			absl::string_view(kMagic, sizeof(kMagic))) {
+			return corrupted();
+		}
+		input.remove_prefix(sizeof(kMagic));
+		if (!Get(&input, &version) || version != kVersion ||
+			!Get(&input, &library_count) || !Get(&input, &signature_count)) {
+			return corrupted();
+		}
+
+		// Индексы библиотек файла переводятся в индексы этого набора.
+		std::vector<uint32_t> libraries(library_count);
+		std::string name;
+		for (uint32_t& library : libraries) {
+			uint32_t size;
+			if (!Get(&input, &size) || !GetString(&input, size, &name)) {
+				return corrupted();
+			}
+			library = AddLibrary(name);
+		}
+		signatures_.reserve(signatures_.size() + signature_count);
+		for (uint32_t i = 0; i < signature_count; ++i) {
+			Signature signature;
+			uint32_t library;
+			uint32_t name_size;
+			uint8_t pattern_size;
+			if (!Get(&input, &library) || library >= library_count ||
+				!Get(&input, &name_size) ||
+				!GetString(&input, name_size, &signature.name) ||
+				!Get(&input, &pattern_size) || pattern_size > kMaxPatternSize ||
+				!GetString(&input, pattern_size, &signature.bytes) ||
+				!GetString(&input, pattern_size, &signature.mask) ||
+				!Get(&input, &signature.shape_hash)) {
+				return corrupted();
+			}
+			signature.library = libraries[library];
+			signatures_.push_back(std::move(signature));
+		}
+		return input.empty() ? absl::OkStatus() : corrupted();
+	}
+
+	absl::Status LibrarySignatures::WriteFile(absl::string_view path) const {
+		std::string output(kMagic, sizeof(kMagic));
+		Put(&output, kVersion);
+		Put(&output, static_cast<uint32_t>(libraries_.size()));
+		Put(&output, static_cast<uint32_t>(signatures_.size()));
+		for (const std::string& library : libraries_) {
+			Put(&output, static_cast<uint32_t>(library.size()));
+			output += library;
+		}
+		for (const Signature& signature : signatures_) {
+			Put(&output, signature.library);
+			Put(&output, static_cast<uint32_t>(signature.name.size()));
+			output += signature.name;
+			Put(&output, static_cast<uint8_t>(signature.bytes.size()));
+			output += signature.bytes;
+			output += signature.mask;
+			Put(&output, signature.shape_hash);
+		}
+
+		std::ofstream stream(std::string(path),
+			std::ios::out | std::ios::binary | std::ios::trunc);
+		stream.write(output.data(), output.size());
+		stream.close();
+		if (!stream) {
+			return absl::UnknownError(
+				absl::StrCat("cannot write signature file \"", path, "\""));
+		}
+		return absl::OkStatus();
+	}
+
+	void LibrarySignatures::Build() {
+		anchors_.clear();
+		max_anchor_size_ = 0;
+		// Якорь - самый длинный участок образца без масок.
+		for (uint32_t i = 0; i < signatures_.size(); ++i) {
+			const std::string& mask = signatures_[i].mask;
+			size_t best_offset = 0;
+			size_t best_size = 0;
+			for (size_t begin = 0; begin < mask.size();) {
+				if (mask[begin] == '\0') {
+					++begin;
+					continue;
+				}
+				size_t end = begin;
+				while (end < mask.size() && mask[end] != '\0') {
+					++end;
+				}
+				if (end - begin > best_size) {
+					best_offset = begin;
+					best_size = end - begin;
+				}
+				begin = end;
+			}
+			if (best_size >= kMinAnchorSize) {
+				anchors_.push_back({ i, static_cast<uint8_t>(best_offset),
+					static_cast<uint8_t>(best_size) });
+				max_anchor_size_ = std::max(max_anchor_size_, best_size);
+			}
+		}
+
+		// Бор якорей. Потомки хранятся по возрастанию байта.
+		std::vector<std::vector<std::pair<Byte, uint32_t>>> children(1);
+		std::vector<std::vector<uint32_t>> terminals(1);
+		const auto child = [&children](uint32_t state, Byte byte) {
+			const auto& list = children[state];
+			const auto it = std::lower_bound(list.begin(), list.end(),
+				std::make_pair(byte, uint32_t{ 0 }));
+			return it != list.end() && it->first == byte ? it->second : kNone;
+		};
+		for (uint32_t i = 0; i < anchors_.size(); ++i) {
+			const Anchor& anchor = anchors_[i];
+			const std::string& bytes = signatures_[anchor.signature].bytes;
+			uint32_t state = 0;
+			for (size_t j = anchor.offset; j < anchor.offset + anchor.size; ++j) {
+				const Byte byte = static_cast<Byte>(bytes[j]);
+				uint32_t next = child(state, byte);
+				if (next == kNone) {
+					next = static_cast<uint32_t>(children.size());
+					auto& list = children[state];
+					list.insert(std::lower_bound(list.begin(), list.end(),
+						std::make_pair(byte, uint32_t{ 0 })),
+						std::make_pair(byte, next));
+					children.emplace_back();
+					terminals.emplace_back();
+				}
+				state = next;
+			}
+			terminals[state].push_back(i);
+		}
+
+		// Суффиксные ссылки обходом в ширину.
+		const uint32_t state_count = static_cast<uint32_t>(children.size());
+		failures_.assign(state_count, 0);
+		output_links_.assign(state_count, kNone);
+		std::vector<uint32_t> queue;
+		queue.reserve(state_count);
+		for (const auto& entry : children[0]) {
+			queue.push_back(entry.second);
+		}
+		for (size_t head = 0; head < queue.size(); ++head) {
+			const uint32_t state = queue[head];
+			const uint32_t failure = failures_[state];
+			output_links_[state] =
+				!terminals[failure].empty() ? failure : output_links_[failure];
+			for (const auto& entry : children[state]) {
+				uint32_t fallback = failure;
+				uint32_t target = child(fallback, entry.first);
+				while (target == kNone && fallback != 0) {
+					fallback = failures_[fallback];
+					target = child(fallback, entry.first);
+				}
+				failures_[entry.second] = target != kNone ? target : 0;
+				queue.push_back(entry.second);
+			}
+		}
+		// Корень не ссылается сам на себя.
+		output_links_[0] = kNone;
+
+		root_.assign(256, 0);
+		for (const auto& entry : children[0]) {
+			root_[entry.first] = entry.second;
+		}
+		transition_offsets_.assign(state_count + 1, 0);
+		output_offsets_.assign(state_count + 1, 0);
+		transition_bytes_.clear();
+		transition_targets_.clear();
+		outputs_.clear();
+		for (uint32_t state = 0; state < state_count; ++state) {
+			for (const auto& entry : children[state]) {
+				transition_bytes_.push_back(entry.first);
+				transition_targets_.push_back(entry.second);
+			}
+			transition_offsets_[state + 1] =
+				static_cast<uint32_t>(transition_bytes_.size());
+			outputs_.insert(outputs_.end(), terminals[state].begin(),
+				terminals[state].end());
+			output_offsets_[state + 1] = static_cast<uint32_t>(outputs_.size());
+		}
+	}
+
+	uint32_t LibrarySignatures::Next(uint32_t state, Byte byte) const {
+		while (state != 0) {
+			const auto begin = transition_bytes_.begin() + transition_offsets_[state];
+			const auto end = transition_bytes_.begin() + transition_offsets_[state + 1];
+			const auto it = std::lower_bound(begin, end, byte);
+			if (it != end && *it == byte) {
+				return transition_targets_[it - transition_bytes_.begin()];
+			}
+			state = failures_[state];
+		}
+		return root_[byte];
+	}
+
+	size_t LibrarySignatures::GetScore(uint32_t signature) const {
+		const Signature& record = signatures_[signature];
+		// Проверенная форма графа весит больше любого числа байтов.
+		return std::count(record.mask.begin(), record.mask.end(), '\xFF') +
+			(record.shape_hash != 0 ? kMaxPatternSize + 1 : 0);
+	}
+
+	std::vector<LibrarySignatures::Match> LibrarySignatures::Find(
+		const AddressSpace& address_space, const FlowGraph& flow_graph) const {
+		std::vector<Match> matches;
+		if (anchors_.empty()) {
+			return matches;
+		}
+		std::vector<Address> starts;
+		starts.reserve(flow_graph.GetFunctions().size());
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			if (!entry.second->GetBasicBlocks().empty()) {
+				starts.push_back(entry.first);
+			}
+		}
+
+		const std::vector<AddressSpaceChunk> chunks = GetAddressSpaceChunks(
+			address_space, kChunkSize, AddressSpace::kExecute, AddressSpace::kExecute);
+		std::vector<std::vector<Match>> chunk_matches(chunks.size());
+		ScanAddressSpaceChunks(chunks,
+			[&](size_t index, const AddressSpaceChunk& chunk) {
+			// Состояние автомата не длиннее самого длинного якоря, поэтому начало
+			// с отступом даёт те же срабатывания, что и проход с начала блока.
+			const size_t warmup = std::min(chunk.begin, max_anchor_size_ - 1);
+			uint32_t state = 0;
+			for (size_t i = chunk.begin - warmup; i < chunk.end; ++i) {
+				state = Next(state, chunk.bytes[i]);
+				if (i < chunk.begin) {
+					continue;
+				}
+				uint32_t output = output_offsets_[state] != output_offsets_[state + 1]
+					? state : output_links_[state];
+				for (; output != kNone; output = output_links_[output]) {
+					for (uint32_t k = output_offsets_[output];
+						k < output_offsets_[output + 1]; ++k) {
+						const Anchor& anchor = anchors_[outputs_[k]];
+						const size_t anchor_begin = i + 1 - anchor.size;
+						if (anchor_begin < anchor.offset) {
+							continue;
+						}
+						const size_t start = anchor_begin - anchor.offset;
+						const Address address = chunk.address + start;
+						if (!std::binary_search(starts.begin(), starts.end(), address)) {
+							continue;
+						}
+						const Signature& signature = signatures_[anchor.signature];
+						if (start + signature.bytes.size() > chunk.size) {
+							continue;
+						}
+						bool equal = true;
+						for (size_t j = 0; j < signature.bytes.size() && equal; ++j) {
+							equal = ((chunk.bytes[start + j] ^
+								static_cast<Byte>(signature.bytes[j])) &
+								static_cast<Byte>(signature.mask[j])) == 0;
+						}
+						if (!equal || (signature.shape_hash != 0 &&
+							GetShapeHash(*flow_graph.GetFunction(address)) !=
+							signature.shape_hash)) {
+							continue;
+						}
+						chunk_matches[index].push_back({ address, anchor.signature });
+					}
+				}
+			}
+		});
+
+		std::vector<Match> candidates;
+		for (const auto& part : chunk_matches) {
+			candidates.insert(candidates.end(), part.begin(), part.end());
+		}
+		std::sort(candidates.begin(), candidates.end(),
+			[](const Match& lhs, const Match& rhs) {
+			return lhs.function != rhs.function ? lhs.function < rhs.function
+				: lhs.signature < rhs.signature;
+		});
+		for (size_t begin = 0; begin < candidates.size();) {
+			size_t end = begin;
+			uint32_t best = kNone;
+			size_t best_score = 0;
+			bool ambiguous = false;
+			for (; end < candidates.size() &&
+				candidates[end].function == candidates[begin].function; ++end) {
+				const uint32_t signature = candidates[end].signature;
+				const size_t score = GetScore(signature);
+				if (best == kNone || score > best_score) {
+					best = signature;
+					best_score = score;
+					ambiguous = false;
+				}
+				else if (score == best_score &&
+					signatures_[signature].name != signatures_[best].name) {
+					ambiguous = true;
+				}
+			}
+			if (!ambiguous) {
+				matches.push_back({ candidates[begin].function, best });
+			}
+			begin = end;
+		}
+		return matches;
+	}
+
+	uint64_t LibrarySignatures::GetShapeHash(const Function& function) {
+		// FNV-1a по байтам 64-битных значений.
+		uint64_t hash = 14695981039346656037ULL;
+		const auto mix = [&hash](uint64_t value) {
+			for (int i = 0; i < 8; ++i) {
+				hash ^= (value >> (i * 8)) & 0xFF;
+				hash *= 1099511628211ULL;
+			}
+		};
+		const auto& basic_blocks = function.GetBasicBlocks();
+		const auto& edges = function.GetEdges();
+		mix(basic_blocks.size());
+		mix(edges.size());
+		for (uint32_t i = 0; i < basic_blocks.size(); ++i) {
+			mix(basic_blocks[i]->GetInstructionCount());
+			const auto successors = function.GetSuccessorEdges(i);
+			mix(successors.size());
+			for (const uint32_t edge : successors) {
+				const uint32_t target = function.GetEdgeTargetIndex(edge);
+				mix(edges[edge].type);
+				mix(target == Function::kInvalidIndex
+					? ~uint64_t{ 0 } : uint64_t{ target } - i);
+			}
+		}
+		return hash != 0 ? hash : 1;
+	}
+
+}  // namespace security::binexport
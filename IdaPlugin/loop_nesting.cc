@@ -0,0 +1,269 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/loop_nesting.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "third_party/zynamics/binexport/function.h"
+
+namespace security::binexport {
+
+	static_assert(LoopNesting::kNone == Function::kInvalidIndex,
+		"Block indices of Function and LoopNesting share the invalid value");
+
+	LoopNesting::LoopNesting(const Function& function) {
+		const uint32_t block_count =
+			static_cast<uint32_t>(function.GetBasicBlocks().size());
+		const size_t edge_count = function.GetEdges().size();
+		order_index_.assign(block_count, kNone);
+		back_edges_.assign(edge_count, false);
+		block_loops_.assign(block_count, kNone);
+
+		// Обратный постпорядок блоков, достижимых из точки входа. Обход в глубину
+		// идёт по явному стеку, поэтому глубина графа не ограничена стеком потока.
+		const uint32_t entry = function.GetEntryBasicBlockIndex();
+		if (entry != kNone) {
+			std::vector<bool> visited(block_count, false);
+			std::vector<std::pair<uint32_t, uint32_t>> stack;  // Блок, следующее ребро.
+			visited[entry] = true;
+			stack.emplace_back(entry, 0);
+			while (!stack.empty()) {
+				const uint32_t block = stack.back().first;
+				const auto successors = function.GetSuccessorEdges(block);
+				if (stack.back().second < successors.size()) {
+					const uint32_t target = function.GetEdgeTargetIndex(
+						successors[stack.back().second++]);
+					if (target != kNone && !visited[target]) {
+						visited[target] = true;
+						stack.emplace_back(target, 0);
+					}
+					continue;
+				}
+				order_.push_back(block);
+				stack.pop_back();
+			}
+			std::reverse(order_.begin(), order_.end());
+			for (uint32_t i = 0; i < order_.size(); ++i) {
+				order_index_[order_[i]] = i;
+			}
+		}
+		const uint32_t reachable = static_cast<uint32_t>(order_.size());
+
+		// Непосредственные доминаторы в номерах обратного постпорядка
+		// (Cooper, Harvey, Kennedy, "A Simple, Fast Dominance Algorithm").
+		idom_.assign(reachable, kNone);
+		if (reachable > 0) {
+			idom_[0] = 0;
+		}
+		for (bool changed = reachable > 1; changed;) {
+			changed = false;
+			for (uint32_t i = 1; i < reachable; ++i) {
+				uint32_t new_idom = kNone;
+				for (const uint32_t edge : function.GetPredecessorEdges(order_[i])) {
+					const uint32_t source = function.GetEdgeSourceIndex(edge);
+					if (source == kNone) {
+						continue;
+					}
+					uint32_t other = order_index_[source];
+					if (other == kNone || idom_[other] == kNone) {
+						continue;
+					}
+					if (new_idom == kNone) {
+						new_idom = other;
+						continue;
+					}
+					uint32_t current = new_idom;
+					while (current != other) {
+						while (current > other) {
+							current = idom_[current];
+						}
+						while (other > current) {
+							other = idom_[other];
+						}
+					}
+					new_idom = current;
+				}
+				if (idom_[i] != new_idom) {
+					idom_[i] = new_idom;
+					changed = true;
+				}
+			}
+		}
+
+		// Интервалы обхода дерева доминаторов: a доминирует над b, если интервал b
+		// вложен в интервал a.
+		enter_.resize(reachable);
+		leave_.resize(reachable);
+		if (reachable > 0) {
+			std::vector<uint32_t> child_offsets(reachable + 1, 0);
+			for (uint32_t i = 1; i < reachable; ++i) {
+				++child_offsets[idom_[i] + 1];
+			}
+			std::partial_sum(child_offsets.begin(), child_offsets.end(),
+				child_offsets.begin());
+			std::vector<uint32_t> children(reachable - 1);
+			{
+				std::vector<uint32_t> next(child_offsets.begin(),
+					child_offsets.end() - 1);
+				for (uint32_t i = 1; i < reachable; ++i) {
+					children[next[idom_[i]]++] = i;
+				}
+			}
+			uint32_t clock = 0;
+			std::vector<std::pair<uint32_t, uint32_t>> stack;  // Узел, следующий потомок.
+			enter_[0] = clock++;
+			stack.emplace_back(0, child_offsets[0]);
+			while (!stack.empty()) {
+				const uint32_t node = stack.back().first;
+				if (stack.back().second < child_offsets[node + 1]) {
+					const uint32_t child = children[stack.back().second++];
+					enter_[child] = clock++;
+					stack.emplace_back(child, child_offsets[child]);
+					continue;
+				}
+				leave_[node] = clock++;
+				stack.pop_back();
+			}
+		}
+		const auto dominates = [this](uint32_t dominator, uint32_t node) {
+			return enter_[dominator] <= enter_[node] && leave_[node] <= leave_[dominator];
+		};
+
+		for (size_t i = 0; i < edge_count; ++i) {
+			const uint32_t source = function.GetEdgeSourceIndex(i);
+			const uint32_t target = function.GetEdgeTargetIndex(i);
+			if (source == kNone || target == kNone) {
+				continue;
+			}
+			// Самостоятельные ребра всегда являются петлями. (Self edges are always loops.)
+			bool is_back_edge = source == target;
+			if (!is_back_edge) {
+				const uint32_t source_order = order_index_[source];
+				const uint32_t target_order = order_index_[target];
+				is_back_edge = source_order != kNone && target_order != kNone &&
+					dominates(target_order, source_order);
+			}
+			if (is_back_edge) {
+				back_edges_[i] = true;
+				++back_edge_count_;
+			}
+		}
+
+		// Естественные циклы от внутренних к внешним: заголовок объемлющего цикла
+		// доминирует над вложенным и потому раньше в обратном постпорядке. Тело
+		// собирается обратным обходом от источников обратных рёбер, найденные
+		// циклы схлопываются в свой заголовок. Обход назад не выходит из области
+		// заголовка, поэтому неприводимые участки не попадают в чужие циклы.
+		std::vector<uint32_t> representative(reachable);
+		std::iota(representative.begin(), representative.end(), 0);
+		const auto find = [&representative](uint32_t node) {
+			while (representative[node] != node) {
+				representative[node] = representative[representative[node]];
+				node = representative[node];
+			}
+			return node;
+		};
+		std::vector<uint32_t> header_loops(reachable, kNone);
+		std::vector<uint32_t> marks(reachable, kNone);
+		std::vector<uint32_t> body;
+		std::vector<uint32_t> worklist;
+		for (uint32_t header = reachable; header-- > 0;) {
+			bool is_header = false;
+			worklist.clear();
+			for (const uint32_t edge : function.GetPredecessorEdges(order_[header])) {
+				if (!back_edges_[edge]) {
+					continue;
+				}
+				is_header = true;
+				const uint32_t source = order_index_[function.GetEdgeSourceIndex(edge)];
+				if (source != header) {
+					worklist.push_back(find(source));
+				}
+			}
+			if (!is_header) {
+				continue;
+			}
+			const uint32_t loop = static_cast<uint32_t>(loops_.size());
+			loops_.push_back({ order_[header], kNone, 0, 0 });
+			header_loops[header] = loop;
+			marks[header] = loop;
+			body.clear();
+			while (!worklist.empty()) {
+				const uint32_t node = worklist.back();
+				worklist.pop_back();
+				if (marks[node] == loop) {
+					continue;
+				}
+				marks[node] = loop;
+				body.push_back(node);
+				for (const uint32_t edge : function.GetPredecessorEdges(order_[node])) {
+					const uint32_t source = function.GetEdgeSourceIndex(edge);
+					if (source == kNone || order_index_[source] == kNone) {
+						continue;
+					}
+					const uint32_t next = find(order_index_[source]);
+					if (marks[next] != loop && dominates(header, next)) {
+						worklist.push_back(next);
+					}
+				}
+			}
+			for (const uint32_t node : body) {
+				representative[node] = header;
+				if (header_loops[node] != kNone) {
+					loops_[header_loops[node]].parent = loop;
+				}
+				else {
+					block_loops_[order_[node]] = loop;
+				}
+			}
+			block_loops_[order_[header]] = loop;
+		}
+
+		// Объемлющий цикл всегда идёт позже вложенного.
+		for (size_t i = loops_.size(); i-- > 0;) {
+			Loop& loop = loops_[i];
+			loop.depth = loop.parent == kNone ? 1 : loops_[loop.parent].depth + 1;
+			max_loop_depth_ = std::max(max_loop_depth_, loop.depth);
+		}
+		for (const uint32_t loop : block_loops_) {
+			if (loop != kNone) {
+				++loops_[loop].size;
+			}
+		}
+		for (Loop& loop : loops_) {
+			if (loop.parent != kNone) {
+				loops_[loop.parent].size += loop.size;
+			}
+		}
+	}
+
+	uint32_t LoopNesting::GetImmediateDominator(uint32_t block) const {
+		const uint32_t node = order_index_[block];
+		if (node == kNone || node == 0) {
+			return kNone;
+		}
+		return order_[idom_[node]];
+	}
+
+	bool LoopNesting::Dominates(uint32_t dominator, uint32_t block) const {
+		const uint32_t first = order_index_[dominator];
+		const uint32_t second = order_index_[block];
+		return first != kNone && second != kNone && enter_[first] <= enter_[second] &&
+			leave_[second] <= leave_[first];
+	}
+
+}  // namespace security::binexport
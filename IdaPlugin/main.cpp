@@ -40,6 +40,7 @@
 #include <graph.hpp>
 
 #include "exporter.h"
+#include "third_party/zynamics/binexport/crypto_constants.h"
 #include "api_monitor.h"
 
 /// \addtogroup PLUGINS_W
@@ -403,6 +404,7 @@ plugin_ctx_t::plugin_ctx_t()
 plugin_ctx_t::~plugin_ctx_t()
 {
 	Settings::shutdown(); // ← один раз на выгрузке
+	Exporter::ReleaseCallGraphIndex();
 
 	// слушатели клавиш и пункты меню
 	unhook_from_notification_point(HT_VIEW, ui_callback, this);
@@ -470,6 +472,7 @@ static plugmod_t*idaapi init()
 		return nullptr;
 
 	Settings::init(); // ← обязательно: загрузить/создать дефолты
+	SB::CryptoConstants::Get(); // база криптографических констант строится один раз
 
 	get_current_plugin_directory();
 	const std::string API_MONITOR_FOLDER = "\\ApiMonitorDoc";
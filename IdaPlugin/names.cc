@@ -15,6 +15,7 @@
 // #include "third_party/zynamics/binexport/ida/names.h"
 #include "names.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <iomanip>
 #include <sstream>
@@ -27,9 +28,11 @@
 #include <idp.hpp>                                              // NOLINT
 #include <allins.hpp>                                           // NOLINT
 #include <enum.hpp>                                             // NOLINT
+#include <fixup.hpp>                                            // NOLINT
 #include <frame.hpp>                                            // NOLINT
 #include <ida.hpp>                                              // NOLINT
 #include <lines.hpp>                                            // NOLINT
+#include <loader.hpp>                                           // NOLINT
 #include <name.hpp>                                             // NOLINT
 #include <nalt.hpp>                                             // NOLINT
 #include <netnode.hpp>                                          // NOLINT
@@ -48,6 +51,7 @@
 #include "third_party/absl/time/time.h"
 #include "third_party/zynamics/binexport/address_references.h"
 #include "third_party/zynamics/binexport/base_types.h"
+#include "third_party/zynamics/binexport/byte_provider.h"
 #include "third_party/zynamics/binexport/flow_analysis.h"
 #include "third_party/zynamics/binexport/flow_graph.h"
 // #include "third_party/zynamics/binexport/ida/flow_analysis.h"
@@ -404,31 +408,101 @@ Name GetName(Address /* address */, Address immediate,
   return Name(name, type);
 }
 
-std::string GetBytes(const Instruction& instruction) {
-  std::string bytes(instruction.GetSize(), '\0');
-  get_bytes(&(bytes[0]), instruction.GetSize(),
+void GetBytes(const Instruction& instruction, std::string* bytes) {
+  bytes->resize(instruction.GetSize());
+  if (bytes->empty()) {
+    return;
+  }
+  get_bytes(&(*bytes)[0], instruction.GetSize(),
             static_cast<ea_t>(instruction.GetAddress()));
-  return bytes;
 }
 
 bool idaapi HasNoValue(flags_t flags, void* /* ud */) {
   return !has_value(flags);
 }
 
-// Returns the raw bytes that are contained within a segment.
-std::vector<Byte> GetSectionBytes(ea_t segment_start_address) {
-  std::vector<Byte> bytes;
+int idaapi HasPatchedByte(ea_t /* ea */, qoff64_t /* fpos */,
+                          uint64 /* original_value */,
+                          uint64 /* patched_value */, void* /* ud */) {
+  return 1;  // Stop at the first patched byte.
+}
+
+// Returns the memory-mapped input file, shared by all segments of one export.
+// The mapping is released once the last address space referencing it is gone.
+std::shared_ptr<MappedFile> GetMappedInputFile() {
+  static std::weak_ptr<MappedFile> cached_file;
+  static std::string cached_path;
+
+  std::string path(QMAXPATH, '\0');
+  if (get_input_file_path(&path[0], QMAXPATH) <= 0) {
+    return nullptr;
+  }
+  path.resize(std::strlen(path.data()));
+  if (path == cached_path) {
+    if (auto file = cached_file.lock()) {
+      return file;
+    }
+  }
+  auto file = MappedFile::Open(path);
+  cached_file = file;
+  cached_path = path;
+  return file;
+}
+
+// Returns a view into the input file if the database bytes of
+// [start_address, start_address + size) are a verbatim copy of one contiguous
+// file region: no patches, no applied fixups and no gaps in the file mapping.
+std::shared_ptr<ByteProvider> GetFileBackedBytes(ea_t start_address,
+                                                 size_t size) {
+  const qoff64_t file_offset = get_fileregion_offset(start_address);
+  if (file_offset < 0 || contains_fixups(start_address, size) ||
+      visit_patched_bytes(start_address, start_address + size, HasPatchedByte,
+                          nullptr /* user data */) != 0) {
+    return nullptr;
+  }
+  // File regions are contiguous per loader chunk, a page-wise probe catches
+  // segments assembled from several chunks.
+  constexpr size_t kProbeStep = 0x1000;
+  for (size_t offset = kProbeStep; offset < size; offset += kProbeStep) {
+    if (get_fileregion_offset(start_address + offset) !=
+        file_offset + static_cast<qoff64_t>(offset)) {
+      return nullptr;
+    }
+  }
+  if (get_fileregion_offset(start_address + size - 1) !=
+      file_offset + static_cast<qoff64_t>(size - 1)) {
+    return nullptr;
+  }
+  auto file = GetMappedInputFile();
+  if (!file || file_offset + size > file->size()) {
+    return nullptr;
+  }
+  return std::make_shared<FileRegionByteProvider>(std::move(file), file_offset,
+                                                  size);
+}
+
+AddressSpace::MemoryBlock GetSectionMemoryBlock(ea_t segment_start_address) {
   const segment_t* ida_segment = getseg(segment_start_address);
-  if (ida_segment && is_loaded(ida_segment->start_ea)) {
-    const ea_t undefined_bytes =
-        next_that(ida_segment->start_ea, ida_segment->end_ea, HasNoValue,
-                  nullptr /* user data */);
-    bytes.resize(
-        (undefined_bytes == BADADDR ? ida_segment->end_ea : undefined_bytes) -
-        ida_segment->start_ea);
-    get_bytes(&bytes[0], bytes.size(), ida_segment->start_ea);
+  if (!ida_segment || !is_loaded(ida_segment->start_ea)) {
+    return AddressSpace::MemoryBlock();
   }
-  return bytes;
+  const ea_t start_address = ida_segment->start_ea;
+  const ea_t undefined_bytes = next_that(start_address, ida_segment->end_ea,
+                                         HasNoValue, nullptr /* user data */);
+  const size_t size =
+      (undefined_bytes == BADADDR ? ida_segment->end_ea : undefined_bytes) -
+      start_address;
+  if (size == 0) {
+    return AddressSpace::MemoryBlock();
+  }
+  if (auto file_bytes = GetFileBackedBytes(start_address, size)) {
+    return AddressSpace::MemoryBlock(std::move(file_bytes));
+  }
+  // IDB-only bytes (bss, patched or rebased segments): page in on demand.
+  return AddressSpace::MemoryBlock(std::make_shared<PagedByteProvider>(
+      size, [start_address](size_t offset, Byte* buffer, size_t length) {
+        get_bytes(buffer, length, start_address + offset);
+      }));
 }
 
 int GetPermissions(const segment_t* ida_segment) {
@@ -442,15 +516,14 @@ int GetPermissions(const segment_t* ida_segment) {
 void GetRegularComments(Address address, Comments* comments) {
   qstring ida_comment;
   if (get_cmt(&ida_comment, address, /*rptble=*/false) > 0) {
-    // TODO(cblichmann): Benchmark against caching an absl::string_view.
     comments->emplace_back(address, UA_MAXOP + 1,
-                           CallGraph::CacheString(std::string(
+                           CallGraph::CacheString(absl::string_view(
                                ida_comment.c_str(), ida_comment.length())),
                            Comment::REGULAR, false);
   }
   if (get_cmt(&ida_comment, address, /*rptble=*/true) > 0) {
     comments->emplace_back(address, UA_MAXOP + 2,
-                           CallGraph::CacheString(std::string(
+                           CallGraph::CacheString(absl::string_view(
                                ida_comment.c_str(), ida_comment.length())),
                            Comment::REGULAR, true);
   }
@@ -613,6 +686,9 @@ void GetLocalReferences(const insn_t& instruction, Comments* comments) {
   if (cache.function != function) {
     cache = FunctionCache(function);
   }
+  if (cache.local_vars.empty()) {
+    return;
+  }
 
   for (size_t operand_num = 0; operand_num < UA_MAXOP; ++operand_num) {
     const ea_t offset =
@@ -640,4 +716,124 @@ void GetComments(const insn_t& instruction, Comments* comments) {
   GetLocalReferences(instruction, comments);
 }
 
+namespace {
+
+bool idaapi HasAnnotation(flags_t flags, void* /* ud */) {
+  return has_cmt(flags) || has_extra_cmts(flags) || is_enum0(flags) ||
+         is_enum1(flags) || has_user_name(flags) || has_xref(flags);
+}
+
+}  // namespace
+
+CommentIndex CommentIndex::Build(StringLiteralTable* string_literals) {
+  CommentIndex index;
+  auto& entries = index.entries_;
+  for (int i = 0; i < get_segm_qty(); ++i) {
+    const segment_t* segment = getnseg(i);
+    // next_that() starts after its first argument, so the segment start is
+    // tested separately.
+    for (ea_t address = segment->start_ea;
+         address != BADADDR && address < segment->end_ea;
+         address = next_that(address, segment->end_ea, HasAnnotation,
+                             nullptr /* user data */)) {
+      const flags_t flags = get_flags(address);
+      uint8_t sources = 0;
+      sources |= has_cmt(flags) ? kCommentRegular : 0;
+      sources |= has_extra_cmts(flags) ? kCommentLine : 0;
+      sources |= is_enum0(flags) || is_enum1(flags) ? kCommentEnum : 0;
+      sources |= has_user_name(flags) ? kCommentUserName : 0;
+      if (sources != 0) {
+        entries.push_back({address, sources});
+      }
+      if (!has_xref(flags)) {
+        continue;
+      }
+      // Data references are recorded at their source, where the flow
+      // analysis looks for them.
+      xrefblk_t xref;
+      for (bool ok = xref.first_to(address, XREF_DATA); ok;
+           ok = xref.next_to()) {
+        entries.push_back({xref.from, kCommentDataReference});
+      }
+      // The scan only finds strings of StringLiteralTable::kMinLength or more
+      // characters in data blocks, IDA also knows shorter ones and those in
+      // code segments. Sizing follows GetStringReference().
+      if (string_literals && is_strlit(flags) &&
+          !string_literals->Find(address)) {
+        size_t length = get_max_strlit_length(address, STRTYPE_C);
+        auto encoding = StringLiteralTable::kAscii;
+        if (length == 2) {
+          length = get_max_strlit_length(address, STRTYPE_C_16);
+          encoding = StringLiteralTable::kUtf16;
+        }
+        std::string value(length, '\0');
+        get_bytes(&value[0], length, address);
+        string_literals->Add(address, encoding, value);
+      }
+    }
+  }
+  for (size_t i = 0; i < get_func_qty(); ++i) {
+    if (const func_t* function = getn_func(i)) {
+      entries.push_back({function->start_ea, kCommentFunction});
+    }
+  }
+
+  // Merge entries of the same address.
+  std::sort(entries.begin(), entries.end());
+  size_t size = 0;
+  for (const Entry& entry : entries) {
+    if (size > 0 && entries[size - 1].address == entry.address) {
+      entries[size - 1].sources |= entry.sources;
+    } else {
+      entries[size++] = entry;
+    }
+  }
+  entries.resize(size);
+  entries.shrink_to_fit();
+  return index;
+}
+
+uint8_t CommentIndex::Find(Address address) const {
+  // The flow analysis mostly follows fall-through edges, so the next lookup
+  // tends to hit at or right after the previous match.
+  if (hint_ < entries_.size() && entries_[hint_].address >= address &&
+      (hint_ == 0 || entries_[hint_ - 1].address < address)) {
+    if (entries_[hint_].address != address) {
+      return 0;
+    }
+    return entries_[hint_++].sources;
+  }
+  const auto it = std::lower_bound(entries_.begin(), entries_.end(),
+                                   Entry{address, 0});
+  hint_ = it - entries_.begin();
+  if (it == entries_.end() || it->address != address) {
+    return 0;
+  }
+  ++hint_;
+  return it->sources;
+}
+
+void GetComments(const insn_t& instruction, uint8_t sources,
+                 Comments* comments) {
+  if (sources & kCommentRegular) {
+    GetRegularComments(instruction.ea, comments);
+  }
+  if (sources & kCommentEnum) {
+    GetEnumComments(instruction.ea, comments);
+  }
+  if (sources & kCommentLine) {
+    GetLineComments(instruction.ea, comments);
+  }
+  if (sources & kCommentFunction) {
+    GetFunctionComments(instruction.ea, comments);
+    if (sources & kCommentUserName) {
+      GetLocationNames(instruction.ea, comments);
+    }
+  }
+  if (sources & kCommentDataReference) {
+    GetGlobalReferences(instruction.ea, comments);
+  }
+  GetLocalReferences(instruction, comments);
+}
+
 }  // namespace security::binexport
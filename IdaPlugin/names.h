@@ -17,6 +17,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 // clang-format off
 #include "begin_idasdk.inc"  // NOLINT
@@ -28,7 +29,9 @@
 #include "third_party/absl/types/optional.h"
 #include "third_party/zynamics/binexport/comment.h"
 #include "third_party/zynamics/binexport/expression.h"
+#include "third_party/zynamics/binexport/string_literals.h"
 #include "third_party/zynamics/binexport/types.h"
+#include "third_party/zynamics/binexport/virtual_memory.h"
 
 namespace security::binexport {
 
@@ -62,7 +65,9 @@ std::string GetDemangledName(Address address);
 
 std::string GetModuleName();
 
-std::string GetBytes(const Instruction& instruction);
+// Instruction::GetBytesCallback: байты инструкции из базы IDA, только в
+// главном потоке.
+void GetBytes(const Instruction& instruction, std::string* bytes);
 
 // CPU instruction sets that are explicitly supported. These apply to both
 // 32-bit and 64-bit variants, where applicable.
@@ -98,12 +103,62 @@ bool IsStackVariable(Address address, uint8_t operand_num);
 // several string references.
 std::string GetStringReference(ea_t address);
 
-std::vector<Byte> GetSectionBytes(ea_t segment_start_address);
+// Returns the loaded bytes of a segment without copying them. Where the
+// database image coincides with the input file, the block is a view into the
+// memory-mapped file. Otherwise the bytes are paged in from the database on
+// first access.
+AddressSpace::MemoryBlock GetSectionMemoryBlock(ea_t segment_start_address);
 int GetPermissions(const segment_t* ida_segment);
 
 void GetComments(const insn_t& instruction,
                  Comments* comments);  // Cached in callgraph!
 
+// Kinds of annotations an address may carry, as recorded by CommentIndex.
+enum CommentSource : uint8_t {
+  kCommentRegular = 1 << 0,        // Regular or repeatable comment.
+  kCommentEnum = 1 << 1,           // Operand 0 or 1 is an enum member.
+  kCommentLine = 1 << 2,           // Anterior or posterior lines.
+  kCommentFunction = 1 << 3,       // Start of a function.
+  kCommentUserName = 1 << 4,       // User-defined name.
+  kCommentDataReference = 1 << 5,  // Data reference from this address.
+};
+
+// Sorted side table of all addresses that carry comments, names or data
+// references. It is built in one pass over the database flags and the data
+// cross references, so the flow analysis only queries IDA for addresses that
+// actually have something to report. Most instructions have nothing.
+class CommentIndex {
+ public:
+  // If string_literals is given, referenced string literals defined in the
+  // database are added to it. The caller must call Finish() on it afterwards.
+  static CommentIndex Build(StringLiteralTable* string_literals = nullptr);
+
+  // Returns a bit mask of CommentSource values for the address. Lookups for
+  // ascending addresses are answered without a binary search.
+  uint8_t Find(Address address) const;
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    Address address;
+    uint8_t sources;
+
+    bool operator<(const Entry& other) const {
+      return address < other.address;
+    }
+  };
+
+  std::vector<Entry> entries_;
+  mutable size_t hint_ = 0;
+};
+
+// Same as GetComments(instruction, comments), restricted to the sources found
+// in a CommentIndex. Local references depend on the decoded operands and are
+// always queried.
+void GetComments(const insn_t& instruction, uint8_t sources,
+                 Comments* comments);
+
 }  // namespace security::binexport
 
 #endif  // NAMES_H_
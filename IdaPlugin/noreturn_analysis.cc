@@ -0,0 +1,254 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/noreturn_analysis.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/container/flat_hash_set.h"
+#include "third_party/zynamics/binexport/call_graph.h"
+#include "third_party/zynamics/binexport/call_graph_index.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
+
+namespace security::binexport {
+	namespace {
+
+		using AddressSet = absl::flat_hash_set<Address>;
+
+		// Код программы до восстановления функций.
+		struct Program {
+			const detego::Instructions& instructions;
+			const std::vector<FlowGraphEdge>& jump_edges;
+			const std::vector<EdgeInfo>& call_edges;
+		};
+
+		size_t FindInstruction(const Program& program, Address address) {
+			const auto it = std::lower_bound(
+				program.instructions.begin(), program.instructions.end(), address,
+				[](const Instruction& instruction, Address value) {
+				return instruction.GetAddress() < value;
+			});
+			return it != program.instructions.end() && it->GetAddress() == address
+				? static_cast<size_t>(it - program.instructions.begin())
+				: program.instructions.size();
+		}
+
+/// \brief \n Есть ли путь от точки входа к возврату. Возвратом считается любой\n
+/// выход из известного кода: инструкция без потока и рёбер, кроме вызова, поток\n
+/// или переход на адрес без инструкции, кроме перехода в невозвратную функцию.\n
+/// Если callees задан, обход идёт до конца и собирает цели вызовов.
+		bool MayReturn(const Program& program, size_t entry, const AddressSet& noreturn,
+			std::vector<Address>* callees) {
+			const auto& instructions = program.instructions;
+			absl::flat_hash_set<size_t> visited = { entry };
+			std::vector<size_t> stack = { entry };
+			bool may_return = false;
+			const auto visit = [&](Address address, size_t hint) {
+				size_t index = hint;
+				if (index >= instructions.size() ||
+					instructions[index].GetAddress() != address) {
+					index = FindInstruction(program, address);
+				}
+				if (index == instructions.size()) {
+					return false;
+				}
+				if (visited.insert(index).second) {
+					stack.push_back(index);
+				}
+				return true;
+			};
+			while (!stack.empty()) {
+				const size_t index = stack.back();
+				stack.pop_back();
+				const Instruction& instruction = instructions[index];
+				const Address address = instruction.GetAddress();
+
+				const bool is_call = instruction.HasFlag(FLAG_CALL);
+				if (is_call) {
+					auto edge = std::lower_bound(
+						program.call_edges.begin(), program.call_edges.end(), address,
+						[](const EdgeInfo& edge, Address value) {
+						return edge.source_ < value;
+					});
+					bool has_targets = false;
+					bool all_noreturn = true;
+					for (; edge != program.call_edges.end() && edge->source_ == address;
+						++edge) {
+						has_targets = true;
+						all_noreturn = all_noreturn && noreturn.contains(edge->target_);
+						if (callees != nullptr) {
+							callees->push_back(edge->target_);
+						}
+					}
+					if (has_targets && all_noreturn) {
+						continue;
+					}
+				}
+
+				bool has_successors = false;
+				auto edge = std::lower_bound(
+					program.jump_edges.begin(), program.jump_edges.end(), address,
+					[](const FlowGraphEdge& edge, Address value) {
+					return edge.source < value;
+				});
+				for (; edge != program.jump_edges.end() && edge->source == address;
+					++edge) {
+					has_successors = true;
+					if (!visit(edge->target, instructions.size()) &&
+						!noreturn.contains(edge->target)) {
+						may_return = true;
+					}
+				}
+				if (instruction.IsFlow()) {
+					has_successors = true;
+					if (!visit(instruction.GetNextInstruction(), index + 1)) {
+						may_return = true;
+					}
+				}
+				// Вызов без потока - локальный признак невозвратного вызова.
+				if (!has_successors && !is_call) {
+					may_return = true;
+				}
+				if (may_return && callees == nullptr) {
+					return true;
+				}
+			}
+			return may_return;
+		}
+
+	}  // namespace
+
+	NoReturnAnalysis::NoReturnAnalysis(const detego::Instructions& instructions,
+		const std::vector<FlowGraphEdge>& jump_edges, const CallGraph& call_graph,
+		std::vector<Address> seeds) {
+		const Program program = { instructions, jump_edges, call_graph.GetEdges() };
+		AddressSet noreturn(seeds.begin(), seeds.end());
+
+		// Функции с кодом и их вызовы. Обходы только читают программу и
+		// начальное множество, поэтому идут параллельно.
+		std::vector<std::pair<Address, size_t>> entries;
+		for (const Address address : call_graph.GetFunctions()) {
+			const size_t index = FindInstruction(program, address);
+			if (index != instructions.size() && !noreturn.contains(address)) {
+				entries.emplace_back(address, index);
+			}
+		}
+		std::vector<std::vector<Address>> callees(entries.size());
+		ParallelFor(entries.size(), 16,
+			[&program, &noreturn, &entries, &callees](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				MayReturn(program, entries[i].second, noreturn, &callees[i]);
+			}
+		});
+
+		std::vector<Address> functions = std::move(seeds);
+		std::vector<std::pair<Address, Address>> calls;
+		for (size_t i = 0; i < entries.size(); ++i) {
+			functions.push_back(entries[i].first);
+			for (const Address callee : callees[i]) {
+				calls.emplace_back(entries[i].first, callee);
+			}
+			std::vector<Address>().swap(callees[i]);
+		}
+		const CallGraphIndex index(std::move(functions), std::move(calls));
+
+		// Номер функции в index -> позиция в entries, только для функций с кодом,
+		// не входящих в начальное множество.
+		std::vector<size_t> entry_positions(index.GetFunctionCount(), entries.size());
+		for (size_t i = 0; i < entries.size(); ++i) {
+			entry_positions[index.GetFunction(entries[i].first)] = i;
+		}
+		const auto may_return = [&](uint32_t function) {
+			return MayReturn(program, entries[entry_positions[function]].second,
+				noreturn, nullptr);
+		};
+
+		// Вызываемые компоненты имеют меньшие номера и к этому моменту посчитаны.
+		std::vector<uint32_t> worklist;
+		absl::flat_hash_map<uint32_t, std::vector<uint32_t>> callers;
+		for (uint32_t component = 0; component < index.GetComponentCount();
+			++component) {
+			const auto members = index.GetComponentFunctions(component);
+			if (!index.IsRecursive(component)) {
+				const uint32_t function = members[0];
+				if (entry_positions[function] != entries.size() && !may_return(function)) {
+					noreturn.insert(index.GetFunctionAddress(function));
+				}
+				continue;
+			}
+
+			// Наибольшая неподвижная точка: предполагаем, что никто в компоненте не
+			// возвращает управление, и снимаем предположение, пока есть изменения.
+			callers.clear();
+			worklist.clear();
+			for (const uint32_t function : members) {
+				if (entry_positions[function] == entries.size()) {
+					continue;
+				}
+				noreturn.insert(index.GetFunctionAddress(function));
+				worklist.push_back(function);
+				for (const uint32_t callee : index.GetCallees(function)) {
+					if (index.GetComponent(callee) == component) {
+						callers[callee].push_back(function);
+					}
+				}
+			}
+			while (!worklist.empty()) {
+				const uint32_t function = worklist.back();
+				worklist.pop_back();
+				const Address address = index.GetFunctionAddress(function);
+				if (!noreturn.contains(address) || !may_return(function)) {
+					continue;
+				}
+				noreturn.erase(address);
+				const auto it = callers.find(function);
+				if (it == callers.end()) {
+					continue;
+				}
+				for (const uint32_t caller : it->second) {
+					if (noreturn.contains(index.GetFunctionAddress(caller))) {
+						worklist.push_back(caller);
+					}
+				}
+			}
+		}
+
+		functions_.assign(noreturn.begin(), noreturn.end());
+		std::sort(functions_.begin(), functions_.end());
+
+		// Вызовы, все цели которых не возвращают управление. Рёбра одного
+		// вызова идут подряд.
+		const auto& call_edges = call_graph.GetEdges();
+		for (auto edge = call_edges.begin(); edge != call_edges.end();) {
+			const Address source = edge->source_;
+			bool all_noreturn = true;
+			for (; edge != call_edges.end() && edge->source_ == source; ++edge) {
+				all_noreturn = all_noreturn && noreturn.contains(edge->target_);
+			}
+			const size_t instruction = FindInstruction(program, source);
+			if (all_noreturn && instruction != instructions.size() &&
+				instructions[instruction].HasFlag(FLAG_CALL) &&
+				instructions[instruction].IsFlow()) {
+				calls_.push_back(source);
+			}
+		}
+	}
+
+	bool NoReturnAnalysis::IsNoReturn(Address function) const {
+		return std::binary_search(functions_.begin(), functions_.end(), function);
+	}
+
+}  // namespace security::binexport
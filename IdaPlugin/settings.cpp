@@ -57,6 +57,9 @@ const char* Settings::KEY_MSSQL_INSTANCE = "db/MSSQL.Instance";
 
 const char* Settings::KEY_NOTEPAD_FILE_PATH = "paths/NotepadFile";
 const char* Settings::KEY_EXPORT_LAST_DIR = "export/LastDir";
+const char* Settings::KEY_EXPORT_FUNCTION_BUDGET = "export/FunctionBudget";
+const char* Settings::KEY_EXPORT_STACK_CALL_ESTIMATE = "export/StackCallEstimate";
+const char* Settings::KEY_EXPORT_LIBRARY_SIGNATURES_DIR = "export/LibrarySignaturesDir";
 
 const char* Settings::KEY_START_WINDOW_GEOM = "ui/StartWindow.Geometry";
 const char* Settings::KEY_SETTINGS_WINDOW_GEOM = "ui/SettingsWindow.Geometry";
@@ -145,6 +148,14 @@ void Settings::loadFromQSettings_()
 
 	state_.notepad_file_path = qsettings_->value(KEY_NOTEPAD_FILE_PATH, QString()).toString();
 	state_.export_last_dir = qsettings_->value(KEY_EXPORT_LAST_DIR, QString()).toString();
+	state_.export_function_budget = qsettings_->value(KEY_EXPORT_FUNCTION_BUDGET, 1000000).toInt();
+	// if: бюджет меньше тысячи блоков усекал бы обычные функции
+	if (state_.export_function_budget < 1000)
+		state_.export_function_budget = 1000;
+	state_.export_stack_call_estimate = qsettings_->value(KEY_EXPORT_STACK_CALL_ESTIMATE, 4096).toInt();
+	if (state_.export_stack_call_estimate < 0)
+		state_.export_stack_call_estimate = 0;
+	state_.export_library_signatures_dir = qsettings_->value(KEY_EXPORT_LIBRARY_SIGNATURES_DIR, QString()).toString();
 
 	state_.start_window_geometry = qsettings_->value(KEY_START_WINDOW_GEOM, QByteArray()).toByteArray();
 	state_.settings_window_geometry = qsettings_->value(KEY_SETTINGS_WINDOW_GEOM, QByteArray()).toByteArray();
@@ -185,6 +196,9 @@ void Settings::writeToQSettings_()
 
 	setAndSync_(KEY_NOTEPAD_FILE_PATH, state_.notepad_file_path);
 	setAndSync_(KEY_EXPORT_LAST_DIR, state_.export_last_dir);
+	setAndSync_(KEY_EXPORT_FUNCTION_BUDGET, state_.export_function_budget);
+	setAndSync_(KEY_EXPORT_STACK_CALL_ESTIMATE, state_.export_stack_call_estimate);
+	setAndSync_(KEY_EXPORT_LIBRARY_SIGNATURES_DIR, state_.export_library_signatures_dir);
 
 	setAndSync_(KEY_START_WINDOW_GEOM, state_.start_window_geometry);
 	setAndSync_(KEY_SETTINGS_WINDOW_GEOM, state_.settings_window_geometry);
@@ -390,6 +404,51 @@ QString Settings::getExportLastDir()
 	return state_.export_last_dir;
 }
 
+void Settings::setExportFunctionBudget(int basic_blocks)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	ensureInited_();
+	// if: не даём усекать обычные функции
+	if (basic_blocks < 1000) basic_blocks = 1000;
+	state_.export_function_budget = basic_blocks;
+	setAndSync_(KEY_EXPORT_FUNCTION_BUDGET, state_.export_function_budget);
+}
+int Settings::getExportFunctionBudget()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	ensureInited_();
+	return state_.export_function_budget;
+}
+
+void Settings::setExportStackCallEstimate(int bytes)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	ensureInited_();
+	if (bytes < 0) bytes = 0;
+	state_.export_stack_call_estimate = bytes;
+	setAndSync_(KEY_EXPORT_STACK_CALL_ESTIMATE, state_.export_stack_call_estimate);
+}
+int Settings::getExportStackCallEstimate()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	ensureInited_();
+	return state_.export_stack_call_estimate;
+}
+
+void Settings::setExportLibrarySignaturesDir(const QString& dir)
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	ensureInited_();
+	state_.export_library_signatures_dir = dir.trimmed();
+	setAndSync_(KEY_EXPORT_LIBRARY_SIGNATURES_DIR, state_.export_library_signatures_dir);
+}
+QString Settings::getExportLibrarySignaturesDir()
+{
+	std::lock_guard<std::mutex> lock(mtx_);
+	ensureInited_();
+	return state_.export_library_signatures_dir;
+}
+
 void Settings::setStartWindowGeometry(const QByteArray& geometry)
 {
 	std::lock_guard<std::mutex> lock(mtx_);
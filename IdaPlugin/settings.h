@@ -56,6 +56,9 @@ struct SettingsState
 
 											 // === Группа export ===
 	QString export_last_dir;                 ///< \brief \n Последний каталог экспорта (BinExport/прочие выгрузки). \n
+	int export_function_budget = 1000000;    ///< \brief \n Мягкий бюджет функции при экспорте (базовых блоков). \n
+	int export_stack_call_estimate = 4096;   ///< \brief \n Оценка глубины стека косвенного/внешнего вызова (байт). \n
+	QString export_library_signatures_dir;   ///< \brief \n Каталог наборов сигнатур библиотек (*.bxsig). \n
 
 											 // === Группа ui ===
 	QByteArray start_window_geometry;        ///< \brief \n Геометрия стартового окна (saveGeometry()). \n
@@ -135,6 +138,15 @@ public:
 	/// \brief \n Последний каталог экспорта. \n
 	static QString getExportLastDir();
 
+	/// \brief \n Мягкий бюджет функции при экспорте (базовых блоков). \n
+	static int getExportFunctionBudget();
+
+	/// \brief \n Оценка глубины стека косвенного/внешнего вызова (байт). \n
+	static int getExportStackCallEstimate();
+
+	/// \brief \n Каталог наборов сигнатур библиотек. \n
+	static QString getExportLibrarySignaturesDir();
+
 	/// \brief \n Геометрия стартового окна. \n
 	static QByteArray getStartWindowGeometry();
 
@@ -188,6 +200,15 @@ public:
 	/// \brief \n Последний каталог экспорта. \n
 	static void setExportLastDir(const QString& dir);
 
+	/// \brief \n Мягкий бюджет функции при экспорте (базовых блоков). \n
+	static void setExportFunctionBudget(int basic_blocks);
+
+	/// \brief \n Оценка глубины стека косвенного/внешнего вызова (байт). \n
+	static void setExportStackCallEstimate(int bytes);
+
+	/// \brief \n Каталог наборов сигнатур библиотек. \n
+	static void setExportLibrarySignaturesDir(const QString& dir);
+
 	/// \brief \n Сохраняет геометрию стартового окна. \n
 	static void setStartWindowGeometry(const QByteArray& geometry);
 
@@ -240,6 +261,9 @@ private:
 
 	static const char* KEY_NOTEPAD_FILE_PATH;            ///< "paths/NotepadFile"
 	static const char* KEY_EXPORT_LAST_DIR;              ///< "export/LastDir"
+	static const char* KEY_EXPORT_FUNCTION_BUDGET;       ///< "export/FunctionBudget"
+	static const char* KEY_EXPORT_STACK_CALL_ESTIMATE;   ///< "export/StackCallEstimate"
+	static const char* KEY_EXPORT_LIBRARY_SIGNATURES_DIR; ///< "export/LibrarySignaturesDir"
 
 	static const char* KEY_START_WINDOW_GEOM;            ///< "ui/StartWindow.Geometry"
 	static const char* KEY_SETTINGS_WINDOW_GEOM;         ///< "ui/SettingsWindow.Geometry"
@@ -0,0 +1,662 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/similarity_index.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <system_error>
+
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/container/flat_hash_set.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "third_party/absl/synchronization/mutex.h"
+#include "third_party/zynamics/binexport/basic_block.h"
+#include "third_party/zynamics/binexport/expression.h"
+#include "third_party/zynamics/binexport/flow_graph.h"
+#include "third_party/zynamics/binexport/function.h"
+#include "third_party/zynamics/binexport/hash.h"
+#include "third_party/zynamics/binexport/operand.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
+
+namespace security::binexport {
+	namespace {
+
+/// \brief \n Формат файла (все числа little-endian):\n
+/// magic[8], u64 generation - номер сжатия, затем блоки экспортов:\n
+///   u32 record_count, u32 len + executable_filename, u32 len + executable_hash,\n
+///   record_count записей: u64 address, u64 sim_hash, u32 min_hash[kMinHashSize],\n
+///   u32 len + name.
+		constexpr char kSimilarityIndexMagic[8] = { 'B', 'X', 'S', 'I', 'M', 'I', 'X', '2' };
+		constexpr size_t kHeaderSize = sizeof(kSimilarityIndexMagic) + sizeof(uint64_t);
+		constexpr size_t kRecordFixedSize = 8 + 8 + 4 * kMinHashSize + 4;
+
+		// Число инструкций в шингле.
+		constexpr int kShingleSize = 3;
+
+		// Функции в индексе считаются кусками, одна функция слишком мала для потока.
+		constexpr size_t kMinFingerprintChunk = 256;
+
+		// Доля заменённых блоков в файле, начиная с которой запись индекса его
+		// сжимает. Каждое сжатие хотя бы вдвое уменьшает файл, поэтому его
+		// стоимость распределяется по дописанным блокам.
+		constexpr double kCompactGarbageRatio = 0.5;
+
+		uint64_t Mix64(uint64_t value) {
+			// Финализатор splitmix64.
+			value ^= value >> 30;
+			value *= 0xbf58476d1ce4e5b9ULL;
+			value ^= value >> 27;
+			value *= 0x94d049bb133111ebULL;
+			value ^= value >> 31;
+			return value;
+		}
+
+		uint64_t CombineHash(uint64_t hash, uint64_t value) {
+			return Mix64(hash ^ (value + 0x9e3779b97f4a7c15ULL));
+		}
+
+/// \brief \n Нормализованная инструкция: мнемоника и типы выражений операндов.\n
+/// Значения регистров, констант и символов не учитываются.
+		uint64_t GetInstructionToken(const Instruction& instruction) {
+			uint64_t token = GetSdbmHash(instruction.GetMnemonic());
+			for (auto it = instruction.cbegin(); it != instruction.cend(); ++it) {
+				token = CombineHash(token, Expression::TYPE_NEWOPERAND);
+				for (auto expression = (*it)->cbegin(); expression != (*it)->cend();
+					++expression) {
+					token = CombineHash(token, (*expression)->GetType());
+				}
+			}
+			return token;
+		}
+
+		uint32_t GetBandKey(const std::array<uint32_t, kMinHashSize>& min_hash,
+			int band) {
+			uint64_t key = band;
+			for (int row = band * kLshRows; row < (band + 1) * kLshRows; ++row) {
+				key = CombineHash(key, min_hash[row]);
+			}
+			return static_cast<uint32_t>(key);
+		}
+
+		void AppendUint32(uint32_t value, std::string* buffer) {
+			buffer->append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		void AppendUint64(uint64_t value, std::string* buffer) {
+			buffer->append(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		void AppendString(const std::string& value, std::string* buffer) {
+			AppendUint32(static_cast<uint32_t>(value.size()), buffer);
+			buffer->append(value);
+		}
+
+/// \brief \n Последовательное чтение из отображённого файла с проверкой границ.
+		class Cursor {
+		public:
+			Cursor(const Byte* data, size_t size, size_t offset)
+				: data_(data), size_(size), offset_(offset) {}
+
+			size_t offset() const { return offset_; }
+
+			bool Skip(size_t size) {
+				if (size_ - offset_ < size) {
+					return false;
+				}
+				offset_ += size;
+				return true;
+			}
+
+			template <typename T>
+			bool Read(T* value) {
+				if (size_ - offset_ < sizeof(T)) {
+					return false;
+				}
+				std::memcpy(value, data_ + offset_, sizeof(T));
+				offset_ += sizeof(T);
+				return true;
+			}
+
+			bool ReadString(std::string* value) {
+				uint32_t size;
+				if (!Read(&size) || size_ - offset_ < size) {
+					return false;
+				}
+				value->assign(reinterpret_cast<const char*>(data_ + offset_), size);
+				offset_ += size;
+				return true;
+			}
+
+		private:
+			const Byte* data_;
+			size_t size_;
+			size_t offset_;
+		};
+
+/// \brief \n Блок экспорта в файле индекса.
+		struct FileBlock {
+			std::string executable_filename;
+			std::string executable_hash;
+			uint64_t begin;  // Смещение начала блока.
+			uint64_t end;    // Смещение конца блока.
+			std::vector<uint64_t> offsets;  // Начала записей.
+		};
+
+		bool HasMagic(const MappedFile& file) {
+			return file.size() >= kHeaderSize &&
+				std::memcmp(file.data(), kSimilarityIndexMagic,
+					sizeof(kSimilarityIndexMagic)) == 0;
+		}
+
+		uint64_t GetGeneration(const MappedFile& file) {
+			uint64_t generation;
+			std::memcpy(&generation, file.data() + sizeof(kSimilarityIndexMagic),
+				sizeof(generation));
+			return generation;
+		}
+
+		std::string GetHeader(uint64_t generation) {
+			std::string header(kSimilarityIndexMagic, sizeof(kSimilarityIndexMagic));
+			AppendUint64(generation, &header);
+			return header;
+		}
+
+/// \brief \n Версия файла индекса: сжатие меняет generation, дописывание -
+/// размер; время изменения ловит пересоздание файла. Читается без отображения.
+		struct FileVersion {
+			int64_t size = -1;
+			int64_t modification_time = 0;
+			uint64_t generation = 0;
+
+			bool operator==(const FileVersion& other) const {
+				return size == other.size &&
+					modification_time == other.modification_time &&
+					generation == other.generation;
+			}
+		};
+
+/// \brief \n false, если файла нет или это не индекс текущего формата.
+		bool GetFileVersion(const std::string& filename, FileVersion* version) {
+			std::error_code error;
+			const auto size = std::filesystem::file_size(filename, error);
+			if (error) {
+				return false;
+			}
+			const auto time = std::filesystem::last_write_time(filename, error);
+			if (error) {
+				return false;
+			}
+			char header[kHeaderSize];
+			std::ifstream file(filename, std::ios::binary | std::ios::in);
+			if (!file.read(header, sizeof(header)) ||
+				std::memcmp(header, kSimilarityIndexMagic,
+					sizeof(kSimilarityIndexMagic)) != 0) {
+				return false;
+			}
+			version->size = static_cast<int64_t>(size);
+			version->modification_time = time.time_since_epoch().count();
+			std::memcpy(&version->generation, header + sizeof(kSimilarityIndexMagic),
+				sizeof(version->generation));
+			return true;
+		}
+
+/// \brief \n Блоки файла после magic. Незавершённый блок в конце файла
+/// (прерванный экспорт) пропускается.
+		std::vector<FileBlock> ParseBlocks(const MappedFile& file) {
+			std::vector<FileBlock> blocks;
+			Cursor cursor(file.data(), file.size(), kHeaderSize);
+			for (;;) {
+				FileBlock block;
+				block.begin = cursor.offset();
+				uint32_t record_count;
+				if (!cursor.Read(&record_count) ||
+					!cursor.ReadString(&block.executable_filename) ||
+					!cursor.ReadString(&block.executable_hash)) {
+					break;
+				}
+				block.offsets.reserve(record_count);
+				bool complete = true;
+				for (uint32_t i = 0; i < record_count && complete; ++i) {
+					block.offsets.push_back(cursor.offset());
+					uint32_t name_size;
+					complete = cursor.Skip(kRecordFixedSize - sizeof(name_size)) &&
+						cursor.Read(&name_size) && cursor.Skip(name_size);
+				}
+				if (!complete) {
+					break;
+				}
+				block.end = cursor.offset();
+				blocks.push_back(std::move(block));
+			}
+			return blocks;
+		}
+
+/// \brief \n Действующие блоки: повторный экспорт того же бинарника заменяет
+/// прежний блок.
+		std::vector<bool> GetLiveBlocks(const std::vector<FileBlock>& blocks) {
+			absl::flat_hash_map<std::string, size_t> latest_block;
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				latest_block[blocks[i].executable_hash] = i;
+			}
+			std::vector<bool> live(blocks.size(), false);
+			for (const auto& entry : latest_block) {
+				live[entry.second] = true;
+			}
+			return live;
+		}
+
+/// \brief \n Последний открытый через SimilarityIndex::Get() индекс.
+		struct IndexCache {
+			absl::Mutex mutex;
+			std::string filename;
+			FileVersion version;
+			std::shared_ptr<const SimilarityIndex> index;
+		};
+
+		IndexCache& GetIndexCache() {
+			static auto* cache = new IndexCache();
+			return *cache;
+		}
+
+/// \brief \n Сбрасывает кэш перед изменением файла. Отображение закрывается,
+/// когда его отпускают и запросы, ещё держащие индекс; в Windows отображённый
+/// файл нельзя усечь.
+		void ResetIndexCache() {
+			IndexCache& cache = GetIndexCache();
+			absl::MutexLock lock(&cache.mutex);
+			cache.filename.clear();
+			cache.version = FileVersion();
+			cache.index.reset();
+		}
+
+	}  // namespace
+
+	FunctionFingerprint ComputeFingerprint(const Function& function) {
+		// Сиды хеш-функций MinHash фиксированы: от них зависят значения в файле индекса.
+		static const auto* const kSeeds = []() {
+			auto* seeds = new std::array<uint64_t, kMinHashSize>();
+			for (int i = 0; i < kMinHashSize; ++i) {
+				(*seeds)[i] = Mix64(0x5bd1e995ULL + i);
+			}
+			return seeds;
+		}();
+
+		FunctionFingerprint fingerprint;
+		fingerprint.min_hash.fill(std::numeric_limits<uint32_t>::max());
+		int sim_hash_votes[64] = {};
+		std::vector<uint64_t> tokens;
+		for (const auto* basic_block : function.GetBasicBlocks()) {
+			tokens.clear();
+			for (const auto& instruction : *basic_block) {
+				tokens.push_back(GetInstructionToken(instruction));
+			}
+			// Шинглы не пересекают границы блоков: порядок блоков в функции
+			// зависит от адресов, а не от структуры.
+			const size_t shingle_size = std::min<size_t>(kShingleSize, tokens.size());
+			for (size_t i = 0; i + shingle_size <= tokens.size() && shingle_size > 0;
+				++i) {
+				uint64_t shingle = shingle_size;
+				for (size_t j = i; j < i + shingle_size; ++j) {
+					shingle = CombineHash(shingle, tokens[j]);
+				}
+				for (int k = 0; k < kMinHashSize; ++k) {
+					fingerprint.min_hash[k] = std::min(fingerprint.min_hash[k],
+						static_cast<uint32_t>(Mix64(shingle ^ (*kSeeds)[k])));
+				}
+				for (int bit = 0; bit < 64; ++bit) {
+					sim_hash_votes[bit] += (shingle >> bit) & 1 ? 1 : -1;
+				}
+			}
+		}
+		for (int bit = 0; bit < 64; ++bit) {
+			if (sim_hash_votes[bit] > 0) {
+				fingerprint.sim_hash |= uint64_t{ 1 } << bit;
+			}
+		}
+		return fingerprint;
+	}
+
+	double GetMinHashSimilarity(const FunctionFingerprint& first,
+		const FunctionFingerprint& second) {
+		int equal = 0;
+		for (int i = 0; i < kMinHashSize; ++i) {
+			equal += first.min_hash[i] == second.min_hash[i];
+		}
+		return static_cast<double>(equal) / kMinHashSize;
+	}
+
+	SimilarityIndexWriter::SimilarityIndexWriter(const std::string& index_filename,
+		const std::string& executable_filename,
+		const std::string& executable_hash)
+		: index_filename_(index_filename),
+		executable_filename_(executable_filename),
+		executable_hash_(executable_hash) {}
+
+	absl::Status SimilarityIndexWriter::Write(const CallGraph&,
+		const FlowGraph& flow_graph,
+		const Instructions&,
+		const AddressReferences&,
+		const TypeSystem*,
+		const AddressSpace&) {
+		std::vector<const Function*> functions;
+		for (const auto& entry : flow_graph.GetFunctions()) {
+			const Function& function = *entry.second;
+			if (!function.IsImported() && !function.GetBasicBlocks().empty()) {
+				functions.push_back(&function);
+			}
+		}
+		std::vector<FunctionFingerprint> fingerprints(functions.size());
+		ParallelFor(functions.size(), kMinFingerprintChunk,
+			[&functions, &fingerprints](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				fingerprints[i] = ComputeFingerprint(*functions[i]);
+			}
+		});
+
+		// Блок собирается в памяти и дописывается одной записью, чтобы прерванный
+		// экспорт оставлял в конце файла только незавершённый блок.
+		// Файл другого формата (или пустой) начинается заново.
+		FileVersion version;
+		const bool create = !GetFileVersion(index_filename_, &version);
+		std::string buffer;
+		if (create) {
+			buffer = GetHeader(0);
+		}
+		AppendUint32(static_cast<uint32_t>(functions.size()), &buffer);
+		AppendString(executable_filename_, &buffer);
+		AppendString(executable_hash_, &buffer);
+		for (size_t i = 0; i < functions.size(); ++i) {
+			AppendUint64(functions[i]->GetEntryPoint(), &buffer);
+			AppendUint64(fingerprints[i].sim_hash, &buffer);
+			for (uint32_t value : fingerprints[i].min_hash) {
+				AppendUint32(value, &buffer);
+			}
+			AppendString(functions[i]->GetName(Function::DEMANGLED), &buffer);
+		}
+
+		ResetIndexCache();
+		{
+			std::ofstream file(index_filename_, std::ios::binary | std::ios::out |
+				(create ? std::ios::trunc : std::ios::app));
+			file.write(buffer.data(), buffer.size());
+			if (!file) {
+				return absl::UnknownError(
+					absl::StrCat("failed to append to similarity index: '", index_filename_, "'"));
+			}
+		}
+		return SimilarityIndex::Compact(index_filename_, kCompactGarbageRatio);
+	}
+
+	SimilarityIndex::SimilarityIndex(std::shared_ptr<MappedFile> file)
+		: file_(std::move(file)) {}
+
+	absl::StatusOr<std::unique_ptr<SimilarityIndex>> SimilarityIndex::Open(
+		const std::string& filename) {
+		std::shared_ptr<MappedFile> file =
+			MappedFile::Open(filename, MappedFile::Mode::kReadOnly);
+		if (!file) {
+			return absl::NotFoundError(absl::StrCat("cannot map file: '", filename, "'"));
+		}
+		std::unique_ptr<SimilarityIndex> index(new SimilarityIndex(std::move(file)));
+		const absl::Status status = index->BuildIndex();
+		if (!status.ok()) {
+			return status;
+		}
+		return index;
+	}
+
+	absl::StatusOr<std::shared_ptr<const SimilarityIndex>> SimilarityIndex::Get(
+		const std::string& filename) {
+		// Версия проверяется при каждом запросе: файл мог дописать или сжать
+		// экспорт в другом процессе IDA. После сжатия с последующим дописыванием
+		// размер может совпасть с прежним, generation - нет.
+		FileVersion version;
+		const bool has_version = GetFileVersion(filename, &version);
+		IndexCache& cache = GetIndexCache();
+		absl::MutexLock lock(&cache.mutex);
+		if (has_version && cache.index && cache.filename == filename &&
+			cache.version == version) {
+			return cache.index;
+		}
+		// Устаревшее отображение отпускается сразу: в Windows оно не даёт другому
+		// процессу переписать файл при сжатии.
+		cache.filename.clear();
+		cache.index.reset();
+		auto index = Open(filename);
+		if (!index.ok()) {
+			return index.status();
+		}
+		// Версия берётся из самого отображения: файл мог измениться между
+		// GetFileVersion() и Open().
+		if (GetGeneration(*(*index)->file_) != version.generation ||
+			static_cast<int64_t>((*index)->file_->size()) != version.size) {
+			return std::shared_ptr<const SimilarityIndex>(std::move(*index));
+		}
+		cache.filename = filename;
+		cache.version = version;
+		cache.index = std::move(*index);
+		return cache.index;
+	}
+
+	absl::Status SimilarityIndex::Compact(const std::string& filename,
+		double min_garbage_ratio) {
+		ResetIndexCache();
+		std::string buffer;
+		{
+			std::shared_ptr<MappedFile> file =
+				MappedFile::Open(filename, MappedFile::Mode::kReadOnly);
+			if (!file) {
+				return absl::NotFoundError(absl::StrCat("cannot map file: '", filename, "'"));
+			}
+			if (!HasMagic(*file)) {
+				return absl::DataLossError("not a similarity index file");
+			}
+			const std::vector<FileBlock> blocks = ParseBlocks(*file);
+			const std::vector<bool> live = GetLiveBlocks(blocks);
+			size_t live_size = kHeaderSize;
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				live_size += live[i] ? blocks[i].end - blocks[i].begin : 0;
+			}
+			const size_t garbage_size = file->size() - live_size;
+			if (garbage_size == 0 ||
+				garbage_size < min_garbage_ratio * static_cast<double>(file->size())) {
+				return absl::OkStatus();
+			}
+			buffer = GetHeader(GetGeneration(*file) + 1);
+			buffer.reserve(live_size);
+			for (size_t i = 0; i < blocks.size(); ++i) {
+				if (live[i]) {
+					buffer.append(reinterpret_cast<const char*>(file->data()) + blocks[i].begin,
+						blocks[i].end - blocks[i].begin);
+				}
+			}
+		}  // Отображение закрывается до перезаписи файла.
+
+		std::ofstream file(filename,
+			std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!file.is_open()) {
+			// В Windows файл, отображённый другим процессом (индекс, открытый
+			// запросом), не открывается на перезапись. Файл не тронут, сжатие
+			// повторит следующая запись индекса.
+			return absl::OkStatus();
+		}
+		file.write(buffer.data(), buffer.size());
+		if (!file) {
+			return absl::UnknownError(
+				absl::StrCat("failed to compact similarity index: '", filename, "'"));
+		}
+		return absl::OkStatus();
+	}
+
+	absl::Status SimilarityIndex::BuildIndex() {
+		if (!HasMagic(*file_)) {
+			return absl::DataLossError("not a similarity index file");
+		}
+
+		std::vector<FileBlock> parsed = ParseBlocks(*file_);
+		const std::vector<bool> live = GetLiveBlocks(parsed);
+		for (size_t i = 0; i < parsed.size(); ++i) {
+			if (!live[i]) {
+				continue;
+			}
+			Block block;
+			block.executable_filename = std::move(parsed[i].executable_filename);
+			block.executable_hash = std::move(parsed[i].executable_hash);
+			block.first_record = static_cast<uint32_t>(records_.size());
+			block.record_count = static_cast<uint32_t>(parsed[i].offsets.size());
+			for (uint64_t offset : parsed[i].offsets) {
+				records_.push_back({ offset, static_cast<uint32_t>(blocks_.size()) });
+			}
+			blocks_.push_back(std::move(block));
+		}
+
+		// Ключи полос считаются параллельно по записям, затем каждая полоса
+		// сортируется в своём потоке.
+		for (auto& bucket : buckets_) {
+			bucket.resize(records_.size());
+		}
+		ParallelFor(records_.size(), 1 << 14, [this](size_t begin, size_t end) {
+			FunctionFingerprint fingerprint;
+			for (size_t i = begin; i < end; ++i) {
+				ReadFingerprint(records_[i], &fingerprint);
+				for (int band = 0; band < kLshBands; ++band) {
+					buckets_[band][i] = { GetBandKey(fingerprint.min_hash, band),
+						static_cast<uint32_t>(i) };
+				}
+			}
+		});
+		ParallelFor(kLshBands, 1, [this](size_t begin, size_t end) {
+			for (size_t band = begin; band < end; ++band) {
+				std::sort(buckets_[band].begin(), buckets_[band].end());
+			}
+		});
+		return absl::OkStatus();
+	}
+
+	void SimilarityIndex::ReadFingerprint(const Record& record,
+		FunctionFingerprint* fingerprint) const {
+		const Byte* data = file_->data() + record.offset + sizeof(uint64_t);
+		std::memcpy(&fingerprint->sim_hash, data, sizeof(fingerprint->sim_hash));
+		std::memcpy(fingerprint->min_hash.data(), data + sizeof(uint64_t),
+			sizeof(uint32_t) * kMinHashSize);
+	}
+
+	std::string SimilarityIndex::ReadName(const Record& record) const {
+		Cursor cursor(file_->data(), file_->size(),
+			record.offset + kRecordFixedSize - sizeof(uint32_t));
+		std::string name;
+		cursor.ReadString(&name);
+		return name;
+	}
+
+	bool SimilarityIndex::FindFunction(const std::string& executable_hash,
+		Address address, FunctionFingerprint* fingerprint) const {
+		for (const Block& block : blocks_) {
+			if (block.executable_hash != executable_hash) {
+				continue;
+			}
+			const auto first = records_.begin() + block.first_record;
+			const auto last = first + block.record_count;
+			const auto it = std::lower_bound(first, last, address,
+				[this](const Record& record, Address address) {
+				uint64_t record_address;
+				std::memcpy(&record_address, file_->data() + record.offset,
+					sizeof(record_address));
+				return record_address < address;
+			});
+			if (it == last) {
+				return false;
+			}
+			uint64_t record_address;
+			std::memcpy(&record_address, file_->data() + it->offset,
+				sizeof(record_address));
+			if (record_address != address) {
+				return false;
+			}
+			ReadFingerprint(*it, fingerprint);
+			return true;
+		}
+		return false;
+	}
+
+	std::vector<SimilarityIndex::Candidate> SimilarityIndex::Query(
+		const FunctionFingerprint& fingerprint, size_t k,
+		const std::string& executable_hash, Address address) const {
+		absl::flat_hash_set<uint32_t> candidates;
+		for (int band = 0; band < kLshBands; ++band) {
+			const BucketEntry first{ GetBandKey(fingerprint.min_hash, band), 0 };
+			const auto& bucket = buckets_[band];
+			for (auto it = std::lower_bound(bucket.begin(), bucket.end(), first);
+				it != bucket.end() && it->key == first.key; ++it) {
+				candidates.insert(it->record);
+			}
+		}
+
+		struct Scored {
+			uint32_t record;
+			Address address;
+			double similarity;
+			int sim_hash_distance;
+		};
+		std::vector<Scored> scored;
+		scored.reserve(candidates.size());
+		FunctionFingerprint other;
+		for (uint32_t index : candidates) {
+			const Record& record = records_[index];
+			uint64_t record_address;
+			std::memcpy(&record_address, file_->data() + record.offset,
+				sizeof(record_address));
+			if (record_address == address &&
+				blocks_[record.block].executable_hash == executable_hash) {
+				continue;
+			}
+			ReadFingerprint(record, &other);
+			scored.push_back({ index, record_address,
+				GetMinHashSimilarity(fingerprint, other),
+				static_cast<int>(std::bitset<64>(fingerprint.sim_hash ^ other.sim_hash)
+					.count()) });
+		}
+
+		// При равном сходстве порядок задают SimHash и номер записи, чтобы
+		// результат не зависел от порядка обхода хеш-таблицы.
+		const size_t count = std::min(k, scored.size());
+		std::partial_sort(scored.begin(), scored.begin() + count, scored.end(),
+			[](const Scored& left, const Scored& right) {
+			if (left.similarity != right.similarity) {
+				return left.similarity > right.similarity;
+			}
+			if (left.sim_hash_distance != right.sim_hash_distance) {
+				return left.sim_hash_distance < right.sim_hash_distance;
+			}
+			return left.record < right.record;
+		});
+
+		std::vector<Candidate> result;
+		result.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			const Record& record = records_[scored[i].record];
+			const Block& block = blocks_[record.block];
+			result.push_back({ &block.executable_filename, &block.executable_hash,
+				scored[i].address, ReadName(record), scored[i].similarity,
+				scored[i].sim_hash_distance });
+		}
+		return result;
+	}
+
+}  // namespace security::binexport
@@ -0,0 +1,111 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/stack_depth.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace security::binexport {
+	namespace {
+
+		uint64_t SaturatingAdd(uint64_t lhs, uint64_t rhs) {
+			return lhs > std::numeric_limits<uint64_t>::max() - rhs
+				? std::numeric_limits<uint64_t>::max()
+				: lhs + rhs;
+		}
+
+	}  // namespace
+
+/// \brief \n Компоненты обходятся по возрастанию номеров: вызываемые компоненты\n
+/// к этому моменту уже посчитаны. Каждый вызов просматривается один раз.
+	StackDepth::StackDepth(const CallGraphIndex& index,
+		const std::vector<uint64_t>& frame_sizes,
+		const std::vector<bool>& unresolved_calls, uint64_t call_estimate)
+		: index_(index) {
+		const size_t function_count = index.GetFunctionCount();
+		depths_.assign(function_count, 0);
+		deepest_callees_.assign(function_count, kNone);
+		flags_.assign(function_count, 0);
+
+		for (uint32_t component = 0; component < index.GetComponentCount();
+			++component) {
+			const auto functions = index.GetComponentFunctions(component);
+			if (index.IsRecursive(component)) {
+				for (const uint32_t function : functions) {
+					flags_[function] = kUnbounded;
+					// Следующий шаг пути - вызов внутри той же компоненты.
+					for (const uint32_t callee : index.GetCallees(function)) {
+						if (index.GetComponent(callee) == component) {
+							deepest_callees_[function] = callee;
+							break;
+						}
+					}
+				}
+				unbounded_count_ += functions.size();
+				continue;
+			}
+
+			// Нерекурсивная компонента состоит из одной функции.
+			const uint32_t function = functions[0];
+			uint8_t flags = 0;
+			uint64_t frame = frame_sizes[function];
+			if (frame == kUnknownFrame) {
+				frame = call_estimate;
+				flags |= kEstimated;
+			}
+			uint64_t callee_depth = 0;
+			if (unresolved_calls[function]) {
+				callee_depth = call_estimate;
+				flags |= kEstimated;
+			}
+			for (const uint32_t callee : index.GetCallees(function)) {
+				flags |= flags_[callee] & kEstimated;
+				if (flags_[callee] & kUnbounded) {
+					if (!(flags & kUnbounded)) {
+						flags |= kUnbounded;
+						deepest_callees_[function] = callee;
+					}
+				}
+				else if (!(flags & kUnbounded) && depths_[callee] > callee_depth) {
+					callee_depth = depths_[callee];
+					deepest_callees_[function] = callee;
+				}
+			}
+			flags_[function] = flags;
+			if (flags & kUnbounded) {
+				++unbounded_count_;
+				continue;
+			}
+			depths_[function] = SaturatingAdd(frame, callee_depth);
+			if (deepest_function_ == kNone ||
+				depths_[function] > depths_[deepest_function_]) {
+				deepest_function_ = function;
+			}
+		}
+	}
+
+	std::vector<uint32_t> StackDepth::GetDeepestPath(uint32_t function) const {
+		std::vector<uint32_t> path;
+		while (function != kNone) {
+			path.push_back(function);
+			if (index_.IsRecursive(index_.GetComponent(function))) {
+				break;
+			}
+			function = deepest_callees_[function];
+		}
+		return path;
+	}
+
+}  // namespace security::binexport
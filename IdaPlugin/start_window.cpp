@@ -249,6 +249,11 @@ void ExportIdbAdditional(SB::DumpWriter* writer) // ИЗМЕНЕНО было SB
 
 	Instructions instructions;
 	FlowGraph    flow_graph;
+	{
+		// Мягкий бюджет функции из настроек, как в ExportIdb().
+		const size_t budget = Settings::getExportFunctionBudget();
+		flow_graph.SetFunctionBudget({ budget, 2 * budget, 8 * budget });
+	}
 	CallGraph    call_graph;
 
 	AnalyzeFlowIdaAdditional(&entry_points, modules, writer, &instructions, &flow_graph,
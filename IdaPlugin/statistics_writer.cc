@@ -14,81 +14,303 @@
 
 #include "third_party/zynamics/binexport/statistics_writer.h"
 
+#include <algorithm>
 #include <iomanip>
 #include <map>
+#include <memory>
+#include <mutex>  // NOLINT
 #include <string>
 
+#include "third_party/absl/container/flat_hash_map.h"
 #include "third_party/zynamics/binexport/call_graph.h"
 #include "third_party/zynamics/binexport/flow_graph.h"
+#include "third_party/zynamics/binexport/json/json.h"
+#include "third_party/zynamics/binexport/loop_nesting.h"
+#include "third_party/zynamics/binexport/util/parallel.h"
 
 namespace security::binexport {
+	namespace {
+
+		constexpr const char* kFunctionTypeNames[] = {
+			"functions (standard)", "functions (library)", "functions (imported)",
+			"functions (thunk)", "functions (invalid)" };
+
+		constexpr const char* kEdgeTypeNames[] = {
+			"flowgraph edges (true)", "flowgraph edges (false)",
+			"flowgraph edges (unconditional)", "flowgraph edges (switch)" };
+
+		/// \brief \n Счётчики одного потока. Мнемоники инструкций хранятся в
+		/// кеше строк Instruction, поэтому указатель на строку служит
+		/// идентификатором мнемоники, а счётчики лежат в плоском массиве.
+		struct LocalCounters {
+			size_t function_types[5] = {};
+			size_t edge_types[4] = {};
+			size_t real_names = 0;
+			size_t instructions = 0;
+			size_t basic_blocks = 0;
+			size_t edges = 0;
+
+			absl::flat_hash_map<const std::string*, uint32_t> mnemonic_ids;
+			std::vector<const std::string*> mnemonic_names;
+			std::vector<size_t> mnemonic_counts;
+
+			void CountMnemonic(const std::string* mnemonic) {
+				const auto inserted = mnemonic_ids.emplace(
+					mnemonic, static_cast<uint32_t>(mnemonic_names.size()));
+				if (inserted.second) {
+					mnemonic_names.push_back(mnemonic);
+					mnemonic_counts.push_back(0);
+				}
+				++mnemonic_counts[inserted.first->second];
+			}
+		};
+
+		/// \brief \n Процентиль по ближайшему рангу в отсортированном массиве.
+		uint64_t GetPercentile(const std::vector<uint64_t>& sorted, int percent) {
+			const size_t rank = (sorted.size() * percent + 99) / 100;
+			return sorted[std::max<size_t>(rank, 1) - 1];
+		}
+
+		void ComputeDistribution(std::vector<uint64_t> values,
+			StatisticsWriter::Distribution* distribution) {
+			*distribution = StatisticsWriter::Distribution();
+			distribution->count = values.size();
+			if (values.empty()) {
+				return;
+			}
+			std::sort(values.begin(), values.end());
+			for (const uint64_t value : values) {
+				distribution->sum += value;
+				int bucket = 0;
+				for (uint64_t rest = value; rest != 0; rest >>= 1) {
+					++bucket;
+				}
+				if (distribution->histogram.size() <= static_cast<size_t>(bucket)) {
+					distribution->histogram.resize(bucket + 1, 0);
+				}
+				++distribution->histogram[bucket];
+			}
+			distribution->min = values.front();
+			distribution->p50 = GetPercentile(values, 50);
+			distribution->p90 = GetPercentile(values, 90);
+			distribution->p99 = GetPercentile(values, 99);
+			distribution->max = values.back();
+		}
+
+		Json::Value DistributionToJson(
+			const StatisticsWriter::Distribution& distribution) {
+			Json::Value result(Json::objectValue);
+			result["count"] = static_cast<Json::UInt64>(distribution.count);
+			result["sum"] = static_cast<Json::UInt64>(distribution.sum);
+			result["mean"] = distribution.count == 0
+				? 0.0
+				: static_cast<double>(distribution.sum) / distribution.count;
+			result["min"] = static_cast<Json::UInt64>(distribution.min);
+			result["p50"] = static_cast<Json::UInt64>(distribution.p50);
+			result["p90"] = static_cast<Json::UInt64>(distribution.p90);
+			result["p99"] = static_cast<Json::UInt64>(distribution.p99);
+			result["max"] = static_cast<Json::UInt64>(distribution.max);
+			Json::Value histogram(Json::arrayValue);
+			for (const size_t bucket : distribution.histogram) {
+				histogram.append(static_cast<Json::UInt64>(bucket));
+			}
+			result["log2_histogram"] = histogram;
+			return result;
+		}
+
+	}  // namespace
 
 	StatisticsWriter::StatisticsWriter(std::ostream& stream) : stream_(stream) {}
 
 	StatisticsWriter::StatisticsWriter(const std::string& filename)
 		: file_(filename.c_str()), stream_(file_) {}
 
+	StatisticsWriter::StatisticsWriter(std::ostream& stream,
+		std::ostream& json_stream,
+		const std::string& executable_filename,
+		const std::string& executable_hash)
+		: stream_(stream),
+		json_stream_(&json_stream),
+		executable_filename_(executable_filename),
+		executable_hash_(executable_hash) {}
+
 	void StatisticsWriter::GenerateStatistics(
 		const CallGraph& call_graph, const FlowGraph& flow_graph,
-		std::map<std::string, size_t>* statistics_ptr) const {
-		std::map<std::string, size_t>& statistics = *statistics_ptr;
-		statistics.clear();
-		const Functions& functions = flow_graph.GetFunctions();
-		statistics["callgraph nodes (functions)"] = functions.size();
-		statistics["callgraph edges (calls)"] = call_graph.GetEdges().size();
+		Statistics* statistics) const {
+		const Functions& functions_map = flow_graph.GetFunctions();
+		std::vector<const Function*> functions;
+		functions.reserve(functions_map.size());
+		for (const auto& function : functions_map) {
+			functions.push_back(function.second);
+		}
 
-		static const char* kFunctionTypeNames[] = {
-			"functions (standard)", "functions (library)", "functions (imported)",
-			"functions (thunk)", "functions (invalid)" };
-		statistics[kFunctionTypeNames[0]] = 0;
-		statistics[kFunctionTypeNames[1]] = 0;
-		statistics[kFunctionTypeNames[2]] = 0;
-		statistics[kFunctionTypeNames[3]] = 0;
-		statistics[kFunctionTypeNames[4]] = 0;
+		// Значения по функциям пишутся по индексу функции, счётчики - в
+		// счётчики своего потока; сливаются они после обхода.
+		constexpr uint64_t kNoFlowGraph = ~uint64_t{ 0 };
+		std::vector<uint64_t> instructions(functions.size(), kNoFlowGraph);
+		std::vector<uint64_t> basic_blocks(functions.size(), kNoFlowGraph);
+		std::vector<uint64_t> edges(functions.size(), kNoFlowGraph);
+		std::vector<uint64_t> loops(functions.size(), kNoFlowGraph);
+		std::vector<uint64_t> max_loop_depth(functions.size(), kNoFlowGraph);
+		std::vector<std::unique_ptr<LocalCounters>> counters;
+		std::mutex counters_mutex;
+		ParallelFor(functions.size(), 256,
+			[&](size_t begin, size_t end) {
+			auto local = std::make_unique<LocalCounters>();
+			for (size_t i = begin; i < end; ++i) {
+				const Function& function = *functions[i];
+				assert(function.GetType(false) != Function::TYPE_NONE);
+				local->function_types[function.GetType(false)]++;
+				local->real_names += function.HasRealName();
 
-		static const char* kEdgeTypeNames[] = {
-			"flowgraph edges (true)", "flowgraph edges (false)",
-			"flowgraph edges (unconditional)", "flowgraph edges (switch)" };
-		statistics[kEdgeTypeNames[0]] = 0;
-		statistics[kEdgeTypeNames[1]] = 0;
-		statistics[kEdgeTypeNames[2]] = 0;
-		statistics[kEdgeTypeNames[3]] = 0;
-
-		statistics["functions with real name"] = 0;
-		statistics["instructions"] = 0;
-
-		size_t basic_block_count = 0;
-		size_t edge_count = 0;
-		for (Functions::const_iterator i = functions.begin(); i != functions.end();
-			++i) {
-			const Function& function = *i->second;
-			assert(function.GetType(false) != Function::TYPE_NONE);
-			statistics[kFunctionTypeNames[function.GetType(false)]]++;
-			statistics["functions with real name"] += function.HasRealName();
-
-			const auto& basic_blocks = function.GetBasicBlocks();
-			const auto& edges = function.GetEdges();
-			basic_block_count += basic_blocks.size();
-			edge_count += edges.size();
-
-			for (const auto k : basic_blocks) {
-				const BasicBlock& basic_block = *k;
-				statistics["instructions"] += basic_block.GetInstructionCount();
-				for (const auto& instruction : basic_block) {
-					statistics["instructions " + instruction.GetMnemonic()]++;
+				const auto& function_basic_blocks = function.GetBasicBlocks();
+				const auto& function_edges = function.GetEdges();
+				local->basic_blocks += function_basic_blocks.size();
+				local->edges += function_edges.size();
+
+				uint64_t instruction_count = 0;
+				for (const auto* basic_block : function_basic_blocks) {
+					instruction_count += basic_block->GetInstructionCount();
+					for (const auto& instruction : *basic_block) {
+						local->CountMnemonic(&instruction.GetMnemonic());
+					}
+				}
+				local->instructions += instruction_count;
+
+				for (const FlowGraphEdge& edge : function_edges) {
+					assert(edge.type > 0 && edge.type < 5);
+					local->edge_types[edge.type - 1]++;
+				}
+
+				if (!function_basic_blocks.empty()) {
+					instructions[i] = instruction_count;
+					basic_blocks[i] = function_basic_blocks.size();
+					edges[i] = function_edges.size();
+					std::unique_ptr<LoopNesting> local_loop_nesting;
+					const LoopNesting* loop_nesting = function.GetLoopNesting();
+					if (!loop_nesting) {
+						local_loop_nesting = std::make_unique<LoopNesting>(function);
+						loop_nesting = local_loop_nesting.get();
+					}
+					loops[i] = loop_nesting->loops().size();
+					max_loop_depth[i] = loop_nesting->GetMaxLoopDepth();
 				}
 			}
+			std::lock_guard<std::mutex> lock(counters_mutex);
+			counters.push_back(std::move(local));
+		});
 
-			for (Function::Edges::const_iterator j = edges.begin(); j != edges.end();
-				++j) {
-				const FlowGraphEdge& edge = *j;
-				assert(edge.type > 0 && edge.type < 5);
-				statistics[kEdgeTypeNames[edge.type - 1]]++;
+		statistics->counters.clear();
+		statistics->mnemonics.clear();
+		auto& result = statistics->counters;
+		result["callgraph nodes (functions)"] = functions.size();
+		result["callgraph edges (calls)"] = call_graph.GetEdges().size();
+		for (const char* name : kFunctionTypeNames) {
+			result[name] = 0;
+		}
+		for (const char* name : kEdgeTypeNames) {
+			result[name] = 0;
+		}
+		result["functions with real name"] = 0;
+		result["instructions"] = 0;
+		result["flowgraph nodes (basicblocks)"] = 0;
+		result["flowgraph edges"] = 0;
+		for (const auto& local : counters) {
+			for (int i = 0; i < 5; ++i) {
+				result[kFunctionTypeNames[i]] += local->function_types[i];
+			}
+			for (int i = 0; i < 4; ++i) {
+				result[kEdgeTypeNames[i]] += local->edge_types[i];
+			}
+			result["functions with real name"] += local->real_names;
+			result["instructions"] += local->instructions;
+			result["flowgraph nodes (basicblocks)"] += local->basic_blocks;
+			result["flowgraph edges"] += local->edges;
+			for (size_t i = 0; i < local->mnemonic_names.size(); ++i) {
+				statistics->mnemonics[*local->mnemonic_names[i]] +=
+					local->mnemonic_counts[i];
 			}
 		}
 
-		statistics["flowgraph nodes (basicblocks)"] = basic_block_count;
-		statistics["flowgraph edges"] = edge_count;
+		// Распределения считаются только по функциям с графом потока.
+		std::vector<uint64_t> complexity;
+		size_t kept = 0;
+		for (size_t i = 0; i < functions.size(); ++i) {
+			if (instructions[i] == kNoFlowGraph) {
+				continue;
+			}
+			instructions[kept] = instructions[i];
+			basic_blocks[kept] = basic_blocks[i];
+			edges[kept] = edges[i];
+			loops[kept] = loops[i];
+			max_loop_depth[kept] = max_loop_depth[i];
+			// Для связного графа E - N + 2 >= 1, меньшее значение даёт только
+			// граф, разорванный при разборе.
+			complexity.push_back(std::max<int64_t>(
+				1, static_cast<int64_t>(edges[i]) -
+				static_cast<int64_t>(basic_blocks[i]) + 2));
+			++kept;
+		}
+		instructions.resize(kept);
+		basic_blocks.resize(kept);
+		edges.resize(kept);
+		loops.resize(kept);
+		max_loop_depth.resize(kept);
+		ComputeDistribution(std::move(instructions), &statistics->instructions);
+		ComputeDistribution(std::move(basic_blocks), &statistics->basic_blocks);
+		ComputeDistribution(std::move(edges), &statistics->edges);
+		ComputeDistribution(std::move(complexity),
+			&statistics->cyclomatic_complexity);
+		ComputeDistribution(std::move(loops), &statistics->loops);
+		ComputeDistribution(std::move(max_loop_depth),
+			&statistics->max_loop_depth);
+	}
+
+	void StatisticsWriter::GenerateStatistics(
+		const CallGraph& call_graph, const FlowGraph& flow_graph,
+		std::map<std::string, size_t>* statistics_ptr) const {
+		Statistics statistics;
+		GenerateStatistics(call_graph, flow_graph, &statistics);
+		*statistics_ptr = std::move(statistics.counters);
+		for (const auto& mnemonic : statistics.mnemonics) {
+			(*statistics_ptr)["instructions " + mnemonic.first] = mnemonic.second;
+		}
+	}
+
+	void StatisticsWriter::WriteJson(const Statistics& statistics) const {
+		Json::Value root(Json::objectValue);
+		root["format_version"] = 1;
+		root["executable_filename"] = executable_filename_;
+		root["executable_hash"] = executable_hash_;
+
+		Json::Value counters(Json::objectValue);
+		for (const auto& entry : statistics.counters) {
+			counters[entry.first] = static_cast<Json::UInt64>(entry.second);
+		}
+		root["counters"] = counters;
+
+		Json::Value mnemonics(Json::objectValue);
+		for (const auto& entry : statistics.mnemonics) {
+			mnemonics[entry.first] = static_cast<Json::UInt64>(entry.second);
+		}
+		root["mnemonics"] = mnemonics;
+
+		Json::Value distributions(Json::objectValue);
+		distributions["instructions"] = DistributionToJson(statistics.instructions);
+		distributions["basic_blocks"] = DistributionToJson(statistics.basic_blocks);
+		distributions["edges"] = DistributionToJson(statistics.edges);
+		distributions["cyclomatic_complexity"] =
+			DistributionToJson(statistics.cyclomatic_complexity);
+		distributions["loops"] = DistributionToJson(statistics.loops);
+		distributions["max_loop_depth"] =
+			DistributionToJson(statistics.max_loop_depth);
+		root["functions"] = distributions;
+
+		Json::StreamWriterBuilder builder;
+		builder["indentation"] = "  ";
+		std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
+		writer->write(root, json_stream_);
+		*json_stream_ << std::endl;
 	}
 
 	absl::Status StatisticsWriter::Write(const CallGraph& call_graph,
@@ -96,14 +318,24 @@ namespace security::binexport {
 		const Instructions&,
 		const AddressReferences&,
 		const TypeSystem*, const AddressSpace&) {
-		std::map<std::string, size_t> statistics;
+		Statistics statistics;
 		GenerateStatistics(call_graph, flow_graph, &statistics);
-		for (const auto& entry : statistics) {
+
+		// Текстовый отчёт не изменился: счётчики мнемоник идут в общем
+		// порядке ключей как "instructions <мнемоника>".
+		std::map<std::string, size_t> text = statistics.counters;
+		for (const auto& mnemonic : statistics.mnemonics) {
+			text["instructions " + mnemonic.first] = mnemonic.second;
+		}
+		for (const auto& entry : text) {
 			const std::string padding(32 - entry.first.size(), '.');
 			stream_ << entry.first << padding << ":" << std::setw(7) << std::dec
 				<< std::setfill(' ') << entry.second << std::endl;
 		}
 
+		if (json_stream_) {
+			WriteJson(statistics);
+		}
 		return absl::OkStatus();
 	}
 
@@ -0,0 +1,283 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/string_literals.h"
+
+#include <algorithm>
+#include <cassert>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STRING_LITERALS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+
+namespace security::binexport {
+	namespace {
+
+		constexpr uint64_t kEvenBits = 0x5555555555555555ULL;
+
+		struct Match {
+			size_t offset;
+			uint32_t size;
+			StringLiteralTable::Encoding encoding;
+		};
+
+		inline bool IsPrintable(Byte byte) {
+			return (byte >= 0x20 && byte < 0x7F) || byte == '\t' || byte == '\n' ||
+				byte == '\r';
+		}
+
+/// \brief \n Маски печатаемых и нулевых байтов куска из 16 байтов.
+		inline void ClassifyChunk(const Byte* bytes, uint32_t* printable,
+			uint32_t* zero) {
+#ifdef STRING_LITERALS_SSE2
+			const __m128i chunk =
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+			// Байты >= 0x80 отрицательны при знаковом сравнении и отсекаются первым
+			// условием.
+			const __m128i visible =
+				_mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8(0x1F)),
+					_mm_cmplt_epi8(chunk, _mm_set1_epi8(0x7F)));
+			const __m128i whitespace =
+				_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')),
+					_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))),
+					_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')));
+			*printable = static_cast<uint32_t>(
+				_mm_movemask_epi8(_mm_or_si128(visible, whitespace)));
+			*zero = static_cast<uint32_t>(
+				_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_setzero_si128())));
+#else
+			*printable = 0;
+			*zero = 0;
+			for (int i = 0; i < 16; ++i) {
+				*printable |= static_cast<uint32_t>(IsPrintable(bytes[i])) << i;
+				*zero |= static_cast<uint32_t>(bytes[i] == 0) << i;
+			}
+#endif
+		}
+
+/// \brief \n Битовые маски печатаемых и нулевых байтов блока, по 64 байта на слово.
+		void ClassifyBlock(const Byte* bytes, size_t size,
+			std::vector<uint64_t>* printable, std::vector<uint64_t>* zero) {
+			const size_t words = (size + 63) / 64;
+			printable->assign(words, 0);
+			zero->assign(words, 0);
+			size_t offset = 0;
+			for (; offset + 16 <= size; offset += 16) {
+				uint32_t chunk_printable;
+				uint32_t chunk_zero;
+				ClassifyChunk(bytes + offset, &chunk_printable, &chunk_zero);
+				const int shift = offset % 64;
+				(*printable)[offset / 64] |= uint64_t{ chunk_printable } << shift;
+				(*zero)[offset / 64] |= uint64_t{ chunk_zero } << shift;
+			}
+			for (; offset < size; ++offset) {
+				const uint64_t bit = uint64_t{ 1 } << (offset % 64);
+				if (IsPrintable(bytes[offset])) {
+					(*printable)[offset / 64] |= bit;
+				}
+				if (bytes[offset] == 0) {
+					(*zero)[offset / 64] |= bit;
+				}
+			}
+		}
+
+/// \brief \n Строки ASCII: не меньше kMinLength печатаемых байтов, затем ноль.
+		void FindAsciiStrings(const std::vector<uint64_t>& printable,
+			const std::vector<uint64_t>& zero, size_t size,
+			std::vector<Match>* matches) {
+			constexpr size_t kNone = ~size_t{ 0 };
+			size_t start = kNone;
+			for (size_t word = 0; word < printable.size(); ++word) {
+				const uint64_t bits = printable[word];
+				if ((start == kNone && bits == 0) || (start != kNone && bits == ~0ULL)) {
+					continue;
+				}
+				for (int bit = 0; bit < 64; ++bit) {
+					const size_t offset = word * 64 + bit;
+					if (offset >= size) {
+						break;
+					}
+					if (bits >> bit & 1) {
+						if (start == kNone) {
+							start = offset;
+						}
+						continue;
+					}
+					if (start != kNone && (zero[word] >> bit & 1) &&
+						offset - start >= StringLiteralTable::kMinLength) {
+						matches->push_back({ start, static_cast<uint32_t>(offset - start),
+							StringLiteralTable::kAscii });
+					}
+					start = kNone;
+				}
+			}
+		}
+
+/// \brief \n Строки UTF-16LE по чётным смещениям: символы "печатаемый байт, ноль",\n
+/// не меньше kMinLength символов, затем нулевой символ.
+		void FindUtf16Strings(const std::vector<uint64_t>& printable,
+			const std::vector<uint64_t>& zero, size_t size,
+			std::vector<Match>* matches) {
+			constexpr size_t kNone = ~size_t{ 0 };
+			size_t start = kNone;
+			for (size_t word = 0; word < printable.size(); ++word) {
+				// Нулевые байты, сдвинутые на один назад: бит i - ноль по смещению i + 1.
+				const uint64_t next_zero =
+					(zero[word] >> 1) |
+					(word + 1 < zero.size() ? zero[word + 1] << 63 : 0);
+				const uint64_t characters = printable[word] & next_zero & kEvenBits;
+				const uint64_t terminators = zero[word] & next_zero & kEvenBits;
+				if ((start == kNone && characters == 0) ||
+					(start != kNone && characters == kEvenBits)) {
+					continue;
+				}
+				for (int bit = 0; bit < 64; bit += 2) {
+					const size_t offset = word * 64 + bit;
+					if (offset + 1 >= size) {
+						break;
+					}
+					if (characters >> bit & 1) {
+						if (start == kNone) {
+							start = offset;
+						}
+						continue;
+					}
+					if (start != kNone && (terminators >> bit & 1) &&
+						(offset - start) / 2 >= StringLiteralTable::kMinLength) {
+						matches->push_back({ start, static_cast<uint32_t>(offset - start),
+							StringLiteralTable::kUtf16 });
+					}
+					start = kNone;
+				}
+			}
+		}
+
+		void NarrowUtf16(absl::string_view text, std::string* output) {
+			output->clear();
+			output->reserve(text.size() / 2);
+			for (size_t i = 0; i + 1 < text.size(); i += 2) {
+				output->push_back(text[i]);
+			}
+		}
+
+	}  // namespace
+
+	void StringLiteralTable::Scan(const AddressSpace& address_space) {
+		// Блоки без права исполнения, каждый одним куском.
+		const std::vector<AddressSpaceChunk> blocks = GetAddressSpaceChunks(
+			address_space, /*chunk_size=*/0, AddressSpace::kExecute, 0);
+		std::vector<std::vector<Match>> block_matches(blocks.size());
+		ScanAddressSpaceChunks(blocks,
+			[&block_matches](size_t index, const AddressSpaceChunk& block) {
+			std::vector<uint64_t> printable;
+			std::vector<uint64_t> zero;
+			ClassifyBlock(block.bytes, block.size, &printable, &zero);
+			FindAsciiStrings(printable, zero, block.size, &block_matches[index]);
+			FindUtf16Strings(printable, zero, block.size, &block_matches[index]);
+		});
+
+		std::string narrow;
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			const AddressSpaceChunk& block = blocks[i];
+			for (const Match& match : block_matches[i]) {
+				const absl::string_view text(
+					reinterpret_cast<const char*>(block.bytes + match.offset), match.size);
+				uint32_t content;
+				if (match.encoding == kAscii) {
+					content = Intern(text, /*copy=*/false);
+				}
+				else {
+					NarrowUtf16(text, &narrow);
+					content = Intern(narrow, /*copy=*/true);
+				}
+				literals_.push_back({ block.address + match.offset, match.size, content,
+					match.encoding });
+			}
+		}
+		std::sort(literals_.begin(), literals_.end());
+		sorted_size_ = literals_.size();
+	}
+
+	void StringLiteralTable::Add(Address address, Encoding encoding,
+		absl::string_view text) {
+		if (encoding == kAscii) {
+			while (!text.empty() && text.back() == '\0') {
+				text.remove_suffix(1);
+			}
+		}
+		else {
+			text.remove_suffix(text.size() % 2);
+			while (text.size() >= 2 && text[text.size() - 1] == '\0' &&
+				text[text.size() - 2] == '\0') {
+				text.remove_suffix(2);
+			}
+		}
+		if (text.empty() || Find(address)) {
+			return;
+		}
+		uint32_t content;
+		if (encoding == kAscii) {
+			content = Intern(text, /*copy=*/true);
+		}
+		else {
+			std::string narrow;
+			NarrowUtf16(text, &narrow);
+			content = Intern(narrow, /*copy=*/true);
+		}
+		literals_.push_back(
+			{ address, static_cast<uint32_t>(text.size()), content, encoding });
+	}
+
+	void StringLiteralTable::Finish() {
+		// Add() не добавляет адреса из отсортированной части, поэтому повторы
+		// возможны только среди добавленных после неё.
+		std::sort(literals_.begin() + sorted_size_, literals_.end());
+		literals_.erase(
+			std::unique(literals_.begin() + sorted_size_, literals_.end(),
+				[](const Literal& lhs, const Literal& rhs) {
+			return lhs.address == rhs.address;
+		}),
+			literals_.end());
+		std::inplace_merge(literals_.begin(), literals_.begin() + sorted_size_,
+			literals_.end());
+		sorted_size_ = literals_.size();
+	}
+
+	const StringLiteralTable::Literal* StringLiteralTable::Find(
+		Address address) const {
+		const auto end = literals_.begin() + sorted_size_;
+		const auto it = std::lower_bound(literals_.begin(), end,
+			Literal{ address, 0, 0, kAscii });
+		return it != end && it->address == address ? &*it : nullptr;
+	}
+
+	uint32_t StringLiteralTable::Intern(absl::string_view text, bool copy) {
+		const auto it = content_ids_.find(text);
+		if (it != content_ids_.end()) {
+			return it->second;
+		}
+		if (copy) {
+			owned_contents_.emplace_back(text.data(), text.size());
+			text = owned_contents_.back();
+		}
+		const uint32_t id = static_cast<uint32_t>(contents_.size());
+		contents_.push_back(text);
+		content_ids_.emplace(text, id);
+		return id;
+	}
+
+}  // namespace security::binexport
@@ -196,6 +196,12 @@ public:
 	void RenderAdditional(std::ostream* stream, const CallGraph& call_graph,
 		const FlowGraph& flow_graph, Exporter& exporter ) const;
 
+	///\n
+	/// то же, что RenderAdditional() для потока, в котором функция уже\n
+	/// выставила std::hex, std::uppercase и std::setfill('0'). Дописывает в output.
+	void RenderAdditional(std::string* output, const CallGraph& call_graph,
+		const FlowGraph& flow_graph) const;
+
 private:
 	explicit BasicBlock(BasicBlockInstructions* instructions) : id_(-1) {
 		Append(&instructions->ranges_);
@@ -19,6 +19,10 @@
 
 class BinExport2;
 
+namespace google::protobuf::io {
+class ZeroCopyOutputStream;
+}  // namespace google::protobuf::io
+
 namespace security::binexport {
 
 class BinExport2Writer : public Writer {
@@ -36,6 +40,8 @@ class BinExport2Writer : public Writer {
                      const TypeSystem*,
                      const AddressSpace& address_space) override;
 
+  // Дописывает результат в proto. Ёмкость повторяющихся полей резервируется
+  // заранее; proto, созданный на google::protobuf::Arena, заполняется на ней.
   absl::Status WriteToProto(const CallGraph& call_graph,
                             const FlowGraph& flow_graph,
                             const Instructions& instructions,
@@ -44,6 +50,15 @@ class BinExport2Writer : public Writer {
                             BinExport2* proto) const;
 
  private:
+  // Пишет сериализованный BinExport2 в output, не собирая сообщение в памяти.
+  // Результат побайтно совпадает с SerializeToOstream() для WriteToProto().
+  absl::Status WriteToStream(const CallGraph& call_graph,
+                             const FlowGraph& flow_graph,
+                             const Instructions& instructions,
+                             const AddressReferences& address_references,
+                             const AddressSpace& address_space,
+                             google::protobuf::io::ZeroCopyOutputStream* output) const;
+
   std::string filename_;
   std::string executable_filename_;
   std::string executable_hash_;
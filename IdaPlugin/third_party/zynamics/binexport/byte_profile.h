@@ -0,0 +1,80 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Профиль байтов блоков AddressSpace (сегментов IDA): гистограмма,
+// энтропия Шеннона (бит на байт, 0..8) и доля печатаемых байтов для всего
+// блока и для окон по kWindowSize байт от его начала.
+//
+// Гистограмма окна считается по 8 байт за чтение в четыре чередующиеся
+// таблицы, поэтому соседние одинаковые байты не ждут друг друга. Окна
+// считаются параллельно кусками, гистограмма блока - сумма гистограмм
+// кусков. Энтропия окна берётся из таблицы c * log2(c), доля печатаемых -
+// из гистограммы, второго прохода по байтам нет.
+
+#ifndef BYTE_PROFILE_H_
+#define BYTE_PROFILE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/types/span.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class AddressSpace;
+
+namespace security::binexport {
+
+class ByteProfile {
+ public:
+  static constexpr uint32_t kWindowSize = 4096;
+  // Энтропия, начиная с которой данные считаются сжатыми или шифрованными.
+  static constexpr double kHighEntropy = 7.2;
+
+  struct Block {
+    Address address;
+    uint64_t size;
+    std::array<uint64_t, 256> histogram;
+    double entropy;
+    double printable_ratio;
+    // Окна с начала блока, последнее может быть короче kWindowSize.
+    std::vector<float> window_entropy;
+    std::vector<float> window_printable_ratio;
+  };
+
+  explicit ByteProfile(const AddressSpace& address_space);
+
+  ByteProfile(const ByteProfile&) = delete;
+  ByteProfile& operator=(const ByteProfile&) = delete;
+
+  // Непустые блоки по возрастанию адреса.
+  const std::vector<Block>& blocks() const { return blocks_; }
+
+  static double GetEntropy(absl::Span<const uint64_t> histogram);
+  static double GetPrintableRatio(absl::Span<const uint64_t> histogram);
+
+  // Участки подряд идущих окон с энтропией не ниже threshold: номер первого
+  // окна и число окон.
+  static std::vector<std::pair<size_t, size_t>> GetHighEntropyRuns(
+      absl::Span<const float> window_entropy, double threshold = kHighEntropy);
+
+ private:
+  std::vector<Block> blocks_;
+};
+
+}  // namespace security::binexport
+
+#endif  // BYTE_PROFILE_H_
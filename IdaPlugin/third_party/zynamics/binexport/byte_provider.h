@@ -0,0 +1,135 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BYTE_PROVIDER_H_
+#define BYTE_PROVIDER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "third_party/zynamics/binexport/types.h"
+
+///\n
+/// Источник байтов блока памяти AddressSpace.\n
+/// Блок не хранит копию сегмента: байты берутся либо из отображённого в память\n
+/// входного файла, либо подгружаются из базы страницами по первому обращению.
+class ByteProvider {
+public:
+	virtual ~ByteProvider() = default;
+
+	///\n
+	/// размер блока в байтах.
+	virtual size_t size() const = 0;
+
+	///\n
+	/// возвращает указатель на непрерывный диапазон [offset, offset + length),\n
+	/// гарантируя, что байты диапазона загружены. nullptr, если диапазон выходит за блок.
+	virtual const Byte* Data(size_t offset, size_t length) const = 0;
+
+	///\n
+	/// то же, но с правом записи. Запись никогда не попадает во входной файл.
+	virtual Byte* MutableData(size_t offset, size_t length) = 0;
+};
+
+///\n
+/// Файл, отображённый в память целиком.\n
+/// Один экземпляр разделяется всеми блоками, которые на него ссылаются.
+class MappedFile {
+public:
+	enum class Mode {
+		/// запись в отображение остаётся приватной для процесса (входной файл).
+		kCopyOnWrite,
+		/// только чтение: в Windows не резервирует commit под весь файл.
+		kReadOnly,
+	};
+
+	///\n
+	/// открывает и отображает файл. nullptr, если файл недоступен или пуст.
+	static std::shared_ptr<MappedFile> Open(const std::string& filename,
+		Mode mode = Mode::kCopyOnWrite);
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	const Byte* data() const { return data_; }
+	///\n
+	/// nullptr для отображения только для чтения.
+	Byte* mutable_data() { return mode_ == Mode::kCopyOnWrite ? data_ : nullptr; }
+	size_t size() const { return size_; }
+
+private:
+	MappedFile() = default;
+
+	Byte* data_ = nullptr;
+	size_t size_ = 0;
+	Mode mode_ = Mode::kCopyOnWrite;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+///\n
+/// Окно [offset, offset + size) отображённого входного файла.\n
+/// Используется для сегментов, образ которых в базе совпадает с файлом.
+class FileRegionByteProvider : public ByteProvider {
+public:
+	FileRegionByteProvider(std::shared_ptr<MappedFile> file, size_t offset,
+		size_t size);
+
+	size_t size() const override { return size_; }
+	const Byte* Data(size_t offset, size_t length) const override;
+	Byte* MutableData(size_t offset, size_t length) override;
+
+private:
+	std::shared_ptr<MappedFile> file_;
+	Byte* data_;
+	size_t size_;
+};
+
+///\n
+/// Байты, которых нет во входном файле (bss, пропатченные или перемещённые сегменты).\n
+/// Память резервируется сразу, но заполняется страницами kPageSize по первому обращению\n
+/// через fetch-колбэк. Нетронутые страницы не расходуют физическую память.
+class PagedByteProvider : public ByteProvider {
+public:
+	///\n
+	/// заполняет buffer байтами [offset, offset + length) блока.
+	using FetchCallback =
+		std::function<void(size_t offset, Byte* buffer, size_t length)>;
+
+	static constexpr size_t kPageSize = 64 * 1024;
+
+	PagedByteProvider(size_t size, FetchCallback fetch);
+
+	size_t size() const override { return size_; }
+	const Byte* Data(size_t offset, size_t length) const override;
+	Byte* MutableData(size_t offset, size_t length) override;
+
+private:
+	void PageIn(size_t offset, size_t length) const;
+
+	size_t size_;
+	FetchCallback fetch_;
+	std::unique_ptr<Byte[]> buffer_;
+	std::unique_ptr<std::atomic<bool>[]> loaded_;
+	mutable std::mutex mutex_;
+};
+
+#endif  // BYTE_PROVIDER_H_
@@ -0,0 +1,94 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Поиск байтовых образцов с масками ("48 8B ?? ?? E8") по всем блокам
+// AddressSpace.
+//
+// Для каждого образца выбираются два самых редких байта без маски (по
+// типичной частоте байтов кода x86). Фильтр сравнивает с ними сразу 16
+// (SSE2) или 32 (AVX2) позиции; образцы с одинаковой парой байтов и
+// расстоянием между ними проверяются одним фильтром. Кандидаты проверяются
+// полным образцом с маской. Блоки делятся на куски, куски просматриваются
+// параллельно, а внутри куска все фильтры проходят по участку, который
+// помещается в кэш.
+
+#ifndef BYTE_SEARCH_H_
+#define BYTE_SEARCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/status/status.h"
+#include "third_party/absl/status/statusor.h"
+#include "third_party/absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class AddressSpace;
+
+namespace security::binexport {
+
+class BytePatternSearch {
+ public:
+  static constexpr size_t kMaxPatternSize = 256;
+
+  struct Pattern {
+    std::string bytes;
+    // 0xFF - байт сравнивается, 0 - нет. Та же длина, что у bytes.
+    std::string mask;
+  };
+
+  struct Hit {
+    Address address;
+    uint32_t pattern;  // Номер образца в порядке добавления.
+  };
+
+  // Байты - пары шестнадцатеричных цифр, пробелы между ними необязательны.
+  // Любой байт задаётся "??", "?" или "xx".
+  static absl::StatusOr<Pattern> ParsePattern(absl::string_view text);
+
+  BytePatternSearch() = default;
+
+  BytePatternSearch(const BytePatternSearch&) = delete;
+  BytePatternSearch& operator=(const BytePatternSearch&) = delete;
+
+  // Образец должен содержать хотя бы один байт без маски.
+  absl::Status AddPattern(Pattern pattern);
+  size_t GetPatternCount() const { return patterns_.size(); }
+
+  // Все вхождения во всех блоках, по возрастанию адреса.
+  std::vector<Hit> Find(const AddressSpace& address_space) const;
+
+ private:
+  struct Filter {
+    Byte first;
+    Byte second;
+    // Смещение второго байта от первого.
+    uint32_t distance;
+    // Номер образца и смещение первого байта в нём.
+    std::vector<std::pair<uint32_t, uint32_t>> patterns;
+  };
+
+  void Scan(const Filter& filter, const Byte* bytes, size_t size, size_t begin,
+            size_t end, Address address, std::vector<Hit>* hits) const;
+
+  std::vector<Pattern> patterns_;
+  std::vector<Filter> filters_;
+};
+
+}  // namespace security::binexport
+
+#endif  // BYTE_SEARCH_H_
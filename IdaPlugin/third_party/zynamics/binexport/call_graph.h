@@ -19,8 +19,6 @@
 #include <set>
 
 #include "third_party/absl/container/btree_set.h"
-#include "third_party/absl/container/node_hash_map.h"
-#include "third_party/absl/container/node_hash_set.h"
 #include "third_party/zynamics/binexport/comment.h"
 #include "third_party/zynamics/binexport/library_manager.h"
 #include "third_party/zynamics/binexport/types.h"
@@ -49,7 +47,6 @@ class CallGraph {
   using FunctionEntryPoints = absl::btree_set<Address>;
 
   using Edges = std::vector<EdgeInfo>;
-  using StringReferences = absl::node_hash_map<Address, size_t>;
 
   CallGraph();
 
@@ -78,28 +75,28 @@ class CallGraph {
   Comments& GetComments();
   std::pair<Comments::const_iterator, Comments::const_iterator> GetComments(
       Address address) const;
-  void AddStringReference(Address address, const std::string& ref);
-  size_t GetStringReference(Address address) const;
-  static const std::string* CacheString(const std::string& text);
+  static const std::string* CacheString(absl::string_view text);
   void Render(std::ostream* stream, const FlowGraph& flow_graph) const;
   void RenderAdditional(std::ostream* stream, const FlowGraph& flow_graph, Exporter& exporter) const;
   int DeleteInvalidFunctions(FlowGraph* flow_graph);
+  // Сортирует комментарии по (адрес, тип, операнд) и склеивает обычные
+  // комментарии одного адреса. Комментарии добавляются почти по порядку
+  // адресов, поэтому сливаются уже упорядоченные отрезки, а не сортируется
+  // весь вектор.
   void PostProcessComments();
 
   LibraryManager* GetLibraryManager() { return &library_manager_; }
   const LibraryManager& GetLibraryManager() const { return library_manager_; }
 
  private:
-  using StringCache = absl::node_hash_set<std::string>;
   void FoldComments();
 
   FunctionEntryPoints functions_;
   Edges edges_;
   Edges temp_edges_;
   Comments comments_;
-  StringReferences string_references_;
   LibraryManager library_manager_;
-  static StringCache string_cache_;
+  static CommentStringPool string_cache_;
   static int instance_count_;
 };
 
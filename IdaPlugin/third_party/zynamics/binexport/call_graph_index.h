@@ -0,0 +1,124 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Сжатый граф вызовов: компоненты сильной связности (Тарьян, без рекурсии),
+// их ациклический граф в топологическом порядке и индекс достижимости.
+// Компоненты нумеруются в обратном топологическом порядке: вызываемые
+// компоненты имеют меньшие номера, поэтому проход по возрастанию номеров -
+// это проход снизу вверх.
+//
+// Достижимость проверяется по интервальным меткам: интервал остовного дерева
+// обхода сразу даёт положительный ответ, метки GRAIL (два обхода с разным
+// порядком потомков) - отрицательный. Остальные запросы идут обходом,
+// отсекаемым теми же метками.
+
+#ifndef CALL_GRAPH_INDEX_H_
+#define CALL_GRAPH_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/types/span.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class CallGraph;
+
+namespace security::binexport {
+
+class CallGraphIndex {
+ public:
+  static constexpr uint32_t kNone = ~uint32_t{0};
+
+  // Вершины - функции графа вызовов и все цели вызовов.
+  explicit CallGraphIndex(const CallGraph& call_graph);
+
+  // Вызовы заданы парами (вызывающая функция, вызываемая функция).
+  CallGraphIndex(std::vector<Address> functions,
+                 std::vector<std::pair<Address, Address>> calls);
+
+  CallGraphIndex(const CallGraphIndex&) = delete;
+  CallGraphIndex& operator=(const CallGraphIndex&) = delete;
+
+  // Функции занумерованы по возрастанию адреса.
+  size_t GetFunctionCount() const { return addresses_.size(); }
+  Address GetFunctionAddress(uint32_t function) const {
+    return addresses_[function];
+  }
+  // Номер функции или kNone.
+  uint32_t GetFunction(Address address) const;
+
+  absl::Span<const uint32_t> GetCallees(uint32_t function) const;
+
+  size_t GetComponentCount() const { return recursive_.size(); }
+  uint32_t GetComponent(uint32_t function) const {
+    return components_[function];
+  }
+  // Функции компоненты по возрастанию адреса.
+  absl::Span<const uint32_t> GetComponentFunctions(uint32_t component) const;
+  // Соседние компоненты в ациклическом графе, без повторов.
+  absl::Span<const uint32_t> GetComponentCallees(uint32_t component) const;
+  absl::Span<const uint32_t> GetComponentCallers(uint32_t component) const;
+  // Компонента из нескольких функций или функция, вызывающая саму себя.
+  bool IsRecursive(uint32_t component) const { return recursive_[component]; }
+
+  // Есть путь хотя бы из одного вызова.
+  bool CanReach(uint32_t from, uint32_t to) const;
+
+  // Все функции, достижимые из функции (вызываемые) или из которых
+  // достижима функция (вызывающие), по возрастанию адреса. Сама функция
+  // входит в результат только при рекурсии.
+  std::vector<uint32_t> GetTransitiveCallees(uint32_t function) const;
+  std::vector<uint32_t> GetTransitiveCallers(uint32_t function) const;
+
+ private:
+  struct Label {
+    uint32_t low;
+    uint32_t rank;
+  };
+
+  void Build(std::vector<Address> functions,
+             std::vector<std::pair<Address, Address>> calls);
+  void BuildComponents();
+  void BuildComponentGraph();
+  void BuildLabels();
+  bool ComponentCanReach(uint32_t from, uint32_t to) const;
+  std::vector<uint32_t> CollectReachable(
+      uint32_t function, const std::vector<uint32_t>& offsets,
+      const std::vector<uint32_t>& neighbours) const;
+
+  std::vector<Address> addresses_;
+  std::vector<uint32_t> callee_offsets_;
+  std::vector<uint32_t> callees_;
+
+  std::vector<uint32_t> components_;
+  std::vector<bool> recursive_;
+  std::vector<uint32_t> component_function_offsets_;
+  std::vector<uint32_t> component_functions_;
+  std::vector<uint32_t> component_callee_offsets_;
+  std::vector<uint32_t> component_callees_;
+  std::vector<uint32_t> component_caller_offsets_;
+  std::vector<uint32_t> component_callers_;
+
+  // Интервал компоненты в остовном лесу первого обхода.
+  std::vector<uint32_t> tree_enter_;
+  std::vector<uint32_t> tree_leave_;
+  // Метки GRAIL двух обходов.
+  std::vector<Label> labels_[2];
+};
+
+}  // namespace security::binexport
+
+#endif  // CALL_GRAPH_INDEX_H_
@@ -0,0 +1,43 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CHAIN_WRITER_H_
+#define CHAIN_WRITER_H_
+
+#include <memory>
+#include <vector>
+
+#include "third_party/zynamics/binexport/writer.h"
+
+namespace security::binexport {
+
+// Передаёт результат одного анализа нескольким writer-ам по очереди.
+class ChainWriter : public Writer {
+ public:
+  absl::Status Write(const CallGraph& call_graph, const FlowGraph& flow_graph,
+                     const Instructions& instructions,
+                     const AddressReferences& address_references,
+                     const TypeSystem* type_system,
+                     const AddressSpace& address_space) override;
+
+  void Add(std::shared_ptr<Writer> writer);
+  bool IsEmpty() const;
+
+ private:
+  std::vector<std::shared_ptr<Writer>> writers_;
+};
+
+}  // namespace security::binexport
+
+#endif  // CHAIN_WRITER_H_
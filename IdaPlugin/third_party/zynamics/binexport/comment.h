@@ -15,9 +15,13 @@
 #ifndef COMMENT_H_
 #define COMMENT_H_
 
+#include <deque>
 #include <string>
 #include <vector>
 
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/string_view.h"
+#include "third_party/absl/types/span.h"
 #include "third_party/zynamics/binexport/types.h"
 
 #pragma pack(push, 1)
@@ -51,4 +55,24 @@ class Comment {
 using Comments = std::vector<Comment>;
 bool SortComments(const Comment& lhs, const Comment& rhs);
 
+// Хранилище текстов комментариев. Строки выделяются подряд блоками deque и
+// живут до Clear(), одинаковые тексты хранятся один раз, поэтому равенство
+// указателей означает равенство текстов. Поиск идёт по хешу содержимого без
+// создания временной строки.
+class CommentStringPool {
+ public:
+  const std::string* Insert(absl::string_view text);
+
+  // Склеивает части через separator сразу в строке пула.
+  const std::string* InsertJoined(absl::Span<const std::string* const> parts,
+                                  char separator);
+
+  void Clear();
+
+ private:
+  std::deque<std::string> strings_;
+  // Ключи ссылаются на строки из strings_.
+  absl::flat_hash_map<absl::string_view, const std::string*> index_;
+};
+
 #endif  // COMMENT_H_
@@ -0,0 +1,83 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Известные криптографические константы и таблицы: S-блоки AES и DES,
+// начальные значения и константы раундов MD5/SHA-1/SHA-2, таблицы CRC32,
+// P-массив Blowfish и т.д.
+//
+// База собрана в коде и строится один раз при первом обращении (Get()):
+// таблицы - в BytePatternSearch, поэтому все они ищутся одним проходом по
+// AddressSpace; 32-битные значения непосредственных операндов - в
+// отсортированном массиве.
+
+#ifndef CRYPTO_CONSTANTS_H_
+#define CRYPTO_CONSTANTS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "third_party/zynamics/binexport/byte_search.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class AddressSpace;
+class FlowGraph;
+
+namespace security::binexport {
+
+class CryptoConstants {
+ public:
+  static constexpr uint32_t kNone = ~uint32_t{0};
+
+  struct Hit {
+    Address address;  // Начало таблицы или адрес инструкции.
+    uint32_t tag;     // Номер в GetTag().
+    // Функция инструкции; для таблиц 0 - функции находятся по ссылкам на
+    // данные.
+    Address function;
+  };
+
+  static const CryptoConstants& Get();
+
+  CryptoConstants(const CryptoConstants&) = delete;
+  CryptoConstants& operator=(const CryptoConstants&) = delete;
+
+  size_t GetTagCount() const { return tags_.size(); }
+  // Короткое имя константы, например "aes-sbox".
+  const char* GetTag(uint32_t tag) const { return tags_[tag]; }
+
+  // Таблицы во всех блоках, по возрастанию адреса. Таблица, с которой
+  // начинается более длинная найденная по тому же адресу, не выдаётся.
+  std::vector<Hit> FindInMemory(const AddressSpace& address_space) const;
+  // Инструкции функций с известными непосредственными операндами.
+  std::vector<Hit> FindInImmediates(const FlowGraph& flow_graph) const;
+  // Номер тега для 32-битного значения операнда (или его знакового
+  // расширения до 64 бит) или kNone.
+  uint32_t FindImmediate(uint64_t value) const;
+
+ private:
+  CryptoConstants();
+
+  std::vector<const char*> tags_;
+  BytePatternSearch tables_;
+  std::vector<uint32_t> table_tags_;  // Тег по номеру образца в tables_.
+  std::vector<size_t> table_sizes_;   // Размер образца в байтах.
+  // Пары (значение, тег) по возрастанию значения.
+  std::vector<std::pair<uint32_t, uint32_t>> immediates_;
+};
+
+}  // namespace security::binexport
+
+#endif  // CRYPTO_CONSTANTS_H_
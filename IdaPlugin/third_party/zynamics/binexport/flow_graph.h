@@ -18,6 +18,8 @@
 #include <cstdint>
 #include <map>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "third_party/absl/container/btree_map.h"
 #include "third_party/absl/container/node_hash_set.h"
@@ -30,15 +32,14 @@ class CallGraph;
 
 class FlowGraph {
  public:
-	 // Максимальное количество базовых блоков/ребер/инструкций, которое мы хотим разрешить для одной функции.
-	 // Если функция имеет больше этого числа, мы просто отбрасываем ее как недействительную.
-	 // Ограничение kMaxFunctionEarlyBasicBlocks оценивается перед объединением bb,
-	 // поэтому его значение устанавливается относительно kMaxFunctionBasicBlocks
-	 enum {
-    kMaxFunctionBasicBlocks = 5000,
-    kMaxFunctionEarlyBasicBlocks = kMaxFunctionBasicBlocks + 1000,
-    kMaxFunctionEdges = 5000,
-    kMaxFunctionInstructions = 20000
+  // Мягкий бюджет на одну функцию. Функция больше бюджета не отбрасывается:
+  // обход останавливается на бюджете, функция экспортируется усечённой, рёбра
+  // в непройденные блоки удаляются. Графы функций хранятся в CSR, а алгоритмы
+  // на них итеративные, поэтому бюджет ограничивает только время и память.
+  struct FunctionBudget {
+    size_t basic_blocks = 1000000;
+    size_t edges = 2000000;
+    size_t instructions = 8000000;
   };
 
   enum class NoReturnHeuristic { kNopsAfterCall, kNone };
@@ -55,6 +56,22 @@ class FlowGraph {
 
   ~FlowGraph();
 
+  void SetFunctionBudget(const FunctionBudget& budget) { budget_ = budget; }
+  const FunctionBudget& GetFunctionBudget() const { return budget_; }
+
+  ///\n
+  /// Функции, заранее известные как невозвратные (импорт по имени, флаги\n
+  /// дизассемблера). ReconstructFunctions() распространяет невозвратность по\n
+  /// графу вызовов и снимает флаг потока у вызовов невозвратных функций.
+  void SetNoReturnFunctions(std::vector<Address> functions) {
+    noreturn_seeds_ = std::move(functions);
+  }
+  ///\n
+  /// Невозвратные функции после ReconstructFunctions(), по возрастанию адреса.
+  const std::vector<Address>& GetNoReturnFunctions() const {
+    return noreturn_functions_;
+  }
+
   void AddEdge(const FlowGraphEdge& edge);
   const Edges& GetEdges() const { return edges_; }
   const Function* GetFunction(Address address) const;
@@ -77,6 +94,11 @@ class FlowGraph {
       NoReturnHeuristic noreturn_heuristic = NoReturnHeuristic::kNopsAfterCall);
 
   void PruneFlowGraphEdges();
+
+  ///\n
+  /// Считает доминаторы и вложенность циклов всех функций параллельно.\n
+  /// Вызывается после PruneFlowGraphEdges(), которая меняет рёбра функций.
+  void ComputeLoopNesting();
   void AddExpressionSubstitution(Address address, uint8_t operator_num,
                                  int expression_id,
                                  const std::string& substitution);
@@ -121,8 +143,20 @@ class FlowGraph {
   /// 3) исходный базовый блок != целевой базовый блок\n
   /// 4) целевой базовый блок != точка входа функции (мы хотим оставить это нетронутым)\n
   void MergeBasicBlocks(const CallGraph& call_graph);
+
+  ///\n
+  /// Собирает базовые блоки и рёбра функции обходом от её точки входа.\n
+  /// Читает только общий "суп" блоков и рёбер, поэтому функции собираются\n
+  /// в рабочих потоках. Рёбра вызовов из функции (источник, цель) копятся в\n
+  /// call_edges и привязываются к графу вызовов после сборки всех функций.\n
+  /// Возвращает true, если функция усечена по бюджету.
+  bool BuildFunction(const CallGraph& call_graph, Function* function,
+                     std::vector<std::pair<Address, Address>>* call_edges) const;
   void FinalizeFunctions(CallGraph* call_graph);
 
+  FunctionBudget budget_;
+  std::vector<Address> noreturn_seeds_;
+  std::vector<Address> noreturn_functions_;
   Edges edges_;
   Functions functions_;
   Substitutions substitutions_;
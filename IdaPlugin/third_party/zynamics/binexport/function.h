@@ -16,9 +16,11 @@
 #define FUNCTION_H_
 
 #include <cstdint>
+#include <memory>
 
 #include "third_party/absl/container/btree_map.h"
 #include "third_party/absl/container/node_hash_set.h"
+#include "third_party/absl/types/span.h"
 #include "third_party/zynamics/binexport/basic_block.h"
 #include "third_party/zynamics/binexport/edge.h"
 #include "third_party/zynamics/binexport/types.h"
@@ -29,6 +31,10 @@ class CallGraph;
 class Function;
 class FlowGraph;
 
+namespace security::binexport {
+class LoopNesting;
+}  // namespace security::binexport
+
 class Exporter;
 
 using Functions = absl::btree_map<Address, Function*>;
@@ -68,12 +74,34 @@ public:
 	void SortGraph();
 	void FixEdges();
 	///\n
-	/// Возвращает набор ребер цикла, определенный алгоритмом\n
-	/// Dominator Tree от Lengauer и Tarjan.\n
+	/// Возвращает набор ребер цикла: ребро, цель которого доминирует над источником.\n
+	/// Берёт их из GetLoopNesting(), если вложенность уже посчитана.\n
 	/// Ребра будут возвращены отсортированными по адресу источника,\n
 	/// что соответствует порядку их хранения в самом графе.
 	void GetBackEdges(std::vector<Edges::const_iterator>* back_edges) const;
 
+	///\n
+	/// Граф функции по индексам базовых блоков в GetBasicBlocks() (формат CSR).\n
+	/// Строится в SortGraph() и FixEdges(). Рёбра задаются номерами в GetEdges(),\n
+	/// конец ребра без базового блока в функции равен kInvalidIndex.
+	static constexpr uint32_t kInvalidIndex = ~uint32_t{ 0 };
+	uint32_t GetEdgeSourceIndex(size_t edge) const { return edge_sources_[edge]; }
+	uint32_t GetEdgeTargetIndex(size_t edge) const { return edge_targets_[edge]; }
+	///\n
+	/// Номера исходящих и входящих рёбер блока по возрастанию.
+	absl::Span<const uint32_t> GetSuccessorEdges(uint32_t basic_block) const;
+	absl::Span<const uint32_t> GetPredecessorEdges(uint32_t basic_block) const;
+	///\n
+	/// Индекс блока точки входа или kInvalidIndex для функции без тела.
+	uint32_t GetEntryBasicBlockIndex() const { return entry_index_; }
+
+	///\n
+	/// Считает доминаторы и вложенность циклов. Сбрасывается при изменении графа.
+	void ComputeLoopNesting();
+	const security::binexport::LoopNesting* GetLoopNesting() const {
+		return loop_nesting_.get();
+	}
+
 	Address GetEntryPoint() const;
 
 	void SetType(FunctionType type);
@@ -105,6 +133,12 @@ public:
 
 	void RenderAdditional(std::ostream* stream, const CallGraph& call_graph,
 		const FlowGraph& flow_graph, Exporter& exporter) const;
+
+	///\n
+	/// то же, но дописывает текст функции в output. Не обращается к API IDA,\n
+	/// поэтому функции можно рендерить параллельно.
+	void RenderAdditional(std::string* output, const CallGraph& call_graph,
+		const FlowGraph& flow_graph) const;
 	
 	int GetLibraryIndex() const { return library_index_; }
 
@@ -116,6 +150,7 @@ public:
 private:
 	int GetBasicBlockIndexForAddress(Address address) const;
 	BasicBlock* GetMutableBasicBlockForAddress(Address address);
+	void BuildGraphIndex();
 
 	using StringCache = absl::node_hash_set<std::string>;
 	static StringCache string_cache_;
@@ -124,6 +159,14 @@ private:
 	Address entry_point_;
 	BasicBlocks basic_blocks_;
 	Edges edges_;
+	std::vector<uint32_t> edge_sources_;
+	std::vector<uint32_t> edge_targets_;
+	std::vector<uint32_t> successor_offsets_;
+	std::vector<uint32_t> successor_edges_;
+	std::vector<uint32_t> predecessor_offsets_;
+	std::vector<uint32_t> predecessor_edges_;
+	uint32_t entry_index_ = kInvalidIndex;
+	std::unique_ptr<security::binexport::LoopNesting> loop_nesting_;
 	std::string name_;
 	std::string demangled_name_;
 	const std::string* module_name_;
@@ -0,0 +1,85 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Отслеживание указателей, возвращённых аллокаторами, внутри функции (x86).
+// Прямой анализ потока данных по базовым блокам: каждому месту хранения
+// (регистру общего назначения или ячейке стека [sp/bp + смещение]) ставится
+// в соответствие битовая маска мест вызова аллокатора, чей результат может в
+// нём лежать, и бит "адрес, полученный через параметр". Слияние - побитовое
+// ИЛИ, маски только растут. Блоки обрабатываются рабочим списком в обратном
+// постпорядке, повторно - только при росте входного состояния. Состояние
+// блока - 65 масок по 64 бита, поэтому блок обрабатывается не больше
+// 65 * 64 + 1 раз: O(4161 * (инструкции + рёбра)) на функцию в худшем случае,
+// на практике - несколько обработок блока.
+//
+// Функции обрабатываются параллельно, анализ читает только инструкции
+// BinExport и не обращается к IDA.
+
+#ifndef HEAP_TRACKING_H_
+#define HEAP_TRACKING_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "third_party/absl/types/span.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class FlowGraph;
+
+namespace security::binexport {
+
+class HeapTracking {
+ public:
+  struct Summary {
+    Address function;
+    uint32_t alloc_calls;
+    uint32_t free_calls;
+    // Обращения к памяти по указателю из аллокатора.
+    uint64_t heap_touches;
+    // Места вызова аллокатора, к памяти которых было хотя бы одно обращение.
+    uint32_t first_touch_events;
+    // При возврате в rax/eax может лежать указатель из аллокатора.
+    bool returns_heap_ptr;
+    // Указатель из аллокатора записывается по адресу, полученному через
+    // параметр (rcx, rdx, r8, r9 или аргумент в стеке).
+    bool writes_heap_to_outparam;
+  };
+
+  // Места вызова аллокаторов и функций освобождения - адреса инструкций
+  // вызова по возрастанию. Функции без таких вызовов пропускаются.
+  HeapTracking(const FlowGraph& flow_graph,
+               absl::Span<const Address> alloc_calls,
+               absl::Span<const Address> free_calls);
+
+  HeapTracking(const HeapTracking&) = delete;
+  HeapTracking& operator=(const HeapTracking&) = delete;
+
+  // По возрастанию адреса функции.
+  const std::vector<Summary>& summaries() const { return summaries_; }
+
+  // Инструкции, обращающиеся к памяти по указателю из аллокатора, по
+  // возрастанию адреса.
+  const std::vector<Address>& GetTouchingInstructions() const {
+    return touching_instructions_;
+  }
+  bool TouchesHeap(Address instruction) const;
+
+ private:
+  std::vector<Summary> summaries_;
+  std::vector<Address> touching_instructions_;
+};
+
+}  // namespace security::binexport
+
+#endif  // HEAP_TRACKING_H_
@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "third_party/absl/container/node_hash_set.h"
+#include "third_party/absl/types/span.h"
 #include "third_party/zynamics/binexport/operand.h"
 #include "third_party/zynamics/binexport/range.h"
 
@@ -84,7 +85,9 @@ FLAG_ENTRY_POINT = 1 << 8,
 #pragma pack(push, 1)
 class Instruction {
 public:
-	using GetBytesCallback = std::function<std::string(const Instruction&)>;
+	// Записывает байты инструкции в bytes (размер задаёт сама функция).
+	using GetBytesCallback =
+		std::function<void(const Instruction&, std::string* bytes)>;
 	using StringCache = absl::node_hash_set<std::string>;
 
 	explicit Instruction(Address address, Address next_instruction = 0,
@@ -119,6 +122,16 @@ public:
 	Address GetNextInstruction() const;
 	void SetNextInstruction(Address address);
 	const std::string& GetMnemonic() const;
+
+	///\n
+	/// байты инструкции без копирования, из адресного пространства (SetVirtualMemory).\n
+	/// Если адрес туда не отображён - через GetBytesCallback во внутренний буфер потока;\n
+	/// такой span действителен до следующего вызова в том же потоке. Callback\n
+	/// обращается к IDA, поэтому для таких адресов вызывать только в главном потоке.
+	absl::Span<const Byte> GetByteSpan() const;
+
+	///\n
+	/// копия байтов инструкции. Для горячих путей использовать GetByteSpan().
 	std::string GetBytes() const;
 	uint16_t GetInDegree() const;
 	void AddInEdge();
@@ -172,6 +185,11 @@ std::string RenderOperands(const Instruction& instruction,
 	const FlowGraph& flow_graph);
 std::string RenderOperandsAdditional(const Instruction& instruction,
 	const FlowGraph& flow_graph, Exporter& exporter);
+///\n
+/// то же, но дописывает результат в output. Не обращается к API IDA,\n
+/// поэтому допускает вызов из рабочих потоков.
+void RenderOperandsAdditional(const Instruction& instruction,
+	const FlowGraph& flow_graph, std::string* output);
 
 
 #endif  // INSTRUCTION_H_
@@ -0,0 +1,128 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Распознавание функций статически скомпонованных библиотек по сигнатурам.
+// Сигнатура - первые байты функции с маской (байты адресов и перемещений не
+// сравниваются) и хеш формы графа функции. Из самого длинного участка каждого
+// образца без масок строится автомат Ахо-Корасик; исполняемые блоки
+// AddressSpace просматриваются им за один проход (кусками, параллельно).
+// Срабатывание якоря на начале функции проверяется полным образцом с маской
+// и хешем формы графа.
+//
+// Наборы сигнатур хранятся в двоичных файлах (WriteFile()/ReadFile()): файл
+// читается целиком и разбирается одним проходом, автомат строится за время,
+// линейное от суммарной длины якорей.
+
+#ifndef LIBRARY_SIGNATURES_H_
+#define LIBRARY_SIGNATURES_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "third_party/absl/status/status.h"
+#include "third_party/absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class AddressSpace;
+class FlowGraph;
+class Function;
+
+namespace security::binexport {
+
+class LibrarySignatures {
+ public:
+  // Длина образца - начало функции.
+  static constexpr size_t kMaxPatternSize = 32;
+  // Сигнатуры с более коротким участком без масок в автомат не попадают.
+  static constexpr size_t kMinAnchorSize = 4;
+
+  struct Signature {
+    uint32_t library;  // Индекс в libraries().
+    std::string name;
+    std::string bytes;
+    // 0xFF - байт сравнивается, 0 - нет. Та же длина, что у bytes.
+    std::string mask;
+    // Хеш формы графа функции (GetShapeHash()), 0 - не проверяется.
+    uint64_t shape_hash;
+  };
+
+  struct Match {
+    Address function;
+    uint32_t signature;  // Индекс в signatures().
+  };
+
+  LibrarySignatures() = default;
+
+  LibrarySignatures(const LibrarySignatures&) = delete;
+  LibrarySignatures& operator=(const LibrarySignatures&) = delete;
+
+  // Индекс библиотеки, библиотеки с одинаковым именем объединяются.
+  uint32_t AddLibrary(absl::string_view name);
+  void AddSignature(Signature signature);
+
+  // Добавляет набор из файла. После добавления сигнатур нужен Build().
+  absl::Status ReadFile(absl::string_view path);
+  absl::Status WriteFile(absl::string_view path) const;
+
+  const std::vector<std::string>& libraries() const { return libraries_; }
+  const std::vector<Signature>& signatures() const { return signatures_; }
+
+  // Строит автомат по всем добавленным сигнатурам.
+  void Build();
+  // Число сигнатур в автомате.
+  size_t GetAnchorCount() const { return anchors_.size(); }
+
+  // Сигнатуры, совпавшие с началами функций flow_graph, по возрастанию
+  // адреса. Функция, которой одинаково хорошо соответствуют сигнатуры с
+  // разными именами, в результат не входит.
+  std::vector<Match> Find(const AddressSpace& address_space,
+                          const FlowGraph& flow_graph) const;
+
+  // Хеш формы графа: число блоков и рёбер, для каждого блока по порядку
+  // адресов - число инструкций, типы исходящих рёбер и смещения их целей.
+  static uint64_t GetShapeHash(const Function& function);
+
+ private:
+  struct Anchor {
+    uint32_t signature;
+    uint8_t offset;  // Начало якоря в образце.
+    uint8_t size;
+  };
+
+  uint32_t Next(uint32_t state, Byte byte) const;
+  size_t GetScore(uint32_t signature) const;
+
+  std::vector<std::string> libraries_;
+  std::vector<Signature> signatures_;
+  std::vector<Anchor> anchors_;
+
+  // Переходы состояния 0 (корня) - полная таблица, остальных - по
+  // возрастанию байта в формате CSR.
+  std::vector<uint32_t> root_;
+  std::vector<uint32_t> transition_offsets_;
+  std::vector<Byte> transition_bytes_;
+  std::vector<uint32_t> transition_targets_;
+  std::vector<uint32_t> failures_;
+  // Ближайшее по суффиксным ссылкам состояние с якорями.
+  std::vector<uint32_t> output_links_;
+  std::vector<uint32_t> output_offsets_;
+  std::vector<uint32_t> outputs_;  // Номера в anchors_.
+  size_t max_anchor_size_ = 0;
+};
+
+}  // namespace security::binexport
+
+#endif  // LIBRARY_SIGNATURES_H_
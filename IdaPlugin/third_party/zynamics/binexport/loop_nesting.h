@@ -0,0 +1,95 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Дерево доминаторов и лес вложенности циклов графа функции. Считается по
+// CSR-графу Function без рекурсии: обратный постпорядок обходом по явному
+// стеку, доминаторы по Cooper, Harvey, Kennedy, циклы - естественные циклы
+// обратных рёбер, вложенные схлопываются через объединение множеств.
+
+#ifndef LOOP_NESTING_H_
+#define LOOP_NESTING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Function;
+
+namespace security::binexport {
+
+class LoopNesting {
+ public:
+  static constexpr uint32_t kNone = ~uint32_t{0};
+
+  struct Loop {
+    uint32_t header;  // Индекс блока заголовка в Function::GetBasicBlocks().
+    uint32_t parent;  // Объемлющий цикл или kNone.
+    uint32_t depth;   // 1 для внешних циклов.
+    uint32_t size;    // Число блоков, включая блоки вложенных циклов.
+  };
+
+  explicit LoopNesting(const Function& function);
+
+  LoopNesting(const LoopNesting&) = delete;
+  LoopNesting& operator=(const LoopNesting&) = delete;
+
+  // Непосредственный доминатор блока. kNone для точки входа и блоков,
+  // недостижимых из неё.
+  uint32_t GetImmediateDominator(uint32_t block) const;
+
+  // Блок dominator доминирует над block (каждый блок доминирует над собой).
+  // Недостижимые блоки не доминируют и не доминируются.
+  bool Dominates(uint32_t dominator, uint32_t block) const;
+
+  // Цель ребра доминирует над его источником. Номер ребра - в
+  // Function::GetEdges().
+  bool IsBackEdge(size_t edge) const { return back_edges_[edge]; }
+  size_t GetBackEdgeCount() const { return back_edge_count_; }
+
+  // Циклы упорядочены так, что вложенный цикл идёт раньше объемлющего.
+  const std::vector<Loop>& loops() const { return loops_; }
+
+  // Самый внутренний цикл блока или kNone.
+  uint32_t GetLoop(uint32_t block) const { return block_loops_[block]; }
+
+  // Глубина вложенности блока в циклы, 0 вне циклов.
+  uint32_t GetLoopDepth(uint32_t block) const {
+    return block_loops_[block] == kNone ? 0 : loops_[block_loops_[block]].depth;
+  }
+
+  uint32_t GetMaxLoopDepth() const { return max_loop_depth_; }
+
+  // Блоки, достижимые из точки входа, в обратном постпорядке.
+  const std::vector<uint32_t>& GetReversePostorder() const { return order_; }
+
+ private:
+  // Номер блока в обратном постпорядке, kNone для недостижимых.
+  std::vector<uint32_t> order_index_;
+  // По номерам обратного постпорядка.
+  std::vector<uint32_t> order_;
+  std::vector<uint32_t> idom_;
+  // Интервалы обхода дерева доминаторов.
+  std::vector<uint32_t> enter_;
+  std::vector<uint32_t> leave_;
+
+  std::vector<bool> back_edges_;
+  size_t back_edge_count_ = 0;
+  std::vector<Loop> loops_;
+  std::vector<uint32_t> block_loops_;
+  uint32_t max_loop_depth_ = 0;
+};
+
+}  // namespace security::binexport
+
+#endif  // LOOP_NESTING_H_
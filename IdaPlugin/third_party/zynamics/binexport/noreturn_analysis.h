@@ -0,0 +1,70 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Невозвратные функции по графу вызовов. Считается до восстановления функций,
+// прямо по инструкциям, рёбрам переходов и рёбрам вызовов: функция не
+// возвращает управление, если любой путь от её точки входа заканчивается
+// вызовом невозвратной функции. Начальное множество - заранее известные
+// функции (импорт по имени, флаги дизассемблера), локальные признаки уже
+// учтены снятым флагом потока у вызова.
+//
+// Сначала каждая функция обходится целиком и собираются её вызовы, затем
+// компоненты сильной связности графа вызовов обрабатываются снизу вверх. Внутри
+// рекурсивной компоненты функции сначала считаются невозвратными, и очередь
+// снимает это предположение с тех, у которых нашёлся путь к возврату.
+
+#ifndef NORETURN_ANALYSIS_H_
+#define NORETURN_ANALYSIS_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "third_party/zynamics/binexport/edge.h"
+#include "third_party/zynamics/binexport/instruction.h"
+#include "third_party/zynamics/binexport/types.h"
+
+class CallGraph;
+
+namespace security::binexport {
+
+class NoReturnAnalysis {
+ public:
+  // instructions отсортированы по адресу, jump_edges и рёбра call_graph - по
+  // адресу источника.
+  NoReturnAnalysis(const detego::Instructions& instructions,
+                   const std::vector<FlowGraphEdge>& jump_edges,
+                   const CallGraph& call_graph, std::vector<Address> seeds);
+
+  NoReturnAnalysis(const NoReturnAnalysis&) = delete;
+  NoReturnAnalysis& operator=(const NoReturnAnalysis&) = delete;
+
+  bool IsNoReturn(Address function) const;
+
+  // По возрастанию адреса, вместе с начальными.
+  const std::vector<Address>& GetNoReturnFunctions() const {
+    return functions_;
+  }
+
+  // Инструкции вызова с флагом потока, все цели которых не возвращают
+  // управление, по возрастанию адреса.
+  const std::vector<Address>& GetNoReturnCalls() const { return calls_; }
+
+ private:
+  std::vector<Address> functions_;
+  std::vector<Address> calls_;
+};
+
+}  // namespace security::binexport
+
+#endif  // NORETURN_ANALYSIS_H_
@@ -0,0 +1,101 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Сравнение двух файлов .BinExport. Для каждой функции считается структурная
+// сигнатура, затем функции сопоставляются по этапам: от точных совпадений
+// к распространению по соседям уже сопоставленных функций в графе вызовов.
+
+#ifndef READER_DIFFER_H_
+#define READER_DIFFER_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/status/status.h"
+#include "third_party/absl/status/statusor.h"
+#include "third_party/zynamics/binexport/reader/lazy_reader.h"
+#include "third_party/zynamics/binexport/types.h"
+
+namespace security::binexport {
+
+// Сигнатура функции, не зависящая от её адреса.
+struct FunctionSignature {
+  Address address = 0;
+  // Имя, если оно задано не автоматически, иначе пустая строка.
+  std::string name;
+
+  uint32_t basic_block_count = 0;
+  uint32_t edge_count = 0;
+  uint32_t instruction_count = 0;
+
+  // MD-индекс графа потока: сумма по рёбрам от степеней их концов и уровней
+  // концов в обходе в ширину от входного блока.
+  double md_index = 0.0;
+
+  // Хеш последовательности мнемоник вместе с числом блоков и рёбер.
+  uint64_t exact_hash = 0;
+
+  // Хеш мнемоники -> число вхождений, по возрастанию хеша.
+  std::vector<std::pair<uint32_t, uint32_t>> mnemonic_histogram;
+
+  // Соседи в графе вызовов, у которых есть граф потока, по возрастанию адреса.
+  std::vector<Address> callers;
+  std::vector<Address> callees;
+};
+
+enum class MatchStage {
+  kExactHash,          // Совпали мнемоники и структура.
+  kName,               // Совпало заданное пользователем или символьное имя.
+  kStructure,          // Совпали MD-индекс, размеры и степени в графе вызовов.
+  kCallGraphNeighbor,  // Наиболее похожие соседи сопоставленных функций.
+};
+
+const char* GetMatchStageName(MatchStage stage);
+
+struct FunctionMatch {
+  Address primary = 0;
+  Address secondary = 0;
+  MatchStage stage = MatchStage::kExactHash;
+  // Сходство сигнатур, от 0 до 1.
+  double similarity = 0.0;
+  // Сходство с поправкой на надёжность этапа, от 0 до 1.
+  double confidence = 0.0;
+};
+
+// Считает сигнатуры всех функций файла с графом потока, по возрастанию адреса.
+// Графы строятся параллельно.
+absl::StatusOr<std::vector<FunctionSignature>> ComputeFunctionSignatures(
+    LazyBinExport2Reader* reader);
+
+// Взвешенный коэффициент Жаккара гистограмм мнемоник, от 0 до 1.
+double GetMnemonicSimilarity(const FunctionSignature& primary,
+                             const FunctionSignature& secondary);
+
+// Сходство двух сигнатур от 0 до 1: гистограммы мнемоник и размеры графов.
+double GetSimilarity(const FunctionSignature& primary,
+                     const FunctionSignature& secondary);
+
+// Сопоставляет функции двух файлов. Результат упорядочен по адресу в primary.
+absl::StatusOr<std::vector<FunctionMatch>> DiffBinExport(
+    LazyBinExport2Reader* primary, LazyBinExport2Reader* secondary);
+
+// Таблица сопоставлений в текстовом виде, поля разделены табуляцией.
+absl::Status WriteMatchTable(const std::vector<FunctionMatch>& matches,
+                             const std::string& filename);
+
+}  // namespace security::binexport
+
+#endif  // READER_DIFFER_H_
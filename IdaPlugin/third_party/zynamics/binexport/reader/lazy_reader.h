@@ -0,0 +1,139 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Ленивое чтение файла .BinExport без разбора всего BinExport2 в память.
+// Файл отображается в память, при открытии индексируются повторяющиеся поля
+// верхнего уровня, граф потока функции строится по первому запросу и держится
+// в LRU-кэше.
+
+#ifndef READER_LAZY_READER_H_
+#define READER_LAZY_READER_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/status/statusor.h"
+#include "third_party/absl/synchronization/mutex.h"
+#include "third_party/zynamics/binexport/binexport2.pb.h"
+#include "third_party/zynamics/binexport/byte_provider.h"
+#include "third_party/zynamics/binexport/reader/call_graph.h"
+#include "third_party/zynamics/binexport/reader/flow_graph.h"
+#include "third_party/zynamics/binexport/types.h"
+
+namespace security::binexport {
+
+class LazyBinExport2Reader {
+ public:
+  // Сколько графов потока держится в кэше по умолчанию.
+  static constexpr size_t kDefaultCacheSize = 256;
+
+  // Отображает файл и строит индекс. Ошибка, если файл недоступен или не
+  // разбирается как BinExport2.
+  static absl::StatusOr<std::unique_ptr<LazyBinExport2Reader>> Open(
+      const std::string& filename, size_t cache_size = kDefaultCacheSize);
+
+  LazyBinExport2Reader(const LazyBinExport2Reader&) = delete;
+  LazyBinExport2Reader& operator=(const LazyBinExport2Reader&) = delete;
+
+  const BinExport2::Meta& meta_information() const {
+    return meta_information_;
+  }
+
+  // Граф вызовов строится при открытии: он мал по сравнению с остальным файлом.
+  const CallGraph& call_graph() const { return *call_graph_; }
+
+  // Адреса всех инструкций файла в порядке таблицы instruction.
+  const std::vector<Address>& instruction_addresses() const {
+    return instruction_addresses_;
+  }
+
+  // Точки входа функций, у которых есть граф потока, по возрастанию.
+  std::vector<Address> GetFlowGraphEntryPoints() const;
+
+  bool HasFlowGraph(Address entry_point) const;
+
+  // Возвращает граф потока функции, строя его при необходимости. Потокобезопасно.
+  // Граф строится из поднабора BinExport2 только с нужными базовыми блоками,
+  // инструкциями и мнемониками, поэтому Instruction::index() у его инструкций -
+  // номер внутри функции. Номера в таблице файла даёт GetInstructionIndices().
+  absl::StatusOr<std::shared_ptr<const FlowGraph>> GetFlowGraph(
+      Address entry_point);
+
+  // Номера инструкций функции в таблице instruction файла, в том же порядке,
+  // что и FlowGraph::instructions() её графа.
+  absl::StatusOr<std::vector<int>> GetInstructionIndices(Address entry_point) const;
+
+ private:
+  // Смещение varint длины элемента в файле (сразу за тегом).
+  using Offsets = std::vector<uint64_t>;
+
+  LazyBinExport2Reader(std::shared_ptr<MappedFile> file, size_t cache_size);
+
+  absl::Status BuildIndex();
+  absl::Status ComputeInstructionAddresses();
+  absl::Status IndexFlowGraphs();
+
+  // Возвращает тело элемента по смещению из Offsets.
+  absl::StatusOr<std::pair<const Byte*, size_t>> GetElement(
+      uint64_t offset) const;
+
+  template <typename Message>
+  absl::Status ParseElement(const Offsets& offsets, size_t index,
+                            Message* message) const;
+
+  // Номер элемента flow_graph по точке входа функции.
+  absl::StatusOr<size_t> FindFlowGraph(Address entry_point) const;
+
+  // Разбирает граф потока и его базовые блоки, собирает отсортированные
+  // номера инструкций функции в таблице файла.
+  absl::Status LoadBasicBlocks(size_t flow_graph_index,
+                               BinExport2::FlowGraph* flow_graph,
+                               std::vector<BinExport2::BasicBlock>* basic_blocks,
+                               std::vector<int>* instruction_indices) const;
+
+  absl::StatusOr<std::unique_ptr<FlowGraph>> LoadFlowGraph(
+      size_t flow_graph_index) const;
+
+  std::shared_ptr<MappedFile> file_;
+
+  BinExport2::Meta meta_information_;
+  std::unique_ptr<CallGraph> call_graph_;
+
+  Offsets mnemonics_;
+  Offsets instructions_;
+  Offsets basic_blocks_;
+  Offsets flow_graphs_;
+  std::vector<Address> instruction_addresses_;
+
+  // Точка входа -> номер элемента flow_graph, по возрастанию адреса.
+  std::vector<std::pair<Address, uint32_t>> flow_graph_entry_points_;
+
+  // LRU-кэш графов потока: в начале списка - последний использованный.
+  using CacheList =
+      std::list<std::pair<Address, std::shared_ptr<const FlowGraph>>>;
+  const size_t cache_size_;
+  absl::Mutex cache_mutex_;
+  CacheList cache_ ABSL_GUARDED_BY(cache_mutex_);
+  absl::flat_hash_map<Address, CacheList::iterator> cache_index_
+      ABSL_GUARDED_BY(cache_mutex_);
+};
+
+}  // namespace security::binexport
+
+#endif  // READER_LAZY_READER_H_
@@ -0,0 +1,166 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Индекс похожих функций по всем экспортированным бинарникам.
+// Отпечаток функции - MinHash и SimHash по шинглам нормализованных инструкций
+// (мнемоника и типы выражений операндов). Индекс хранится в одном файле,
+// каждый экспорт дописывает в него блок; поиск идёт через LSH-корзины по
+// полосам MinHash. Открытый индекс кэшируется между запросами, блоки,
+// заменённые повторными экспортами, удаляются сжатием файла.
+
+#ifndef SIMILARITY_INDEX_H_
+#define SIMILARITY_INDEX_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/status/statusor.h"
+#include "third_party/zynamics/binexport/byte_provider.h"
+#include "third_party/zynamics/binexport/writer.h"
+
+class Function;
+
+namespace security::binexport {
+
+// Имя файла индекса в каталоге экспорта.
+inline constexpr char kSimilarityIndexFilename[] = "BinExport.simindex";
+
+// Размер MinHash и разбиение его на LSH-полосы. Значения записаны в файл
+// индекса: при их изменении нужно менять kSimilarityIndexMagic.
+inline constexpr int kMinHashSize = 64;
+inline constexpr int kLshBands = 16;
+inline constexpr int kLshRows = kMinHashSize / kLshBands;
+
+struct FunctionFingerprint {
+  std::array<uint32_t, kMinHashSize> min_hash;
+  uint64_t sim_hash = 0;
+};
+
+// Отпечаток функции. Функция без инструкций даёт отпечаток из одних максимумов.
+FunctionFingerprint ComputeFingerprint(const Function& function);
+
+// Доля совпавших позиций MinHash - оценка коэффициента Жаккара.
+double GetMinHashSimilarity(const FunctionFingerprint& first,
+                            const FunctionFingerprint& second);
+
+// Дописывает в файл индекса отпечатки всех не импортированных функций.
+class SimilarityIndexWriter : public Writer {
+ public:
+  SimilarityIndexWriter(const std::string& index_filename,
+                        const std::string& executable_filename,
+                        const std::string& executable_hash);
+
+  absl::Status Write(const CallGraph& call_graph, const FlowGraph& flow_graph,
+                     const Instructions& instructions,
+                     const AddressReferences& address_references,
+                     const TypeSystem* type_system,
+                     const AddressSpace& address_space) override;
+
+ private:
+  std::string index_filename_;
+  std::string executable_filename_;
+  std::string executable_hash_;
+};
+
+// Индекс, открытый для поиска. Файл отображается в память, в памяти строятся
+// только смещения записей и отсортированные таблицы LSH-корзин.
+class SimilarityIndex {
+ public:
+  struct Candidate {
+    const std::string* executable_filename;
+    const std::string* executable_hash;
+    Address address;
+    std::string name;
+    double similarity;  // Оценка Жаккара по MinHash.
+    int sim_hash_distance;  // Расстояние Хэмминга между SimHash.
+  };
+
+  // Незавершённый блок в конце файла (прерванный экспорт) пропускается.
+  static absl::StatusOr<std::unique_ptr<SimilarityIndex>> Open(
+      const std::string& filename);
+
+  // Как Open(), но индекс остаётся открытым до изменения файла: повторные
+  // запросы не перечитывают записи и не сортируют корзины заново. Изменение
+  // определяется при каждом вызове по размеру, времени изменения и номеру
+  // сжатия в заголовке файла, в том числе если файл менял другой процесс.
+  static absl::StatusOr<std::shared_ptr<const SimilarityIndex>> Get(
+      const std::string& filename);
+
+  // Переписывает файл без заменённых блоков и незавершённого хвоста, если они
+  // занимают не меньше min_garbage_ratio файла, и увеличивает номер сжатия в
+  // заголовке. Вызывается после каждой записи индекса. Если файл не удаётся
+  // открыть на перезапись (в Windows - отображён другим процессом), он
+  // остаётся как есть.
+  static absl::Status Compact(const std::string& filename,
+                              double min_garbage_ratio = 0.0);
+
+  SimilarityIndex(const SimilarityIndex&) = delete;
+  SimilarityIndex& operator=(const SimilarityIndex&) = delete;
+
+  size_t size() const { return records_.size(); }
+
+  // Ищет функцию в последнем экспорте бинарника с данным хешем.
+  bool FindFunction(const std::string& executable_hash, Address address,
+                    FunctionFingerprint* fingerprint) const;
+
+  // До k кандидатов, у которых совпала хотя бы одна полоса MinHash, по
+  // убыванию сходства. Функция с тем же адресом в том же бинарнике пропускается.
+  std::vector<Candidate> Query(const FunctionFingerprint& fingerprint, size_t k,
+                               const std::string& executable_hash = "",
+                               Address address = 0) const;
+
+ private:
+  // Блок одного экспорта. Записи блока идут подряд по возрастанию адреса.
+  struct Block {
+    std::string executable_filename;
+    std::string executable_hash;
+    uint32_t first_record;
+    uint32_t record_count;
+  };
+
+  struct Record {
+    uint64_t offset;  // Начало записи в файле.
+    uint32_t block;
+  };
+
+  // Ключ полосы и номер записи.
+  struct BucketEntry {
+    uint32_t key;
+    uint32_t record;
+
+    bool operator<(const BucketEntry& other) const {
+      return key < other.key || (key == other.key && record < other.record);
+    }
+  };
+
+  explicit SimilarityIndex(std::shared_ptr<MappedFile> file);
+
+  absl::Status BuildIndex();
+  void ReadFingerprint(const Record& record,
+                       FunctionFingerprint* fingerprint) const;
+  std::string ReadName(const Record& record) const;
+
+  std::shared_ptr<MappedFile> file_;
+  std::vector<Block> blocks_;
+  std::vector<Record> records_;
+  std::array<std::vector<BucketEntry>, kLshBands> buckets_;
+};
+
+}  // namespace security::binexport
+
+#endif  // SIMILARITY_INDEX_H_
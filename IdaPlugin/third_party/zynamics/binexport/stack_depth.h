@@ -0,0 +1,89 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Наибольшая глубина стека функции по графу вызовов: кадр функции плюс
+// наибольшая глубина вызываемых. Считается одним проходом по компонентам
+// CallGraphIndex снизу вверх, то есть за линейное время от размера графа.
+// Рекурсия (компонента из нескольких функций или вызов самой себя) делает
+// глубину неограниченной для всех функций, из которых она достижима.
+// Неразрешённые (косвенные) вызовы и функции без известного кадра, например
+// импортированные, оцениваются заданной величиной.
+
+#ifndef STACK_DEPTH_H_
+#define STACK_DEPTH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "third_party/zynamics/binexport/call_graph_index.h"
+
+namespace security::binexport {
+
+class StackDepth {
+ public:
+  static constexpr uint64_t kUnknownFrame = ~uint64_t{0};
+  static constexpr uint32_t kNone = CallGraphIndex::kNone;
+
+  // frame_sizes и unresolved_calls заданы по номерам функций index:
+  // размер кадра в байтах (kUnknownFrame, если неизвестен) и наличие
+  // вызовов без известной цели. call_estimate - оценка глубины для них.
+  StackDepth(const CallGraphIndex& index,
+             const std::vector<uint64_t>& frame_sizes,
+             const std::vector<bool>& unresolved_calls, uint64_t call_estimate);
+
+  StackDepth(const StackDepth&) = delete;
+  StackDepth& operator=(const StackDepth&) = delete;
+
+  // Глубина в байтах, 0 для неограниченной.
+  uint64_t GetDepth(uint32_t function) const { return depths_[function]; }
+  bool IsUnbounded(uint32_t function) const {
+    return flags_[function] & kUnbounded;
+  }
+  // В глубину вошла оценка: достижим неразрешённый вызов или функция без
+  // известного кадра.
+  bool IsEstimated(uint32_t function) const {
+    return flags_[function] & kEstimated;
+  }
+
+  // Вызываемая функция на самом глубоком пути или kNone. Для неограниченной
+  // глубины - вызов, ведущий к рекурсии.
+  uint32_t GetDeepestCallee(uint32_t function) const {
+    return deepest_callees_[function];
+  }
+  // Путь от функции по GetDeepestCallee(), заканчивается на первой
+  // рекурсивной функции.
+  std::vector<uint32_t> GetDeepestPath(uint32_t function) const;
+
+  // Функция с наибольшей ограниченной глубиной или kNone.
+  uint32_t GetDeepestFunction() const { return deepest_function_; }
+  size_t GetUnboundedCount() const { return unbounded_count_; }
+
+ private:
+  enum : uint8_t {
+    kUnbounded = 1 << 0,
+    kEstimated = 1 << 1,
+  };
+
+  const CallGraphIndex& index_;
+  std::vector<uint64_t> depths_;
+  std::vector<uint32_t> deepest_callees_;
+  std::vector<uint8_t> flags_;
+  uint32_t deepest_function_ = kNone;
+  size_t unbounded_count_ = 0;
+};
+
+}  // namespace security::binexport
+
+#endif  // STACK_DEPTH_H_
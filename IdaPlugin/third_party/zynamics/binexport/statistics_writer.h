@@ -15,7 +15,11 @@
 #ifndef STATISTICS_WRITER_H_
 #define STATISTICS_WRITER_H_
 
+#include <cstdint>
 #include <fstream>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "third_party/zynamics/binexport/writer.h"
 
@@ -23,9 +27,48 @@ namespace security::binexport {
 
 class StatisticsWriter : public Writer {
  public:
+  // Распределение величины по функциям.
+  struct Distribution {
+    size_t count = 0;
+    uint64_t sum = 0;
+    uint64_t min = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+    // histogram[0] - число нулей, histogram[i] - число значений
+    // в [2^(i-1), 2^i).
+    std::vector<size_t> histogram;
+  };
+
+  struct Statistics {
+    // Счётчики текстового отчёта, кроме счётчиков мнемоник.
+    std::map<std::string, size_t> counters;
+    std::map<std::string, size_t> mnemonics;
+
+    // По функциям с графом потока (без импортированных).
+    Distribution instructions;
+    Distribution basic_blocks;
+    Distribution edges;
+    Distribution cyclomatic_complexity;  // E - N + 2.
+    Distribution loops;
+    Distribution max_loop_depth;
+  };
+
   explicit StatisticsWriter(std::ostream& stream);
   explicit StatisticsWriter(const std::string& filename);
 
+  // Вместе с текстовым отчётом пишет в json_stream те же данные и
+  // распределения в JSON.
+  StatisticsWriter(std::ostream& stream, std::ostream& json_stream,
+                   const std::string& executable_filename,
+                   const std::string& executable_hash);
+
+  // Функции обрабатываются параллельно, у каждого потока свои счётчики.
+  void GenerateStatistics(const CallGraph& call_graph,
+                          const FlowGraph& flow_graph,
+                          Statistics* statistics) const;
+
   void GenerateStatistics(const CallGraph& call_graph,
                           const FlowGraph& flow_graph,
                           std::map<std::string, size_t>* statistics) const;
@@ -34,11 +77,14 @@ class StatisticsWriter : public Writer {
                      const Instructions&, const AddressReferences&,
                      const TypeSystem*, const AddressSpace&) override;
 
-
-	
  private:
+  void WriteJson(const Statistics& statistics) const;
+
   std::ofstream file_;
   std::ostream& stream_;
+  std::ostream* json_stream_ = nullptr;
+  std::string executable_filename_;
+  std::string executable_hash_;
 };
 
 }  // namespace security::binexport
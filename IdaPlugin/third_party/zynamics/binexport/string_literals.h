@@ -0,0 +1,94 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Таблица строковых литералов адресного пространства. Блоки данных
+// сканируются один раз до анализа потока (классификация байтов идёт по 16 за
+// раз), ссылки инструкций на данные разрешаются поиском по адресу в таблице.
+
+#ifndef STRING_LITERALS_H_
+#define STRING_LITERALS_H_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/strings/string_view.h"
+#include "third_party/zynamics/binexport/types.h"
+#include "third_party/zynamics/binexport/virtual_memory.h"
+
+namespace security::binexport {
+
+class StringLiteralTable {
+ public:
+  enum Encoding : uint8_t {
+    kAscii = 0,
+    kUtf16 = 1,  // UTF-16LE из символов ASCII.
+  };
+
+  struct Literal {
+    Address address;
+    uint32_t size;     // В байтах, без завершающего нуля.
+    uint32_t content;  // Индекс текста, одинаковые тексты имеют один индекс.
+    Encoding encoding;
+
+    bool operator<(const Literal& other) const {
+      return address < other.address;
+    }
+  };
+
+  // Минимальная длина строки в символах, найденной сканированием.
+  static constexpr size_t kMinLength = 4;
+
+  StringLiteralTable() = default;
+  StringLiteralTable(const StringLiteralTable&) = delete;
+  StringLiteralTable& operator=(const StringLiteralTable&) = delete;
+
+  // Ищет завершённые нулём строки из печатаемых символов ASCII и UTF-16 в
+  // блоках без права исполнения. Байты блоков загружаются в вызывающем потоке,
+  // сами блоки сканируются параллельно.
+  void Scan(const AddressSpace& address_space);
+
+  // Добавляет строку, определённую дизассемблером. Для UTF-16 text содержит
+  // байты UTF-16LE. Строки по уже известным адресам пропускаются. Find()
+  // находит добавленные строки только после Finish().
+  void Add(Address address, Encoding encoding, absl::string_view text);
+  void Finish();
+
+  // Строка, начинающаяся точно по адресу, или nullptr.
+  const Literal* Find(Address address) const;
+
+  // Текст строки. Для UTF-16 - младшие байты символов.
+  absl::string_view GetContent(const Literal& literal) const {
+    return contents_[literal.content];
+  }
+
+  size_t size() const { return literals_.size(); }
+
+ private:
+  uint32_t Intern(absl::string_view text, bool copy);
+
+  std::vector<Literal> literals_;
+  size_t sorted_size_ = 0;
+  // Тексты ASCII-строк из сканирования указывают прямо в байты блоков,
+  // остальные хранятся в owned_contents_.
+  std::vector<absl::string_view> contents_;
+  std::deque<std::string> owned_contents_;
+  absl::flat_hash_map<absl::string_view, uint32_t> content_ids_;
+};
+
+}  // namespace security::binexport
+
+#endif  // STRING_LITERALS_H_
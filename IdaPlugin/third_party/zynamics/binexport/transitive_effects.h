@@ -0,0 +1,76 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Транзитивные побочные эффекты функций: собственные эффекты функции и всех
+// функций, достижимых из неё по графу вызовов. Эффекты - битовые маски,
+// объединяются побитовым ИЛИ, поэтому функции одной компоненты сильной
+// связности имеют одинаковую маску.
+//
+// Компоненты CallGraphIndex разбиваются на волны: волна компоненты на
+// единицу больше наибольшей волны вызываемых компонент. Компоненты одной
+// волны не зависят друг от друга и считаются параллельно, волны - по
+// порядку. Вся работа линейна от размера графа.
+
+#ifndef TRANSITIVE_EFFECTS_H_
+#define TRANSITIVE_EFFECTS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "third_party/zynamics/binexport/call_graph_index.h"
+
+namespace security::binexport {
+
+class TransitiveEffects {
+ public:
+  enum Effect : uint8_t {
+    kAllocates = 1 << 0,
+    kFrees = 1 << 1,
+    kWritesGlobals = 1 << 2,
+    kTouchesHeap = 1 << 3,
+    kDispatchesViaFunctionPointer = 1 << 4,
+  };
+  static constexpr int kEffectCount = 5;
+
+  // Короткое имя эффекта для вывода, bit - один из Effect.
+  static const char* GetEffectName(Effect bit);
+
+  // local_effects - собственные эффекты по номерам функций index.
+  TransitiveEffects(const CallGraphIndex& index,
+                    std::vector<uint8_t> local_effects);
+
+  TransitiveEffects(const TransitiveEffects&) = delete;
+  TransitiveEffects& operator=(const TransitiveEffects&) = delete;
+
+  uint8_t GetLocalEffects(uint32_t function) const {
+    return local_effects_[function];
+  }
+  uint8_t GetEffects(uint32_t function) const {
+    return component_effects_[index_.GetComponent(function)];
+  }
+
+  // Число волн: 1 + наибольшая длина цепочки вызовов между компонентами.
+  size_t GetWaveCount() const { return wave_count_; }
+
+ private:
+  const CallGraphIndex& index_;
+  std::vector<uint8_t> local_effects_;
+  std::vector<uint8_t> component_effects_;
+  size_t wave_count_ = 0;
+};
+
+}  // namespace security::binexport
+
+#endif  // TRANSITIVE_EFFECTS_H_
@@ -42,6 +42,12 @@ std::string FormatAddress(Address address);
 std::string HumanReadableDuration(double seconds);
 std::string HumanReadableDuration(absl::Duration duration);
 
+// Быстрое форматирование в буфер для текстовых дампов. Результат совпадает с
+// выводом std::ostream с флагами std::hex, std::uppercase, std::setfill('0')
+// и std::setw(min_width) (AppendHex) или с флагом std::dec (AppendDecimal).
+void AppendHex(uint64_t value, int min_width, std::string* output);
+void AppendDecimal(int64_t value, std::string* output);
+
 }  // namespace security::binexport
 
 #endif  // UTIL_FORMAT_H_
@@ -0,0 +1,110 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTIL_PARALLEL_H_
+#define UTIL_PARALLEL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <thread>  // NOLINT
+#include <vector>
+
+// Минимальные средства распараллеливания поверх std::thread.
+// Задачи не должны обращаться к API IDA: оно допускает вызовы только из главного потока.
+
+// Число потоков для параллельных участков: по числу ядер, но не меньше одного.
+inline int GetParallelism() {
+	const unsigned int cores = std::thread::hardware_concurrency();
+	return cores == 0 ? 1 : static_cast<int>(cores);
+}
+
+// Выполняет задачи одновременно и возвращается после завершения всех.
+// Последняя задача выполняется в вызывающем потоке.
+inline void RunInParallel(std::vector<std::function<void()>> tasks) {
+	if (tasks.empty()) {
+		return;
+	}
+	std::vector<std::thread> threads;
+	threads.reserve(tasks.size() - 1);
+	for (size_t i = 0; i + 1 < tasks.size(); ++i) {
+		threads.emplace_back(std::move(tasks[i]));
+	}
+	tasks.back()();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+// Делит [0, count) на не более чем GetParallelism() непересекающихся диапазонов
+// длиной не меньше min_chunk и вызывает body(begin, end) для каждого из них.
+template <typename Body>
+void ParallelFor(size_t count, size_t min_chunk, Body body) {
+	const size_t chunks = std::max<size_t>(
+		1, std::min<size_t>(GetParallelism(), count / std::max<size_t>(min_chunk, 1)));
+	if (chunks == 1) {
+		body(size_t{0}, count);
+		return;
+	}
+	std::vector<std::function<void()>> tasks;
+	tasks.reserve(chunks);
+	for (size_t i = 0; i < chunks; ++i) {
+		const size_t begin = count * i / chunks;
+		const size_t end = count * (i + 1) / chunks;
+		tasks.emplace_back([&body, begin, end]() { body(begin, end); });
+	}
+	RunInParallel(std::move(tasks));
+}
+
+// Сортировка с тем же результатом, что и std::sort при попарно различных ключах:
+// куски сортируются параллельно, затем попарно сливаются (тоже параллельно).
+template <typename RandomIt, typename Compare>
+void ParallelSort(RandomIt first, RandomIt last, Compare comp) {
+	constexpr size_t kMinChunkSize = 1 << 16;
+	const size_t size = static_cast<size_t>(last - first);
+	const size_t chunks = std::max<size_t>(
+		1, std::min<size_t>(GetParallelism(), size / kMinChunkSize));
+	if (chunks == 1) {
+		std::sort(first, last, comp);
+		return;
+	}
+	std::vector<RandomIt> bounds(chunks + 1);
+	for (size_t i = 0; i <= chunks; ++i) {
+		bounds[i] = first + size * i / chunks;
+	}
+	ParallelFor(chunks, 1, [&bounds, &comp](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i) {
+			std::sort(bounds[i], bounds[i + 1], comp);
+		}
+	});
+	for (size_t width = 1; width < chunks; width *= 2) {
+		std::vector<std::function<void()>> merges;
+		for (size_t i = 0; i + width < chunks; i += 2 * width) {
+			const RandomIt begin = bounds[i];
+			const RandomIt middle = bounds[i + width];
+			const RandomIt end = bounds[std::min(i + 2 * width, chunks)];
+			merges.emplace_back([begin, middle, end, &comp]() {
+				std::inplace_merge(begin, middle, end, comp);
+			});
+		}
+		RunInParallel(std::move(merges));
+	}
+}
+
+template <typename RandomIt>
+void ParallelSort(RandomIt first, RandomIt last) {
+	ParallelSort(first, last, std::less<>());
+}
+
+#endif  // UTIL_PARALLEL_H_
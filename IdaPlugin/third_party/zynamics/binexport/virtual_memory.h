@@ -16,11 +16,18 @@
 #define VIRTUAL_MEMORY_H_
 
 #include <atomic>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
+#include "third_party/absl/base/config.h"
 #include "third_party/absl/container/btree_map.h"
 #include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/types/span.h"
+#include "third_party/zynamics/binexport/byte_provider.h"
 #include "third_party/zynamics/binexport/types.h"
 
 class AddressSpace {
@@ -31,14 +38,74 @@ public:
 		kExecute = 1 << 2  ///<\n адресное пространство является executable.
 	};
 
-	using MemoryBlock = std::vector<Byte>;
+	///\n
+	/// Непрерывный блок байтов. Байты либо принадлежат блоку (флаги, малые блоки),\n
+	/// либо предоставляются ByteProvider'ом без копирования (сегменты образа).
+	class MemoryBlock {
+	public:
+		using size_type = size_t;
+
+		MemoryBlock() = default;
+
+		///\n
+		/// собственный блок из size нулевых байтов.
+		explicit MemoryBlock(size_type size) : bytes_(size), size_(size) {}
+
+		///\n
+		/// собственный блок, забирает байты.
+		explicit MemoryBlock(std::vector<Byte> bytes)
+			: bytes_(std::move(bytes)), size_(bytes_.size()) {}
+
+		///\n
+		/// блок без копии: байты выдаются провайдером.
+		explicit MemoryBlock(std::shared_ptr<ByteProvider> provider)
+			: provider_(std::move(provider)),
+			size_(provider_ ? provider_->size() : 0) {}
+
+		size_type size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+
+		///\n
+		/// указатель на [index, index + length) или nullptr, если диапазон вне блока.
+		const Byte* data(size_type index, size_type length) const {
+			if (!provider_) {
+				return index <= size_ && length <= size_ - index ? bytes_.data() + index
+					: nullptr;
+			}
+			return provider_->Data(index, length);
+		}
+		Byte* mutable_data(size_type index, size_type length) {
+			if (!provider_) {
+				return index <= size_ && length <= size_ - index ? bytes_.data() + index
+					: nullptr;
+			}
+			return provider_->MutableData(index, length);
+		}
+
+		const Byte& operator[](size_type index) const {
+			return provider_ ? *provider_->Data(index, 1) : bytes_[index];
+		}
+		Byte& operator[](size_type index) {
+			return provider_ ? *provider_->MutableData(index, 1) : bytes_[index];
+		}
+
+	private:
+		std::vector<Byte> bytes_;
+		std::shared_ptr<ByteProvider> provider_;
+		size_type size_ = 0;
+	};
+
 	using Data = absl::btree_map<Address, MemoryBlock>;
 	using Flags = absl::flat_hash_map<Address, int>;
 
+	AddressSpace() = default;
+	AddressSpace(const AddressSpace&) = delete;
+	AddressSpace& operator=(const AddressSpace&) = delete;
+
 	///\n
-/// копирует блок. возвращает true, если блок был успешно добавлен,\n
+/// добавляет блок (провайдер разделяется, байты не копируются). возвращает true, если блок был успешно добавлен,\n
 /// false, если блок перекрывает существующую память.\n
-	bool AddMemoryBlock(Address address, const MemoryBlock& block, int flags);
+	bool AddMemoryBlock(Address address, MemoryBlock block, int flags);
 
 	///\n
 /// возвращает блок памяти, содержащий адрес.
@@ -82,6 +149,11 @@ public:
 	/// если адрес не отображен в данное адресное пространство.
 	const Byte& operator[](Address address) const;
 	Byte& operator[](Address address);
+
+		///\n
+		/// байты [address, address + length) без копирования.\n
+		/// пустой span, если диапазон не лежит целиком в одном блоке.
+	absl::Span<const Byte> GetBytes(Address address, size_t length) const;
 	
 		///\n
 		/// интерпретирует байты по адресу как little endian и сохраняет результат.\n
@@ -93,14 +165,24 @@ public:
 		MemoryBlock::size_type index, T* data) const;
 
 private:
+		///\n
+		/// блок, содержащий адрес, или nullptr. Последний найденный блок кэшируется,\n
+		/// поэтому последовательные чтения внутри одного сегмента не ходят в btree.
+	const Data::value_type* FindBlock(Address address) const;
+
 	Data data_;
 	Flags flags_;
+
+		///\n
+		/// кэш последнего блока для FindBlock(). Указатели на элементы btree_map\n
+		/// стабильны, пока нет вставок; AddMemoryBlock() сбрасывает кэш.
+	mutable std::atomic<const Data::value_type*> last_block_{nullptr};
 };
 
 template <typename T>
 bool AddressSpace::ReadLittleEndian(Address address, T* data) const {
-	const auto memory_block = GetMemoryBlock(address);
-	if (memory_block == data_.end()) {
+	const auto* memory_block = FindBlock(address);
+	if (!memory_block) {
 		return false;
 	}
 	return ReadLittleEndian(memory_block->second, address - memory_block->first,
@@ -111,14 +193,50 @@ template <typename T>
 bool AddressSpace::ReadLittleEndian(const MemoryBlock& memory_block,
 	MemoryBlock::size_type index,
 	T* data) const {
-	if (!data || index + sizeof(T) > memory_block.size()) {
+	static_assert(std::is_integral<T>::value, "integral types only");
+	const Byte* bytes = memory_block.data(index, sizeof(T));
+	if (!data || !bytes) {
 		return false;
 	}
-	*data = 0;
-	for (T i = 0; i < sizeof(T); ++i) {
-		*data |= static_cast<T>(memory_block[index + i]) << (i * 8);
+#if defined(ABSL_IS_BIG_ENDIAN)
+	using Unsigned = typename std::make_unsigned<T>::type;
+	Unsigned value = 0;
+	for (size_t i = 0; i < sizeof(T); ++i) {
+		value |= static_cast<Unsigned>(bytes[i]) << (i * 8);
 	}
+	*data = static_cast<T>(value);
+#else
+	// Невыровненная загрузка через memcpy компилируется в одну mov-инструкцию.
+	std::memcpy(data, bytes, sizeof(T));
+#endif
 	return true;
 }
 
+	///\n
+	/// кусок блока памяти для параллельного сканирования: смещения [begin, end)\n
+	/// блока. Байты блока доступны целиком, кусок может читать за свои границы.
+struct AddressSpaceChunk {
+	Address address;    ///< адрес блока.
+	const Byte* bytes;  ///< все байты блока.
+	size_t size;        ///< размер блока.
+	size_t begin;
+	size_t end;
+};
+
+	///\n
+	/// делит блоки памяти, у которых (флаги & flag_mask) == flags, на куски по\n
+	/// chunk_size байт (0 - блок одним куском), в порядке адресов. Байты блоков\n
+	/// берутся здесь, в вызывающем (главном) потоке: страницы PagedByteProvider\n
+	/// подгружаются из базы IDA. Блоки без байтов пропускаются.
+std::vector<AddressSpaceChunk> GetAddressSpaceChunks(
+	const AddressSpace& address_space, size_t chunk_size, int flag_mask = 0,
+	int flags = 0);
+
+	///\n
+	/// вызывает scan(номер куска, кусок) для всех кусков в пуле потоков, по одному\n
+	/// куску на задачу. scan не должен обращаться к IDA.
+void ScanAddressSpaceChunks(
+	const std::vector<AddressSpaceChunk>& chunks,
+	const std::function<void(size_t, const AddressSpaceChunk&)>& scan);
+
 #endif  // VIRTUAL_MEMORY_H_
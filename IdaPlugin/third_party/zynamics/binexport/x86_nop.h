@@ -18,6 +18,8 @@
 #include <cstddef>
 
 #include "third_party/absl/strings/string_view.h"
+#include "third_party/absl/types/span.h"
+#include "third_party/zynamics/binexport/types.h"
 
 		///\n
 /// Возвращает true, если инструкция, начинающаяся с первого байта в "bytes", является инструкцией NOP.
@@ -25,4 +27,9 @@
 /// Подробнее см. b/24084521#comment7
 bool IsNopX86(absl::string_view bytes);
 
+inline bool IsNopX86(absl::Span<const Byte> bytes) {
+	return IsNopX86(absl::string_view(
+		reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+}
+
 #endif  // X86_NOP_H_
@@ -0,0 +1,98 @@
+// Copyright 2011-2021 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/zynamics/binexport/transitive_effects.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "third_party/zynamics/binexport/util/parallel.h"
+
+namespace security::binexport {
+
+	const char* TransitiveEffects::GetEffectName(Effect bit) {
+		switch (bit) {
+		case kAllocates:
+			return "alloc";
+		case kFrees:
+			return "free";
+		case kWritesGlobals:
+			return "global-write";
+		case kTouchesHeap:
+			return "heap";
+		case kDispatchesViaFunctionPointer:
+			return "funptr";
+		}
+		return "";
+	}
+
+	TransitiveEffects::TransitiveEffects(const CallGraphIndex& index,
+		std::vector<uint8_t> local_effects)
+		: index_(index), local_effects_(std::move(local_effects)) {
+		const uint32_t component_count =
+			static_cast<uint32_t>(index_.GetComponentCount());
+		component_effects_.assign(component_count, 0);
+
+		// Вызываемые компоненты имеют меньшие номера, поэтому волны считаются
+		// одним проходом по возрастанию номеров.
+		std::vector<uint32_t> waves(component_count, 0);
+		uint32_t max_wave = 0;
+		for (uint32_t component = 0; component < component_count; ++component) {
+			uint32_t wave = 0;
+			for (const uint32_t callee : index_.GetComponentCallees(component)) {
+				wave = std::max(wave, waves[callee] + 1);
+			}
+			waves[component] = wave;
+			max_wave = std::max(max_wave, wave);
+		}
+		wave_count_ = component_count == 0 ? 0 : max_wave + 1;
+
+		// Компоненты по волнам (сортировка подсчётом).
+		std::vector<uint32_t> wave_offsets(wave_count_ + 1, 0);
+		for (const uint32_t wave : waves) {
+			++wave_offsets[wave + 1];
+		}
+		std::partial_sum(wave_offsets.begin(), wave_offsets.end(),
+			wave_offsets.begin());
+		std::vector<uint32_t> wave_components(component_count);
+		{
+			std::vector<uint32_t> next(wave_offsets.begin(), wave_offsets.end() - 1);
+			for (uint32_t component = 0; component < component_count; ++component) {
+				wave_components[next[waves[component]]++] = component;
+			}
+		}
+
+		for (size_t wave = 0; wave < wave_count_; ++wave) {
+			const uint32_t* components = wave_components.data() + wave_offsets[wave];
+			const size_t count = wave_offsets[wave + 1] - wave_offsets[wave];
+			// Компонента пишет только свою маску и читает маски прошлых волн.
+			ParallelFor(count, 1024, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; ++i) {
+					const uint32_t component = components[i];
+					uint8_t effects = 0;
+					for (const uint32_t function :
+						index_.GetComponentFunctions(component)) {
+						effects |= local_effects_[function];
+					}
+					for (const uint32_t callee : index_.GetComponentCallees(component)) {
+						effects |= component_effects_[callee];
+					}
+					component_effects_[component] = effects;
+				}
+			});
+		}
+	}
+
+}  // namespace security::binexport
@@ -14,7 +14,11 @@
 
 #include "third_party/zynamics/binexport/virtual_memory.h"
 
-bool AddressSpace::AddMemoryBlock(Address address, const MemoryBlock& block,
+#include <algorithm>
+
+#include "third_party/zynamics/binexport/util/parallel.h"
+
+bool AddressSpace::AddMemoryBlock(Address address, MemoryBlock block,
 	int flags) {
 	auto it = data_.upper_bound(address);
 	if (it != data_.end() && it->first < address + block.size()) {
@@ -29,10 +33,41 @@ bool AddressSpace::AddMemoryBlock(Address address, const MemoryBlock& block,
 		}
 	}
 
-	return data_.emplace(address, block).second &&
+	// Вставка может перестроить узлы btree - кэш становится недействительным.
+	last_block_.store(nullptr, std::memory_order_relaxed);
+	return data_.emplace(address, std::move(block)).second &&
 		flags_.emplace(address, flags).second;
 }
 
+const AddressSpace::Data::value_type* AddressSpace::FindBlock(
+	Address address) const {
+	const auto* last = last_block_.load(std::memory_order_relaxed);
+	// Беззнаковое вычитание отсекает и адреса ниже начала блока.
+	if (last && address - last->first < last->second.size()) {
+		return last;
+	}
+	const auto it = GetMemoryBlock(address);
+	if (it == data_.end()) {
+		return nullptr;
+	}
+	last_block_.store(&*it, std::memory_order_relaxed);
+	return &*it;
+}
+
+absl::Span<const Byte> AddressSpace::GetBytes(Address address,
+	size_t length) const {
+	const auto* memory_block = FindBlock(address);
+	if (!memory_block) {
+		return {};
+	}
+	const Byte* bytes =
+		memory_block->second.data(address - memory_block->first, length);
+	if (!bytes) {
+		return {};
+	}
+	return absl::Span<const Byte>(bytes, length);
+}
+
 AddressSpace::Data::const_iterator AddressSpace::GetMemoryBlock(
 	Address address) const {
 	auto it = data_.upper_bound(address);
@@ -57,15 +92,13 @@ AddressSpace::Data::iterator AddressSpace::GetMemoryBlock(Address address) {
 }
 
 const Byte& AddressSpace::operator[](Address address) const {
-	auto it = data_.upper_bound(address);
-	--it;
-	return it->second[address - it->first];
+	const auto* memory_block = FindBlock(address);
+	return memory_block->second[address - memory_block->first];
 }
 
 Byte& AddressSpace::operator[](Address address) {
-	auto it = data_.upper_bound(address);
-	--it;
-	return it->second[address - it->first];
+	auto* memory_block = const_cast<Data::value_type*>(FindBlock(address));
+	return memory_block->second[address - memory_block->first];
 }
 
 bool AddressSpace::IsValidAddress(Address address) const {
@@ -106,3 +139,37 @@ size_t AddressSpace::size() const {
 	}
 	return value;
 }
+
+std::vector<AddressSpaceChunk> GetAddressSpaceChunks(
+	const AddressSpace& address_space, size_t chunk_size, int flag_mask,
+	int flags) {
+	std::vector<AddressSpaceChunk> chunks;
+	for (const auto& entry : address_space.data()) {
+		if (entry.second.empty() ||
+			(address_space.GetFlags(entry.first) & flag_mask) != flags) {
+			continue;
+		}
+		const size_t size = entry.second.size();
+		const Byte* bytes = entry.second.data(0, size);
+		if (bytes == nullptr) {
+			continue;
+		}
+		const size_t step = chunk_size != 0 ? chunk_size : size;
+		for (size_t begin = 0; begin < size; begin += step) {
+			chunks.push_back({ entry.first, bytes, size, begin,
+				std::min(size, begin + step) });
+		}
+	}
+	return chunks;
+}
+
+void ScanAddressSpaceChunks(
+	const std::vector<AddressSpaceChunk>& chunks,
+	const std::function<void(size_t, const AddressSpaceChunk&)>& scan) {
+	ParallelFor(chunks.size(), 1,
+		[&chunks, &scan](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			scan(i, chunks[i]);
+		}
+	});
+}